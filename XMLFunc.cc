@@ -2,17 +2,36 @@
 
 #include <algorithm>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
 #include <stdexcept>
 #include <map>
+#include <set>
+#include <deque>
+#include <limits>
+#include <new>
+#include <typeinfo>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <locale.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <time.h>
+
+// The tokenizer scans 16 (SSE2) or 32 (AVX2, if the CPU has it) bytes at a
+//   time on x86, and the array kernels add 2 or 4 doubles at a time.
+//   XMLFUNC_NO_SIMD restricts them to the portable loops.
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(XMLFUNC_NO_SIMD)
+#define XMLFUNC_SSE2
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -24,8 +43,16 @@ typedef XMLFunc::Operation  *OpPtr_t;
 typedef vector<OpPtr_t>      OpList_t;
 typedef XMLFunc::ArgDefs     ArgDefs_t;
 typedef XMLFunc::Args        Args_t;
+typedef XMLFunc::Xref_t      Xref_t;
+typedef XMLFunc::BatchArgs   BatchArgs_t;
+typedef XMLFunc::Batch       Batch_t;
+typedef XMLFunc::Block       Block_t;
 
 class XMLNode;
+class XMLRoots;
+class Scope;
+class Linker;
+struct CallTarget;
 
 // prototypes for support functions
 
@@ -36,18 +63,71 @@ class XMLNode;
 }
 
 string load_xml     (const string &src);
-string strip_xml    (const string &xml, const string &start, const string &end);
+void   strip_xml    (string &xml, const string &start, const string &end);
 
 size_t skip_whitespace(const string &xml,size_t pos=0);
+size_t skip_name      (const string &xml,size_t pos);
+size_t skip_value     (const string &xml,size_t pos);
+size_t skip_element   (const string &xml,size_t pos);
+void   lowercase      (string &xml);
+
+void   parse_roots(const string &xml, size_t depth, XMLRoots &roots);
+bool   parse_roots(const string &xml, size_t depth, XMLRoots &roots, unsigned nthreads);
 
 bool   has_content  (const string &s);
 
 bool   read_double  (const string &s, double &dval,  string &tail);
 bool   read_integer (const string &s, long   &ival,  string &tail);
 bool   read_token   (const string &s, string &token, string &tail);
+size_t read_doubles (const string &s, vector<double> &dvals);
+
+const char *parse_double (const char *s, const char *end, double &dval);
+const char *parse_integer(const char *s, const char *end, long   &ival);
+
+bool   arg_matches  (NumberType_t argType, NumberType_t valueType);
+
+const size_t ArrayLanes = 16;  // partial sums of the array kernels
+
+void   add_lanes    (const double *a, const double *b, size_t n, double *lanes);
+double lane_total   (const double *lanes);
+
+size_t hash_mix     (size_t h, unsigned long v);
+size_t hash_doubles (size_t h, const double *v, size_t n);
+bool   same_doubles (const double *a, const double *b, size_t n);
+
+OpPtr_t build_op(const string &arg,  const Scope &);
+OpPtr_t build_op(const XMLNode *xml, const Scope &);
+
+size_t  count_ops(const XMLFunc::Operation *root);
+size_t  tree_hash(size_t h, const XMLFunc::Operation *root);
+bool    same_tree(const XMLFunc::Operation *a, const XMLFunc::Operation *b);
+
+void    insert_attribute_ops(OpList_t &operands, const XMLNode *xml, const Scope &, const char **attrs, size_t nattrs);
+
+OpPtr_t fold_polynomials(OpPtr_t root);
+
+inline long wrap_add(long a, long b);
+inline long wrap_sub(long a, long b);
+inline long wrap_mul(long a, long b);
+inline long wrap_neg(long a);
+
+void    as_double(const XMLFunc::Operation *op, Block_t &block, size_t n);
+
+template<class Real_t>
+void    as_real(const XMLFunc::Operation *op, Block_t &block, size_t n);
+
+void    as_double(const XMLFunc::Operation *op, const Batch_t &batch, Block_t &block);
+void    as_float (const XMLFunc::Operation *op, const Batch_t &batch, Block_t &block);
+
+void    preorder_nodes(const vector<size_t> &parents, vector<size_t> &order);
 
-OpPtr_t build_op(const string &arg,  const ArgDefs_t &);
-OpPtr_t build_op(const XMLNode *xml, const ArgDefs_t &);
+const string *intern_element(const string &element);
+
+double  latency_quantile(const unsigned long *bins, size_t nbins, double q);
+
+class ParallelTask;
+
+void    run_parallel(ParallelTask &task, size_t nparts, unsigned nthreads);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Support classes
@@ -56,26 +136,45 @@ OpPtr_t build_op(const XMLNode *xml, const ArgDefs_t &);
 class XMLNode
 {
   public:
-    static XMLNode *build(string &xml, XMLNode *parent=NULL);
+    // Parses the element at pos.  Elements nested more than depth levels within 
+    //   it are checked, but are not kept (see XMLFunc::Lazy).
+    static XMLNode *parse(const string &xml, size_t &pos, size_t depth=string::npos);
 
+    // Child nodes are detached before being deleted so that the tree is
+    //   deleted without recursion.
     ~XMLNode()
     {
-      for(vector<XMLNode *>::iterator ci=children_.begin(); ci!=children_.end(); ++ci) delete *ci;
+      vector<XMLNode *> doomed;
+      doomed.swap(children_);
+
+      while( doomed.empty() == false )
+      {
+        XMLNode *node = doomed.back();
+        doomed.pop_back();
+
+        doomed.insert(doomed.end(), node->children_.begin(), node->children_.end());
+        node->children_.clear();
+
+        delete node;
+      }
     }
 
     const string name(void) const { return name_; }
-    
+
+    // Position of the element's opening tag in the XML
+    size_t offset(void) const { return offset_; }
+
     bool hasAttribute(const string &key) const
     {
       return attributes_.find(key) != attributes_.end();
     }
 
-    string attributeValue(const string &key) const
+    // (empty if the element does not have the attribute)
+    const string &attributeValue(const string &key) const
     {
-      string rval;
+      static const string none;
       Attributes_t::const_iterator ai = attributes_.find(key);
-      if(ai != attributes_.end()) rval = ai->second;
-      return rval;
+      return ( ai != attributes_.end() ? ai->second : none );
     }
 
 
@@ -91,1017 +190,7755 @@ class XMLNode
 
   private:
 
-    XMLNode(string name) : name_(name) {}
+    XMLNode(string name, size_t offset) : name_(name), offset_(offset) {}
 
-    void addAttribute(const string &key, const string &value) { attributes_[key] = value;   }
+    void addAttribute(const string &key, const string &xml, size_t pos, size_t n) { attributes_[key].assign(xml,pos,n); }
     void addChild(XMLNode *node)                              { children_.push_back(node); }
 
     string             name_;
+    size_t             offset_;
     Attributes_t       attributes_;
     vector<XMLNode *>  children_;
 };
 
-
-// XMLFunc::ArgDefs methods
-
-void XMLFunc::ArgDefs::add(NumberType_t type, const string &name)
-{
-  if(name.empty()==false) xref_[name] = int(types_.size());
-  types_.push_back(type);
-}
-
-size_t XMLFunc::ArgDefs::index(const string &name) const
+// The root level elements of the XML (deleted along with the list)
+class XMLRoots : public vector<XMLNode *>
 {
-  Xref_t::const_iterator i = xref_.find(name);
-  if( i == xref_.end() ) INVALID_XML("bad argument name (" << name << ")");
-  return i->second;
-}
+  public:
+    ~XMLRoots() { for(iterator ri=begin(); ri!=end(); ++ri) delete *ri; }
+};
 
-pair<size_t,bool> XMLFunc::ArgDefs::find(const string &name) const
+// Converts positions in the XML to (1 based) line and column numbers
+class SourceLines
 {
-  pair<size_t,bool> rval(0,false);
+  public:
+    SourceLines(const string &xml) : starts_(1,0)
+    {
+      for(size_t pos = xml.find('\n'); pos != string::npos; pos = xml.find('\n',pos+1))
+      {
+        starts_.push_back(pos+1);
+      }
+    }
 
-  Xref_t::const_iterator i = xref_.find(name);
-  if( i != xref_.end() )
-  {
-    rval.first = i->second;
-    rval.second = true;
-  }
+    void locate(size_t offset, unsigned &line, unsigned &column) const
+    {
+      size_t i = size_t( upper_bound(starts_.begin(),starts_.end(),offset) - starts_.begin() );
+      line   = unsigned(i);
+      column = unsigned(offset - starts_[i-1] + 1);
+    }
 
-  return rval;
-}
+    size_t memoryUsage(void) const { return starts_.capacity() * sizeof(size_t); }
 
-////////////////////////////////////////////////////////////////////////////////
-// XMLFunc::Op subclasses
-////////////////////////////////////////////////////////////////////////////////
+  private:
+    vector<size_t> starts_;  // position of the first character of each line
+};
 
-class ConstOp : public XMLFunc::Operation
+// Function names hashed (FNV-1a) into an open addressing table which is never
+//   more than half full.  Looking up a name almost always compares it with only
+//   the one name whose hash matches.  The table is built once all functions 
+//   have been named.  It also maps each function index back to its name.
+class XMLFunc::FunctionIndex
 {
   public:
+    // Names the function with the next index (empty if it is not named)
+    void add(const string &name) { names_.push_back(name); }
 
-    static ConstOp *build(const XMLNode *xml, const ArgDefs_t &argDefs)
-    {
-      ConstOp *rval(NULL);
-
-      string name = xml->name();
-      if      ( name == "double"  ) { rval = new ConstOp( xml,argDefs, Number_t::Double  ); }
-      else if ( name == "float"   ) { rval = new ConstOp( xml,argDefs, Number_t::Double  ); }
-      else if ( name == "real"    ) { rval = new ConstOp( xml,argDefs, Number_t::Double  ); }
-      else if ( name == "integer" ) { rval = new ConstOp( xml,argDefs, Number_t::Integer ); }
-      else if ( name == "int"     ) { rval = new ConstOp( xml,argDefs, Number_t::Integer ); }
+    // Builds the table.  Throws if a name is used by more than one function.
+    void build(void);
 
-      return rval;
-    }
+    // Returns the index of the named function (second is false if there is none)
+    pair<size_t,bool> find(const string &name) const;
 
-    ConstOp(long v)   : value_(v) {}
-    ConstOp(double v) : value_(v) {}
+    const string &name(size_t index) const { return names_.at(index); }
 
-    Number_t eval(const Args_t &args) const { return value_; }
+    size_t memoryUsage(void) const;
 
   private:
 
-    ConstOp(const XMLNode *xml, const ArgDefs_t &, NumberType_t);
+    struct Slot
+    {
+      Slot(void) : hash(0), index(0) {}
+      size_t hash;
+      size_t index;   // 1 + index of the function (0 if the slot is empty)
+    };
 
-    Number_t value_;
+    static size_t hash(const string &name);
+
+    vector<string> names_;
+    vector<Slot>   slots_;   // (size is a power of 2)
 };
 
-class ArgOp : public XMLFunc::Operation
+// Interns argument definitions so that functions with identical arglists share
+//   one copy.  The copies are owned by the pool vector (see XMLFunc::argDefs_).
+class ArgDefsPool
 {
   public:
+    ArgDefsPool(vector<ArgDefs_t *> &pool) : pool_(pool) {}
 
-    static ArgOp *build(const XMLNode *xml, const ArgDefs_t &args)
-    {
-      ArgOp *rval(NULL);
-      if( xml->name() == "arg") rval = new ArgOp(xml,args);
-      return rval;
-    }
-
-    ArgOp(size_t i) : index_(i) {}
-
-    Number_t eval(const Args_t &args) const { return args.at(index_); }
+    const ArgDefs_t *intern(const ArgDefs_t &argDefs);
 
   private:
+    static string signature(const ArgDefs_t &argDefs);
 
-    ArgOp(const XMLNode *xml, const ArgDefs_t &);
-
-    size_t index_;
+    vector<ArgDefs_t *> &pool_;
+    map<string,size_t>   index_;   // signature to index in pool
 };
 
-
-class UnaryOp : public XMLFunc::Operation
+// Interns the ops of the functions built with XMLFunc::Shared in a table shared
+//   by every XMLFunc, so that each distinct subtree is kept once.  Ops are 
+//   equivalent if they are of the same class, have the same value type and
+//   parameters (see Operation::equivalent), and have the same operands, which
+//   are interned first.  Each interned op counts the references to it (from the
+//   ops and functions using it) and is deleted by the release which drops the
+//   last one.  The table is only used under its mutex, which is taken once 
+//   per tree interned or released.
+class XMLFunc::OperationPool
 {
   public:
+    // Interns the ops of the tree (deleting those already in the pool) and 
+    //   returns its interned root, holding one reference to it
+    static OpPtr_t intern(OpPtr_t root);
 
-    typedef enum { NEG, ABS, SIN, COS, TAN, ASIN, ACOS, ATAN, DEG, RAD, SQRT, EXP, LN, CHILD } Type_t;
-
-    ~UnaryOp() { if(op_!=NULL) delete op_; }
-
-    static UnaryOp *build(const XMLNode *xml, const ArgDefs_t &args)
-    {
-      UnaryOp *rval(NULL);
+    // Drops the reference to an interned root, deleting the ops no longer used
+    static void    release(OpPtr_t root);
 
-      string name = xml->name();
-      if      ( name == "neg"  ) rval = new UnaryOp(xml,args,NEG);
-      else if ( name == "abs"  ) rval = new UnaryOp(xml,args,ABS);
-      else if ( name == "sin"  ) rval = new UnaryOp(xml,args,SIN);
-      else if ( name == "cos"  ) rval = new UnaryOp(xml,args,COS);
-      else if ( name == "tan"  ) rval = new UnaryOp(xml,args,TAN);
-      else if ( name == "asin" ) rval = new UnaryOp(xml,args,ASIN);
-      else if ( name == "acos" ) rval = new UnaryOp(xml,args,ACOS);
-      else if ( name == "atan" ) rval = new UnaryOp(xml,args,ATAN);
-      else if ( name == "deg"  ) rval = new UnaryOp(xml,args,DEG);
-      else if ( name == "rad"  ) rval = new UnaryOp(xml,args,RAD);
-      else if ( name == "sqrt" ) rval = new UnaryOp(xml,args,SQRT);
-      else if ( name == "exp"  ) rval = new UnaryOp(xml,args,EXP);
-      else if ( name == "ln"   ) rval = new UnaryOp(xml,args,LN);
+    static SharedOperations stats(void);
 
-      return rval;
-    }
+  private:
+    OperationPool(void) { pthread_mutex_init(&mutex_,NULL); }
 
-    Number_t eval(const Args_t &args) const
-    {
-      static double deg_to_rad = atan(1.0)/45.;
-      static double rad_to_deg = 1./deg_to_rad;
+    // (never deleted, so that XMLFunc objects may be deleted during exit)
+    static OperationPool &instance(void);
 
-      Number_t v = op_->eval(args);
+    static size_t  hash(const Operation *op);
+    static bool    equivalent(const Operation *a, const Operation *b);
 
-      Number_t rval;
-      switch(type_)
-      {
-        case NEG:  rval = v.negate();             break;
-        case ABS:  rval = v.abs();                break;
+    // Memory of the ops of the tree, counting each use of a shared op
+    static size_t  treeMemory(const Operation *root);
 
-        case SIN:  rval = sin(  double(v) );      break;
-        case COS:  rval = cos(  double(v) );      break;
-        case TAN:  rval = tan(  double(v) );      break;
-        case ASIN: rval = asin( double(v) );      break;
-        case ACOS: rval = acos( double(v) );      break;
-        case ATAN: rval = atan( double(v) );      break;
-        case SQRT: rval = sqrt( double(v) );      break;
-        case EXP:  rval = exp(  double(v) );      break;
-        case LN:   rval = log(  double(v) );      break;
+    typedef multimap<size_t,OpPtr_t> Table_t;
 
-        case DEG:  rval = double(v) * rad_to_deg; break;
-        case RAD:  rval = double(v) * deg_to_rad; break;
+    pthread_mutex_t   mutex_;
+    Table_t           table_;     // by hash
+    SharedOperations  stats_;
+};
 
-        case CHILD: 
-          throw logic_error("Child class of UnaryOp missing override of eval method"); 
-          break;
-      }
-      return rval;
-    }
+// Everything needed to build the op tree for a function body:
+//   - the argument definitions used to resolve argument references
+//   - the linker used to resolve <call> elements
+//   - when inlining a <call>, the caller's operand trees which replace
+//     all references to the callee's arguments
+class Scope
+{
+  public:
+    Scope(const ArgDefs_t &argDefs, Linker &linker, const OpList_t *actuals=NULL)
+      : argDefs_(argDefs), linker_(linker), actuals_(actuals) {}
 
-  protected:
+    const ArgDefs_t &argDefs(void) const { return argDefs_; }
+    Linker          &linker(void)  const { return linker_;  }
 
-    UnaryOp(const XMLNode *, const ArgDefs_t &, Type_t);
+    // Returns the op that supplies the value of the specified argument
+    OpPtr_t arg(size_t index) const;
 
-    Type_t  type_;
-    OpPtr_t op_;
+  private:
+    const ArgDefs_t &argDefs_;
+    Linker          &linker_;
+    const OpList_t  *actuals_;
+    mutable vector<size_t> sizes_;  // ops in each actual (0 until referenced)
 };
 
-class BinaryOp : public XMLFunc::Operation
+// Builds the op tree for each function body, inlining <call> elements
+//   by rebuilding the callee's body in the scope of the call.  The chain
+//   of functions currently being expanded is tracked to reject recursion.
+//
+// A callee which is called again (while building the same function) with 
+//   identical actual arguments is copied from the body already built for it
+//   rather than rebuilt.  As the op tree has a copy of the callee's body for
+//   each call (and of each actual for each reference to the argument), its 
+//   size may grow exponentially with the depth of the calls, so a function 
+//   is rejected once more than MaxOps ops have been built for it.
+//
+// A body which was not kept when its <func> was parsed (see XMLFunc::Lazy)
+//   is parsed from the XML the first time it is needed.
+class Linker
 {
   public:
+    static const size_t MaxOps = 1 << 20;
 
-    typedef enum { SUB, DIV, MOD, POW, ATAN2 } Type_t;
+    Linker(const XMLFunc::FunctionIndex &index, const string &xml, const SourceLines &lines) 
+      : index_(index), xml_(xml), lines_(lines), table_(this), ops_(0), inlining_(false), calls_(false) {}
 
-    ~BinaryOp() 
-    {
-      if(op1_!=NULL) delete op1_;
-      if(op2_!=NULL) delete op2_; 
-    }
-
-    static BinaryOp *build(const XMLNode *xml, const ArgDefs_t &args)
-    {
-      BinaryOp *rval(NULL);
+    // A linker which builds the functions added to table, with its own chain
+    //   of active functions, so that functions may be built in parallel (see 
+    //   XMLFunc::Compiler::compileAll).  All of the bodies must have been kept.
+    Linker(Linker &table) 
+      : index_(table.index_), xml_(table.xml_), lines_(table.lines_), table_(&table), ops_(0), inlining_(false), calls_(false) {}
 
-      string name = xml->name();
-      if      ( name == "sub"   ) rval = new BinaryOp(xml,args,SUB);
-      else if ( name == "div"   ) rval = new BinaryOp(xml,args,DIV);
-      else if ( name == "mod"   ) rval = new BinaryOp(xml,args,MOD);
-      else if ( name == "pow"   ) rval = new BinaryOp(xml,args,POW);
-      else if ( name == "atan2" ) rval = new BinaryOp(xml,args,ATAN2);
+    ~Linker();
 
-      return rval;
+    void add(const XMLNode *body, const ArgDefs_t *argDefs, bool kept=true)
+    {
+      bodies_.push_back( kept ? body : NULL );
+      offsets_.push_back(body->offset());
+      argDefs_.push_back(argDefs);
     }
 
-    Number_t eval(const Args_t &args) const
+    OpPtr_t build(size_t index);
+
+    // Begins inlining the function referenced by a <call> element once the ops
+    //   for its actual arguments have been built.  Returns the function's body,
+    //   which must be built in the new scope returned in callee.  leave() must
+    //   be called once the body has been built.  If the function was already
+    //   inlined with identical actuals, NULL is returned instead, and copy is
+    //   set to a copy of the body built then.  If the call is evaluated out of
+    //   line (see expand()), NULL is returned, and copy is set to a CallOp 
+    //   which takes the actuals.
+    const XMLNode *enter(const XMLNode *xml, OpList_t &actuals, Scope *&callee, OpPtr_t &copy);
+    void           leave(void) { active_.pop_back(); }
+
+    // Records the body built for the function being inlined (before leave() is 
+    //   called), taking the actuals.  The body must not be deleted until the 
+    //   function being built is complete.
+    void           inlined(OpList_t &actuals, const XMLFunc::Operation *body);
+
+    // Counts n more ops built for the function.  If there are more than MaxOps
+    //   once its calls are inlined, it is built again with its calls evaluated
+    //   out of line (see expand()).
+    void           grow(size_t n);
+
+    // Identifies op as built from the element (or from the specified attribute
+    //   of the element) unless it is already identified (see Operation::element)
+    void locate(OpPtr_t op, const XMLNode *xml, const char *attr=NULL) const;
+
+  private:
+    OpPtr_t          expand(size_t index);
+    CallTarget      *target(size_t index);
+    void             push(size_t index);
+    string           name(size_t index) const;
+    const XMLNode   *body(size_t index);
+    const ArgDefs_t &argDefs(size_t index) const { return *table_->argDefs_.at(index); }
+    const string    *element(const string &name) const;
+    void             forget(void);
+
+    // A body inlined while building the current function (see inlined())
+    struct Inlined
     {
-      Number_t v1 = op1_->eval(args);
-      Number_t v2 = op2_->eval(args);
+      size_t                      index;    // of the called function
+      OpList_t                    actuals;
+      const XMLFunc::Operation   *body;
+      size_t                      ops;      // in the body
+    };
+    typedef multimap<size_t,Inlined> InlinedTable_t;
+
+    // Thrown by grow() to abandon inlining the function's calls
+    struct Oversized {};
+
+    const XMLFunc::FunctionIndex &index_;
+    const string                 &xml_;
+    const SourceLines            &lines_;
+    Linker                       *table_;    // this, or the linker whose functions are built
+    vector<const XMLNode *>       bodies_;
+    vector<size_t>                offsets_;  // position of each body in the XML
+    vector<const ArgDefs_t *>     argDefs_;
+    vector<size_t>                active_;
+    XMLRoots                      parsed_;   // bodies parsed when first needed
+    InlinedTable_t                inlined_;  // by hash of the function index and actuals
+    size_t                        ops_;      // built for the current function
+    bool                          inlining_; // a call has been inlined into the current function
+    bool                          calls_;    // its calls are evaluated out of line
+    map<size_t,CallTarget *>      targets_;  // bodies of the functions called out of line
+    set<size_t>                   oversized_; // functions too large to inline (see expand())
+
+    mutable map<string,const string *> elements_;  // (see intern_element)
+};
 
-      bool isInteger = v1.isInteger() && v2.isInteger();
+// The XML, and everything else needed to build its functions.  With Lazy, this
+//   is kept so that each function may be built (by any thread) on first use.
+class XMLFunc::Compiler
+{
+  public:
+    Compiler(const string &xml, const FunctionIndex &index, unsigned optimizations)
+      : xml_(xml), lines_(xml_), linker_(index,xml_,lines_), optimizations_(optimizations)
+    {
+      pthread_mutex_init(&mutex_,NULL);
+    }
 
-      Number_t rval;
-      switch(type_)
-      {
-        case SUB: 
-          if(isInteger) rval = Number_t( long(v1)   - long(v2)   );
-          else          rval = Number_t( double(v1) - double(v2) ); 
-          break;
+    ~Compiler() { pthread_mutex_destroy(&mutex_); }
 
-        case DIV: 
-          if(isInteger) rval = Number_t( long(v1)   / long(v2)   );
-          else          rval = Number_t( double(v1) / double(v2) ); 
-          break;
+    const string &xml(void)    const { return xml_;    }
+    XMLRoots     &roots(void)        { return roots_;  }
+    Linker       &linker(void)       { return linker_; }
 
-        case MOD:
-          if(isInteger) rval = Number_t( long(v1) % long(v2) );
-          else          rval = Number_t( std::fmod(double(v1),double(v2)) );
+    // Builds the ops and program of function f (with the specified index) 
+    //   unless another thread already has
+    void compile(size_t index, const Function &f);
 
-        case POW: 
-          rval = Number_t( pow( double(v1), double(v2) ) );
-          break;
+    // Builds all of the functions using up to nthreads threads (see Linker)
+    void compileAll(const vector<Function> &funcs, unsigned nthreads);
 
-        case ATAN2: 
-          rval = Number_t( atan2( double(v1), double(v2)) );
-          break;
-      }
-      return rval;
-    }
+    size_t memoryUsage(void) const { return sizeof(*this) + xml_.capacity() + lines_.memoryUsage(); }
 
-  protected:
+  private:
+    class BuildTask;
 
-    BinaryOp(const XMLNode *xml, const ArgDefs_t &, Type_t);
+    void build(size_t index, const Function &f, Linker &linker) const;
 
-    Type_t  type_;
-    OpPtr_t op1_;
-    OpPtr_t op2_;
+    string          xml_;
+    SourceLines     lines_;
+    XMLRoots        roots_;
+    Linker          linker_;
+    unsigned        optimizations_;
+    pthread_mutex_t mutex_;
 };
 
-class ListOp : public XMLFunc::Operation
+// A function body flattened into a sequence of steps which are evaluated with
+//   an explicit stack of values rather than by recursion through the op tree.
+//
+// Single row evaluation visits the operands of each op in order and evaluates
+//   <if> lazily by jumping over the operand which is not chosen.
+//
+// Batch evaluation needs a block of values on the stack for each pending value,
+//   so the operand which needs the most stack is evaluated first (Sethi-Ullman
+//   order) and list ops are evaluated as a left fold over their operands.  Long
+//   chains of nested operators, and long lists of operands, then need only a few
+//   blocks regardless of their depth or length.
+class XMLFunc::Program
 {
   public:
+    Program(const Operation *root);
 
-    typedef enum { ADD, MULT } Type_t;
+    const Operation *root(void) const { return root_; }
 
-    ~ListOp() { for(OpList_t::iterator i=ops_.begin(); i!=ops_.end(); ++i) delete *i; }
+    Number_t eval(const Args_t &args) const;
 
-    static ListOp *build(const XMLNode *xml, const ArgDefs_t &argDefs)
-    {
-      ListOp *rval(NULL);
+    // Evaluates as eval(), also setting the row status of the value (see tryEval)
+    Number_t eval(const Args_t &args, unsigned &status) const;
 
-      string name = xml->name();
-      if      ( name == "add"  ) rval = new ListOp(xml,argDefs,ADD);
-      else if ( name == "mult" ) rval = new ListOp(xml,argDefs,MULT);
+    // Evaluates one block of rows, using stack (grown as needed) for the pending
+    //   values.  Returns the block (within stack) containing the function values.
+    //   If status is true, the row status of each value is also set.
+    //   Double values are computed in single precision if batch.single().
+    Block_t &evalBlock(const Batch_t &batch, vector<Block_t> &stack, bool status=false) const;
 
-      return rval;
-    }
+    // Profiling (see XMLFunc::Profile).  Each op is completed by one step, its
+    //   node step.  The node steps are listed in order along with the index (in
+    //   the list) of the op they are an operand of.
+    size_t           numSteps(void)     const { return steps_.size(); }
+    const Operation *op(size_t step)    const { return steps_[step].op; }
+    void             nodes(vector<size_t> &steps, vector<size_t> &parents) const;
 
-    Number_t eval(const Args_t &args) const
+    // The element and location (see Operation::element) of the op of a node step
+    //   as it was built for this function.  A shared op (see XMLFunc::Shared) has
+    //   those of the first function that built it, so the node steps whose ops 
+    //   were built from other elements are listed in locations_.
+    struct Location
     {
-      long   ival(0);
-      double dval(0);
+      size_t        step;
+      const string *element;
+      unsigned      line;
+      unsigned      column;
 
-      switch(type_)
-      {
-        case ADD:  ival=0; dval=0.0;  break;
-        case MULT: ival=1; dval=1.0;  break;
-      }
+      bool operator<(const Location &l) const { return step < l.step; }
+    };
 
-      bool isInteger = true;
+    void locate(size_t step, Location &location) const;
 
-      for(OpList_t::const_iterator op = ops_.begin(); op!=ops_.end(); ++op)
-      {
-        Number_t v = (*op)->eval(args);
+    // Lists the locations of the ops of a tree in the order of their node steps
+    static void locations(const Operation *root, vector<Location> &list);
 
-        isInteger = isInteger && v.isInteger();
+    // Records the locations (of the ops of this function's tree before they were
+    //   shared) which differ from those of the shared ops
+    void relocate(const vector<Location> &unshared);
 
-        switch(type_)
-        {
-          case ADD:   ival += long(v);  dval += double(v);  break;
-          case MULT:  ival *= long(v);  dval *= double(v);  break;
-        }
-      }
+    // Evaluates as eval(), adding the number of times each node step is run 
+    //   to evals and its inclusive time (in ns) to ns.  marks is scratch space.
+    //   Each is indexed by step.
+    Number_t profile(const Args_t &args, unsigned long *evals, unsigned long *ns, unsigned long *marks) const;
 
-      return ( isInteger ? Number_t(ival) : Number_t(dval) );
+    // Approximate heap memory used by the steps (not including the ops)
+    size_t memoryUsage(void) const
+    {
+      return sizeof(*this) + steps_.capacity() * sizeof(Step) + blockSteps_.capacity() * sizeof(BlockStep)
+        + locations_.capacity() * sizeof(Location);
     }
 
-  protected:
+  private:
 
-    ListOp(const XMLNode *xml, const ArgDefs_t &, Type_t);
+    // PUSH_CONST and PUSH_ARG push the value of a leaf op without calling it.
+    // ENDIF completes a lazy <if> (it does nothing, but is a node step).
+    typedef enum { EVAL, PUSH_CONST, PUSH_ARG, JUMP, JUMP_IF_FALSE, ENDIF } Code_t;
 
-    Type_t   type_;
-    OpList_t ops_;
-};
+    struct Step
+    {
+      Step(Code_t c, const Operation *o=NULL, size_t s=0) 
+        : code(c), op(o), count(o==NULL ? 0 : o->numOperands()), target(0), start(s) {}
+
+      Code_t           code;
+      const Operation *op;
+      size_t           count;   // number of operand values on the stack
+      size_t           target;  // step to jump to (or PUSH_ARG: argument index)
+      size_t           start;   // first step of the op (including its operands)
+      Number_t         value;   // PUSH_CONST: value
+    };
+
+    // Hooks called by run() before each step (with the stack pointer) and 
+    //   after the last step
+    struct NoHook
+    {
+      void step(const Step *, const Number_t *) {}
+      void end(void) {}
+    };
 
+    class Timing;
+    class RowStatus;
 
+    // APPLY evaluates an op whose operands are the top count values on the stack.
+    // APPLY_ALL does the same for an op with more than three operands (see
+    //   CallOp), which are evaluated in order.
+    // START, FOLD, and FOLD_HELD evaluate a list op (see ListOp::foldBlock).
+    typedef enum { APPLY, APPLY_ALL, START, FOLD, FOLD_HELD } BlockCode_t;
 
+    struct BlockStep
+    {
+      BlockStep(BlockCode_t c, const Operation *o, size_t i=0) 
+        : code(c), op(o), count(c==APPLY || c==APPLY_ALL ? o->numOperands() : 0), operand(i) {}
+
+      BlockCode_t      code;
+      const Operation *op;
+      size_t           count;    // APPLY, APPLY_ALL: number of operand values on the stack
+      size_t           operand;  // index of the list operand being folded
+      unsigned char    slot[3];  // APPLY: position of each operand above the first
+    };
+
+    // Ops (and their progress) on the work stack while compiling
+    struct Frame
+    {
+      Frame(const Operation *o, size_t s) : op(o), next(0), jump(0), start(s) {}
+      const Operation *op;
+      size_t           next;   // next operand to compile
+      size_t           jump;   // step whose target is not yet known
+      size_t           start;  // first step of the op
+    };
+
+    struct BlockFrame
+    {
+      BlockFrame(size_t i) : index(i), next(0) {}
+      size_t        index;
+      size_t        next;      // number of operands evaluated
+      unsigned char order[3];  // (fixed operands) order in which they are evaluated
+    };
 
-class LogOp : public UnaryOp
+    template<class Hook_t>
+    Number_t evalWith(const Args_t &args, Hook_t &hook) const;
+
+    template<class Real_t>
+    Block_t &evalLanes(const Batch_t &batch, vector<Block_t> &stack, bool status) const;
+
+    template<class Hook_t>
+    Number_t run(const Args_t &args, Number_t *stack, Hook_t &hook) const;
+
+    void compile(const Operation *root);
+    void compileBlock(const Operation *root);
+
+    static void orderOperands(size_t k, const size_t *need, unsigned char *order);
+
+    const Operation   *root_;
+    vector<Step>       steps_;
+    size_t             depth_;
+    vector<BlockStep>  blockSteps_;
+    size_t             blockDepth_;
+    vector<Location>   locations_;  // by step (see locate())
+};
+
+// A function rewritten for a sweep over one axis, or a grid of two (see
+//   XMLFunc::sweep).  The level of each op is the number of the innermost axis
+//   it depends on: 0 if it depends on no axis, 1 for the only (or outer) axis
+//   and 2 for the inner axis of a grid.  Each operand at a lower level than the
+//   op using it (other than an argument or constant) is hoisted: it is replaced
+//   by an extra argument, numbered after the function's own, and evaluated on
+//   its own.  Level 0 ops are evaluated once, and level 1 ops of a grid once
+//   for each outer value (in batch, over the outer axis).  The function is then
+//   evaluated in batch over the inner axis, with the values of the outer axis
+//   and of the hoisted ops broadcast to every row (by columns with a 0 stride).
+class XMLFunc::Sweep
 {
   public:
+    // axisArgs are the indices of the swept arguments (outer first)
+    Sweep(const Operation *root, size_t numArgs, const vector<size_t> &axisArgs);
+    ~Sweep() { clear(); }
 
-    static LogOp *build(const XMLNode *xml, const ArgDefs_t &args)
-    {
-      LogOp *rval(NULL);
-      if( xml->name() == "log" ) rval = new LogOp(xml,args);
-      return rval;
-    }
+    // Evaluates the function over the values of each axis (outer first), with
+    //   the values of the other arguments in args
+    void eval(const Args_t &args, const vector<const vector<double> *> &axes, bool single, double *out) const;
 
-    Number_t eval(const Args_t &args) const
-    {
-      return Number_t( fac_ * log( double(op_->eval(args))) );
-    }
   private:
+    Sweep(const Sweep &);
+    Sweep &operator=(const Sweep &);
 
-    LogOp(const XMLNode *xml, const ArgDefs_t &); 
-
-    double fac_;
+    struct Hoisted
+    {
+      Hoisted(OpPtr_t o, size_t l) : op(o), level(l), program(NULL) {}
+      OpPtr_t  op;
+      size_t   level;
+      Program *program;
+    };
+
+    // Returns the argument replacing op (which is hoisted), or op itself if
+    //   it is an argument or constant
+    OpPtr_t hoist(OpPtr_t op, size_t level);
+
+    // Evaluates n rows of program, writing the values to i if its op has
+    //   integer values (else to d)
+    static void run(const Program &program, const BatchArgs_t &cols, size_t n, bool single,
+                    double *d, long *i, vector<Block_t> &stack);
+
+    void clear(void);
+
+    OpPtr_t          root_;       // the function, without the hoisted ops
+    Program         *program_;
+    vector<Hoisted>  hoisted_;    // by extra argument
+    size_t           numArgs_;
+    vector<size_t>   axisArgs_;
 };
 
+// The lanes of a block holding double values computed in double (d) or single 
+//   (f) precision, and the Operation method computing them.  Op kernels are 
+//   written once as templates on the lane type.
+template<class Real_t> struct Lanes;
 
-////////////////////////////////////////////////////////////////////////////////
-// XMLNode methods
-////////////////////////////////////////////////////////////////////////////////
-
-// Constructs a new XMLNode using the specified XML.
-//   Returns NULL if the XML string is empty.
-//   Returns the parent node if this is a closing tag
-//   Throws a runtime_error if invalid XMl syntax
-XMLNode *XMLNode::build(string &xml, XMLNode *parent)
+template<> struct Lanes<double>
 {
-  static const string alpha      = "abcdefghijklmnopqrstuvwxyz";
-  static const string alphanum   = alpha + "0123456789";
-
-  size_t end_xml = xml.length();
+  static double       *of(Block_t &block)       { return block.d; }
+  static const double *of(const Block_t &block) { return block.d; }
 
-  size_t start_tag = xml.find("<");
-  if( start_tag == string::npos )
+  static void eval(const XMLFunc::Operation *op, const Batch_t &batch, Block_t *const *operands, Block_t &out)
   {
-    if(has_content(xml)) INVALID_XML("all content must be tagged");
-    return NULL;
+    op->evalBlock(batch,operands,out);
   }
-  if( has_content( xml.substr(0,start_tag) ) ) INVALID_XML("all content must be tagged");
+};
 
-  bool   is_closing(false);
-  size_t start_name = start_tag + 1;
+template<> struct Lanes<float>
+{
+  static float       *of(Block_t &block)       { return block.f; }
+  static const float *of(const Block_t &block) { return block.f; }
 
-  if( xml.compare(start_tag,2,"</") == 0 ) // this is a closing tag
+  static void eval(const XMLFunc::Operation *op, const Batch_t &batch, Block_t *const *operands, Block_t &out)
   {
-    is_closing = true;
-    ++start_name;
+    op->evalBlockFloat(batch,operands,out);
   }
+};
 
-  size_t end_name = xml.find_first_not_of(alphanum,start_name);
-  if( end_name==start_name  ) INVALID_XML("missing tag name");
-  if( end_name==string::npos) INVALID_XML("tag is missing closing '>'");
-
-  string name = xml.substr(start_name, end_name-start_name);
-
-  // validate/handle closing tag
- 
-  if(is_closing)
-  {
-    if(parent==NULL)
-      INVALID_XML("closing </" << name << "> tag has no opening tag");
+// Signed integer division by a constant, computed as a multiply-high, a shift,
+//   and a sign correction (see Hacker's Delight, chapter 10) rather than by the
+//   hardware divide, which takes many times longer.  The quotients truncate 
+//   toward zero and match BinaryOp::quotient() and remainder() for every 
+//   dividend, including division by 0 (which is 0) and of the most negative
+//   value by -1 (which wraps around to itself).
+class ConstDivisor
+{
+  public:
+    ConstDivisor(long d);
 
-    if(name != parent->name())
-      INVALID_XML("closing </" << name << "> tag does not pair with opening <" << parent->name() << "> tag");
+    long divisor(void) const { return d_; }
 
-    size_t end_tag = skip_whitespace(xml,end_name);
+    void quotients (const long *n, long *q, size_t count) const;
+    void remainders(const long *n, long *r, size_t count) const;
 
-    if( end_tag == string::npos )
-      INVALID_XML("</" << name << "> tag does not have a closing '>'");
+  private:
 
-    if( xml[end_tag] != '>' )
-      INVALID_XML("closing tags cannot have attributes");
+    typedef enum { ZERO, ONE, MINUS_ONE, MAGIC } Kind_t;
 
-    xml = xml.substr(end_tag+1);
+    static long mulhi(long a, long b);
 
-    return parent;
-  }
+    long quotient(long n) const;
 
-  // find attributes
+    long   d_;
+    Kind_t kind_;
+    long   magic_;
+    int    shift_;
+    long   sign_;    // (-1, 0, or 1) multiple of the dividend added to the high product
+};
 
-  XMLNode *rval = new XMLNode(name);
+// Work which can be divided into a number of independent parts, which
+//   may be run concurrently (see run_parallel)
+class ParallelTask
+{
+  public:
+    virtual ~ParallelTask() {}
+    virtual void run(size_t part) = 0;
+};
 
-  bool is_opening_tag(false);
+// Parses root level elements which have been located in the XML (see 
+//   parse_roots).  An element fails if it does not parse, or does not end 
+//   where expected.
+class ParseTask : public ParallelTask
+{
+  public:
+    ParseTask(const string &xml, size_t depth, const vector<size_t> &starts, const vector<size_t> &ends, XMLRoots &roots)
+      : xml_(xml), depth_(depth), starts_(starts), ends_(ends), roots_(roots), failures_(0) {}
 
-  size_t end_tag(0);
-  size_t pos(end_name);
-  while( (pos=skip_whitespace(xml,pos)) != string::npos )
-  {
-    if(xml[pos]=='>') 
-    {
-      is_opening_tag = true;
-      end_tag = pos + 1;
-      break;
-    }
-    else if(xml.compare(pos,2,"/>")==0)
+    void run(size_t i)
     {
-      is_opening_tag = false;
-      end_tag = pos + 2;
-      break;
+      try
+      {
+        size_t pos = starts_[i];
+        roots_[i] = XMLNode::parse(xml_,pos,depth_);
+        if( roots_[i] == NULL || pos != ends_[i] ) __sync_fetch_and_add(&failures_,1U);
+      }
+      catch( runtime_error & )
+      {
+        __sync_fetch_and_add(&failures_,1U);
+      }
     }
-    else
-    {
-      if( xml.find_first_of(alpha,pos) != pos )
-        INVALID_XML("attribute keys must start with a-z, not '" << xml.substr(pos,1) << "'");
-
-      size_t start_key = pos;
-      size_t end_key = xml.find_first_not_of(alphanum,pos);
 
-      if(end_key==string::npos)
-        INVALID_XML("attribute key '" << xml.substr(start_key) << "' in <" << name << "> has no assigned value");
+    bool failed(void) const { return failures_ != 0; }
 
-      string key = xml.substr(start_key,end_key-start_key);
+  private:
+    const string         &xml_;
+    size_t                depth_;
+    const vector<size_t> &starts_;
+    const vector<size_t> &ends_;
+    XMLRoots             &roots_;
+    unsigned              failures_;
+};
 
-      if(xml[end_key]!='=')
-        INVALID_XML("attribute key '" << key << "' in <" << name << "> not followed by an '='");
+// Reduces the function values for a batch of rows.  Each part is a fixed
+//   size chunk of rows which is reduced into its own partial result.
+template<class Result_t>
+class ReduceTask : public ParallelTask
+{
+  public:
+    static const size_t ChunkSize = 256 * XMLFunc::BlockSize;
 
-      if(end_key==start_key)
-        INVALID_XML("attributes keys must consist solely of alphanumeric characters");
+    ReduceTask(const XMLFunc::Program &program, const BatchArgs_t &args, size_t n, bool single, const Result_t &result)
+      : program_(program), args_(args), n_(n), single_(single), 
+        partials_( (n + ChunkSize - 1) / ChunkSize, empty(result) ) {}
 
-      size_t start_value = end_key+1;
-      if( start_value >= end_xml)
-        INVALID_XML("<" << name << "> tag does not have a closing '>'");
+    size_t numChunks(void) const { return partials_.size(); }
 
+    void run(size_t chunk)
+    {
+      size_t end = min( n_, (chunk+1) * ChunkSize );
 
-      // value may or may not be quoted
-      size_t end_value = start_value;
+      vector<Block_t> stack;
+      for(size_t offset = chunk * ChunkSize; offset<end; offset += XMLFunc::BlockSize)
+      {
+        Batch_t batch(args_, offset, min(XMLFunc::BlockSize, end-offset), single_);
 
-      char q = xml[start_value];
-      if( q=='"' || q=='\'' ) 
-      { 
-        start_value += 1; 
-        if( start_value >= end_xml)
-          INVALID_XML("<" << name << "> tag does not have a closing '>'");
+        Block_t &block = program_.evalBlock(batch,stack);
+        as_double(program_.root(),batch,block);
 
-        end_value = xml.find(q,start_value);
-        if(end_value == string::npos)
-          INVALID_XML("value for attribute key '" << key << "' in <" << name << "> has no closing quote");
-        
-        pos = end_value+1;
-      }
-      else
-      { 
-        end_value = xml.find_first_not_of(alphanum+".-+",start_value);
-        if(end_value == string::npos)
-          INVALID_XML("<" << name << "> tag does not have a closing '>'");
-        
-        pos = end_value;
+        partials_[chunk].add(block.d,batch.size());
       }
-
-      string value = xml.substr(start_value,end_value-start_value);
-
-      rval->addAttribute(key,value);
     }
-  }
 
-  xml = xml.substr(end_tag);
-
-  // Add children nodes if unless this a bodyless tag
-
-  if(is_opening_tag)
-  {
-    for(XMLNode *child=build(xml,rval); child!=rval; child=build(xml,rval))
+    // merges the partial results into result in chunk order
+    void merge(Result_t &result) const
     {
-      if(child == NULL) INVALID_XML("<" << name << "> tag is missing closing </" << name <<"> tag");
-      rval->addChild(child);
+      for(size_t i=0; i<partials_.size(); ++i) result.merge(partials_[i]);
     }
-  }
 
-  return rval;
-}
+  private:
 
+    static XMLFunc::Summary   empty(const XMLFunc::Summary &)     { return XMLFunc::Summary(); }
+    static XMLFunc::Histogram empty(const XMLFunc::Histogram &h) { return XMLFunc::Histogram(h.lo(),h.hi(),h.nbins()); }
 
-////////////////////////////////////////////////////////////////////////////////
-// XMLFunc methods
-////////////////////////////////////////////////////////////////////////////////
+    const XMLFunc::Program &program_;
+    const BatchArgs_t      &args_;
+    size_t             n_;
+    bool               single_;
+    vector<Result_t>   partials_;
+};
 
-void populate(ArgDefs_t &argDefs, const XMLNode *xml)
+
+// ConstDivisor methods
+
+// The magic multiplier and shift are found as in Hacker's Delight (figure 10-1),
+//   generalized to the width of long.
+ConstDivisor::ConstDivisor(long d) : d_(d), kind_(MAGIC), magic_(0), shift_(0), sign_(0)
 {
-  size_t numArgs = xml->numChildren();
+  if     ( d ==  0 ) { kind_ = ZERO;      return; }
+  else if( d ==  1 ) { kind_ = ONE;       return; }
+  else if( d == -1 ) { kind_ = MINUS_ONE; return; }
 
-  if(numArgs==0)  INVALID_XML("<arglist> is empty");
+  const int           w   = numeric_limits<unsigned long>::digits;
+  const unsigned long two = 1UL << (w-1);
 
-  argDefs.clear();
-  for(size_t i=0; i<numArgs; ++i)
-  {
-    const XMLNode *arg = xml->child(i);
-    if(arg->name() != "arg") INVALID_XML("<arglist> may only contain <arg> elements");
+  unsigned long ad  = ( d < 0 ? 0UL - (unsigned long)d : (unsigned long)d );
+  unsigned long t   = two + ( (unsigned long)d >> (w-1) );
+  unsigned long anc = t - 1 - t % ad;
 
-    NumberType_t type = Number_t::Double;
+  int           p  = w - 1;
+  unsigned long q1 = two / anc;
+  unsigned long r1 = two - q1 * anc;
+  unsigned long q2 = two / ad;
+  unsigned long r2 = two - q2 * ad;
+  unsigned long delta;
 
-    const string &type_str = arg->attributeValue("type");
-    if( type_str.empty() == false )
-    {
-      if     (type_str == "double")  { type = Number_t::Double; }
-      else if(type_str == "float")   { type = Number_t::Double; }
-      else if(type_str == "real")    { type = Number_t::Double; }
-      else if(type_str == "integer") { type = Number_t::Integer; }
-      else if(type_str == "int")     { type = Number_t::Integer; }
-      else INVALID_XML("Unknown argument type: " << type_str);
-    }
+  do
+  {
+    ++p;
+    q1 *= 2; r1 *= 2; if( r1 >= anc ) { ++q1; r1 -= anc; }
+    q2 *= 2; r2 *= 2; if( r2 >= ad  ) { ++q2; r2 -= ad;  }
+    delta = ad - r2;
+  } while( q1 < delta || ( q1 == delta && r1 == 0 ) );
+
+  magic_ = long(q2 + 1);
+  if( d < 0 ) magic_ = wrap_neg(magic_);
+  shift_ = p - w;
+
+  if     ( d > 0 && magic_ < 0 ) sign_ =  1;
+  else if( d < 0 && magic_ > 0 ) sign_ = -1;
+}
 
-    const string &name = arg->attributeValue("name");
+// The kind of divisor is chosen once per block; the loops do not branch.
+//   The output may be the same block as the dividends.
+void ConstDivisor::quotients(const long *n, long *q, size_t count) const
+{
+  switch(kind_)
+  {
+    case ZERO:      for(size_t k=0; k<count; ++k) q[k] = 0;              break;
+    case ONE:       for(size_t k=0; k<count; ++k) q[k] = n[k];           break;
+    case MINUS_ONE: for(size_t k=0; k<count; ++k) q[k] = wrap_neg(n[k]); break;
+    case MAGIC:     for(size_t k=0; k<count; ++k) q[k] = quotient(n[k]); break;
+  }
+}
 
-    if( name.empty() ) { argDefs.add(type); }
-    else               { argDefs.add(type,name); }
+void ConstDivisor::remainders(const long *n, long *r, size_t count) const
+{
+  if( kind_ != MAGIC )
+  {
+    for(size_t k=0; k<count; ++k) r[k] = 0;
+    return;
   }
+
+  for(size_t k=0; k<count; ++k) r[k] = wrap_sub( n[k], wrap_mul( quotient(n[k]), d_ ) );
 }
 
-// XMLFunc constructor
+// Quotient by a MAGIC divisor: the high product, shifted, plus one if negative
+long ConstDivisor::quotient(long n) const
+{
+  const int w = numeric_limits<unsigned long>::digits;
+
+  long t = wrap_add( mulhi(magic_,n), wrap_mul(sign_,n) ) >> shift_;
+  return t + long( (unsigned long)t >> (w-1) );
+}
 
-XMLFunc::XMLFunc(const string &src)
+// The high half of the (double width) product a*b
+long ConstDivisor::mulhi(long a, long b)
 {
-  string raw_xml = load_xml(src);
-  raw_xml = strip_xml(raw_xml,"<?xml","?>"); // remove declaration
-  raw_xml = strip_xml(raw_xml,"<!--","-->"); // remove comments
+#if defined(__SIZEOF_INT128__) && __SIZEOF_LONG__ == 8
+  __extension__ typedef __int128 wide_t;
+  return long( ( wide_t(a) * wide_t(b) ) >> 64 );
+#else
+  // unsigned product from half width parts, then corrected for the signs
+  const int           h    = numeric_limits<unsigned long>::digits / 2;
+  const unsigned long mask = ( 1UL << h ) - 1;
+
+  unsigned long ua = (unsigned long)a, ub = (unsigned long)b;
+  unsigned long a0 = ua & mask, a1 = ua >> h;
+  unsigned long b0 = ub & mask, b1 = ub >> h;
+
+  unsigned long t  = a1 * b0 + ( ( a0 * b0 ) >> h );
+  unsigned long u  = a0 * b1 + ( t & mask );
+  unsigned long hi = a1 * b1 + ( t >> h ) + ( u >> h );
+
+  if( a < 0 ) hi -= ub;
+  if( b < 0 ) hi -= ua;
+  return long(hi);
+#endif
+}
+
+// XMLFunc::ArgDefs methods
 
-  transform( raw_xml.begin(), raw_xml.end(), raw_xml.begin(), ::tolower );
+void XMLFunc::ArgDefs::add(NumberType_t type, const string &name)
+{
+  if(name.empty()==false) xref_[name] = int(types_.size());
+  types_.push_back(type);
+}
 
-  ArgDefs_t sharedArgDefs;
+size_t XMLFunc::ArgDefs::index(const string &name) const
+{
+  Xref_t::const_iterator i = xref_.find(name);
+  if( i == xref_.end() ) INVALID_XML("bad argument name (" << name << ")");
+  return i->second;
+}
 
-  while(has_content(raw_xml))
+// returns the name of the specified argument (empty if it was not named)
+string XMLFunc::ArgDefs::name(int i) const
+{
+  for(Xref_t::const_iterator xi=xref_.begin(); xi!=xref_.end(); ++xi)
   {
-    XMLNode *xml = XMLNode::build(raw_xml);
-    if( xml==NULL ) INVALID_XML("Failed to parse root level element");
+    if( xi->second == size_t(i) ) return xi->first;
+  }
+  return "";
+}
 
-    string tag = xml->name();
+pair<size_t,bool> XMLFunc::ArgDefs::find(const string &name) const
+{
+  pair<size_t,bool> rval(0,false);
 
-    if( tag == "arglist" )
-    {
-      populate(sharedArgDefs,xml);
-    }
-    else if( tag == "func" )
-    {
-      size_t numChildren = xml->numChildren();
-      if( numChildren == 1 )
-      {
-        if(sharedArgDefs.empty()) 
-          INVALID_XML("<func> must have <arglist> child as there is no root level <arglist>");
+  Xref_t::const_iterator i = xref_.find(name);
+  if( i != xref_.end() )
+  {
+    rval.first = i->second;
+    rval.second = true;
+  }
 
-        OpPtr_t func = build_op( xml->child(0), sharedArgDefs );
-        funcs_.push_back( Function(func, sharedArgDefs) );
-      }
-      else if(numChildren == 2 )
-      {
-        const XMLNode *arglist = xml->child(0);
-        if( arglist->name() != "arglist" ) 
-          INVALID_XML("<arglist> must be first element in <func> if there is more than one child element");
+  return rval;
+}
 
-        ArgDefs_t argDefs;
-        populate(argDefs,arglist);
+size_t XMLFunc::ArgDefs::memoryUsage(void) const
+{
+  size_t rval = sizeof(*this) + types_.capacity() * sizeof(NumberType_t);
 
-        OpPtr_t func = build_op( xml->child(1), argDefs );
+  // map nodes (value and three links) and the names
+  for(Xref_t::const_iterator xi=xref_.begin(); xi!=xref_.end(); ++xi)
+  {
+    rval += sizeof(*xi) + 3 * sizeof(void *) + xi->first.capacity();
+  }
+  return rval;
+}
 
-        funcs_.push_back( Function(func, argDefs) );
-      }
-      else
-      {
-        INVALID_XML("<func> must one child element, with an optional arg list");
-      }
+// XMLFunc::FunctionIndex methods
 
-      if( xml->hasAttribute("name") )
-      {
-        string name = xml->attributeValue("name");
-        size_t index = funcs_.size() - 1;
+void XMLFunc::FunctionIndex::build(void)
+{
+  size_t capacity = 8;
+  while( capacity < 2 * names_.size() ) capacity *= 2;
 
-        XrefEntry_t entry(name,index);
+  slots_.assign(capacity, Slot());
 
-        pair< Xref_t::iterator, bool> rc = funcXref_.insert(entry);
+  const size_t mask = capacity - 1;
+  for(size_t index=0; index<names_.size(); ++index)
+  {
+    const string &name = names_[index];
+    if( name.empty() ) continue;
 
-        if(rc.second == false) INVALID_XML("function name " << name << " can only be used once");
-      }
-    }
-    else
+    size_t h = hash(name);
+    size_t k = h & mask;
+    for( ; slots_[k].index != 0; k = (k+1) & mask )
     {
-      INVALID_XML("Only <func> and <arglist> elements may exist at root level");
+      if( slots_[k].hash == h && names_[slots_[k].index-1] == name )
+        INVALID_XML("function name " << name << " can only be used once");
     }
+    slots_[k].hash  = h;
+    slots_[k].index = index + 1;
   }
-
-  if(funcs_.empty()) INVALID_XML("contains no <func> elements");
 }
 
-Number_t XMLFunc::eval(const Args_t &args) const
+pair<size_t,bool> XMLFunc::FunctionIndex::find(const string &name) const
 {
-  if(funcs_.size() != 1) 
-    throw runtime_error("Must specify the function by name or index as there is more than one functin defined");
+  pair<size_t,bool> rval(0,false);
+  if( slots_.empty() || name.empty() ) return rval;
 
-  return _eval(funcs_.at(0), args);
-}
+  const size_t mask = slots_.size() - 1;
 
-Number_t XMLFunc::eval(size_t index, const Args_t &args) const
-{
-  if(index >= funcs_.size())
+  size_t h = hash(name);
+  for(size_t k = h & mask; slots_[k].index != 0; k = (k+1) & mask)
   {
-    stringstream err;
-    err << "Invalid function index (" << index << ").  There are only " << funcs_.size() << " functions defined";
-    throw runtime_error(err.str());
+    if( slots_[k].hash == h && names_[slots_[k].index-1] == name )
+    {
+      rval.first  = slots_[k].index - 1;
+      rval.second = true;
+      break;
+    }
   }
-
-  return _eval(funcs_.at(index), args);
+  return rval;
 }
 
-Number_t XMLFunc::eval(const string &name,const Args_t &args) const
+size_t XMLFunc::FunctionIndex::memoryUsage(void) const
 {
-  Xref_t::const_iterator i = funcXref_.find(name);
+  size_t rval = sizeof(*this) + names_.capacity() * sizeof(string) + slots_.capacity() * sizeof(Slot);
+  for(vector<string>::const_iterator i=names_.begin(); i!=names_.end(); ++i) rval += i->capacity();
+  return rval;
+}
 
-  if(i==funcXref_.end())
+size_t XMLFunc::FunctionIndex::hash(const string &name)
+{
+  unsigned long h = 14695981039346656037UL;
+  for(string::const_iterator c=name.begin(); c!=name.end(); ++c)
   {
-    stringstream err;
-    err << "Invalid function name (" << name << ")";
-    throw runtime_error(err.str());
+    h ^= (unsigned char)(*c);
+    h *= 1099511628211UL;
   }
+  return size_t(h);
+}
 
-  size_t index = i->second;
+// ArgDefsPool methods
 
-  return _eval( funcs_.at(index), args);
+const ArgDefs_t *ArgDefsPool::intern(const ArgDefs_t &argDefs)
+{
+  pair<map<string,size_t>::iterator,bool> rc = index_.insert( make_pair(signature(argDefs), pool_.size()) );
+  if( rc.second ) pool_.push_back( new ArgDefs_t(argDefs) );
+
+  return pool_[rc.first->second];
 }
 
-Number_t XMLFunc::_eval(const Function &f, const Args_t &args) const
+// The type and name of each argument
+string ArgDefsPool::signature(const ArgDefs_t &argDefs)
 {
-  if( args.size() < f.argDefs.count() )
+  string rval;
+  for(int i=0; i<argDefs.count(); ++i)
   {
-    stringstream err;
-    err << "Insufficient arguments passed to eval.  Need " << f.argDefs.count()
-      << ". Only " << args.size() << " were provided";
-    throw runtime_error(err.str());
+    switch( argDefs.type(i) )
+    {
+      case Number_t::Integer: rval += 'i'; break;
+      case Number_t::Double:  rval += 'd'; break;
+      case Number_t::Array:   rval += 'a'; break;
+    }
+    rval += argDefs.name(i);
+    rval += '\0';
   }
+  return rval;
+}
+
+// XMLFunc::OperationPool methods
+
+// The tree is interned from its leaves up.  An op equivalent to one already in
+//   the pool is replaced by that op in its parent; its operands (which are the
+//   pooled op's operands) each lose the reference it held.
+OpPtr_t XMLFunc::OperationPool::intern(OpPtr_t root)
+{
+  OperationPool &pool = instance();
+
+  pthread_mutex_lock(&pool.mutex_);
 
-  for(int i=0; i<f.argDefs.count(); ++i)
+  OpPtr_t rval(NULL);
+
+  vector< pair<OpPtr_t,size_t> > pending(1, make_pair(root,size_t(0)));
+  while( pending.empty() == false )
   {
-    const Number &arg = args.at(i);
-    if(f.argDefs.type(i) == Number_t::Integer && arg.isDouble())
+    OpPtr_t op = pending.back().first;
+    size_t &next = pending.back().second;
+
+    if( next < op->operands_.size() )
     {
-      stringstream err;
-      err << "Argument " << i << " should be an integer, but a double ("
-        << double(arg) << ") was passed to eval()";
-      throw runtime_error(err.str());
+      pending.push_back( make_pair(op->operands_[next++],size_t(0)) );
+      continue;
+    }
+    pending.pop_back();
+
+    size_t h = hash(op);
+
+    OpPtr_t shared(NULL);
+    pair<Table_t::iterator,Table_t::iterator> range = pool.table_.equal_range(h);
+    for(Table_t::iterator i=range.first; i!=range.second && shared==NULL; ++i)
+    {
+      if( equivalent(i->second,op) ) shared = i->second;
+    }
+
+    if( shared != NULL )
+    {
+      for(size_t i=0; i<op->operands_.size(); ++i) --op->operands_[i]->refs_;
+      op->operands_.clear();
+      delete op;
     }
+    else
+    {
+      shared = op;
+      pool.table_.insert( make_pair(h,op) );
+      pool.stats_.nodes += 1;
+      pool.stats_.bytes += op->memoryUsage();
+    }
+    ++shared->refs_;
+
+    if( pending.empty() ) rval = shared;
+    else                  pending.back().first->operands_[ pending.back().second - 1 ] = shared;
   }
 
-  return f.root->eval(args);
-}
+  pool.stats_.functions += 1;
+  pool.stats_.unshared  += treeMemory(rval);
 
-////////////////////////////////////////////////////////////////////////////////
-// XMLFunc::Op subclass methods
-////////////////////////////////////////////////////////////////////////////////
+  pthread_mutex_unlock(&pool.mutex_);
 
-ConstOp::ConstOp(const XMLNode *xml, const ArgDefs_t &argDefs, NumberType_t type)
+  return rval;
+}
+
+// The ops whose last reference is dropped are removed from the table under
+//   the mutex, and deleted (each detached from its operands) after it is released.
+void XMLFunc::OperationPool::release(OpPtr_t root)
 {
-  const string &value = xml->attributeValue("value");
-  if( value.empty() ) INVALID_XML("Const op must have a value attribute");
+  OperationPool &pool = instance();
 
-  if( xml->hasChildren() ) INVALID_XML("Const op cannot have child ops");
+  size_t bytes = treeMemory(root);  // (the tree cannot change while the reference is held)
 
-  string extra;
-  if(type == Number_t::Double)
+  vector<OpPtr_t> doomed;
+
+  pthread_mutex_lock(&pool.mutex_);
+
+  pool.stats_.functions -= 1;
+  pool.stats_.unshared  -= bytes;
+
+  vector<OpPtr_t> pending(1,root);
+  while( pending.empty() == false )
   {
-    double dval(0.);
-    if( ! read_double( value, dval, extra ) ) INVALID_XML("Invalid double value (" << value << ")");
-    value_ = Number_t(dval);
+    OpPtr_t op = pending.back();
+    pending.pop_back();
+
+    if( --op->refs_ > 0 ) continue;
+
+    pair<Table_t::iterator,Table_t::iterator> range = pool.table_.equal_range( hash(op) );
+    for(Table_t::iterator i=range.first; i!=range.second; ++i)
+    {
+      if( i->second == op ) { pool.table_.erase(i); break; }
+    }
+    pool.stats_.nodes -= 1;
+    pool.stats_.bytes -= op->memoryUsage();
+
+    pending.insert(pending.end(), op->operands_.begin(), op->operands_.end());
+    doomed.push_back(op);
   }
-  else
+
+  pthread_mutex_unlock(&pool.mutex_);
+
+  for(vector<OpPtr_t>::iterator i=doomed.begin(); i!=doomed.end(); ++i)
   {
-    long ival(0);
-    if( ! read_integer( value, ival, extra ) ) INVALID_XML("Invalid integer value (" << value << ")");
-    value_ = Number_t(ival);
+    (*i)->operands_.clear();
+    delete *i;
   }
-  if( has_content(extra) ) INVALID_XML("Extraneous data (" << extra << ") following " << value);
 }
 
-
-ArgOp::ArgOp(const XMLNode *xml, const ArgDefs_t &argDefs)
+// Each table entry is a node of the multimap's tree: the entry and (about) 
+//   three pointers and a color
+XMLFunc::SharedOperations XMLFunc::OperationPool::stats(void)
 {
-  const string &index_attr = xml->attributeValue("index");
-  const string &name_attr  = xml->attributeValue("name");
+  OperationPool &pool = instance();
 
-  bool hasIndex = ( index_attr.empty() == false );
-  bool hasName  = ( name_attr.empty() == false );
+  pthread_mutex_lock(&pool.mutex_);
+  SharedOperations rval = pool.stats_;
+  rval.table = sizeof(pool) + pool.table_.size() * ( sizeof(Table_t::value_type) + 4 * sizeof(void *) );
+  pthread_mutex_unlock(&pool.mutex_);
 
-  if( hasIndex && hasName ) 
-  {
-    INVALID_XML("Arg op may only contain name or index attribute, not both");
-  }
-  else if(hasIndex)
-  {
-    long ival(0);
-    string extra;
+  return rval;
+}
 
-    if( read_integer(index_attr,ival,extra) == false )
-      INVALID_XML("index attribute is not an integer (" << index_attr << ")");
+XMLFunc::OperationPool &XMLFunc::OperationPool::instance(void)
+{
+  static OperationPool *pool = new OperationPool;
+  return *pool;
+}
 
-    if(has_content(extra)) 
-      INVALID_XML("index attribute contains extraneous data (" << extra << ")");
+// The class is identified by its type_info name, which is unique to the 
+//   class in the program (its address may not be)
+size_t XMLFunc::OperationPool::hash(const Operation *op)
+{
+  const char *name = typeid(*op).name();
 
-    index_ = (size_t)ival;
+  size_t h = 14695981039346656037UL;
+  for(const char *c=name; *c; ++c) h = hash_mix(h,(unsigned char)(*c));
 
-    if( ival<0 || index_ >= argDefs.count() )
-      INVALID_XML("Argument index " << index_ << " is out of range (0-" << argDefs.count()-1 << ")");
-  }
-  else if(hasName)
-  {
-    string name;
-    string extra;
+  h = hash_mix(h,op->valueType_);
+  h = hash_mix(h,op->hash());
+  for(size_t i=0; i<op->operands_.size(); ++i) h = hash_mix(h,(unsigned long)op->operands_[i]);
 
-    if( read_token(name_attr,name,extra) == false )
-      INVALID_XML("Arg name attribute must contain a non-empty string");
+  return h;
+}
 
-    if(has_content(extra)) 
-      INVALID_XML("name attribute contains extraneous data (" << extra << ")");
+bool XMLFunc::OperationPool::equivalent(const Operation *a, const Operation *b)
+{
+  return typeid(*a) == typeid(*b) && a->valueType_ == b->valueType_ 
+    && a->operands_ == b->operands_ && a->equivalent(*b);
+}
 
-    index_ = argDefs.index(name);
-  }
-  else
+size_t XMLFunc::OperationPool::treeMemory(const Operation *root)
+{
+  size_t rval(0);
+
+  vector<const Operation *> pending(1,root);
+  while( pending.empty() == false )
   {
-    INVALID_XML("Arg op must contain either name or index attribute");
+    const Operation *op = pending.back();
+    pending.pop_back();
+
+    rval += op->memoryUsage();
+    pending.insert(pending.end(), op->operands_.begin(), op->operands_.end());
   }
+
+  return rval;
 }
 
+// XMLFunc::Axis methods
 
-UnaryOp::UnaryOp(const XMLNode *xml, const ArgDefs_t &argDefs, Type_t type) 
-  : type_(type), op_(NULL)
+XMLFunc::Axis::Axis(size_t arg, double first, double last, size_t count) : index_(arg)
 {
-  const string &arg = xml->attributeValue("arg");
+  linspace(first,last,count);
+}
 
-  bool hasArg = arg.empty() == false;
+XMLFunc::Axis::Axis(const string &arg, double first, double last, size_t count) : index_(0), name_(arg)
+{
+  linspace(first,last,count);
+}
 
-  size_t numArg  = xml->numChildren();
-  if(hasArg) ++numArg;
+XMLFunc::Axis::Axis(size_t arg, const double *v, size_t count) : index_(arg), values_(v,v+count) {}
 
-  if(numArg == 0)
-    INVALID_XML(xml->name() << " op requires an arg attribute or child element");
-  if(numArg>1)
-    INVALID_XML(xml->name() << " op cannot specify more than one arg attribute or child element");
+XMLFunc::Axis::Axis(const string &arg, const double *v, size_t count) : index_(0), name_(arg), values_(v,v+count) {}
+
+// The last value is last exactly (rather than first plus count-1 steps)
+void XMLFunc::Axis::linspace(double first, double last, size_t count)
+{
+  double step = ( count > 1 ? (last - first) / double(count - 1) : 0. );
 
-  if(hasArg) op_ = build_op(arg,argDefs);
-  else       op_ = build_op(xml->child(0),argDefs);
+  values_.resize(count);
+  for(size_t k=0; k<count; ++k) values_[k] = first + double(k) * step;
+  if(count > 1) values_.back() = last;
 }
 
-BinaryOp::BinaryOp(const XMLNode *xml, const ArgDefs_t &argDefs, Type_t type) 
-  : type_(type), op1_(NULL), op2_(NULL)
+// XMLFunc::Summary methods
+
+XMLFunc::Summary::Summary(void) 
+  : count_(0), sum_(0.), mean_(0.), m2_(0.), 
+    min_(numeric_limits<double>::infinity()), max_(-numeric_limits<double>::infinity())
 {
-  const string &arg1 = xml->attributeValue("arg1");
-  const string &arg2 = xml->attributeValue("arg2");
+}
 
-  bool hasArg1 = arg1.empty() == false;
-  bool hasArg2 = arg2.empty() == false;
+// The block is reduced using four independent accumulators (which the compiler
+//   can keep in registers) and then merged with the current summary.  The mean
+//   and squared differences from the mean are computed in separate passes to
+//   avoid the cancellation errors of a sum of squares.
+void XMLFunc::Summary::add(const double *v, size_t n)
+{
+  if(n==0) return;
 
-  size_t numArg  = xml->numChildren();
-  if(hasArg1) ++numArg;
-  if(hasArg2) ++numArg;
+  const double inf = numeric_limits<double>::infinity();
 
-  if(numArg < 2)
-  {
-    INVALID_XML(xml->name() << " op requires two arg attributes or child elements");
-  }
-  else if(numArg>2)
+  double s[4]  = { 0., 0., 0., 0. };
+  double lo[4] = { inf, inf, inf, inf };
+  double hi[4] = { -inf, -inf, -inf, -inf };
+
+  size_t k(0);
+  for( ; k+4<=n; k+=4)
   {
-    INVALID_XML(xml->name() << " op cannot specify more than two arg attribute or child element");
+    for(int j=0; j<4; ++j)
+    {
+      double x = v[k+j];
+      s[j] += x;
+      lo[j] = ( x < lo[j] ? x : lo[j] );
+      hi[j] = ( x > hi[j] ? x : hi[j] );
+    }
   }
-  else if(hasArg1 && hasArg2)
+  for( ; k<n; ++k)
   {
-    op1_ = build_op(arg1,argDefs);
-    op2_ = build_op(arg2,argDefs);
+    double x = v[k];
+    s[0] += x;
+    lo[0] = ( x < lo[0] ? x : lo[0] );
+    hi[0] = ( x > hi[0] ? x : hi[0] );
   }
-  else if(hasArg1)
+
+  Summary b;
+  b.count_ = n;
+  b.sum_   = (s[0] + s[1]) + (s[2] + s[3]);
+  b.mean_  = b.sum_ / double(n);
+  b.min_   = std::min( std::min(lo[0],lo[1]), std::min(lo[2],lo[3]) );
+  b.max_   = std::max( std::max(hi[0],hi[1]), std::max(hi[2],hi[3]) );
+
+  double q[4] = { 0., 0., 0., 0. };
+  for(k=0 ; k+4<=n; k+=4)
   {
-    op1_ = build_op(arg1,argDefs);
-    op2_ = build_op(xml->child(0),argDefs);
+    for(int j=0; j<4; ++j)
+    {
+      double d = v[k+j] - b.mean_;
+      q[j] += d*d;
+    }
   }
-  else if(hasArg2)
+  for( ; k<n; ++k)
   {
-    op1_ = build_op(xml->child(0),argDefs);
-    op2_ = build_op(arg2,argDefs);
+    double d = v[k] - b.mean_;
+    q[0] += d*d;
+  }
+  b.m2_ = (q[0] + q[1]) + (q[2] + q[3]);
+
+  merge(b);
+}
+
+// Uses Chan et al's pairwise update for the mean and variance
+void XMLFunc::Summary::merge(const Summary &x)
+{
+  if(x.count_ == 0) return;
+  if(count_ == 0) { *this = x; return; }
+
+  double n1 = double(count_);
+  double n2 = double(x.count_);
+  double n  = n1 + n2;
+
+  double delta = x.mean_ - mean_;
+
+  mean_  += delta * n2 / n;
+  m2_    += x.m2_ + delta * delta * n1 * n2 / n;
+  sum_   += x.sum_;
+  count_ += x.count_;
+
+  if(x.min_ < min_) min_ = x.min_;
+  if(x.max_ > max_) max_ = x.max_;
+}
+
+// XMLFunc::Histogram methods
+
+XMLFunc::Histogram::Histogram(double lo, double hi, size_t nbins)
+  : lo_(lo), hi_(hi), scale_(0.), counts_(nbins+2,0), nan_(0)
+{
+  if( nbins == 0 ) throw runtime_error("Histogram must have at least one bin");
+  if( (hi > lo) == false ) throw runtime_error("Histogram upper edge must be greater than its lower edge");
+
+  scale_ = double(nbins) / (hi - lo);
+}
+
+void XMLFunc::Histogram::add(const double *v, size_t n)
+{
+  double nbins = double(counts_.size() - 2);
+
+  for(size_t k=0; k<n; ++k)
+  {
+    double f = ( v[k] - lo_ ) * scale_;
+
+    if( f != f ) { ++nan_; continue; }
+
+    size_t bin = ( f < 0. ? 0 : ( f >= nbins ? counts_.size()-1 : size_t(f) + 1 ) );
+    ++counts_[bin];
+  }
+}
+
+void XMLFunc::Histogram::merge(const Histogram &x)
+{
+  if( x.counts_.size() != counts_.size() || x.lo_ != lo_ || x.hi_ != hi_ )
+    throw runtime_error("Cannot merge histograms with different bins");
+
+  for(size_t i=0; i<counts_.size(); ++i) counts_[i] += x.counts_[i];
+  nan_ += x.nan_;
+}
+
+// XMLFunc::FunctionMetrics methods
+
+const size_t XMLFunc::FunctionMetrics::LatencyBins;
+
+XMLFunc::FunctionMetrics::FunctionMetrics(void) : calls(0), rows(0), errors(0), seconds(0.)
+{
+  for(size_t b=0; b<LatencyBins; ++b) latencies[b] = 0;
+}
+
+// Returns the upper edge of the latency bin containing the q quantile
+double XMLFunc::FunctionMetrics::latency(double q) const
+{
+  return latency_quantile(latencies, LatencyBins, q);
+}
+
+XMLFunc::Profile::Profile(unsigned long period) 
+  : program_(NULL), period_(period > 0 ? period : 1), calls_(0), timed_(0)
+{
+}
+
+// The counts and times of the timed calls are scaled up by the number of
+//   calls per timed call.  The operands of each op are evaluated within the
+//   op's inclusive time, so its exclusive time is what remains once theirs
+//   is removed.
+void XMLFunc::Profile::nodes(vector<Node> &nodes) const
+{
+  nodes.clear();
+  if( program_ == NULL ) return;
+
+  double scale = ( timed_ > 0 ? double(calls_) / double(timed_) : 0. );
+
+  size_t n = steps_.size();
+  nodes.resize(n);
+
+  // parents follow their operands, so each node's parent is set up before it
+
+  for(size_t i=n; i>0; --i)
+  {
+    Node            &node = nodes[i-1];
+    size_t           step = steps_[i-1];
+
+    Program::Location location;
+    program_->locate(step,location);
+
+    node.element   = *location.element;
+    node.line      = location.line;
+    node.column    = location.column;
+    node.parent    = parents_[i-1];
+    node.depth     = ( node.parent == string::npos ? 0 : nodes[node.parent].depth + 1 );
+    node.evals     = scale * double(evals_[step]);
+    node.inclusive = scale * 1.e-9 * double(ns_[step]);
+    node.exclusive = node.inclusive;
+  }
+
+  for(size_t i=0; i<n; ++i)
+  {
+    if(nodes[i].parent != string::npos) nodes[nodes[i].parent].exclusive -= nodes[i].inclusive;
+  }
+}
+
+void XMLFunc::Profile::report(ostream &s) const
+{
+  vector<Node> list;
+  nodes(list);
+
+  vector<size_t> order;
+  preorder_nodes(parents_,order);
+
+  double total = ( list.empty() ? 0. : list.back().inclusive );
+
+  ios::fmtflags flags     = s.flags();
+  streamsize    precision = s.precision();
+
+  s << "profile of " << function_ << ": " << calls_ << " calls (" << timed_ << " timed)" << endl;
+  s << setw(12) << "evals" << setw(12) << "incl(us)" << setw(12) << "excl(us)" << setw(8) << "excl%" 
+    << "  element" << endl;
+
+  for(vector<size_t>::const_iterator i=order.begin(); i!=order.end(); ++i)
+  {
+    const Node &node = list[*i];
+
+    s << fixed << setprecision(0) << setw(12) << node.evals
+      << setprecision(3) << setw(12) << 1.e6 * node.inclusive << setw(12) << 1.e6 * node.exclusive
+      << setprecision(1) << setw(7) << ( total > 0. ? 100. * node.exclusive / total : 0. ) << "%"
+      << "  " << string( 2 * min(node.depth,size_t(32)), ' ' )
+      << ( node.element.empty() ? "?" : node.element ) 
+      << " (line " << node.line << ", col " << node.column << ")" << endl;
+  }
+  s.flags(flags);
+  s.precision(precision);
+}
+
+void XMLFunc::Profile::folded(ostream &s) const
+{
+  vector<Node> list;
+  nodes(list);
+
+  vector<size_t> order;
+  preorder_nodes(parents_,order);
+
+  // the stack of each node extends that of its parent, which precedes it
+
+  string         stack;
+  vector<size_t> lengths(1, function_.size());
+  stack = function_;
+
+  for(vector<size_t>::const_iterator i=order.begin(); i!=order.end(); ++i)
+  {
+    const Node &node = list[*i];
+
+    stack.resize( lengths[node.depth] );
+
+    stringstream frame;
+    frame << ";" << ( node.element.empty() ? "?" : node.element ) << "@" << node.line << ":" << node.column;
+    stack += frame.str();
+
+    lengths.resize(node.depth+1);
+    lengths.push_back(stack.size());
+
+    s << stack << " " << (unsigned long)( 1.e9 * node.exclusive + 0.5 ) << endl;
+  }
+}
+
+void XMLFunc::Profile::clear(void)
+{
+  calls_ = 0;
+  timed_ = 0;
+  evals_.assign(evals_.size(),0);
+  ns_.assign(ns_.size(),0);
+}
+
+// Per-function counters behind XMLFunc::metrics().  Each function has a set
+//   of counters in each of NumShards shards.  Threads are spread across the
+//   shards by thread id and update the counters with atomic adds, so evals of
+//   the same function in different threads rarely contend for a cache line.
+class XMLFunc::Metrics
+{
+  public:
+    static const size_t        NumShards    = 16;
+    static const unsigned long SamplePeriod = 16;
+
+    // Padded to a whole number of (64 byte) cache lines
+    struct Counters
+    {
+      Counters(void) : calls(0), rows(0), errors(0), ns(0)
+      {
+        for(size_t b=0; b<FunctionMetrics::LatencyBins; ++b) latencies[b] = 0;
+      }
+
+      unsigned long calls;
+      unsigned long rows;
+      unsigned long errors;
+      unsigned long ns;   // sum of the timed calls (each weighted by its sampling period)
+      unsigned long latencies[FunctionMetrics::LatencyBins];
+      unsigned long pad[ 8 - (4 + FunctionMetrics::LatencyBins) % 8 ];
+    };
+
+    // Times an eval call (from construction to destruction).  Single row calls
+    //   are timed one in SamplePeriod; batch calls are always timed.  The call 
+    //   is counted as an error unless end() is called before it is destroyed.
+    class Timer
+    {
+      public:
+        Timer(Metrics *metrics, size_t func, size_t rows);
+        ~Timer();
+
+        void end(void) { ended_ = true; }
+
+      private:
+        Counters      &counters_;
+        size_t         rows_;
+        unsigned long  weight_;
+        unsigned long  start_;
+        bool           ended_;
+    };
+
+    Metrics(size_t nfuncs) : nfuncs_(nfuncs), counters_(NumShards*nfuncs) {}
+
+    Counters &counters(size_t func) { return counters_[ shard() * nfuncs_ + func ]; }
+
+    void snapshot(size_t func, FunctionMetrics &m) const
+    {
+      unsigned long ns(0);
+      for(size_t i=0; i<NumShards; ++i)
+      {
+        const Counters &c = counters_[ i * nfuncs_ + func ];
+
+        m.calls  += c.calls;
+        m.rows   += c.rows;
+        m.errors += c.errors;
+        ns       += c.ns;
+        for(size_t b=0; b<FunctionMetrics::LatencyBins; ++b) m.latencies[b] += c.latencies[b];
+      }
+      m.seconds = 1.e-9 * double(ns);
+    }
+
+    void reset(void)
+    {
+      for(vector<Counters>::iterator c=counters_.begin(); c!=counters_.end(); ++c) *c = Counters();
+    }
+
+    // Monotonic time in nanoseconds
+    static unsigned long now(void)
+    {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC,&ts);
+      return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+    }
+
+  private:
+
+    static size_t shard(void)
+    {
+      unsigned long id = (unsigned long)pthread_self();
+      return size_t( ( id * 0x9E3779B97F4A7C15UL ) >> 60 ) % NumShards;
+    }
+
+    size_t           nfuncs_;
+    vector<Counters> counters_;
+};
+
+const size_t        XMLFunc::Metrics::NumShards;
+const unsigned long XMLFunc::Metrics::SamplePeriod;
+
+XMLFunc::Metrics::Timer::Timer(Metrics *metrics, size_t func, size_t rows)
+  : counters_(metrics->counters(func)), rows_(rows), weight_(0), start_(0), ended_(false)
+{
+  unsigned long n = __sync_fetch_and_add( &counters_.calls, 1UL );
+
+  if     ( rows != 1 )            weight_ = 1;
+  else if( n % SamplePeriod == 0) weight_ = SamplePeriod;
+
+  if(weight_ > 0) start_ = now();
+}
+
+XMLFunc::Metrics::Timer::~Timer()
+{
+  if(weight_ > 0)
+  {
+    unsigned long ns = now() - start_;
+
+    size_t bin = 0;
+    while( bin < FunctionMetrics::LatencyBins-1 && ( ns >> (bin+1) ) != 0 ) ++bin;
+
+    __sync_fetch_and_add( &counters_.latencies[bin], 1UL );
+    __sync_fetch_and_add( &counters_.ns, ns * weight_ );
+  }
+
+  __sync_fetch_and_add( &counters_.rows, (unsigned long)rows_ );
+
+  if(ended_ == false) __sync_fetch_and_add( &counters_.errors, 1UL );
+}
+
+// Instrumentation of the eval methods (compiled out unless XMLFUNC_METRICS is defined)
+#ifdef XMLFUNC_METRICS
+#define METRICS_START(f,rows) Metrics::Timer metrics_timer(metrics_, size_t(&(f) - &funcs_[0]), rows)
+#define METRICS_END           metrics_timer.end()
+#else
+#define METRICS_START(f,rows)
+#define METRICS_END
+#endif
+
+// The source file, the lock held while publishing a new version and the thread
+//   started by watch().  Only writers use this: readers never lock.
+class ReloadableXMLFunc::Reloader
+{
+  public:
+    // Identifies one version of a file (replacing a file by renaming another
+    //   onto it changes the inode, writing to it changes the modification time)
+    struct Stamp
+    {
+      Stamp(void) : sec(0), nsec(0), size(0), inode(0) {}
+      bool operator!=(const Stamp &x) const { return sec!=x.sec || nsec!=x.nsec || size!=x.size || inode!=x.inode; }
+      long sec, nsec, size, inode;
+    };
+
+    Reloader(ReloadableXMLFunc &holder, const string &xml, unsigned optimizations, unsigned nthreads)
+      : holder_(holder), optimizations_(optimizations), nthreads_(nthreads), version_(0),
+        watching_(false), stop_(false), interval_(1.)
+    {
+      pthread_mutex_init(&mutex_,NULL);
+      pthread_mutex_init(&watchMutex_,NULL);
+      pthread_cond_init(&wake_,NULL);
+      if( stamp(xml,stamp_) ) path_ = xml;
+    }
+
+    ~Reloader()
+    {
+      pthread_cond_destroy(&wake_);
+      pthread_mutex_destroy(&watchMutex_);
+      pthread_mutex_destroy(&mutex_);
+    }
+
+    // Returns false if path is not a regular file
+    static bool stamp(const string &path, Stamp &s)
+    {
+      struct stat st;
+      if( stat(path.c_str(),&st) != 0 || S_ISREG(st.st_mode) == false ) return false;
+      s.sec   = long(st.st_mtim.tv_sec);
+      s.nsec  = long(st.st_mtim.tv_nsec);
+      s.size  = long(st.st_size);
+      s.inode = long(st.st_ino);
+      return true;
+    }
+
+    const string &path(void) const { return path_; }
+
+    XMLFunc *build(const string &xml) const { return new XMLFunc(xml, optimizations_, nthreads_); }
+
+    // Writers hold this while publishing a new version or deleting old ones
+    void lock(void)   { pthread_mutex_lock(&mutex_);   }
+    void unlock(void) { pthread_mutex_unlock(&mutex_); }
+
+    unsigned long nextVersion(void) { return ++version_; }
+
+    // Returns true if the file has changed since it was last built (and notes 
+    //   that it is being built now)
+    bool changed(void);
+
+    void   watch(double interval);
+    void   unwatch(void);
+    string lastError(void);
+
+  private:
+
+    static void *watch_thread(void *);
+
+    ReloadableXMLFunc &holder_;
+    unsigned           optimizations_;
+    unsigned           nthreads_;
+    string             path_;      // (empty unless constructed from a file)
+    Stamp              stamp_;     // the file as it was when last built
+    unsigned long      version_;   // most recent version number
+    pthread_mutex_t    mutex_;
+
+    pthread_mutex_t    watchMutex_;  // guards the members below
+    pthread_cond_t     wake_;
+    pthread_t          thread_;
+    bool               watching_;
+    bool               stop_;
+    double             interval_;
+    string             lastError_;
+};
+
+// Requests waiting to be evaluated, gathered into one batch per function, and
+//   the threads which evaluate the batches.
+class XMLFuncQueue::Dispatcher
+{
+  public:
+    struct Target
+    {
+      Request      *request;    // (NULL if completed by callback)
+      Callback_t    callback;
+      void         *context;
+      unsigned long submitted;  // (ns)
+    };
+
+    // Requests for one function, with their argument values stored by column 
+    //   (each argument uses either its ivals or its dvals, as its type requires)
+    struct Batch
+    {
+      size_t                   index;
+      unsigned long            deadline;  // (ns) when the oldest request will have waited maxDelay
+      bool                     full;
+      vector< vector<long> >   ivals;
+      vector< vector<double> > dvals;
+      vector<Target>           targets;
+      vector<double>           out;
+      vector<unsigned char>    status;
+    };
+
+    Dispatcher(const XMLFunc &func, size_t maxBatch, double maxDelay, unsigned nthreads);
+    ~Dispatcher();
+
+    void  submit(size_t index, const Args_t &args, const Target &target);
+    void  flush(void);
+    void  wait(const Request &request);
+
+    Stats stats(void);
+    void  resetStats(void);
+
+    // Sets the value of a request (or calls its callback)
+    static void complete(const Target &target, double value, unsigned status);
+
+    // Monotonic time in nanoseconds
+    static unsigned long now(void)
+    {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC,&ts);
+      return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+    }
+
+  private:
+
+    static void *worker_thread(void *);
+
+    void work(void);
+    void evaluate(Batch &batch);
+    void send(map<size_t,Batch *>::iterator pending);
+
+    const XMLFunc          &func_;
+    size_t                  maxBatch_;
+    unsigned long           maxDelay_;   // (ns)
+
+    pthread_mutex_t         mutex_;      // guards the members below
+    pthread_cond_t          work_;       // signalled when a batch is ready or a new deadline is set
+    pthread_cond_t          completed_;  // broadcast when requests have been completed
+    map<size_t,Batch *>     pending_;    // batch being gathered for each function
+    deque<Batch *>          ready_;      // batches waiting for a thread
+    vector<Batch *>         free_;       // batches to reuse (keeping their capacity)
+    bool                    stop_;
+    Stats                   stats_;
+    unsigned long           statsStart_;
+
+    vector<pthread_t>       threads_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// XMLFunc::Op subclasses
+////////////////////////////////////////////////////////////////////////////////
+
+class ConstOp : public XMLFunc::Operation
+{
+  public:
+
+    static ConstOp *build(const XMLNode *xml, const Scope &scope)
+    {
+      ConstOp *rval(NULL);
+
+      string name = xml->name();
+      if      ( name == "double"  ) { rval = new ConstOp( xml,scope, Number_t::Double  ); }
+      else if ( name == "float"   ) { rval = new ConstOp( xml,scope, Number_t::Double  ); }
+      else if ( name == "real"    ) { rval = new ConstOp( xml,scope, Number_t::Double  ); }
+      else if ( name == "integer" ) { rval = new ConstOp( xml,scope, Number_t::Integer ); }
+      else if ( name == "int"     ) { rval = new ConstOp( xml,scope, Number_t::Integer ); }
+
+      return rval;
+    }
+
+    ConstOp(long v)   : value_(v) { valueType_ = Number_t::Integer; }
+    ConstOp(double v) : value_(v) { valueType_ = Number_t::Double;  }
+
+    const Number_t &value(void) const { return value_; }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const { return value_; }
+
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<double>(batch,out);
+    }
+
+    void evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<float>(batch,out);
+    }
+
+    template<class Real_t>
+    void evalLanes(const Batch_t &batch, Block_t &out) const
+    {
+      size_t n = batch.size();
+      if(value_.isInteger()) { long   v = long(value_);           for(size_t k=0; k<n; ++k) out.i[k] = v; }
+      else                   { Real_t v = Real_t(double(value_)); Real_t *r = Lanes<Real_t>::of(out); for(size_t k=0; k<n; ++k) r[k] = v; }
+    }
+
+  public:
+    size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory(); }
+
+    // Double constants are compared bit for bit (so 0 and -0 differ, and NaN matches itself)
+    size_t hash(void) const
+    {
+      double d = double(value_);
+      return value_.isInteger() ? hash_mix(0,(unsigned long)long(value_)) : hash_doubles(0,&d,1);
+    }
+
+    bool equivalent(const XMLFunc::Operation &op) const
+    {
+      const Number_t &v = static_cast<const ConstOp &>(op).value_;
+      double a = double(value_);
+      double b = double(v);
+      return value_.isInteger() ? long(v) == long(value_) : same_doubles(&a,&b,1);
+    }
+
+  protected:
+
+    OpPtr_t copy(void) const { return new ConstOp(*this); }
+
+  private:
+
+    ConstOp(const XMLNode *xml, const Scope &, NumberType_t);
+
+    Number_t value_;
+};
+
+class ArgOp : public XMLFunc::Operation
+{
+  public:
+
+    static OpPtr_t build(const XMLNode *xml, const Scope &scope)
+    {
+      OpPtr_t rval(NULL);
+      if( xml->name() == "arg") rval = scope.arg( index(xml,scope.argDefs()) );
+      return rval;
+    }
+
+    ArgOp(size_t i, NumberType_t type) : index_(i) { valueType_ = type; }
+
+    size_t argIndex(void) const { return index_; }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const { return args.at(index_); }
+
+    // Integer and float columns passed for double arguments are converted.  Double
+    //   columns passed for integer arguments are rejected before evaluation begins.
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<double>(batch,out);
+    }
+
+    void evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<float>(batch,out);
+    }
+
+    template<class Real_t>
+    void evalLanes(const Batch_t &batch, Block_t &out) const
+    {
+      // (an array is passed on to a CallOp, which reads its column)
+      if( valueType_ == Number_t::Array ) return;
+
+      const XMLFunc::Column &col = batch.args().at(index_);
+
+      size_t n = batch.size();
+      size_t offset = batch.offset();
+
+      Real_t *r = Lanes<Real_t>::of(out);
+
+      // Broadcast columns (with a 0 stride, see Sweep) repeat the value of row 0
+      if( col.stride() == 0 )
+      {
+        if( valueType_ == Number_t::Integer )
+        {
+          long v = col.ival(0);
+          for(size_t k=0; k<n; ++k) out.i[k] = v;
+        }
+        else
+        {
+          Real_t v = ( col.type() == Number_t::Integer ? Real_t( col.ival(0) ) :
+                       col.fvals() != NULL           ? Real_t( col.fval(0) ) : Real_t( col.dval(0) ) );
+          for(size_t k=0; k<n; ++k) r[k] = v;
+        }
+      }
+      // Strided columns (e.g. fields of records) are gathered a row at a time
+      else if( col.contiguous() == false )
+      {
+        if     (valueType_ == Number_t::Integer)  for(size_t k=0; k<n; ++k) out.i[k] = col.ival(offset+k);
+        else if(col.type() == Number_t::Integer)  for(size_t k=0; k<n; ++k) r[k] = Real_t( col.ival(offset+k) );
+        else if(col.fvals() != NULL)              for(size_t k=0; k<n; ++k) r[k] = Real_t( col.fval(offset+k) );
+        else                                      for(size_t k=0; k<n; ++k) r[k] = Real_t( col.dval(offset+k) );
+      }
+      else if(valueType_ == Number_t::Integer)
+      {
+        const long *v = col.ivals() + offset;
+        for(size_t k=0; k<n; ++k) out.i[k] = v[k];
+      }
+      else if(col.type() == Number_t::Integer)
+      {
+        const long *v = col.ivals() + offset;
+        for(size_t k=0; k<n; ++k) r[k] = Real_t(v[k]);
+      }
+      else if(col.fvals() != NULL)
+      {
+        const float *v = col.fvals() + offset;
+        for(size_t k=0; k<n; ++k) r[k] = Real_t(v[k]);
+      }
+      else
+      {
+        const double *v = col.dvals() + offset;
+        for(size_t k=0; k<n; ++k) r[k] = Real_t(v[k]);
+      }
+    }
+
+  public:
+    size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory(); }
+
+    size_t hash(void) const { return hash_mix(0,index_); }
+
+    bool equivalent(const XMLFunc::Operation &op) const { return static_cast<const ArgOp &>(op).index_ == index_; }
+
+  protected:
+
+    OpPtr_t copy(void) const { return new ArgOp(*this); }
+
+  private:
+
+    static size_t index(const XMLNode *xml, const ArgDefs_t &);
+
+    size_t index_;
+};
+
+
+class UnaryOp : public XMLFunc::Operation
+{
+  public:
+
+    typedef enum { NEG, ABS, SIN, COS, TAN, ASIN, ACOS, ATAN, DEG, RAD, SQRT, EXP, LN, CHILD } Type_t;
+
+    static UnaryOp *build(const XMLNode *xml, const Scope &scope, OpList_t &operands)
+    {
+      UnaryOp *rval(NULL);
+
+      string name = xml->name();
+      if      ( name == "neg"  ) rval = new UnaryOp(xml,scope,NEG,operands);
+      else if ( name == "abs"  ) rval = new UnaryOp(xml,scope,ABS,operands);
+      else if ( name == "sin"  ) rval = new UnaryOp(xml,scope,SIN,operands);
+      else if ( name == "cos"  ) rval = new UnaryOp(xml,scope,COS,operands);
+      else if ( name == "tan"  ) rval = new UnaryOp(xml,scope,TAN,operands);
+      else if ( name == "asin" ) rval = new UnaryOp(xml,scope,ASIN,operands);
+      else if ( name == "acos" ) rval = new UnaryOp(xml,scope,ACOS,operands);
+      else if ( name == "atan" ) rval = new UnaryOp(xml,scope,ATAN,operands);
+      else if ( name == "deg"  ) rval = new UnaryOp(xml,scope,DEG,operands);
+      else if ( name == "rad"  ) rval = new UnaryOp(xml,scope,RAD,operands);
+      else if ( name == "sqrt" ) rval = new UnaryOp(xml,scope,SQRT,operands);
+      else if ( name == "exp"  ) rval = new UnaryOp(xml,scope,EXP,operands);
+      else if ( name == "ln"   ) rval = new UnaryOp(xml,scope,LN,operands);
+
+      return rval;
+    }
+
+    Type_t opType(void) const { return type_; }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const
+    {
+      static double deg_to_rad = atan(1.0)/45.;
+      static double rad_to_deg = 1./deg_to_rad;
+
+      Number_t v = operands[0];
+
+      Number_t rval;
+      switch(type_)
+      {
+        case NEG:  rval = v.negate();             break;
+        case ABS:  rval = v.abs();                break;
+
+        case SIN:  rval = sin(  double(v) );      break;
+        case COS:  rval = cos(  double(v) );      break;
+        case TAN:  rval = tan(  double(v) );      break;
+        case ASIN: rval = asin( double(v) );      break;
+        case ACOS: rval = acos( double(v) );      break;
+        case ATAN: rval = atan( double(v) );      break;
+        case SQRT: rval = sqrt( double(v) );      break;
+        case EXP:  rval = exp(  double(v) );      break;
+        case LN:   rval = log(  double(v) );      break;
+
+        case DEG:  rval = double(v) * rad_to_deg; break;
+        case RAD:  rval = double(v) * deg_to_rad; break;
+
+        case CHILD:
+          throw logic_error("Child class of UnaryOp missing override of eval method");
+          break;
+      }
+      return rval;
+    }
+
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<double>(batch,operands,out);
+    }
+
+    void evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<float>(batch,operands,out);
+    }
+
+    template<class Real_t>
+    void evalLanes(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      static double deg_to_rad = atan(1.0)/45.;
+      static double rad_to_deg = 1./deg_to_rad;
+
+      size_t n = batch.size();
+
+      Block_t &a = *operands[0];
+
+      if( valueType_ == Number_t::Integer )
+      {
+        const long *v = a.i;
+        long       *r = out.i;
+        switch(type_)
+        {
+          case NEG:  for(size_t k=0; k<n; ++k) r[k] = wrap_neg(v[k]);                       break;
+          case ABS:  for(size_t k=0; k<n; ++k) r[k] = ( v[k] < 0 ? wrap_neg(v[k]) : v[k] ); break;
+          default:   break;
+        }
+        return;
+      }
+
+      as_real<Real_t>(operands_[0],a,n);
+
+      const Real_t *v = Lanes<Real_t>::of(a);
+      Real_t       *r = Lanes<Real_t>::of(out);
+      switch(type_)
+      {
+        case NEG:  for(size_t k=0; k<n; ++k) r[k] = -v[k];             break;
+        case ABS:  for(size_t k=0; k<n; ++k) r[k] = fabs(v[k]);        break;
+
+        case SIN:  for(size_t k=0; k<n; ++k) r[k] = sin(v[k]);         break;
+        case COS:  for(size_t k=0; k<n; ++k) r[k] = cos(v[k]);         break;
+        case TAN:  for(size_t k=0; k<n; ++k) r[k] = tan(v[k]);         break;
+        case ASIN: for(size_t k=0; k<n; ++k) r[k] = asin(v[k]);        break;
+        case ACOS: for(size_t k=0; k<n; ++k) r[k] = acos(v[k]);        break;
+        case ATAN: for(size_t k=0; k<n; ++k) r[k] = atan(v[k]);        break;
+        case SQRT: for(size_t k=0; k<n; ++k) r[k] = sqrt(v[k]);        break;
+        case EXP:  for(size_t k=0; k<n; ++k) r[k] = exp(v[k]);         break;
+        case LN:   for(size_t k=0; k<n; ++k) r[k] = log(v[k]);         break;
+
+        case DEG:  for(size_t k=0; k<n; ++k) r[k] = v[k] * Real_t(rad_to_deg); break;
+        case RAD:  for(size_t k=0; k<n; ++k) r[k] = v[k] * Real_t(deg_to_rad); break;
+
+        case CHILD:
+          throw logic_error("Child class of UnaryOp missing override of evalBlock method");
+          break;
+      }
+    }
+
+  public:
+    size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory(); }
+
+    size_t hash(void) const { return hash_mix(0,type_); }
+
+    bool equivalent(const XMLFunc::Operation &op) const { return static_cast<const UnaryOp &>(op).type_ == type_; }
+
+  protected:
+
+    UnaryOp(const XMLNode *, const Scope &, Type_t, OpList_t &);
+
+    OpPtr_t copy(void) const { return new UnaryOp(*this); }
+
+    Type_t  type_;
+};
+
+class BinaryOp : public XMLFunc::Operation
+{
+  public:
+
+    typedef enum { SUB, DIV, MOD, POW, ATAN2, LT, LE, GT, GE, EQ, NE } Type_t;
+
+    static BinaryOp *build(const XMLNode *xml, const Scope &scope, OpList_t &operands)
+    {
+      BinaryOp *rval(NULL);
+
+      string name = xml->name();
+      if      ( name == "sub"   ) rval = new BinaryOp(xml,scope,SUB,operands);
+      else if ( name == "div"   ) rval = new BinaryOp(xml,scope,DIV,operands);
+      else if ( name == "mod"   ) rval = new BinaryOp(xml,scope,MOD,operands);
+      else if ( name == "pow"   ) rval = new BinaryOp(xml,scope,POW,operands);
+      else if ( name == "atan2" ) rval = new BinaryOp(xml,scope,ATAN2,operands);
+      else if ( name == "lt"    ) rval = new BinaryOp(xml,scope,LT,operands);
+      else if ( name == "le"    ) rval = new BinaryOp(xml,scope,LE,operands);
+      else if ( name == "gt"    ) rval = new BinaryOp(xml,scope,GT,operands);
+      else if ( name == "ge"    ) rval = new BinaryOp(xml,scope,GE,operands);
+      else if ( name == "eq"    ) rval = new BinaryOp(xml,scope,EQ,operands);
+      else if ( name == "ne"    ) rval = new BinaryOp(xml,scope,NE,operands);
+
+      return rval;
+    }
+
+    Type_t opType(void) const { return type_; }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const
+    {
+      const Number_t &v1 = operands[0];
+      const Number_t &v2 = operands[1];
+
+      bool isInteger = v1.isInteger() && v2.isInteger();
+
+      Number_t rval;
+      switch(type_)
+      {
+        case SUB:
+          if(isInteger) rval = Number_t( wrap_sub( long(v1), long(v2) ) );
+          else          rval = Number_t( double(v1) - double(v2) );
+          break;
+
+        case DIV:
+          if(isInteger) rval = Number_t( quotient( long(v1), long(v2) ) );
+          else          rval = Number_t( double(v1) / double(v2) );
+          break;
+
+        case MOD:
+          if(isInteger) rval = Number_t( remainder( long(v1), long(v2) ) );
+          else          rval = Number_t( std::fmod(double(v1),double(v2)) );
+          break;
+
+        case POW:
+          rval = Number_t( pow( double(v1), double(v2) ) );
+          break;
+
+        case ATAN2:
+          rval = Number_t( atan2( double(v1), double(v2)) );
+          break;
+
+        case LT: rval = Number_t( long( isInteger ? long(v1) <  long(v2) : double(v1) <  double(v2) ) ); break;
+        case LE: rval = Number_t( long( isInteger ? long(v1) <= long(v2) : double(v1) <= double(v2) ) ); break;
+        case GT: rval = Number_t( long( isInteger ? long(v1) >  long(v2) : double(v1) >  double(v2) ) ); break;
+        case GE: rval = Number_t( long( isInteger ? long(v1) >= long(v2) : double(v1) >= double(v2) ) ); break;
+        case EQ: rval = Number_t( long( isInteger ? long(v1) == long(v2) : double(v1) == double(v2) ) ); break;
+        case NE: rval = Number_t( long( isInteger ? long(v1) != long(v2) : double(v1) != double(v2) ) ); break;
+      }
+      return rval;
+    }
+
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<double>(batch,operands,out);
+    }
+
+    void evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<float>(batch,operands,out);
+    }
+
+    template<class Real_t>
+    void evalLanes(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      size_t n = batch.size();
+
+      Block_t &a = *operands[0];
+      Block_t &b = *operands[1];
+
+      bool isInteger = operands_[0]->type() == Number_t::Integer && operands_[1]->type() == Number_t::Integer;
+
+      if(isInteger)
+      {
+        const long *v1 = a.i;
+        const long *v2 = b.i;
+        long       *r  = out.i;
+        switch(type_)
+        {
+          case SUB: for(size_t k=0; k<n; ++k) r[k] = wrap_sub(v1[k],v2[k]); return;
+
+          case DIV: 
+            if(hasDivisor_) divisor_.quotients(v1,r,n);
+            else            for(size_t k=0; k<n; ++k) r[k] = quotient(v1[k],v2[k]);
+            return;
+
+          case MOD: 
+            if(hasDivisor_) divisor_.remainders(v1,r,n);
+            else            for(size_t k=0; k<n; ++k) r[k] = remainder(v1[k],v2[k]);
+            return;
+
+          case LT:  for(size_t k=0; k<n; ++k) r[k] = v1[k] <  v2[k]; return;
+          case LE:  for(size_t k=0; k<n; ++k) r[k] = v1[k] <= v2[k]; return;
+          case GT:  for(size_t k=0; k<n; ++k) r[k] = v1[k] >  v2[k]; return;
+          case GE:  for(size_t k=0; k<n; ++k) r[k] = v1[k] >= v2[k]; return;
+          case EQ:  for(size_t k=0; k<n; ++k) r[k] = v1[k] == v2[k]; return;
+          case NE:  for(size_t k=0; k<n; ++k) r[k] = v1[k] != v2[k]; return;
+          default:  break;
+        }
+      }
+
+      as_real<Real_t>(operands_[0],a,n);
+      as_real<Real_t>(operands_[1],b,n);
+
+      const Real_t *v1 = Lanes<Real_t>::of(a);
+      const Real_t *v2 = Lanes<Real_t>::of(b);
+      Real_t       *r  = Lanes<Real_t>::of(out);
+      long         *c  = out.i;
+      switch(type_)
+      {
+        case SUB:   for(size_t k=0; k<n; ++k) r[k] = v1[k] - v2[k];          break;
+        case DIV:   for(size_t k=0; k<n; ++k) r[k] = v1[k] / v2[k];          break;
+        case MOD:   for(size_t k=0; k<n; ++k) r[k] = std::fmod(v1[k],v2[k]); break;
+        case POW:   for(size_t k=0; k<n; ++k) r[k] = pow(v1[k],v2[k]);       break;
+        case ATAN2: for(size_t k=0; k<n; ++k) r[k] = atan2(v1[k],v2[k]);     break;
+        case LT:    for(size_t k=0; k<n; ++k) c[k] = v1[k] <  v2[k];         break;
+        case LE:    for(size_t k=0; k<n; ++k) c[k] = v1[k] <= v2[k];         break;
+        case GT:    for(size_t k=0; k<n; ++k) c[k] = v1[k] >  v2[k];         break;
+        case GE:    for(size_t k=0; k<n; ++k) c[k] = v1[k] >= v2[k];         break;
+        case EQ:    for(size_t k=0; k<n; ++k) c[k] = v1[k] == v2[k];         break;
+        case NE:    for(size_t k=0; k<n; ++k) c[k] = v1[k] != v2[k];         break;
+      }
+    }
+
+    unsigned char evalStatus(const Number_t *operands, const unsigned char *status) const
+    {
+      unsigned char rval = status[0] | status[1];
+      if( isDivision() && operands[0].isInteger() && operands[1].isInteger() && long(operands[1]) == 0 )
+      {
+        rval |= XMLFunc::DivideByZero;
+      }
+      return rval;
+    }
+
+    void evalBlockStatus(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      size_t n = batch.size();
+
+      const Block_t &a = *operands[0];
+      const Block_t &b = *operands[1];
+
+      if( isDivision() && operands_[0]->type() == Number_t::Integer && operands_[1]->type() == Number_t::Integer )
+      {
+        for(size_t k=0; k<n; ++k) out.status[k] = a.status[k] | b.status[k] | ( b.i[k] == 0 ? XMLFunc::DivideByZero : 0 );
+      }
+      else
+      {
+        for(size_t k=0; k<n; ++k) out.status[k] = a.status[k] | b.status[k];
+      }
+    }
+
+    // Integer division (and modulus) by zero is 0.  Neither it nor the division
+    //   of the most negative value by -1 (which wraps around to itself) can be
+    //   done by the hardware, so the divisor is replaced by 1 in both cases. 
+    //   These are selected rather than branched on.
+    static long divisor(long a, long b)
+    {
+      bool bad = ( b == 0 ) | ( ( b == -1 ) & ( a == numeric_limits<long>::min() ) );
+      return bad ? 1L : b;
+    }
+
+    static long quotient(long a, long b)  { return ( a / divisor(a,b) ) & -long(b != 0); }
+    static long remainder(long a, long b) { return a % divisor(a,b); }
+
+  public:
+    size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory(); }
+
+    size_t hash(void) const { return hash_mix( hash_mix(0,type_), hasDivisor_ ? divisor_.divisor() : 0 ); }
+
+    bool equivalent(const XMLFunc::Operation &op) const
+    {
+      const BinaryOp &x = static_cast<const BinaryOp &>(op);
+      return x.type_ == type_ && x.hasDivisor_ == hasDivisor_ && ( !hasDivisor_ || x.divisor_.divisor() == divisor_.divisor() );
+    }
+
+  protected:
+
+    BinaryOp(const XMLNode *xml, const Scope &, Type_t, OpList_t &);
+
+    OpPtr_t copy(void) const { return new BinaryOp(*this); }
+
+    bool isDivision(void) const { return type_ == DIV || type_ == MOD; }
+
+    Type_t        type_;
+    bool          hasDivisor_;  // integer division by a constant (in batch evaluation)
+    ConstDivisor  divisor_;
+};
+
+class ListOp : public XMLFunc::Operation
+{
+  public:
+
+    typedef enum { ADD, MULT, MIN, MAX } Type_t;
+
+    static ListOp *build(const XMLNode *xml, const Scope &scope, OpList_t &operands)
+    {
+      ListOp *rval(NULL);
+
+      string name = xml->name();
+      if      ( name == "add"  ) rval = new ListOp(xml,scope,ADD,operands);
+      else if ( name == "mult" ) rval = new ListOp(xml,scope,MULT,operands);
+      else if ( name == "min"  ) rval = new ListOp(xml,scope,MIN,operands);
+      else if ( name == "max"  ) rval = new ListOp(xml,scope,MAX,operands);
+
+      return rval;
+    }
+
+    Type_t opType(void) const { return type_; }
+
+    // The same left fold, starting from operand 0, as foldBlock() so that a NaN
+    //   operand gives the same min or max in single row and batch evaluation
+    Number_t eval(const Args_t &args, const Number_t *operands) const
+    {
+      long   ival = long(operands[0]);
+      double dval = double(operands[0]);
+
+      bool isInteger = operands[0].isInteger();
+
+      for(size_t i=1; i<operands_.size(); ++i)
+      {
+        const Number_t &v = operands[i];
+
+        isInteger = isInteger && v.isInteger();
+
+        long   b = long(v);
+        double d = double(v);
+        switch(type_)
+        {
+          case ADD:   ival = wrap_add(ival,b);  dval += d;  break;
+          case MULT:  ival = wrap_mul(ival,b);  dval *= d;  break;
+          case MIN:   ival = ( b < ival ? b : ival );  dval = ( d < dval ? d : dval );  break;
+          case MAX:   ival = ( b > ival ? b : ival );  dval = ( d > dval ? d : dval );  break;
+        }
+      }
+
+      return ( isInteger ? Number_t(ival) : Number_t(dval) );
+    }
+
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<double>(batch,operands,out);
+    }
+
+    void evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<float>(batch,operands,out);
+    }
+
+    template<class Real_t>
+    void evalLanes(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      size_t n = batch.size();
+
+      Block_t &acc = *operands[0];
+
+      startBlock<Real_t>(0,acc,n);
+      for(size_t i=1; i<operands_.size(); ++i) foldBlock<Real_t>(i,acc,*operands[i],acc,n);
+
+      if( &acc != &out ) out = acc;
+    }
+
+    // In batch evaluation (see Program), a list op is evaluated as a left fold
+    //   over its operands so that only two blocks of values are needed at a time.
+
+    // Prepares the values of operand i to be the first accumulated values
+    template<class Real_t>
+    void startBlock(size_t i, Block_t &v, size_t n) const
+    {
+      if( valueType_ == Number_t::Double ) as_real<Real_t>(operands_[i],v,n);
+    }
+
+    // Combines the accumulated values (acc) with the values of operand i (v).
+    //   The out block may be either of the other two blocks.
+    template<class Real_t>
+    void foldBlock(size_t i, const Block_t &acc, Block_t &v, Block_t &out, size_t n) const
+    {
+      if( valueType_ == Number_t::Integer )
+      {
+        const long *a = acc.i;
+        const long *b = v.i;
+        long       *r = out.i;
+        switch(type_)
+        {
+          case ADD:  for(size_t k=0; k<n; ++k) r[k] = wrap_add(a[k],b[k]);          break;
+          case MULT: for(size_t k=0; k<n; ++k) r[k] = wrap_mul(a[k],b[k]);          break;
+          case MIN:  for(size_t k=0; k<n; ++k) r[k] = ( b[k] < a[k] ? b[k] : a[k] ); break;
+          case MAX:  for(size_t k=0; k<n; ++k) r[k] = ( b[k] > a[k] ? b[k] : a[k] ); break;
+        }
+      }
+      else
+      {
+        as_real<Real_t>(operands_[i],v,n);
+
+        const Real_t *a = Lanes<Real_t>::of(acc);
+        const Real_t *b = Lanes<Real_t>::of(v);
+        Real_t       *r = Lanes<Real_t>::of(out);
+        switch(type_)
+        {
+          case ADD:  for(size_t k=0; k<n; ++k) r[k] = a[k] + b[k];                  break;
+          case MULT: for(size_t k=0; k<n; ++k) r[k] = a[k] * b[k];                  break;
+          case MIN:  for(size_t k=0; k<n; ++k) r[k] = ( b[k] < a[k] ? b[k] : a[k] ); break;
+          case MAX:  for(size_t k=0; k<n; ++k) r[k] = ( b[k] > a[k] ? b[k] : a[k] ); break;
+        }
+      }
+    }
+
+  public:
+    size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory(); }
+
+    size_t hash(void) const { return hash_mix(0,type_); }
+
+    bool equivalent(const XMLFunc::Operation &op) const { return static_cast<const ListOp &>(op).type_ == type_; }
+
+  protected:
+
+    ListOp(const XMLNode *xml, const Scope &, Type_t, OpList_t &);
+
+    OpPtr_t copy(void) const { return new ListOp(*this); }
+
+    Type_t   type_;
+};
+
+class TernaryOp : public XMLFunc::Operation
+{
+  public:
+
+    // IF     returns arg2 if arg1 is non-zero, otherwise arg3 (only the chosen value is evaluated)
+    // SELECT same as IF, but always evaluates both candidate values
+    // CLAMP  limits arg1 to the range arg2 to arg3
+    typedef enum { IF, SELECT, CLAMP } Type_t;
+
+    static TernaryOp *build(const XMLNode *xml, const Scope &scope, OpList_t &operands)
+    {
+      TernaryOp *rval(NULL);
+
+      string name = xml->name();
+      if      ( name == "if"     ) rval = new TernaryOp(xml,scope,IF,operands);
+      else if ( name == "select" ) rval = new TernaryOp(xml,scope,SELECT,operands);
+      else if ( name == "clamp"  ) rval = new TernaryOp(xml,scope,CLAMP,operands);
+
+      return rval;
+    }
+
+    // Single row evaluation of an IF only evaluates the operand chosen by the
+    //   first operand (see Program).  This op is then never evaluated itself.
+    bool isLazy(void) const { return type_ == IF; }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const
+    {
+      Number_t rval;
+      switch(type_)
+      {
+        case IF:
+        case SELECT:
+          rval = operands[ is_true(operands[0]) ? 1 : 2 ];
+          break;
+
+        case CLAMP:
+          {
+            // compared as in evalLanes(), so a NaN value is NaN in both
+            const Number_t &v  = operands[0];
+            const Number_t &lo = operands[1];
+            const Number_t &hi = operands[2];
+            if( v.isInteger() && lo.isInteger() && hi.isInteger() )
+            {
+              long x = ( long(v) > long(hi) ? long(hi) : long(v) );
+              rval = Number_t( x < long(lo) ? long(lo) : x );
+            }
+            else
+            {
+              double x = ( double(v) > double(hi) ? double(hi) : double(v) );
+              rval = Number_t( x < double(lo) ? double(lo) : x );
+            }
+          }
+          break;
+      }
+      return rval;
+    }
+
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<double>(batch,operands,out);
+    }
+
+    void evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<float>(batch,operands,out);
+    }
+
+    // All three values are computed for the entire block and the result is
+    //   blended without branching on the values.
+    template<class Real_t>
+    void evalLanes(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      size_t n = batch.size();
+
+      bool isInteger = ( valueType_ == Number_t::Integer );
+
+      Block_t &a0 = *operands[0];
+      Block_t &a1 = *operands[1];
+      Block_t &a2 = *operands[2];
+
+      if( type_ == CLAMP )
+      {
+        if(isInteger)
+        {
+          const long *v  = a0.i;
+          const long *lo = a1.i;
+          const long *hi = a2.i;
+          long       *r  = out.i;
+          for(size_t k=0; k<n; ++k)
+          {
+            long x = ( v[k] > hi[k] ? hi[k] : v[k] );
+            r[k] = ( x < lo[k] ? lo[k] : x );
+          }
+        }
+        else
+        {
+          as_real<Real_t>(operands_[0],a0,n);
+          as_real<Real_t>(operands_[1],a1,n);
+          as_real<Real_t>(operands_[2],a2,n);
+
+          const Real_t *v  = Lanes<Real_t>::of(a0);
+          const Real_t *lo = Lanes<Real_t>::of(a1);
+          const Real_t *hi = Lanes<Real_t>::of(a2);
+          Real_t       *r  = Lanes<Real_t>::of(out);
+          for(size_t k=0; k<n; ++k)
+          {
+            Real_t x = ( v[k] > hi[k] ? hi[k] : v[k] );
+            r[k] = ( x < lo[k] ? lo[k] : x );
+          }
+        }
+        return;
+      }
+
+      if( operands_[0]->type() == Number_t::Double )
+      {
+        const Real_t *v = Lanes<Real_t>::of(a0);
+        for(size_t k=0; k<n; ++k) a0.i[k] = ( v[k] != 0 );
+      }
+
+      const long *c = a0.i;
+      if(isInteger)
+      {
+        for(size_t k=0; k<n; ++k) out.i[k] = ( c[k] ? a1.i[k] : a2.i[k] );
+      }
+      else
+      {
+        as_real<Real_t>(operands_[1],a1,n);
+        as_real<Real_t>(operands_[2],a2,n);
+
+        const Real_t *v1 = Lanes<Real_t>::of(a1);
+        const Real_t *v2 = Lanes<Real_t>::of(a2);
+        Real_t       *r  = Lanes<Real_t>::of(out);
+        for(size_t k=0; k<n; ++k) r[k] = ( c[k] ? v1[k] : v2[k] );
+      }
+    }
+
+    // The status of an IF or SELECT is that of its condition and the value chosen
+    unsigned char evalStatus(const Number_t *operands, const unsigned char *status) const
+    {
+      if( type_ == CLAMP ) return status[0] | status[1] | status[2];
+      return status[0] | status[ is_true(operands[0]) ? 1 : 2 ];
+    }
+
+    void evalBlockStatus(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      if( type_ == CLAMP ) 
+      {
+        Operation::evalBlockStatus(batch,operands,out);
+        return;
+      }
+
+      size_t n = batch.size();
+
+      const Block_t &a0 = *operands[0];
+      const Block_t &a1 = *operands[1];
+      const Block_t &a2 = *operands[2];
+
+      if( operands_[0]->type() == Number_t::Double && batch.single() )
+      {
+        for(size_t k=0; k<n; ++k) out.status[k] = a0.status[k] | ( a0.f[k] != 0.f ? a1.status[k] : a2.status[k] );
+      }
+      else if( operands_[0]->type() == Number_t::Double )
+      {
+        for(size_t k=0; k<n; ++k) out.status[k] = a0.status[k] | ( a0.d[k] != 0. ? a1.status[k] : a2.status[k] );
+      }
+      else
+      {
+        for(size_t k=0; k<n; ++k) out.status[k] = a0.status[k] | ( a0.i[k] != 0  ? a1.status[k] : a2.status[k] );
+      }
+    }
+
+    static bool is_true(const Number_t &v) { return v.isInteger() ? long(v) != 0 : double(v) != 0.; }
+
+  public:
+    size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory(); }
+
+    size_t hash(void) const { return hash_mix(0,type_); }
+
+    bool equivalent(const XMLFunc::Operation &op) const { return static_cast<const TernaryOp &>(op).type_ == type_; }
+
+  protected:
+
+    TernaryOp(const XMLNode *xml, const Scope &, Type_t, OpList_t &);
+
+    OpPtr_t copy(void) const { return new TernaryOp(*this); }
+
+    Type_t  type_;
+};
+
+
+class LogOp : public UnaryOp
+{
+  public:
+
+    static LogOp *build(const XMLNode *xml, const Scope &scope, OpList_t &operands)
+    {
+      LogOp *rval(NULL);
+      if( xml->name() == "log" ) rval = new LogOp(xml,scope,operands);
+      return rval;
+    }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const
+    {
+      return Number_t( fac_ * log( double(operands[0]) ) );
+    }
+
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<double>(batch,operands,out);
+    }
+
+    void evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<float>(batch,operands,out);
+    }
+
+    template<class Real_t>
+    void evalLanes(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      size_t n = batch.size();
+
+      Block_t &a = *operands[0];
+      as_real<Real_t>(operands_[0],a,n);
+
+      const Real_t *v   = Lanes<Real_t>::of(a);
+      Real_t       *r   = Lanes<Real_t>::of(out);
+      Real_t        fac = Real_t(fac_);
+      for(size_t k=0; k<n; ++k) r[k] = fac * log(v[k]);
+    }
+
+  public:
+    size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory(); }
+
+    size_t hash(void) const { return hash_doubles(0,&fac_,1); }
+
+    bool equivalent(const XMLFunc::Operation &op) const { return same_doubles(&static_cast<const LogOp &>(op).fac_,&fac_,1); }
+
+  protected:
+
+    OpPtr_t copy(void) const { return new LogOp(*this); }
+
+  private:
+
+    LogOp(const XMLNode *xml, const Scope &, OpList_t &);
+
+    double fac_;
+};
+
+// Interpolates a table of points (x,y) at the value of its operand (see the 
+//   <table> element).  The table is kept as a cubic on each interval between 
+//   adjacent x values, y = a + t * (b + t * (c + t * d)) with t the distance
+//   from the start of the interval, so that step, linear and cubic tables are
+//   evaluated alike.  The interval is found by a branchless binary search of the
+//   x values, which are kept in Eytzinger (breadth first) order so that the
+//   first levels of every search share a few cache lines.  The cubics are kept
+//   in the same order, so the search leads directly to the one to evaluate.
+class TableOp : public UnaryOp
+{
+  public:
+
+    typedef enum { STEP, LINEAR, CUBIC } Interp_t;
+
+    static TableOp *build(const XMLNode *xml, const Scope &scope, OpList_t &operands)
+    {
+      TableOp *rval(NULL);
+      if( xml->name() == "table" ) rval = new TableOp(xml,scope,operands);
+      return rval;
+    }
+
+    size_t numPoints(void) const { return tree_.size() - 1; }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const
+    {
+      return Number_t( interpolate( double(operands[0]) ) );
+    }
+
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<double>(batch,operands,out);
+    }
+
+    void evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<float>(batch,operands,out);
+    }
+
+    template<class Real_t>
+    void evalLanes(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      size_t n = batch.size();
+
+      Block_t &a = *operands[0];
+      as_real<Real_t>(operands_[0],a,n);
+
+      const Real_t *v = Lanes<Real_t>::of(a);
+      Real_t       *r = Lanes<Real_t>::of(out);
+      for(size_t k=0; k<n; ++k) r[k] = Real_t( interpolate( double(v[k]) ) );
+    }
+
+  public:
+    size_t memoryUsage(void) const 
+    {
+      return sizeof(*this) + operandsMemory() + tree_.capacity() * sizeof(double)
+        + segments_.capacity() * sizeof(double);
+    }
+
+    // (the x values and the segments determine xmin and xmax)
+    size_t hash(void) const
+    {
+      return hash_doubles( hash_doubles( hash_mix(0,interp_), &tree_[0], tree_.size() ), &segments_[0], segments_.size() );
+    }
+
+    bool equivalent(const XMLFunc::Operation &op) const
+    {
+      const TableOp &x = static_cast<const TableOp &>(op);
+      return x.interp_ == interp_ && x.tree_.size() == tree_.size() && x.segments_.size() == segments_.size()
+        && same_doubles(&x.tree_[0],&tree_[0],tree_.size()) && same_doubles(&x.segments_[0],&segments_[0],segments_.size());
+    }
+
+  protected:
+
+    OpPtr_t copy(void) const { return new TableOp(*this); }
+
+  private:
+
+    TableOp(const XMLNode *xml, const Scope &, OpList_t &);
+
+    // Fills the tree (from node k down) with the sorted x values from i, and the
+    //   segments below them, returning the index of the next x value
+    size_t fill(const vector<double> &x, const vector<double> &y, const vector<double> &m, size_t i, size_t k);
+
+    // Sets the segment of node k to the one for x values from x[j-1] to x[j]
+    void   setSegment(size_t k, size_t j, const vector<double> &x, const vector<double> &y, const vector<double> &m);
+
+    // The tree node holding the first x value greater than x (0 if there is none)
+    size_t node(double x) const
+    {
+      const double *tree = &tree_[0];
+      size_t        end  = tree_.size();
+
+      // Trees larger than the L1 cache prefetch the line holding the node's
+      //   descendants 3 levels down
+      size_t k = 1;
+#ifdef __GNUC__
+      if( end > 4096 )
+      {
+        while( k < end )
+        {
+          __builtin_prefetch( tree + 8 * k );
+          k = 2 * k + ( tree[k] <= x );
+        }
+      }
+#endif
+      while( k < end ) k = 2 * k + ( tree[k] <= x );
+
+      // k went right (+1) after passing its last node greater than x, then left 
+      //   every time since: dropping those steps leaves that node (or 0 if none)
+#ifdef __GNUC__
+      k >>= __builtin_ffsl( ~long(k) );
+#else
+      while( k & 1 ) k >>= 1;
+      k >>= 1;
+#endif
+      return k;
+    }
+
+    double interpolate(double x) const
+    {
+      // outside the table, the nearest end value (NaN is kept)
+      if( x < xmin_ ) x = xmin_;
+      if( x > xmax_ ) x = xmax_;
+
+      const double *s = &segments_[ 5 * node(x) ];
+      double t = x - s[0];
+      return s[1] + t * ( s[2] + t * ( s[3] + t * s[4] ) );
+    }
+
+    Interp_t          interp_;
+    double            xmin_;
+    double            xmax_;
+    vector<double>    tree_;      // x values in Eytzinger order (from 1)
+
+    // The segment of node k, for x values from x[j-1] to x[j] (the value at the 
+    //   node), is { x[j-1], a, b, c, d }.  Node 0's is the constant y[n-1], for
+    //   x values from x[n-1].  The constant y[0] is kept for x values below x[0],
+    //   which are only NaN (as the others are clamped).
+    vector<double>    segments_;
+};
+
+// Reduces array arguments (see XMLFunc::Number::Array) to a double value: the
+//   <dot> product of two arrays, the <sum> of an array's values, and its 
+//   (Euclidean) <norm>.  A map (e.g. exp) may be applied to each value of the
+//   last array first.  The arrays are read directly from the arguments (or the
+//   batch columns), so the op has no operands once it is built.  Arrays whose
+//   lengths differ have a NaN dot product.
+class ArrayOp : public XMLFunc::Operation
+{
+  public:
+
+    typedef enum { DOT, SUM, NORM } Type_t;
+    typedef enum { NONE, ABS, SQUARE, SQRT, EXP, LN, SIN, COS, TAN, ASIN, ACOS, ATAN } Map_t;
+
+    static ArrayOp *build(const XMLNode *xml, const Scope &scope, OpList_t &operands)
+    {
+      ArrayOp *rval(NULL);
+
+      string name = xml->name();
+      if      ( name == "dot"  ) rval = new ArrayOp(xml,scope,DOT,operands);
+      else if ( name == "sum"  ) rval = new ArrayOp(xml,scope,SUM,operands);
+      else if ( name == "norm" ) rval = new ArrayOp(xml,scope,NORM,operands);
+
+      return rval;
+    }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const
+    {
+      const Number_t &a = args[ index_[0] ];
+      const Number_t &b = args[ index_.back() ];
+      return Number_t( reduce( a.array(), a.length(), b.array(), b.length() ) );
+    }
+
+    // Each row's array is a stride past that of the previous row (by default, 
+    //   immediately after it) in the array columns
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      const XMLFunc::Column &a = batch.args()[ index_[0] ];
+      const XMLFunc::Column &b = batch.args()[ index_.back() ];
+
+      size_t n  = batch.size();
+      size_t r  = batch.offset();
+      size_t na = a.length();
+      size_t nb = b.length();
+
+      for(size_t k=0; k<n; ++k) out.d[k] = reduce( a.array(r+k), na, b.array(r+k), nb );
+    }
+
+  public:
+    size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory() + index_.capacity() * sizeof(size_t); }
+
+    size_t hash(void) const
+    {
+      size_t h = hash_mix( hash_mix(0,type_), map_ );
+      for(size_t i=0; i<index_.size(); ++i) h = hash_mix(h,index_[i]);
+      return h;
+    }
+
+    bool equivalent(const XMLFunc::Operation &op) const
+    {
+      const ArrayOp &x = static_cast<const ArrayOp &>(op);
+      return x.type_ == type_ && x.map_ == map_ && x.index_ == index_;
+    }
+
+  protected:
+
+    OpPtr_t copy(void) const { return new ArrayOp(*this); }
+
+  private:
+
+    ArrayOp(const XMLNode *xml, const Scope &, Type_t, OpList_t &);
+
+    // The value for arrays a and b (which are the same array unless a <dot>)
+    double reduce(const double *a, size_t na, const double *b, size_t nb) const
+    {
+      if( na != nb ) return numeric_limits<double>::quiet_NaN();
+
+      double lanes[ArrayLanes] = {0.};
+      switch(type_)
+      {
+        case DOT:  sum_mapped(a,b,nb,lanes);    return lane_total(lanes);
+        case SUM:  sum_mapped(NULL,b,nb,lanes); return lane_total(lanes);
+        case NORM: add_lanes(a,a,na,lanes);     return sqrt( lane_total(lanes) );
+      }
+      return 0.;
+    }
+
+    // Adds a[i]*f(b[i]) (or f(b[i]) if a is NULL) to the lanes, mapping a block
+    //   of b's values at a time
+    void sum_mapped(const double *a, const double *b, size_t n, double *lanes) const
+    {
+      if( map_ == NONE )
+      {
+        if( a == NULL ) add_lanes(b,NULL,n,lanes);
+        else            add_lanes(a,b,n,lanes);
+        return;
+      }
+
+      double v[XMLFunc::BlockSize];
+      for(size_t i=0; i<n; i+=XMLFunc::BlockSize)
+      {
+        size_t m = min(n-i,XMLFunc::BlockSize);
+        switch(map_)
+        {
+          case NONE:   break;
+          case ABS:    for(size_t k=0; k<m; ++k) v[k] = fabs(b[i+k]);        break;
+          case SQUARE: for(size_t k=0; k<m; ++k) v[k] = b[i+k] * b[i+k];     break;
+          case SQRT:   for(size_t k=0; k<m; ++k) v[k] = sqrt(b[i+k]);        break;
+          case EXP:    for(size_t k=0; k<m; ++k) v[k] = exp(b[i+k]);         break;
+          case LN:     for(size_t k=0; k<m; ++k) v[k] = log(b[i+k]);         break;
+          case SIN:    for(size_t k=0; k<m; ++k) v[k] = sin(b[i+k]);         break;
+          case COS:    for(size_t k=0; k<m; ++k) v[k] = cos(b[i+k]);         break;
+          case TAN:    for(size_t k=0; k<m; ++k) v[k] = tan(b[i+k]);         break;
+          case ASIN:   for(size_t k=0; k<m; ++k) v[k] = asin(b[i+k]);        break;
+          case ACOS:   for(size_t k=0; k<m; ++k) v[k] = acos(b[i+k]);        break;
+          case ATAN:   for(size_t k=0; k<m; ++k) v[k] = atan(b[i+k]);        break;
+        }
+        if( a == NULL ) add_lanes(v,NULL,m,lanes);
+        else            add_lanes(a+i,v,m,lanes);
+      }
+    }
+
+    Type_t         type_;
+    Map_t          map_;
+    vector<size_t> index_;   // of the array arguments
+};
+
+// A polynomial in one (double) value, its operand, evaluated by Horner's rule.
+//   These replace subtrees of add, mult, pow, etc. (see fold_polynomials).  If
+//   the replaced subtree would have had an integer value for an integer operand
+//   value (i.e. all its constants were integers and it had no pow or div), the
+//   integer coefficients are kept to compute the same (integer) value.
+class PolyOp : public XMLFunc::Operation
+{
+  public:
+
+    // coefficients[j] is the coefficient of x^j
+    PolyOp(OpPtr_t x, const vector<double> &coefficients, const vector<long> &integers)
+      : coefficients_(coefficients), floats_(coefficients.begin(),coefficients.end()), integers_(integers)
+    {
+      operands_.push_back(x);
+      valueType_ = Number_t::Double;
+    }
+
+    size_t degree(void) const { return coefficients_.size() - 1; }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const
+    {
+      const Number_t &x = operands[0];
+
+      size_t m = coefficients_.size() - 1;
+
+      if( x.isInteger() && integers_.empty() == false )
+      {
+        // unsigned so that overflow wraps around (as it does in practice for long)
+        unsigned long v = (unsigned long)long(x);
+        unsigned long r = (unsigned long)integers_[m];
+        for(size_t j=m; j>0; --j) r = r * v + (unsigned long)integers_[j-1];
+        return Number_t( long(r) );
+      }
+
+      double v = double(x);
+      double r = coefficients_[m];
+      for(size_t j=m; j>0; --j) r = fmadd(r, v, coefficients_[j-1]);
+      return Number_t(r);
+    }
+
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<double>(batch,operands,out,&coefficients_[0]);
+    }
+
+    void evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      evalLanes<float>(batch,operands,out,&floats_[0]);
+    }
+
+    template<class Real_t>
+    void evalLanes(const Batch_t &batch, Block_t *const *operands, Block_t &out, const Real_t *c) const
+    {
+      size_t n = batch.size();
+
+      Block_t &a = *operands[0];
+      as_real<Real_t>(operands_[0],a,n);
+
+      size_t m = coefficients_.size() - 1;
+
+      const Real_t *v = Lanes<Real_t>::of(a);
+      Real_t       *r = Lanes<Real_t>::of(out);
+      for(size_t k=0; k<n; ++k)
+      {
+        Real_t x = v[k];
+        Real_t y = c[m];
+        for(size_t j=m; j>0; --j) y = fmadd(y, x, c[j-1]);
+        r[k] = y;
+      }
+    }
+
+  public:
+    size_t memoryUsage(void) const 
+    {
+      return sizeof(*this) + operandsMemory() + coefficients_.capacity() * sizeof(double) 
+        + floats_.capacity() * sizeof(float) + integers_.capacity() * sizeof(long);
+    }
+
+    // (the floats are the coefficients rounded)
+    size_t hash(void) const
+    {
+      size_t h = hash_doubles(0,&coefficients_[0],coefficients_.size());
+      for(size_t j=0; j<integers_.size(); ++j) h = hash_mix(h,(unsigned long)integers_[j]);
+      return h;
+    }
+
+    bool equivalent(const XMLFunc::Operation &op) const
+    {
+      const PolyOp &x = static_cast<const PolyOp &>(op);
+      return x.coefficients_.size() == coefficients_.size() && x.integers_ == integers_
+        && same_doubles(&x.coefficients_[0],&coefficients_[0],coefficients_.size());
+    }
+
+  protected:
+
+    OpPtr_t copy(void) const { return new PolyOp(*this); }
+
+  private:
+
+    // a*b + c with a single rounding.  The builtin is a single instruction 
+    //   where the target has one (e.g. -mfma), otherwise a call to fma().
+    static double fmadd(double a, double b, double c)
+    {
+#ifdef __GNUC__
+      return __builtin_fma(a,b,c);
+#else
+      return fma(a,b,c);
+#endif
+    }
+
+    static float fmadd(float a, float b, float c)
+    {
+#ifdef __GNUC__
+      return __builtin_fmaf(a,b,c);
+#else
+      return fmaf(a,b,c);
+#endif
+    }
+
+    vector<double> coefficients_;
+    vector<float>  floats_;       // (coefficients rounded to float, see SinglePrecision)
+    vector<long>   integers_;     // (empty unless the subtree had an integer value)
+};
+
+// The body of a function whose calls are evaluated out of line (see CallOp),
+//   built once in its own scope and shared by every call to it
+struct CallTarget
+{
+  CallTarget(OpPtr_t r) : root(r), program(NULL), refs(0)
+  {
+    try
+    {
+      program = new XMLFunc::Program(root);
+    }
+    catch(...)
+    {
+      delete root;
+      throw;
+    }
+  }
+
+  ~CallTarget() { delete program; delete root; }
+
+  void hold(void)    { __sync_add_and_fetch(&refs,1u); }
+  void release(void) { if( __sync_sub_and_fetch(&refs,1u) == 0 ) delete this; }
+
+  OpPtr_t            root;
+  XMLFunc::Program  *program;
+  unsigned           refs;
+};
+
+// A <call> which is evaluated rather than inlined (see Linker::expand).  The 
+//   operands are the actual arguments, which are passed as the arguments of 
+//   the called function's body.  Array actuals are arguments of the calling 
+//   function: in batch, their columns are passed on (their blocks are unused).
+class CallOp : public XMLFunc::Operation
+{
+  public:
+
+    // Takes the actuals
+    CallOp(CallTarget *target, OpList_t &actuals) : target_(target)
+    {
+      target_->hold();
+      valueType_ = target_->root->type();
+      operands_.swap(actuals);
+    }
+
+    ~CallOp() { target_->release(); }
+
+    Number_t eval(const Args_t &args, const Number_t *operands) const
+    {
+      Args_t values;
+      values.assign(operands, operands + operands_.size());
+      return target_->program->eval(values);
+    }
+
+    // The called function is evaluated again for its status
+    unsigned char evalStatus(const Number_t *operands, const unsigned char *status) const
+    {
+      Args_t values;
+      values.assign(operands, operands + operands_.size());
+
+      unsigned rval;
+      target_->program->eval(values,rval);
+      return (unsigned char)( rval | XMLFunc::Operation::evalStatus(operands,status) );
+    }
+
+    void evalBlock(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      BatchArgs_t columns;
+      bind(batch,operands,columns);
+
+      vector<Block_t> stack;
+      const Block_t &value = target_->program->evalBlock( Batch_t(columns,0,batch.size()), stack );
+
+      size_t n = batch.size();
+      if( valueType_ == Number_t::Integer ) for(size_t k=0; k<n; ++k) out.i[k] = value.i[k];
+      else                                  for(size_t k=0; k<n; ++k) out.d[k] = value.d[k];
+    }
+
+    void evalBlockStatus(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+    {
+      BatchArgs_t columns;
+      bind(batch,operands,columns);
+
+      vector<Block_t> stack;
+      const Block_t &value = target_->program->evalBlock( Batch_t(columns,0,batch.size()), stack, true );
+
+      size_t n = batch.size();
+      size_t m = operands_.size();
+      for(size_t k=0; k<n; ++k)
+      {
+        unsigned char s = value.status[k];
+        for(size_t i=0; i<m; ++i) s |= operands[i]->status[k];
+        out.status[k] = s;
+      }
+    }
+
+  public:
+    size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory(); }
+
+  protected:
+
+    CallOp(const CallOp &x) : XMLFunc::Operation(x), target_(x.target_) { target_->hold(); }
+
+    OpPtr_t copy(void) const { return new CallOp(*this); }
+
+  private:
+
+    // The columns of the called function's arguments for the rows of the batch
+    void bind(const Batch_t &batch, Block_t *const *operands, BatchArgs_t &columns) const
+    {
+      for(size_t i=0; i<operands_.size(); ++i)
+      {
+        const XMLFunc::Operation *op = operands_[i];
+
+        if( op->type() == Number_t::Array )
+        {
+          const XMLFunc::Column &col = batch.args().at( static_cast<const ArgOp *>(op)->argIndex() );
+          columns.add( col.array(batch.offset()), col.length(), XMLFunc::Stride(col.stride()) );
+        }
+        else if( op->type() == Number_t::Integer ) columns.add( operands[i]->i );
+        else                                       columns.add( operands[i]->d );
+      }
+    }
+
+    CallTarget *target_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Scope and Linker methods
+////////////////////////////////////////////////////////////////////////////////
+
+// Scope methods
+
+OpPtr_t Scope::arg(size_t index) const
+{
+  if( actuals_ == NULL ) return new ArgOp(index,argDefs_.type(int(index)));
+
+  // the size of each actual is counted when it is first referenced
+  if( sizes_.empty() ) sizes_.resize(actuals_->size(),0);
+  if( sizes_.at(index) == 0 ) sizes_[index] = count_ops( actuals_->at(index) );
+
+  linker_.grow( sizes_[index] );
+  return actuals_->at(index)->clone();
+}
+
+// Linker methods
+
+Linker::~Linker()
+{
+  forget();
+  for(map<size_t,CallTarget *>::iterator t=targets_.begin(); t!=targets_.end(); ++t) t->second->release();
+}
+
+string Linker::name(size_t index) const
+{
+  const string &rval = index_.name(index);
+  return rval.empty() ? "<func>" : rval;
+}
+
+// The chain of active functions is cleared if the build fails, so that the
+//   linker may be used to build other functions (see XMLFunc::Lazy).
+OpPtr_t Linker::build(size_t index)
+{
+  OpPtr_t rval = NULL;
+  try
+  {
+    rval = expand(index);
+  }
+  catch(...)
+  {
+    active_.clear();
+    forget();
+    throw;
+  }
+
+  forget();
+  return rval;
+}
+
+// Builds the body of the function with its calls inlined.  If that would build
+//   more than MaxOps ops, the function is oversized: it is built again with each
+//   of its calls evaluated out of line (see CallOp), and calls to it from other
+//   functions are also evaluated out of line.  A function which calls another 
+//   twice, which calls another twice, and so on, then does not double in size 
+//   at each level.
+OpPtr_t Linker::expand(size_t index)
+{
+  size_t depth = active_.size();
+
+  calls_ = ( oversized_.count(index) > 0 );
+  if( calls_ == false )
+  {
+    try
+    {
+      push(index);
+      OpPtr_t rval = build_op( body(index), Scope(argDefs(index),*this) );
+      leave();
+      return rval;
+    }
+    catch( Oversized & )
+    {
+      active_.resize(depth);
+      forget();
+      oversized_.insert(index);
+    }
+    calls_ = true;
+  }
+
+  push(index);
+  OpPtr_t rval = build_op( body(index), Scope(argDefs(index),*this) );
+  leave();
+  return rval;
+}
+
+// The body of a function called out of line is built (once) in its own scope.
+//   The state of the function being built is set aside meanwhile, but the chain
+//   of active functions is kept so that recursive calls are still detected.
+CallTarget *Linker::target(size_t index)
+{
+  map<size_t,CallTarget *>::iterator t = targets_.find(index);
+  if( t != targets_.end() ) return t->second;
+
+  InlinedTable_t inlined;
+  inlined.swap(inlined_);
+
+  size_t ops      = ops_;
+  bool   inlining = inlining_;
+  bool   calls    = calls_;
+
+  ops_      = 0;
+  inlining_ = false;
+
+  OpPtr_t root = NULL;
+  try
+  {
+    root = expand(index);
+  }
+  catch(...)
+  {
+    forget();
+    inlined_.swap(inlined);
+    ops_      = ops;
+    inlining_ = inlining;
+    calls_    = calls;
+    throw;
+  }
+
+  forget();
+  inlined_.swap(inlined);
+  ops_      = ops;
+  inlining_ = inlining;
+  calls_    = calls;
+
+  CallTarget *rval = new CallTarget(root);
+  rval->hold();
+  targets_[index] = rval;
+  return rval;
+}
+
+const XMLNode *Linker::body(size_t index)
+{
+  Linker &table = *table_;
+  if( table.bodies_.at(index) == NULL )
+  {
+    size_t pos = table.offsets_[index];
+    table.parsed_.push_back(NULL);
+    table.parsed_.back() = XMLNode::parse(xml_,pos);
+    table.bodies_[index] = table.parsed_.back();
+  }
+  return table.bodies_[index];
+}
+
+// Validates the arguments passed to the called function.  The body of the
+//   called function is then built using these in place of its arguments.
+const XMLNode *Linker::enter(const XMLNode *xml, OpList_t &actuals, Scope *&callee, OpPtr_t &copy)
+{
+  string name = xml->attributeValue("func");
+  if( name.empty() ) INVALID_XML("<call> must have a func attribute");
+
+  pair<size_t,bool> found = index_.find(name);
+  if( found.second == false ) INVALID_XML("<call> references unknown function (" << name << ")");
+
+  size_t index = found.first;
+
+  const ArgDefs_t &argDefs = this->argDefs(index);
+
+  size_t numArgs = actuals.size();
+  if( numArgs != size_t(argDefs.count()) )
+    INVALID_XML("<call> to " << name << " passes " << numArgs << " arguments, requires " << argDefs.count());
+
+  for(size_t i=0; i<numArgs; ++i)
+  {
+    if( argDefs.type(int(i)) == Number_t::Integer && actuals[i]->type() == Number_t::Double )
+      INVALID_XML("<call> to " << name << " passes a double value for integer argument " << i);
+    if( argDefs.type(int(i)) == Number_t::Array && actuals[i]->type() != Number_t::Array )
+      INVALID_XML("<call> to " << name << " passes a number for array argument " << i);
+    if( argDefs.type(int(i)) != Number_t::Array && actuals[i]->type() == Number_t::Array )
+      INVALID_XML("<call> to " << name << " passes an array for argument " << i);
+  }
+
+  if( calls_ || oversized_.count(index) > 0 )
+  {
+    copy = new CallOp( target(index), actuals );
+    return NULL;
+  }
+
+  inlining_ = true;
+
+  size_t h = hash_mix(0,index);
+  for(size_t i=0; i<numArgs; ++i) h = tree_hash(h,actuals[i]);
+
+  pair<InlinedTable_t::const_iterator,InlinedTable_t::const_iterator> range = inlined_.equal_range(h);
+  for(InlinedTable_t::const_iterator i=range.first; i!=range.second; ++i)
+  {
+    const Inlined &prior = i->second;
+    if( prior.index != index ) continue;
+
+    bool same = true;
+    for(size_t j=0; j<numArgs && same; ++j) same = same_tree(prior.actuals[j],actuals[j]);
+    if( same == false ) continue;
+
+    grow(prior.ops);
+    copy = prior.body->clone();
+    return NULL;
+  }
+
+  push(index);
+
+  callee = new Scope(argDefs,*this,&actuals);
+
+  return body(index);
+}
+
+// Array values are not recorded, as the array ops take (and delete) their operands
+void Linker::inlined(OpList_t &actuals, const XMLFunc::Operation *body)
+{
+  if( body->type() == Number_t::Array ) return;
+
+  Inlined entry;
+  entry.index = active_.back();
+  entry.body  = body;
+  entry.ops   = count_ops(body);
+
+  size_t h = hash_mix(0,entry.index);
+  for(size_t i=0; i<actuals.size(); ++i) h = tree_hash(h,actuals[i]);
+
+  InlinedTable_t::iterator i = inlined_.insert( make_pair(h,entry) );
+  i->second.actuals.swap(actuals);
+}
+
+void Linker::grow(size_t n)
+{
+  ops_ += n;
+  if( ops_ > MaxOps && inlining_ && calls_ == false ) throw Oversized();
+}
+
+const size_t Linker::MaxOps;
+
+void Linker::forget(void)
+{
+  for(InlinedTable_t::iterator i=inlined_.begin(); i!=inlined_.end(); ++i)
+  {
+    OpList_t &actuals = i->second.actuals;
+    for(OpList_t::iterator a=actuals.begin(); a!=actuals.end(); ++a) delete *a;
+  }
+  inlined_.clear();
+  ops_      = 0;
+  inlining_ = false;
+}
+
+void Linker::locate(OpPtr_t op, const XMLNode *xml, const char *attr) const
+{
+  if( op->element().empty() == false ) return;
+
+  unsigned line, column;
+  lines_.locate(xml->offset(), line, column);
+
+  string element = xml->name();
+  if(attr != NULL) element = element + "." + attr;
+
+  op->locate( this->element(element), line, column );
+}
+
+// The interned element names are cached, as interning takes a lock
+const string *Linker::element(const string &name) const
+{
+  map<string,const string *>::const_iterator i = elements_.find(name);
+  if( i != elements_.end() ) return i->second;
+
+  const string *rval = intern_element(name);
+  elements_[name] = rval;
+  return rval;
+}
+
+void Linker::push(size_t index)
+{
+  if( find(active_.begin(),active_.end(),index) != active_.end() )
+  {
+    string chain;
+    for(vector<size_t>::const_iterator i=active_.begin(); i!=active_.end(); ++i)
+    {
+      chain += name(*i) + " -> ";
+    }
+    INVALID_XML("recursive <call> (" << chain << name(index) << ")");
+  }
+
+  active_.push_back(index);
+}
+
+// XMLFunc::Compiler methods
+
+// Builds functions on the threads of run_parallel, each with its own linker.
+//   The functions are handed out in index order.  If any fail to build, the 
+//   error of the first (lowest index) is kept, as it is the one which would be
+//   thrown if they were built in order.
+class XMLFunc::Compiler::BuildTask : public ParallelTask
+{
+  public:
+    BuildTask(Compiler &compiler, const vector<Function> &funcs) 
+      : compiler_(compiler), funcs_(funcs), next_(0), failed_(funcs.size())
+    {
+      pthread_mutex_init(&mutex_,NULL);
+    }
+
+    ~BuildTask() { pthread_mutex_destroy(&mutex_); }
+
+    void run(size_t)
+    {
+      Linker linker(compiler_.linker_);
+
+      for(size_t i = __sync_fetch_and_add(&next_,size_t(1)); i<funcs_.size(); i = __sync_fetch_and_add(&next_,size_t(1)))
+      {
+        try
+        {
+          compiler_.build(i,funcs_[i],linker);
+        }
+        catch( exception &e )
+        {
+          pthread_mutex_lock(&mutex_);
+          if( i < failed_ )
+          {
+            failed_ = i;
+            error_  = e.what();
+          }
+          pthread_mutex_unlock(&mutex_);
+        }
+      }
+    }
+
+    bool          failed(void) const { return failed_ < funcs_.size(); }
+    const string &error(void)  const { return error_; }
+
+  private:
+    Compiler               &compiler_;
+    const vector<Function> &funcs_;
+    size_t                  next_;
+    size_t                  failed_;  // index of the first function which failed
+    string                  error_;
+    pthread_mutex_t         mutex_;
+};
+
+// The program is published (with release ordering) only once the function is 
+//   completely built.  Evaluating threads check it (with acquire ordering) 
+//   without taking the lock (see XMLFunc::_compile).
+void XMLFunc::Compiler::compile(size_t index, const Function &f)
+{
+  pthread_mutex_lock(&mutex_);
+  try
+  {
+    if( f.program == NULL ) build(index,f,linker_);
+  }
+  catch(...)
+  {
+    pthread_mutex_unlock(&mutex_);
+    throw;
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void XMLFunc::Compiler::compileAll(const vector<Function> &funcs, unsigned nthreads)
+{
+  if( nthreads <= 1 )
+  {
+    for(size_t i=0; i<funcs.size(); ++i) build(i,funcs[i],linker_);
+    return;
+  }
+
+  BuildTask task(*this,funcs);
+  run_parallel(task,nthreads,nthreads);
+
+  if( task.failed() ) throw runtime_error(task.error());
+}
+
+void XMLFunc::Compiler::build(size_t index, const Function &f, Linker &linker) const
+{
+  OpPtr_t root = linker.build(index);
+  if( optimizations_ & Polynomials ) root = fold_polynomials(root);
+
+  bool shared = ( optimizations_ & Shared ) != 0;
+
+  // (the locations of the ops are kept, as the shared ops have those of the 
+  //   first function which built them)
+  vector<Program::Location> locations;
+  if( shared ) Program::locations(root,locations);
+
+  if( shared ) root = OperationPool::intern(root);
+
+  Program *program = NULL;
+  try 
+  { 
+    program = new Program(root); 
+    if( shared ) program->relocate(locations);
+  }
+  catch(...) 
+  { 
+    if( shared ) OperationPool::release(root);
+    else         delete root;
+    throw; 
+  }
+
+  f.root   = root;
+  f.shared = shared;
+  __atomic_store_n( &f.program, program, __ATOMIC_RELEASE );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// XMLFunc::Program methods
+////////////////////////////////////////////////////////////////////////////////
+
+XMLFunc::Program::Program(const Operation *root) : root_(root), depth_(0), blockDepth_(0)
+{
+  compile(root);
+  compileBlock(root);
+}
+
+Number_t XMLFunc::Program::eval(const Args_t &args) const
+{
+  NoHook hook;
+  return evalWith(args,hook);
+}
+
+template<class Hook_t>
+Number_t XMLFunc::Program::evalWith(const Args_t &args, Hook_t &hook) const
+{
+  // Most functions need only a few values on the stack at a time.  Values are
+  //   copy constructed onto the stack as they are pushed (see run), so the local
+  //   stack is left as raw storage rather than default constructed.
+  if( depth_ <= 16 )
+  {
+    union { double align; char bytes[16*sizeof(Number_t)]; } local;
+    return run(args, reinterpret_cast<Number_t *>(local.bytes), hook);
+  }
+
+  vector<Number_t> stack(depth_);
+  return run(args,&stack[0],hook);
+}
+
+// Reads the clock before each step.  The time from the first step of an op to
+//   the step following its node step is the op's inclusive time.
+class XMLFunc::Program::Timing
+{
+  public:
+    Timing(const Step *steps, unsigned long *evals, unsigned long *ns, unsigned long *marks)
+      : steps_(steps), evals_(evals), ns_(ns), marks_(marks), pending_(0), isPending_(false) {}
+
+    void step(const Step *step, const Number_t *)
+    {
+      unsigned long t = Metrics::now();
+      settle(t);
+
+      size_t k = size_t(step - steps_);
+
+      marks_[k] = t;
+      if(steps_[k].op != NULL) { pending_ = k; isPending_ = true; }
+    }
+
+    void end(void) { settle( Metrics::now() ); }
+
+  private:
+    void settle(unsigned long t)
+    {
+      if(isPending_)
+      {
+        ns_[pending_] += t - marks_[ steps_[pending_].start ];
+        ++evals_[pending_];
+        isPending_ = false;
+      }
+    }
+
+    const Step    *steps_;
+    unsigned long *evals_;
+    unsigned long *ns_;
+    unsigned long *marks_;
+    size_t         pending_;    // node step whose time is not yet settled
+    bool           isPending_;
+};
+
+// Tracks the row status of each value on the stack.  The status of an <if>
+//   condition is held (beneath the value chosen) until the ENDIF step.
+class XMLFunc::Program::RowStatus
+{
+  public:
+    void step(const Step *step, const Number_t *sp)
+    {
+      switch(step->code)
+      {
+        case EVAL:
+          {
+            size_t base = stack_.size() - step->count;
+            unsigned char s = step->op->evalStatus( sp - step->count, stack_.empty() ? NULL : &stack_[0] + base );
+            stack_.resize(base);
+            stack_.push_back(s);
+          }
+          break;
+
+        case PUSH_CONST:
+        case PUSH_ARG:
+          stack_.push_back(Ok);
+          break;
+
+        case ENDIF:
+          {
+            unsigned char s = stack_.back();
+            stack_.pop_back();
+            stack_.back() |= s;
+          }
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    void end(void) {}
+
+    unsigned status(void) const { return stack_.back(); }
+
+  private:
+    vector<unsigned char> stack_;
+};
+
+Number_t XMLFunc::Program::eval(const Args_t &args, unsigned &status) const
+{
+  RowStatus hook;
+  Number_t rval = evalWith(args,hook);
+  status = hook.status();
+  return rval;
+}
+
+Number_t XMLFunc::Program::profile(const Args_t &args, unsigned long *evals, unsigned long *ns, unsigned long *marks) const
+{
+  Timing timing(&steps_[0],evals,ns,marks);
+
+  vector<Number_t> stack(depth_);
+  return run(args,&stack[0],timing);
+}
+
+template<class Hook_t>
+Number_t XMLFunc::Program::run(const Args_t &args, Number_t *stack, Hook_t &hook) const
+{
+  Number_t *sp = stack;
+
+  const Step *steps = &steps_[0];
+  const Step *end   = steps + steps_.size();
+
+  for(const Step *step = steps; step != end; ++step)
+  {
+    hook.step(step,sp);
+
+    switch(step->code)
+    {
+      case EVAL:
+        {
+          Number_t *operands = sp - step->count;
+          Number_t  value    = step->op->eval(args,operands);
+          new (operands) Number_t(value);
+          sp = operands + 1;
+        }
+        break;
+
+      case PUSH_CONST:
+        new (sp++) Number_t(step->value);
+        break;
+
+      case PUSH_ARG:
+        new (sp++) Number_t(args[step->target]);
+        break;
+
+      case JUMP:
+        step = steps + step->target - 1;
+        break;
+
+      case JUMP_IF_FALSE:
+        --sp;
+        if( TernaryOp::is_true(*sp) == false ) step = steps + step->target - 1;
+        break;
+
+      case ENDIF:
+        break;
+    }
+  }
+
+  hook.end();
+
+  return stack[0];
+}
+
+// The node steps are those completing an op.  As each node step follows the 
+//   steps of its operands, the pending nodes whose steps lie within an op's 
+//   steps are its operands.
+void XMLFunc::Program::nodes(vector<size_t> &steps, vector<size_t> &parents) const
+{
+  steps.clear();
+  parents.clear();
+
+  vector<size_t> pending;
+
+  for(size_t k=0; k<steps_.size(); ++k)
+  {
+    if(steps_[k].op == NULL) continue;
+
+    size_t node = steps.size();
+    while( pending.empty() == false && steps[pending.back()] >= steps_[k].start )
+    {
+      parents[pending.back()] = node;
+      pending.pop_back();
+    }
+
+    steps.push_back(k);
+    parents.push_back(string::npos);
+    pending.push_back(node);
+  }
+}
+
+void XMLFunc::Program::locate(size_t step, Location &location) const
+{
+  Location key;
+  key.step = step;
+
+  vector<Location>::const_iterator i = lower_bound(locations_.begin(), locations_.end(), key);
+  if( i != locations_.end() && i->step == step ) 
+  {
+    location = *i;
+    return;
+  }
+
+  const Operation *op = steps_.at(step).op;
+
+  location.step    = step;
+  location.element = &op->element();
+  location.line    = op->line();
+  location.column  = op->column();
+}
+
+// The node steps of an op's operands precede its own, in the order of the 
+//   operands (see compile), so the ops are listed in post order
+void XMLFunc::Program::locations(const Operation *root, vector<Location> &list)
+{
+  list.clear();
+
+  vector< pair<const Operation *,size_t> > pending(1, make_pair(root,size_t(0)));
+  while( pending.empty() == false )
+  {
+    const Operation *op = pending.back().first;
+    size_t &next = pending.back().second;
+
+    if( next < op->numOperands() )
+    {
+      pending.push_back( make_pair(op->operand(next++),size_t(0)) );
+      continue;
+    }
+    pending.pop_back();
+
+    Location location;
+    location.step    = list.size();
+    location.element = &op->element();
+    location.line    = op->line();
+    location.column  = op->column();
+    list.push_back(location);
+  }
+}
+
+void XMLFunc::Program::relocate(const vector<Location> &unshared)
+{
+  locations_.clear();
+
+  size_t node = 0;
+  for(size_t k=0; k<steps_.size() && node<unshared.size(); ++k)
+  {
+    const Operation *op = steps_[k].op;
+    if( op == NULL ) continue;
+
+    const Location &built = unshared[node++];
+    if( built.element != &op->element() || built.line != op->line() || built.column != op->column() )
+    {
+      locations_.push_back(built);
+      locations_.back().step = k;
+    }
+  }
+}
+
+XMLFunc::Block &XMLFunc::Program::evalBlock(const Batch_t &batch, vector<Block_t> &stack, bool status) const
+{
+  if( batch.single() ) return evalLanes<float>(batch,stack,status);
+  return evalLanes<double>(batch,stack,status);
+}
+
+template<class Real_t>
+XMLFunc::Block &XMLFunc::Program::evalLanes(const Batch_t &batch, vector<Block_t> &stack, bool status) const
+{
+  if( stack.size() < blockDepth_ ) stack.resize(blockDepth_);
+
+  size_t   n      = batch.size();
+  Block_t *blocks = &stack[0];
+  size_t   sp     = 0;
+
+  for(vector<BlockStep>::const_iterator step=blockSteps_.begin(); step!=blockSteps_.end(); ++step)
+  {
+    // A folded value's status is that of the list operands folded into it
+    if( status && ( step->code == FOLD || step->code == FOLD_HELD ) )
+    {
+      unsigned char       *s = blocks[sp-2].status;
+      const unsigned char *t = blocks[sp-1].status;
+      for(size_t k=0; k<n; ++k) s[k] |= t[k];
+    }
+
+    switch(step->code)
+    {
+      case APPLY:
+        {
+          size_t base = sp - step->count;
+
+          Block_t *operands[3];
+          for(size_t j=0; j<step->count; ++j) operands[j] = blocks + base + step->slot[j];
+
+          if(status) step->op->evalBlockStatus(batch,operands,blocks[base]);
+          Lanes<Real_t>::eval(step->op,batch,operands,blocks[base]);
+          sp = base + 1;
+        }
+        break;
+
+      case APPLY_ALL:
+        {
+          size_t base = sp - step->count;
+
+          vector<Block_t *> operands(step->count);
+          for(size_t j=0; j<step->count; ++j) operands[j] = blocks + base + j;
+
+          if(status) step->op->evalBlockStatus(batch,&operands[0],blocks[base]);
+          Lanes<Real_t>::eval(step->op,batch,&operands[0],blocks[base]);
+          sp = base + 1;
+        }
+        break;
+
+      case START:
+        static_cast<const ListOp *>(step->op)->startBlock<Real_t>(step->operand,blocks[sp-1],n);
+        break;
+
+      case FOLD:
+        static_cast<const ListOp *>(step->op)->foldBlock<Real_t>(step->operand,blocks[sp-2],blocks[sp-1],blocks[sp-2],n);
+        --sp;
+        break;
+
+      case FOLD_HELD:
+        static_cast<const ListOp *>(step->op)->foldBlock<Real_t>(step->operand,blocks[sp-1],blocks[sp-2],blocks[sp-2],n);
+        --sp;
+        break;
+    }
+  }
+
+  return blocks[0];
+}
+
+// Single row steps: each op follows its operands (in order).  An <if> is 
+//   compiled as its condition, a conditional jump over its second operand, 
+//   an unconditional jump over its third operand, and an ENDIF step.
+void XMLFunc::Program::compile(const Operation *root)
+{
+  vector<Frame> pending(1,Frame(root,0));
+
+  size_t sp = 0;
+
+  while( pending.empty() == false )
+  {
+    Frame &frame = pending.back();
+    const Operation *op = frame.op;
+
+    const TernaryOp *cond = dynamic_cast<const TernaryOp *>(op);
+
+    if( cond != NULL && cond->isLazy() )
+    {
+      switch(frame.next++)
+      {
+        case 0:
+          break;
+
+        case 1:
+          frame.jump = steps_.size();
+          steps_.push_back( Step(JUMP_IF_FALSE) );
+          --sp;
+          break;
+
+        case 2:
+          steps_[frame.jump].target = steps_.size() + 1;
+          frame.jump = steps_.size();
+          steps_.push_back( Step(JUMP) );
+          --sp;  // the third operand replaces the second
+          break;
+
+        default:
+          steps_[frame.jump].target = steps_.size();
+          steps_.push_back( Step(ENDIF,op,frame.start) );
+          pending.pop_back();
+          continue;
+      }
+      pending.push_back( Frame( op->operand(frame.next-1), steps_.size() ) );
+    }
+    else if( frame.next < op->numOperands() )
+    {
+      pending.push_back( Frame( op->operand(frame.next++), steps_.size() ) );
+    }
+    else
+    {
+      const ConstOp *c = dynamic_cast<const ConstOp *>(op);
+      const ArgOp   *a = dynamic_cast<const ArgOp *>(op);
+
+      steps_.push_back( Step(EVAL,op,frame.start) );
+      if(c != NULL) { steps_.back().code = PUSH_CONST; steps_.back().value  = c->value();    }
+      if(a != NULL) { steps_.back().code = PUSH_ARG;   steps_.back().target = a->argIndex(); }
+
+      sp = sp - op->numOperands() + 1;
+      depth_ = max(depth_,sp);
+      pending.pop_back();
+    }
+  }
+}
+
+// Batch steps: the ops are first numbered breadth first (so that the operands 
+//   of each op are numbered consecutively) to compute the number of blocks each
+//   op needs to be evaluated, which determines the order its operands are 
+//   evaluated.  The steps are then generated depth first.
+void XMLFunc::Program::compileBlock(const Operation *root)
+{
+  vector<const Operation *> ops(1,root);
+  vector<size_t>            first;  // index of the first operand of each op
+
+  for(size_t i=0; i<ops.size(); ++i)
+  {
+    first.push_back(ops.size());
+    for(size_t j=0; j<ops[i]->numOperands(); ++j) ops.push_back( ops[i]->operand(j) );
+  }
+
+  // The blocks needed by an op with fixed operands is the largest of the blocks
+  //   needed by each operand plus the number of operands already evaluated.  A 
+  //   list op evaluates its heaviest operand first (held until its turn in the
+  //   fold), then folds the others in order.
+
+  vector<size_t> need(ops.size(),1);
+  vector<size_t> heavy(ops.size(),0);
+
+  for(size_t i=ops.size(); i-- > 0; )
+  {
+    size_t k = ops[i]->numOperands();
+    if(k == 0) continue;
+
+    const size_t *w = &need[first[i]];
+
+    if( dynamic_cast<const ListOp *>(ops[i]) != NULL )
+    {
+      size_t h = 0;
+      for(size_t j=1; j<k; ++j) if( w[j] > w[h] ) h = j;
+      heavy[i] = h;
+
+      size_t n = w[h];
+      for(size_t j=0; j<k; ++j)
+      {
+        if( j == h ) continue;
+        size_t held = ( h > 0 && j < h ? 1 : 0 );
+        size_t acc  = ( j > 0 && !(h > 0 && j == 0) ? 1 : 0 );
+        n = max( n, w[j] + held + acc );
+      }
+      need[i] = n;
+    }
+    else if( k > 3 )
+    {
+      size_t n = 0;
+      for(size_t j=0; j<k; ++j) n = max( n, w[j] + j );
+      need[i] = n;
+    }
+    else
+    {
+      unsigned char order[3];
+      orderOperands(k,w,order);
+
+      size_t n = 0;
+      for(size_t j=0; j<k; ++j) n = max( n, w[order[j]] + j );
+      need[i] = n;
+    }
+  }
+
+  vector<BlockFrame> pending(1,BlockFrame(0));
+
+  size_t sp = 0;
+
+  while( pending.empty() == false )
+  {
+    BlockFrame &frame = pending.back();
+
+    size_t           i    = frame.index;
+    const Operation *op   = ops[i];
+    size_t           k    = op->numOperands();
+    const ListOp    *list = dynamic_cast<const ListOp *>(op);
+
+    // The order in which the operands of a list op are evaluated: 
+    //   heavy, 0, 1, ..., heavy-1, heavy+1, ..., k-1
+    size_t h = heavy[i];
+
+    if( list != NULL && frame.next > 0 )
+    {
+      size_t s = frame.next - 1;  // operand just evaluated
+      size_t j = ( h == 0 ? s : ( s == 0 ? h : ( s <= h ? s-1 : s ) ) );
+
+      if( j == 0 ) 
+      {
+        blockSteps_.push_back( BlockStep(START,op,0) );
+      }
+      else if( j != h || h == 0 )
+      {
+        blockSteps_.push_back( BlockStep(FOLD,op,j) );
+        --sp;
+      }
+
+      if( h > 0 && j == h-1 )
+      {
+        blockSteps_.push_back( BlockStep(FOLD_HELD,op,h) );
+        --sp;
+      }
+    }
+
+    if( frame.next < k )
+    {
+      size_t s = frame.next;
+      size_t j(0);
+
+      if( list != NULL ) 
+      {
+        j = ( h == 0 ? s : ( s == 0 ? h : ( s <= h ? s-1 : s ) ) );
+      }
+      else if( k > 3 )
+      {
+        j = s;
+      }
+      else
+      {
+        if( s == 0 ) orderOperands(k,&need[first[i]],frame.order);
+        j = frame.order[s];
+      }
+
+      ++frame.next;
+      pending.push_back( BlockFrame( first[i] + j ) );
+      continue;
+    }
+
+    if( list == NULL && k > 3 )
+    {
+      blockSteps_.push_back( BlockStep(APPLY_ALL,op) );
+
+      sp = sp - k + 1;
+      blockDepth_ = max(blockDepth_,sp);
+    }
+    else if( list == NULL )
+    {
+      BlockStep step(APPLY,op);
+      for(size_t s=0; s<k; ++s) step.slot[ frame.order[s] ] = (unsigned char)(s);
+      blockSteps_.push_back(step);
+
+      sp = sp - k + 1;
+      blockDepth_ = max(blockDepth_,sp);
+    }
+
+    pending.pop_back();
+  }
+}
+
+// Orders the (up to three) operands by decreasing need, keeping operands with
+//   the same need in their original order.
+void XMLFunc::Program::orderOperands(size_t k, const size_t *need, unsigned char *order)
+{
+  for(size_t j=0; j<k; ++j)
+  {
+    size_t m = j;
+    while( m > 0 && need[ order[m-1] ] < need[j] )
+    {
+      order[m] = order[m-1];
+      --m;
+    }
+    order[m] = (unsigned char)(j);
+  }
+}
+
+// XMLFunc::Sweep methods
+
+// The ops of a copy of the function are numbered breadth first (so that the
+//   operands of each op follow it) and their levels found in reverse.  The root
+//   is hoisted if it does not depend on the inner axis, so that the function
+//   is then evaluated once for each outer value, as its argument.
+XMLFunc::Sweep::Sweep(const Operation *root, size_t numArgs, const vector<size_t> &axisArgs)
+  : root_(root->clone()), program_(NULL), numArgs_(numArgs), axisArgs_(axisArgs)
+{
+  try
+  {
+    vector<OpPtr_t> ops(1,root_);
+    vector<size_t>  first;
+
+    for(size_t i=0; i<ops.size(); ++i)
+    {
+      first.push_back(ops.size());
+      for(size_t j=0; j<ops[i]->numOperands(); ++j) ops.push_back( ops[i]->operand(j) );
+    }
+
+    vector<size_t> level(ops.size(),0);
+    for(size_t i=ops.size(); i-- > 0; )
+    {
+      const ArgOp *arg = dynamic_cast<const ArgOp *>(ops[i]);
+      for(size_t a=0; arg != NULL && a<axisArgs.size(); ++a)
+      {
+        if( arg->argIndex() == axisArgs[a] ) level[i] = a + 1;
+      }
+      for(size_t j=0; j<ops[i]->numOperands(); ++j) level[i] = max( level[i], level[first[i]+j] );
+    }
+
+    if( level[0] < axisArgs.size() ) root_ = hoist(root_,level[0]);
+
+    for(size_t i=0; i<ops.size(); ++i)
+    {
+      for(size_t j=0; j<ops[i]->numOperands(); ++j)
+      {
+        size_t c = first[i] + j;
+        if( level[c] >= level[i] ) continue;
+
+        OpPtr_t arg = hoist(ops[c],level[c]);
+        if( arg != ops[c] ) ops[i]->replaceOperand(j,arg);
+      }
+    }
+
+    program_ = new Program(root_);
+    for(size_t h=0; h<hoisted_.size(); ++h) hoisted_[h].program = new Program(hoisted_[h].op);
+  }
+  catch(...)
+  {
+    clear();
+    throw;
+  }
+}
+
+OpPtr_t XMLFunc::Sweep::hoist(OpPtr_t op, size_t level)
+{
+  if( dynamic_cast<const ArgOp *>(op) != NULL || dynamic_cast<const ConstOp *>(op) != NULL ) return op;
+
+  OpPtr_t arg = new ArgOp( numArgs_ + hoisted_.size(), op->type() );
+  try
+  {
+    hoisted_.push_back( Hoisted(op,level) );
+  }
+  catch(...)
+  {
+    delete arg;
+    throw;
+  }
+  return arg;
+}
+
+void XMLFunc::Sweep::clear(void)
+{
+  delete program_;
+  delete root_;
+  for(size_t h=0; h<hoisted_.size(); ++h)
+  {
+    delete hoisted_[h].program;
+    delete hoisted_[h].op;
+  }
+  program_ = NULL;
+  root_    = NULL;
+  hoisted_.clear();
+}
+
+void XMLFunc::Sweep::eval(const Args_t &args, const vector<const vector<double> *> &axes, bool single, double *out) const
+{
+  for(size_t a=0; a<axes.size(); ++a) if( axes[a]->empty() ) return;
+
+  // Each argument's value is broadcast until its axis is evaluated
+
+  vector<long>   ivals(numArgs_);
+  vector<double> dvals(numArgs_);
+  BatchArgs_t    cols;
+
+  for(size_t a=0; a<numArgs_; ++a)
+  {
+    const Number_t &v = args[a];
+    if     ( v.isArray()   ) { cols.add( v.array(), v.length(), Stride(0) ); }
+    else if( v.isInteger() ) { ivals[a] = long(v);   cols.add( &ivals[a], Stride(0) ); }
+    else                     { dvals[a] = double(v); cols.add( &dvals[a], Stride(0) ); }
+  }
+
+  // The value of each level 0 op, or the values of each level 1 op (one for
+  //   each outer value)
+
+  size_t outer = ( axes.size() > 1 ? axes[0]->size() : 1 );
+
+  vector< vector<long> >   hivals(hoisted_.size());
+  vector< vector<double> > hdvals(hoisted_.size());
+
+  for(size_t h=0; h<hoisted_.size(); ++h)
+  {
+    size_t n = ( hoisted_[h].level == 0 ? 1 : outer );
+    if( hoisted_[h].op->type() == Number_t::Integer ) { hivals[h].resize(n); cols.add( &hivals[h][0], Stride(0) ); }
+    else                                              { hdvals[h].resize(n); cols.add( &hdvals[h][0], Stride(0) ); }
+  }
+
+  vector<Block_t> stack;
+
+  for(size_t level=0; level<axes.size(); ++level)
+  {
+    size_t n = 1;
+    if( level > 0 )
+    {
+      const vector<double> &values = *axes[level-1];
+      cols[ axisArgs_[level-1] ] = XMLFunc::Column( &values[0] );
+      n = values.size();
+    }
+
+    for(size_t h=0; h<hoisted_.size(); ++h)
+    {
+      if( hoisted_[h].level != level ) continue;
+
+      if( hivals[h].empty() ) run( *hoisted_[h].program, cols, n, single, &hdvals[h][0], NULL, stack );
+      else                    run( *hoisted_[h].program, cols, n, single, NULL, &hivals[h][0], stack );
+    }
+  }
+
+  const vector<double> &inner = *axes.back();
+  cols[ axisArgs_.back() ] = XMLFunc::Column( &inner[0] );
+
+  for(size_t r=0; r<outer; ++r)
+  {
+    if( axes.size() > 1 )
+    {
+      cols[ axisArgs_[0] ] = XMLFunc::Column( &(*axes[0])[r], Stride(0) );
+      for(size_t h=0; h<hoisted_.size(); ++h)
+      {
+        if( hoisted_[h].level != 1 ) continue;
+
+        if( hivals[h].empty() ) cols[numArgs_+h] = XMLFunc::Column( &hdvals[h][r], Stride(0) );
+        else                    cols[numArgs_+h] = XMLFunc::Column( &hivals[h][r], Stride(0) );
+      }
+    }
+    run( *program_, cols, inner.size(), single, out + r * inner.size(), NULL, stack );
+  }
+}
+
+void XMLFunc::Sweep::run(const Program &program, const BatchArgs_t &cols, size_t n, bool single,
+                         double *d, long *i, vector<Block_t> &stack)
+{
+  for(size_t offset=0; offset<n; offset+=BlockSize)
+  {
+    Batch_t batch(cols, offset, min(BlockSize, n-offset), single);
+
+    Block_t &block = program.evalBlock(batch,stack);
+
+    if( i != NULL )
+    {
+      for(size_t k=0; k<batch.size(); ++k) i[offset+k] = block.i[k];
+    }
+    else
+    {
+      as_double(program.root(),batch,block);
+      for(size_t k=0; k<batch.size(); ++k) d[offset+k] = block.d[k];
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// XMLNode methods
+////////////////////////////////////////////////////////////////////////////////
+
+// Constructs a new XMLNode (and all of its children) from the element which
+//   starts at (or after whitespace following) pos in the XML string.  Leaves pos 
+//   just past the end of the element.
+//   Returns NULL if there is nothing but whitespace following pos.
+//   Throws a runtime_error if invalid XMl syntax
+//
+// The elements which have been opened, but not yet closed, are kept on an
+//   explicit stack so that the depth of the XML is not limited by the call stack.
+XMLNode *XMLNode::parse(const string &xml, size_t &pos, size_t depth)
+{
+  static const string alpha = "abcdefghijklmnopqrstuvwxyz";
+
+  size_t end_xml = xml.length();
+
+  XMLNode          *root(NULL);
+  vector<XMLNode *> open;
+  vector<string>    skipped;  // open elements (within open.back()) which are not kept
+
+  try
+  {
+    do
+    {
+      size_t start_tag = xml.find('<',pos);
+      if( skip_whitespace(xml,pos) != start_tag ) INVALID_XML("all content must be tagged");
+
+      if( start_tag == string::npos )
+      {
+        if( open.empty() ) 
+        {
+          pos = end_xml;
+          return NULL;
+        }
+        const string &name = ( skipped.empty() ? open.back()->name() : skipped.back() );
+        INVALID_XML("<" << name << "> tag is missing closing </" << name <<"> tag");
+      }
+
+      bool   is_closing(false);
+      size_t start_name = start_tag + 1;
+
+      if( xml.compare(start_tag,2,"</") == 0 ) // this is a closing tag
+      {
+        is_closing = true;
+        ++start_name;
+      }
+
+      size_t end_name = skip_name(xml,start_name);
+      if( end_name==start_name  ) INVALID_XML("missing tag name");
+      if( end_name==string::npos) INVALID_XML("tag is missing closing '>'");
+
+      string name = xml.substr(start_name, end_name-start_name);
+
+      // validate/handle closing tag
+
+      if(is_closing)
+      {
+        if(open.empty())
+          INVALID_XML("closing </" << name << "> tag has no opening tag");
+
+        const string &opening = ( skipped.empty() ? open.back()->name() : skipped.back() );
+        if(name != opening)
+          INVALID_XML("closing </" << name << "> tag does not pair with opening <" << opening << "> tag");
+
+        size_t end_tag = skip_whitespace(xml,end_name);
+
+        if( end_tag == string::npos )
+          INVALID_XML("</" << name << "> tag does not have a closing '>'");
+
+        if( xml[end_tag] != '>' )
+          INVALID_XML("closing tags cannot have attributes");
+
+        pos = end_tag + 1;
+        if( skipped.empty() ) open.pop_back();
+        else                  skipped.pop_back();
+        continue;
+      }
+
+      // find attributes
+
+      XMLNode *node = NULL;
+      if( skipped.empty() && open.size() <= depth )
+      {
+        node = new XMLNode(name,start_tag);
+
+        if( root == NULL ) root = node;
+        else               open.back()->addChild(node);
+      }
+
+      bool is_opening_tag(false);
+
+      size_t end_tag(string::npos);
+      size_t p(end_name);
+      while( (p=skip_whitespace(xml,p)) != string::npos )
+      {
+        if(xml[p]=='>') 
+        {
+          is_opening_tag = true;
+          end_tag = p + 1;
+          break;
+        }
+        else if(xml.compare(p,2,"/>")==0)
+        {
+          is_opening_tag = false;
+          end_tag = p + 2;
+          break;
+        }
+        else
+        {
+          if( alpha.find(xml[p]) == string::npos )
+            INVALID_XML("attribute keys must start with a-z, not '" << xml.substr(p,1) << "'");
+
+          size_t start_key = p;
+          size_t end_key = skip_name(xml,p);
+
+          if(end_key==string::npos)
+            INVALID_XML("attribute key '" << xml.substr(start_key) << "' in <" << name << "> has no assigned value");
+
+          string key = xml.substr(start_key,end_key-start_key);
+
+          if(xml[end_key]!='=')
+            INVALID_XML("attribute key '" << key << "' in <" << name << "> not followed by an '='");
+
+          size_t start_value = end_key+1;
+          if( start_value >= end_xml)
+            INVALID_XML("<" << name << "> tag does not have a closing '>'");
+
+          // value may or may not be quoted
+          size_t end_value = start_value;
+
+          char q = xml[start_value];
+          if( q=='"' || q=='\'' ) 
+          { 
+            start_value += 1; 
+            if( start_value >= end_xml)
+              INVALID_XML("<" << name << "> tag does not have a closing '>'");
+
+            end_value = xml.find(q,start_value);
+            if(end_value == string::npos)
+              INVALID_XML("value for attribute key '" << key << "' in <" << name << "> has no closing quote");
+            
+            p = end_value+1;
+          }
+          else
+          { 
+            end_value = skip_value(xml,start_value);
+            if(end_value == string::npos)
+              INVALID_XML("<" << name << "> tag does not have a closing '>'");
+            
+            p = end_value;
+          }
+
+          if(node != NULL) node->addAttribute(key, xml, start_value, end_value-start_value);
+        }
+      }
+
+      if( end_tag == string::npos )
+        INVALID_XML("<" << name << "> tag does not have a closing '>'");
+
+      pos = end_tag;
+
+      // Subsequent elements are children of this one until its closing tag
+
+      if(is_opening_tag)
+      {
+        if(node != NULL) open.push_back(node);
+        else             skipped.push_back(name);
+      }
+    }
+    while( open.empty() == false );
+  }
+  catch(...)
+  {
+    delete root;
+    throw;
+  }
+
+  return root;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// XMLFunc methods
+////////////////////////////////////////////////////////////////////////////////
+
+const size_t XMLFunc::BlockSize;
+
+void populate(ArgDefs_t &argDefs, const XMLNode *xml)
+{
+  size_t numArgs = xml->numChildren();
+
+  if(numArgs==0)  INVALID_XML("<arglist> is empty");
+
+  argDefs.clear();
+  for(size_t i=0; i<numArgs; ++i)
+  {
+    const XMLNode *arg = xml->child(i);
+    if(arg->name() != "arg") INVALID_XML("<arglist> may only contain <arg> elements");
+
+    NumberType_t type = Number_t::Double;
+
+    const string &type_str = arg->attributeValue("type");
+    if( type_str.empty() == false )
+    {
+      if     (type_str == "double")  { type = Number_t::Double; }
+      else if(type_str == "float")   { type = Number_t::Double; }
+      else if(type_str == "real")    { type = Number_t::Double; }
+      else if(type_str == "integer") { type = Number_t::Integer; }
+      else if(type_str == "int")     { type = Number_t::Integer; }
+      else if(type_str == "double[]"){ type = Number_t::Array; }
+      else if(type_str == "real[]")  { type = Number_t::Array; }
+      else INVALID_XML("Unknown argument type: " << type_str);
+    }
+
+    const string &name = arg->attributeValue("name");
+
+    if( name.empty() ) { argDefs.add(type); }
+    else               { argDefs.add(type,name); }
+  }
+}
+
+// XMLFunc constructor
+
+XMLFunc::XMLFunc(const string &src, unsigned optimizations, unsigned nthreads) 
+  : funcIndex_(NULL), compiler_(NULL), metrics_(NULL)
+{
+  string raw_xml = load_xml(src);
+  strip_xml(raw_xml,"<?xml","?>"); // remove declaration
+  strip_xml(raw_xml,"<!--","-->"); // remove comments
+
+  lowercase(raw_xml);
+
+  // With Lazy, only the <func> elements and their children are kept (not the
+  //   elements of the function bodies) until the functions are built
+
+  const bool   lazy  = ( optimizations & Lazy ) != 0;
+  const size_t depth = ( lazy ? 1 : string::npos );
+
+  try
+  {
+    funcIndex_ = new FunctionIndex;
+    compiler_  = new Compiler(raw_xml, *funcIndex_, optimizations);
+
+    const string &xml    = compiler_->xml();
+    XMLRoots     &roots  = compiler_->roots();
+    Linker       &linker = compiler_->linker();
+
+    ArgDefsPool      argDefsPool(argDefs_);
+    const ArgDefs_t *sharedArgDefs = NULL;
+
+    // The root level elements are all parsed (and all function names registered)
+    //   before any function body is built so that <call> elements may reference
+    //   functions defined later in the XML.  They are then read in order, so the
+    //   functions are numbered (and errors found) in the same order however many
+    //   threads parse them.
+
+    if( nthreads <= 1 || parse_roots(xml,depth,roots,nthreads) == false ) parse_roots(xml,depth,roots);
+
+    size_t numRoots = roots.size();
+    for(size_t r=0; r<numRoots; ++r)
+    {
+      const XMLNode *node = roots[r];
+
+      string tag = node->name();
+
+      if( tag == "arglist" )
+      {
+        ArgDefs_t argDefs;
+        populate(argDefs,node);
+        sharedArgDefs = argDefsPool.intern(argDefs);
+      }
+      else if( tag == "func" )
+      {
+        size_t numChildren = node->numChildren();
+        if( numChildren == 1 )
+        {
+          if(sharedArgDefs == NULL) 
+            INVALID_XML("<func> must have <arglist> child as there is no root level <arglist>");
+
+          linker.add( node->child(0), sharedArgDefs, !lazy );
+          funcs_.push_back( Function(NULL, sharedArgDefs) );
+        }
+        else if(numChildren == 2 )
+        {
+          const XMLNode *arglist = node->child(0);
+          if( arglist->name() != "arglist" ) 
+            INVALID_XML("<arglist> must be first element in <func> if there is more than one child element");
+
+          // (the <arg> elements were not kept if lazy)
+          if( lazy )
+          {
+            size_t argPos = arglist->offset();
+            roots.push_back(NULL);
+            roots.back() = XMLNode::parse(xml,argPos);
+            arglist = roots.back();
+          }
+
+          ArgDefs_t argDefs;
+          populate(argDefs,arglist);
+
+          const ArgDefs_t *interned = argDefsPool.intern(argDefs);
+
+          linker.add( node->child(1), interned, !lazy );
+          funcs_.push_back( Function(NULL, interned) );
+        }
+        else
+        {
+          INVALID_XML("<func> must one child element, with an optional arg list");
+        }
+
+        funcs_.back().single = ( optimizations & SinglePrecision ) != 0;
+        if( node->hasAttribute("precision") )
+        {
+          string precision = node->attributeValue("precision");
+          if     ( precision == "single" ) funcs_.back().single = true;
+          else if( precision == "double" ) funcs_.back().single = false;
+          else INVALID_XML("<func> precision must be single or double (not " << precision << ")");
+        }
+
+        funcIndex_->add( node->hasAttribute("name") ? node->attributeValue("name") : string() );
+      }
+      else
+      {
+        INVALID_XML("Only <func> and <arglist> elements may exist at root level");
+      }
+    }
+
+    if(funcs_.empty()) INVALID_XML("contains no <func> elements");
+
+    funcIndex_->build();
+
+#ifdef XMLFUNC_METRICS
+    metrics_ = new Metrics(funcs_.size());
+#endif
+
+    if( lazy == false )
+    {
+      compiler_->compileAll(funcs_,nthreads);
+
+      delete compiler_;
+      compiler_ = NULL;
+    }
+  }
+  catch(...)
+  {
+    _clear();
+    throw;
+  }
+}
+
+XMLFunc::~XMLFunc()
+{
+  _clear();
+}
+
+void XMLFunc::_clear(void)
+{
+  for(vector<Function>::iterator i=funcs_.begin(); i!=funcs_.end(); ++i)
+  {
+    delete i->program;
+    if( i->shared ) OperationPool::release(i->root);
+    else            delete i->root;
+  }
+  funcs_.clear();
+
+  for(vector<ArgDefs_t *>::iterator i=argDefs_.begin(); i!=argDefs_.end(); ++i) delete *i;
+  argDefs_.clear();
+
+  delete compiler_;
+  delete funcIndex_;
+  delete metrics_;
+  compiler_  = NULL;
+  funcIndex_ = NULL;
+  metrics_   = NULL;
+}
+
+// Builds the function if it has not been built already (see Lazy).  Once it
+//   has, this is a single load.
+inline void XMLFunc::_compile(const Function &f) const
+{
+  if( __atomic_load_n( &f.program, __ATOMIC_ACQUIRE ) == NULL ) 
+  {
+    compiler_->compile( size_t(&f - &funcs_[0]), f );
+  }
+}
+
+bool XMLFunc::built(size_t index) const
+{
+  return __atomic_load_n( &_function(index).program, __ATOMIC_ACQUIRE ) != NULL;
+}
+
+void XMLFunc::warm(const vector<string> &names) const
+{
+  for(vector<string>::const_iterator i=names.begin(); i!=names.end(); ++i) _compile(_function(*i));
+}
+
+void XMLFunc::warm(const vector<size_t> &indices) const
+{
+  for(vector<size_t>::const_iterator i=indices.begin(); i!=indices.end(); ++i) _compile(_function(*i));
+}
+
+void XMLFunc::warm(void) const
+{
+  for(vector<Function>::const_iterator i=funcs_.begin(); i!=funcs_.end(); ++i) _compile(*i);
+}
+
+Number_t XMLFunc::eval(const Args_t &args) const
+{
+  return _eval(_function(), args);
+}
+
+Number_t XMLFunc::eval(size_t index, const Args_t &args) const
+{
+  return _eval(_function(index), args);
+}
+
+Number_t XMLFunc::eval(const string &name,const Args_t &args) const
+{
+  return _eval(_function(name), args);
+}
+
+const XMLFunc::Function &XMLFunc::_function(void) const
+{
+  if(funcs_.size() != 1) 
+    throw runtime_error("Must specify the function by name or index as there is more than one functin defined");
+
+  return funcs_.at(0);
+}
+
+const XMLFunc::Function &XMLFunc::_function(size_t index) const
+{
+  if(index >= funcs_.size())
+  {
+    stringstream err;
+    err << "Invalid function index (" << index << ").  There are only " << funcs_.size() << " functions defined";
+    throw runtime_error(err.str());
+  }
+
+  return funcs_.at(index);
+}
+
+const XMLFunc::Function &XMLFunc::_function(const string &name) const
+{
+  return funcs_.at( functionIndex(name) );
+}
+
+// Non-throwing function lookups (see tryEval).  A function which cannot be 
+//   built (see Lazy) is not found.
+const XMLFunc::Function *XMLFunc::_find(size_t index) const
+{
+  if( index >= funcs_.size() ) return NULL;
+
+  try                      { _compile(funcs_[index]); }
+  catch( runtime_error & ) { return NULL; }
+
+  return &funcs_[index];
+}
+
+const XMLFunc::Function *XMLFunc::_find(const string &name) const
+{
+  pair<size_t,bool> found = funcIndex_->find(name);
+  return found.second ? _find(found.first) : NULL;
+}
+
+size_t XMLFunc::functionIndex(const string &name) const
+{
+  pair<size_t,bool> found = funcIndex_->find(name);
+
+  if(found.second == false)
+  {
+    stringstream err;
+    err << "Invalid function name (" << name << ")";
+    throw runtime_error(err.str());
+  }
+
+  return found.first;
+}
+
+const string &XMLFunc::functionName(size_t index) const
+{
+  return funcIndex_->name(index);
+}
+
+const ArgDefs_t &XMLFunc::argDefs(size_t index) const
+{
+  return *_function(index).argDefs;
+}
+
+string XMLFunc::statusText(unsigned status)
+{
+  static const unsigned    bits[]  = { DivideByZero, NotANumber, Infinite, UnknownFunction, MissingArguments, ArgumentType, RequestTooLarge };
+  static const char *const names[] = { "DivideByZero", "NotANumber", "Infinite", "UnknownFunction", "MissingArguments", "ArgumentType", "RequestTooLarge" };
+
+  string rval;
+  for(size_t i=0; i<sizeof(bits)/sizeof(bits[0]); ++i)
+  {
+    if( status & bits[i] ) 
+    {
+      if( rval.empty() == false ) rval += "|";
+      rval += names[i];
+    }
+  }
+  return rval.empty() ? "Ok" : rval;
+}
+
+bool XMLFunc::metricsEnabled(void)
+{
+#ifdef XMLFUNC_METRICS
+  return true;
+#else
+  return false;
+#endif
+}
+
+void XMLFunc::metrics(vector<FunctionMetrics> &snapshot) const
+{
+  snapshot.assign(funcs_.size(), FunctionMetrics());
+
+  for(size_t i=0; i<funcs_.size(); ++i) snapshot[i].name = funcIndex_->name(i);
+
+  if(metrics_ == NULL) return;
+
+  for(size_t i=0; i<funcs_.size(); ++i) metrics_->snapshot(i,snapshot[i]);
+}
+
+void XMLFunc::resetMetrics(void)
+{
+  if(metrics_ != NULL) metrics_->reset();
+}
+
+XMLFunc::MemoryUsage XMLFunc::memoryUsage(void) const
+{
+  MemoryUsage rval;
+
+  rval.functions  = funcs_.capacity() * sizeof(Function);
+  rval.names      = funcIndex_->memoryUsage();
+  rval.numArgDefs = argDefs_.size();
+  rval.argDefs    = argDefs_.capacity() * sizeof(ArgDefs_t *);
+
+  for(vector<ArgDefs_t *>::const_iterator i=argDefs_.begin(); i!=argDefs_.end(); ++i)
+  {
+    rval.argDefs += (*i)->memoryUsage();
+  }
+
+  if( compiler_ != NULL ) rval.source = compiler_->memoryUsage();
+
+  // Shared ops (see Shared) may be used more than once, but are counted once
+  vector<const Operation *> pending;
+  set<const Operation *>    shared;
+  for(vector<Function>::const_iterator f=funcs_.begin(); f!=funcs_.end(); ++f)
+  {
+    if( built( size_t(f - funcs_.begin()) ) == false ) continue;
+
+    rval.programs += f->program->memoryUsage();
+
+    pending.push_back(f->root);
+    while( pending.empty() == false )
+    {
+      const Operation *op = pending.back();
+      pending.pop_back();
+
+      if( f->shared && shared.insert(op).second == false ) continue;
+
+      rval.operations += op->memoryUsage();
+      for(size_t i=0; i<op->numOperands(); ++i) pending.push_back(op->operand(i));
+    }
+  }
+
+  return rval;
+}
+
+XMLFunc::SharedOperations XMLFunc::sharedOperations(void)
+{
+  return OperationPool::stats();
+}
+
+Number_t XMLFunc::_eval(const Function &f, const Args_t &args) const
+{
+  METRICS_START(f,1);
+
+  _compile(f);
+  _check(f,args);
+
+  Number_t rval = f.program->eval(args);
+
+  METRICS_END;
+  return rval;
+}
+
+// Returns the call status of evaluating the function with the arguments
+unsigned XMLFunc::_validate(const Function &f, const Args_t &args) const
+{
+  if( args.size() < size_t(f.argDefs->count()) ) return MissingArguments;
+
+  for(int i=0; i<f.argDefs->count(); ++i)
+  {
+    if( arg_matches(f.argDefs->type(i),args[i].type()) == false ) return ArgumentType;
+  }
+  return Ok;
+}
+
+void XMLFunc::_check(const Function &f, const Args_t &args) const
+{
+  if( _validate(f,args) == Ok ) return;
+
+  if( args.size() < size_t(f.argDefs->count()) )
+  {
+    stringstream err;
+    err << "Insufficient arguments passed to eval.  Need " << f.argDefs->count()
+      << ". Only " << args.size() << " were provided";
+    throw runtime_error(err.str());
+  }
+
+  for(int i=0; i<f.argDefs->count(); ++i)
+  {
+    const Number &arg = args.at(i);
+    if(f.argDefs->type(i) == Number_t::Integer && arg.isDouble())
+    {
+      stringstream err;
+      err << "Argument " << i << " should be an integer, but a double ("
+        << double(arg) << ") was passed to eval()";
+      throw runtime_error(err.str());
+    }
+    if( arg_matches(f.argDefs->type(i),arg.type()) == false )
+    {
+      stringstream err;
+      err << "Argument " << i << ( arg.isArray() ? " is not an array, but an array was" : " is an array, but a number was" )
+        << " passed to eval()";
+      throw runtime_error(err.str());
+    }
+  }
+}
+
+Number_t XMLFunc::profile(size_t index, const Args_t &args, Profile &profile) const
+{
+  return _profile(_function(index), args, profile);
+}
+
+Number_t XMLFunc::profile(const string &name, const Args_t &args, Profile &profile) const
+{
+  return _profile(_function(name), args, profile);
+}
+
+// Binds the profile to the function on first use.  Only one in every period 
+//   calls is timed.
+Number_t XMLFunc::_profile(const Function &f, const Args_t &args, Profile &profile) const
+{
+  _compile(f);
+  _check(f,args);
+
+  if( profile.program_ == NULL )
+  {
+    profile.program_  = f.program;
+    profile.function_ = funcIndex_->name( size_t(&f - &funcs_[0]) );
+    if( profile.function_.empty() ) profile.function_ = "<func>";
+
+    size_t nsteps = f.program->numSteps();
+    profile.evals_.assign(nsteps,0);
+    profile.ns_.assign(nsteps,0);
+    profile.marks_.assign(nsteps,0);
+
+    f.program->nodes(profile.steps_,profile.parents_);
+  }
+  else if( profile.program_ != f.program )
+  {
+    throw runtime_error("Profile cannot be used with more than one function (it is bound to " + profile.function_ + ")");
+  }
+
+  if( profile.calls_++ % profile.period_ != 0 ) return f.program->eval(args);
+
+  ++profile.timed_;
+  return f.program->profile(args, &profile.evals_[0], &profile.ns_[0], &profile.marks_[0]);
+}
+
+void XMLFunc::eval(const BatchArgs_t &args, size_t n, double *out) const
+{
+  _eval(_function(), args, n, out);
+}
+
+void XMLFunc::eval(size_t index, const BatchArgs_t &args, size_t n, double *out) const
+{
+  _eval(_function(index), args, n, out);
+}
+
+void XMLFunc::eval(const string &name, const BatchArgs_t &args, size_t n, double *out) const
+{
+  _eval(_function(name), args, n, out);
+}
+
+void XMLFunc::eval(size_t index, const BatchArgs_t &args, size_t n, double *out, Stride stride) const
+{
+  _eval(_function(index), args, n, out, stride.bytes);
+}
+
+void XMLFunc::eval(const string &name, const BatchArgs_t &args, size_t n, double *out, Stride stride) const
+{
+  _eval(_function(name), args, n, out, stride.bytes);
+}
+
+BatchArgs_t XMLFunc::bind(size_t index, const map<string,Column> &columns) const
+{
+  const ArgDefs_t &defs = argDefs(index);
+
+  BatchArgs_t rval;
+  for(int i=0; i<defs.count(); ++i)
+  {
+    map<string,Column>::const_iterator c = columns.find( defs.name(i) );
+    if( c == columns.end() )
+    {
+      stringstream err;
+      err << "No column was bound to argument " << i << " (" << defs.name(i) << ") of function " << index;
+      throw runtime_error(err.str());
+    }
+    rval.push_back(c->second);
+  }
+
+  for(map<string,Column>::const_iterator c=columns.begin(); c!=columns.end(); ++c)
+  {
+    if( defs.find(c->first).second == false )
+    {
+      stringstream err;
+      err << "Function " << index << " has no argument named " << c->first;
+      throw runtime_error(err.str());
+    }
+  }
+
+  return rval;
+}
+
+void XMLFunc::sweep(size_t index, const Args_t &args, const Axis &x, double *out) const
+{
+  _sweep(_function(index), args, NULL, x, out);
+}
+
+void XMLFunc::sweep(const string &name, const Args_t &args, const Axis &x, double *out) const
+{
+  _sweep(_function(name), args, NULL, x, out);
+}
+
+void XMLFunc::sweep(size_t index, const Args_t &args, const Axis &y, const Axis &x, double *out) const
+{
+  _sweep(_function(index), args, &y, x, out);
+}
+
+void XMLFunc::sweep(const string &name, const Args_t &args, const Axis &y, const Axis &x, double *out) const
+{
+  _sweep(_function(name), args, &y, x, out);
+}
+
+// The function is rewritten for each sweep (see Sweep), which costs about as
+//   much as evaluating a few rows of it
+void XMLFunc::_sweep(const Function &f, const Args_t &args, const Axis *y, const Axis &x, double *out) const
+{
+  METRICS_START(f, x.size() * ( y != NULL ? y->size() : 1 ));
+
+  _compile(f);
+  _check(f,args);
+
+  vector<const Axis *> axes;
+  if( y != NULL ) axes.push_back(y);
+  axes.push_back(&x);
+
+  vector<size_t>                  axisArgs;
+  vector<const vector<double> *>  values;
+
+  for(size_t a=0; a<axes.size(); ++a)
+  {
+    const Axis &axis = *axes[a];
+
+    size_t index = axis.index_;
+    if( axis.name_.empty() == false )
+    {
+      pair<size_t,bool> found = f.argDefs->find(axis.name_);
+      if( found.second == false ) throw runtime_error("Cannot sweep " + axis.name_ + ": the function has no argument with that name");
+      index = found.first;
+    }
+
+    if( index >= size_t(f.argDefs->count()) || f.argDefs->type(int(index)) != Number_t::Double )
+    {
+      stringstream err;
+      err << "Cannot sweep argument " << index << ": the function has no double argument with that index";
+      throw runtime_error(err.str());
+    }
+    if( a > 0 && index == axisArgs[0] ) throw runtime_error("Cannot sweep the same argument along both axes of a grid");
+
+    axisArgs.push_back(index);
+    values.push_back(&axis.values_);
+  }
+
+  Sweep sweep(f.root, size_t(f.argDefs->count()), axisArgs);
+  sweep.eval(args, values, f.single, out);
+
+  METRICS_END;
+}
+
+unsigned XMLFunc::_validate(const Function &f, const BatchArgs_t &args) const
+{
+  if( args.size() < size_t(f.argDefs->count()) ) return MissingArguments;
+
+  for(int i=0; i<f.argDefs->count(); ++i)
+  {
+    if( arg_matches(f.argDefs->type(i),args[i].type()) == false ) return ArgumentType;
+  }
+  return Ok;
+}
+
+// Verifies that the batch argument columns are compatible with the function's arglist
+void XMLFunc::_check(const Function &f, const BatchArgs_t &args) const
+{
+  if( _validate(f,args) == Ok ) return;
+
+  if( args.size() < size_t(f.argDefs->count()) )
+  {
+    stringstream err;
+    err << "Insufficient argument columns passed to eval.  Need " << f.argDefs->count()
+      << ". Only " << args.size() << " were provided";
+    throw runtime_error(err.str());
+  }
+
+  for(int i=0; i<f.argDefs->count(); ++i)
+  {
+    const XMLFunc::Column &col = args.at(i);
+    if(f.argDefs->type(i) == Number_t::Integer && col.type() == Number_t::Double)
+    {
+      stringstream err;
+      err << "Argument " << i << " should be an integer, but a double column was passed to eval()";
+      throw runtime_error(err.str());
+    }
+    if( arg_matches(f.argDefs->type(i),col.type()) == false )
+    {
+      stringstream err;
+      err << "Argument " << i << ( col.type() == Number_t::Array ? " is not an array, but an array column was" : " is an array, but a number column was" )
+        << " passed to eval()";
+      throw runtime_error(err.str());
+    }
+  }
+}
+
+// Evaluates the function one block of rows at a time.  Each op computes its
+//   values for the entire block before passing them up to its parent.
+void XMLFunc::_eval(const Function &f, const BatchArgs_t &args, size_t n, double *out, size_t stride) const
+{
+  METRICS_START(f,n);
+
+  _compile(f);
+  _check(f,args);
+
+  vector<Block_t> stack;
+  for(size_t offset=0; offset<n; offset+=BlockSize)
+  {
+    Batch_t batch(args, offset, min(BlockSize, n-offset), f.single);
+
+    Block_t &block = f.program->evalBlock(batch,stack);
+    as_double(f.root,batch,block);
+
+    if( stride == sizeof(double) )
+    {
+      double *r = out + offset;
+      for(size_t k=0; k<batch.size(); ++k) r[k] = block.d[k];
+    }
+    else
+    {
+      char *r = reinterpret_cast<char *>(out) + offset * stride;
+      for(size_t k=0; k<batch.size(); ++k, r+=stride) *reinterpret_cast<double *>(r) = block.d[k];
+    }
+  }
+
+  METRICS_END;
+}
+
+void XMLFunc::eval(const BatchArgs_t &args, size_t n, float *out) const
+{
+  _eval(_function(), args, n, out);
+}
+
+void XMLFunc::eval(size_t index, const BatchArgs_t &args, size_t n, float *out) const
+{
+  _eval(_function(index), args, n, out);
+}
+
+void XMLFunc::eval(const string &name, const BatchArgs_t &args, size_t n, float *out) const
+{
+  _eval(_function(name), args, n, out);
+}
+
+void XMLFunc::_eval(const Function &f, const BatchArgs_t &args, size_t n, float *out) const
+{
+  METRICS_START(f,n);
+
+  _compile(f);
+  _check(f,args);
+
+  vector<Block_t> stack;
+  for(size_t offset=0; offset<n; offset+=BlockSize)
+  {
+    Batch_t batch(args, offset, min(BlockSize, n-offset), f.single);
+
+    Block_t &block = f.program->evalBlock(batch,stack);
+    as_float(f.root,batch,block);
+
+    float *r = out + offset;
+    for(size_t k=0; k<batch.size(); ++k) r[k] = block.f[k];
+  }
+
+  METRICS_END;
+}
+
+unsigned XMLFunc::tryEval(size_t index, const Args_t &args, Number_t &value) const
+{
+  return _tryEval(_find(index), args, value);
+}
+
+unsigned XMLFunc::tryEval(const string &name, const Args_t &args, Number_t &value) const
+{
+  return _tryEval(_find(name), args, value);
+}
+
+unsigned XMLFunc::tryEval(size_t index, const BatchArgs_t &args, size_t n, double *out, unsigned char *status) const
+{
+  return _tryEval(_find(index), args, n, out, status);
+}
+
+unsigned XMLFunc::tryEval(const string &name, const BatchArgs_t &args, size_t n, double *out, unsigned char *status) const
+{
+  return _tryEval(_find(name), args, n, out, status);
+}
+
+// A call which evaluates nothing is recorded as an error (see Metrics)
+unsigned XMLFunc::_tryEval(const Function *f, const Args_t &args, Number_t &value) const
+{
+  if( f == NULL ) return UnknownFunction;
+
+  METRICS_START(*f,1);
+
+  unsigned rval = _validate(*f,args);
+  if( rval != Ok ) return rval;
+
+  value = f->program->eval(args,rval);
+
+  if( value.isDouble() )
+  {
+    double v = double(value);
+    if( v != v ) rval |= NotANumber;
+    if( v == numeric_limits<double>::infinity() || v == -numeric_limits<double>::infinity() ) rval |= Infinite;
+  }
+
+  METRICS_END;
+  return rval;
+}
+
+// As _eval(), also tracking the status of each row.  NaN and infinite values
+//   are detected as the values are copied out (without branching).  Integer 
+//   values are never NaN or infinite.
+unsigned XMLFunc::_tryEval(const Function *f, const BatchArgs_t &args, size_t n, double *out, unsigned char *status) const
+{
+  if( f == NULL ) return UnknownFunction;
+
+  METRICS_START(*f,n);
+
+  unsigned rval = _validate(*f,args);
+  if( rval != Ok ) return rval;
+
+  const double inf = numeric_limits<double>::infinity();
+
+  unsigned char any = Ok;
+
+  vector<Block_t> stack;
+  for(size_t offset=0; offset<n; offset+=BlockSize)
+  {
+    Batch_t batch(args, offset, min(BlockSize, n-offset), f->single);
+
+    Block_t &block = f->program->evalBlock(batch,stack,true);
+    as_double(f->root,batch,block);
+
+    double        *r = out + offset;
+    unsigned char *s = status + offset;
+    for(size_t k=0; k<batch.size(); ++k) 
+    {
+      double v = block.d[k];
+      r[k] = v;
+      s[k] = block.status[k] | ( v != v ? NotANumber : 0 ) | ( ( v == inf ) | ( v == -inf ) ? Infinite : 0 );
+    }
+
+    for(size_t k=0; k<batch.size(); ++k) any |= s[k];
+  }
+
+  METRICS_END;
+  return any;
+}
+
+void XMLFunc::reduce(const BatchArgs_t &args, size_t n, Summary &summary, unsigned nthreads) const
+{
+  _reduce(_function(), args, n, summary, nthreads);
+}
+
+void XMLFunc::reduce(size_t index, const BatchArgs_t &args, size_t n, Summary &summary, unsigned nthreads) const
+{
+  _reduce(_function(index), args, n, summary, nthreads);
+}
+
+void XMLFunc::reduce(const string &name, const BatchArgs_t &args, size_t n, Summary &summary, unsigned nthreads) const
+{
+  _reduce(_function(name), args, n, summary, nthreads);
+}
+
+void XMLFunc::reduce(const BatchArgs_t &args, size_t n, Histogram &hist, unsigned nthreads) const
+{
+  _reduce(_function(), args, n, hist, nthreads);
+}
+
+void XMLFunc::reduce(size_t index, const BatchArgs_t &args, size_t n, Histogram &hist, unsigned nthreads) const
+{
+  _reduce(_function(index), args, n, hist, nthreads);
+}
+
+void XMLFunc::reduce(const string &name, const BatchArgs_t &args, size_t n, Histogram &hist, unsigned nthreads) const
+{
+  _reduce(_function(name), args, n, hist, nthreads);
+}
+
+// The rows are divided into fixed size chunks, each of which is reduced into
+//   its own partial result (one block at a time, never storing the function
+//   values).  The partial results are then merged in chunk order.  As neither
+//   the chunks nor the merge order depend on the number of threads, neither
+//   does the result.
+template<class Result_t>
+void XMLFunc::_reduce(const Function &f, const BatchArgs_t &args, size_t n, Result_t &result, unsigned nthreads) const
+{
+  METRICS_START(f,n);
+
+  _compile(f);
+  _check(f,args);
+
+  ReduceTask<Result_t> task(*f.program, args, n, f.single, result);
+
+  run_parallel(task, task.numChunks(), nthreads);
+
+  task.merge(result);
+
+  METRICS_END;
+}
+////////////////////////////////////////////////////////////////////////////////
+// ReloadableXMLFunc methods
+////////////////////////////////////////////////////////////////////////////////
+
+// current_ holds the slot of the current version in its high bits and counts
+//   the times it has been pinned in the low bits.  Pinning is a single atomic
+//   add which both reads the slot and counts the pin.  Releasing a pin 
+//   decrements its slot's pending count.  When a new version is published, the 
+//   swap of current_ returns the number of times the old version was pinned, 
+//   which is added to its pending count: once that reaches zero, every pin has
+//   been released and the old version may be deleted.  (The pin count has 
+//   room for 2^56 pins of a single version.)
+
+static const unsigned           SlotShift = 56;
+static const unsigned long long PinMask   = (1ULL << SlotShift) - 1;
+
+const size_t ReloadableXMLFunc::MaxVersions;
+
+ReloadableXMLFunc::Handle::Handle(const ReloadableXMLFunc &holder) : holder_(&holder)
+{
+  unsigned long long current = __atomic_fetch_add( &holder.current_, 1ULL, __ATOMIC_ACQUIRE );
+
+  slot_    = size_t( current >> SlotShift );
+  func_    = holder.slots_[slot_].func;
+  version_ = holder.slots_[slot_].version;
+}
+
+ReloadableXMLFunc::Handle::~Handle()
+{
+  __atomic_fetch_sub( &holder_->slots_[slot_].pending, 1LL, __ATOMIC_RELEASE );
+}
+
+ReloadableXMLFunc::ReloadableXMLFunc(const string &xml, unsigned optimizations, unsigned nthreads)
+  : current_(0), reloader_(NULL)
+{
+  for(size_t i=0; i<MaxVersions; ++i)
+  {
+    slots_[i].func    = NULL;
+    slots_[i].version = 0;
+    slots_[i].pending = 0;
+    slots_[i].retired = false;
+  }
+
+  reloader_ = new Reloader(*this, xml, optimizations, nthreads);
+
+  try
+  {
+    slots_[0].func    = reloader_->build(xml);
+    slots_[0].version = reloader_->nextVersion();
+  }
+  catch(...)
+  {
+    delete reloader_;
+    throw;
+  }
+}
+
+// All handles must have been destroyed, so every version may be deleted
+ReloadableXMLFunc::~ReloadableXMLFunc()
+{
+  reloader_->unwatch();
+  for(size_t i=0; i<MaxVersions; ++i) delete slots_[i].func;
+  delete reloader_;
+}
+
+Number_t ReloadableXMLFunc::eval(size_t index, const Args_t &args) const
+{
+  Handle h(*this);
+  return h->eval(index,args);
+}
+
+Number_t ReloadableXMLFunc::eval(const string &name, const Args_t &args) const
+{
+  Handle h(*this);
+  return h->eval(name,args);
+}
+
+void ReloadableXMLFunc::eval(size_t index, const BatchArgs_t &args, size_t n, double *out) const
+{
+  Handle h(*this);
+  h->eval(index,args,n,out);
+}
+
+void ReloadableXMLFunc::eval(const string &name, const BatchArgs_t &args, size_t n, double *out) const
+{
+  Handle h(*this);
+  h->eval(name,args,n,out);
+}
+
+unsigned long ReloadableXMLFunc::version(void) const
+{
+  Handle h(*this);
+  return h.version();
+}
+
+// The new version is built before the writer lock is taken, so a slow build 
+//   only delays other reloads when they publish.
+unsigned long ReloadableXMLFunc::reload(const string &xml)
+{
+  XMLFunc *func = reloader_->build(xml);
+
+  try
+  {
+    return _publish(func);
+  }
+  catch(...)
+  {
+    delete func;
+    throw;
+  }
+}
+
+unsigned long ReloadableXMLFunc::reload(void)
+{
+  if( reloader_->path().empty() ) throw runtime_error("ReloadableXMLFunc was not constructed from a file");
+
+  reloader_->changed();
+  return reload(reloader_->path());
+}
+
+unsigned long ReloadableXMLFunc::_publish(XMLFunc *func)
+{
+  reloader_->lock();
+
+  size_t slot = 0;
+  while( slot < MaxVersions && slots_[slot].func != NULL ) ++slot;
+
+  if( slot == MaxVersions )
+  {
+    // reclaim() takes the lock itself
+    reloader_->unlock();
+    if( reclaim() == MaxVersions )
+    {
+      stringstream err;
+      err << "Cannot reload: all " << MaxVersions << " versions of the functions are still in use";
+      throw runtime_error(err.str());
+    }
+    return _publish(func);
+  }
+
+  unsigned long version = reloader_->nextVersion();
+
+  slots_[slot].func    = func;
+  slots_[slot].version = version;
+  slots_[slot].pending = 0;
+  slots_[slot].retired = false;
+
+  unsigned long long old = __atomic_exchange_n( &current_, (unsigned long long)slot << SlotShift, __ATOMIC_ACQ_REL );
+
+  Slot &prev = slots_[ size_t( old >> SlotShift ) ];
+  prev.retired = true;
+  __atomic_add_fetch( &prev.pending, (long long)( old & PinMask ), __ATOMIC_ACQ_REL );
+
+  reloader_->unlock();
+
+  reclaim();
+
+  return version;
+}
+
+size_t ReloadableXMLFunc::reclaim(void)
+{
+  reloader_->lock();
+
+  size_t remaining = 0;
+  for(size_t i=0; i<MaxVersions; ++i)
+  {
+    Slot &slot = slots_[i];
+    if( slot.func == NULL ) continue;
+
+    if( slot.retired && __atomic_load_n( &slot.pending, __ATOMIC_ACQUIRE ) == 0 )
+    {
+      delete slot.func;
+      slot.func    = NULL;
+      slot.retired = false;
+    }
+    else
+    {
+      ++remaining;
+    }
+  }
+
+  reloader_->unlock();
+
+  return remaining;
+}
+
+void ReloadableXMLFunc::watch(double interval)
+{
+  if( reloader_->path().empty() ) throw runtime_error("ReloadableXMLFunc was not constructed from a file");
+  reloader_->watch(interval);
+}
+
+void ReloadableXMLFunc::unwatch(void)
+{
+  reloader_->unwatch();
+}
+
+string ReloadableXMLFunc::lastError(void) const
+{
+  return reloader_->lastError();
+}
+
+// Reloader methods
+
+bool ReloadableXMLFunc::Reloader::changed(void)
+{
+  Stamp s;
+  if( stamp(path_,s) == false ) return false;  // (being replaced?) check again later
+
+  lock();
+  bool rval = s != stamp_;
+  stamp_ = s;
+  unlock();
+
+  return rval;
+}
+
+void ReloadableXMLFunc::Reloader::watch(double interval)
+{
+  pthread_mutex_lock(&watchMutex_);
+
+  interval_ = interval;
+  if( watching_ == false )
+  {
+    stop_ = false;
+    if( pthread_create(&thread_,NULL,watch_thread,this) != 0 )
+    {
+      pthread_mutex_unlock(&watchMutex_);
+      throw runtime_error("Failed to start the thread which watches the XML file");
+    }
+    watching_ = true;
+  }
+
+  pthread_mutex_unlock(&watchMutex_);
+}
+
+void ReloadableXMLFunc::Reloader::unwatch(void)
+{
+  pthread_mutex_lock(&watchMutex_);
+  bool watching = watching_;
+  stop_     = true;
+  watching_ = false;
+  pthread_cond_signal(&wake_);
+  pthread_mutex_unlock(&watchMutex_);
+
+  if(watching) pthread_join(thread_,NULL);
+}
+
+string ReloadableXMLFunc::Reloader::lastError(void)
+{
+  pthread_mutex_lock(&watchMutex_);
+  string rval = lastError_;
+  pthread_mutex_unlock(&watchMutex_);
+  return rval;
+}
+
+// Every interval, reloads the file if it has changed and deletes old versions
+//   which are no longer pinned.
+void *ReloadableXMLFunc::Reloader::watch_thread(void *arg)
+{
+  Reloader *reloader = static_cast<Reloader *>(arg);
+
+  pthread_mutex_lock(&reloader->watchMutex_);
+  while( reloader->stop_ == false )
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME,&deadline);
+
+    double wake = double(deadline.tv_nsec) + 1.e9 * reloader->interval_;
+    deadline.tv_sec  += time_t( wake / 1.e9 );
+    deadline.tv_nsec  = long( fmod(wake, 1.e9) );
+
+    pthread_cond_timedwait(&reloader->wake_,&reloader->watchMutex_,&deadline);
+    if( reloader->stop_ ) break;
+
+    pthread_mutex_unlock(&reloader->watchMutex_);
+
+    string error;
+    try
+    {
+      if( reloader->changed() ) reloader->holder_.reload(reloader->path_);
+      reloader->holder_.reclaim();
+    }
+    catch(const exception &e)
+    {
+      error = e.what();
+    }
+
+    pthread_mutex_lock(&reloader->watchMutex_);
+    if( error.empty() == false ) reloader->lastError_ = error;
+  }
+  pthread_mutex_unlock(&reloader->watchMutex_);
+
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// XMLFuncQueue methods
+////////////////////////////////////////////////////////////////////////////////
+
+const size_t XMLFuncQueue::Stats::LatencyBins;
+
+XMLFuncQueue::Stats::Stats(void) : requests(0), batches(0), fullBatches(0), evalSeconds(0.), seconds(0.)
+{
+  for(size_t b=0; b<LatencyBins; ++b) latencies[b] = 0;
+}
+
+double XMLFuncQueue::Stats::latency(double q) const
+{
+  return latency_quantile(latencies, LatencyBins, q);
+}
+
+double XMLFuncQueue::Request::wait(void)
+{
+  if( ready() == false ) queue_->dispatcher_->wait(*this);
+  return value_;
+}
+
+XMLFuncQueue::XMLFuncQueue(const XMLFunc &func, size_t maxBatch, double maxDelay, unsigned nthreads)
+  : func_(func), dispatcher_(NULL)
+{
+  dispatcher_ = new Dispatcher(func, maxBatch, maxDelay, nthreads);
+}
+
+XMLFuncQueue::~XMLFuncQueue()
+{
+  delete dispatcher_;
+}
+
+void XMLFuncQueue::submit(size_t index, const Args_t &args, Request &request)
+{
+  _submit(index, args, &request, NULL, NULL);
+}
+
+void XMLFuncQueue::submit(size_t index, const Args_t &args, Callback_t callback, void *context)
+{
+  _submit(index, args, NULL, callback, context);
+}
+
+void XMLFuncQueue::submit(const string &name, const Args_t &args, Request &request)
+{
+  size_t index = func_.numFunctions();
+  try { index = func_.functionIndex(name); } catch( runtime_error & ) {}
+  _submit(index, args, &request, NULL, NULL);
+}
+
+void XMLFuncQueue::submit(const string &name, const Args_t &args, Callback_t callback, void *context)
+{
+  size_t index = func_.numFunctions();
+  try { index = func_.functionIndex(name); } catch( runtime_error & ) {}
+  _submit(index, args, NULL, callback, context);
+}
+
+// Requests which cannot be evaluated are completed at once (on the calling 
+//   thread) with the call status that XMLFunc::tryEval() would return.
+void XMLFuncQueue::_submit(size_t index, const Args_t &args, Request *request, Callback_t callback, void *context)
+{
+  Dispatcher::Target target;
+  target.request   = request;
+  target.callback  = callback;
+  target.context   = context;
+  target.submitted = Dispatcher::now();
+
+  if(request != NULL)
+  {
+    request->queue_  = this;
+    request->ready_  = false;
+  }
+
+  unsigned status = XMLFunc::Ok;
+  bool     arrays = false;
+  if( index >= func_.numFunctions() )
+  {
+    status = XMLFunc::UnknownFunction;
+  }
+  else
+  {
+    const XMLFunc::ArgDefs &argDefs = func_.argDefs(index);
+    if( args.size() < size_t(argDefs.count()) ) status = XMLFunc::MissingArguments;
+
+    for(int i=0; i<argDefs.count() && status == XMLFunc::Ok; ++i)
+    {
+      if( arg_matches(argDefs.type(i),args[i].type()) == false ) status = XMLFunc::ArgumentType;
+      if( argDefs.type(i) == Number_t::Array ) arrays = true;
+    }
+  }
+
+  // The arrays of the requests may differ in length, so they cannot share an
+  //   array column: functions with array arguments are evaluated at once.
+  if( status == XMLFunc::Ok && arrays )
+  {
+    Number_t value;
+    status = func_.tryEval(index, args, value);
+    Dispatcher::complete(target, double(value), status);
+  }
+  else if( status == XMLFunc::Ok ) dispatcher_->submit(index, args, target);
+  else                             Dispatcher::complete(target, 0., status);
+}
+
+void XMLFuncQueue::flush(void)
+{
+  dispatcher_->flush();
+}
+
+XMLFuncQueue::Stats XMLFuncQueue::stats(void) const
+{
+  return dispatcher_->stats();
+}
+
+void XMLFuncQueue::resetStats(void)
+{
+  dispatcher_->resetStats();
+}
+
+// Dispatcher methods
+
+XMLFuncQueue::Dispatcher::Dispatcher(const XMLFunc &func, size_t maxBatch, double maxDelay, unsigned nthreads)
+  : func_(func), maxBatch_(maxBatch > 0 ? maxBatch : 1), 
+    maxDelay_( maxDelay > 0. ? (unsigned long)(1.e9 * maxDelay) : 0 ), stop_(false), statsStart_(now())
+{
+  pthread_mutex_init(&mutex_,NULL);
+
+  // deadlines are monotonic times
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+  pthread_cond_init(&work_,&attr);
+  pthread_condattr_destroy(&attr);
+
+  pthread_cond_init(&completed_,NULL);
+
+  if(nthreads == 0) nthreads = 1;
+  for(unsigned i=0; i<nthreads; ++i)
+  {
+    pthread_t thread;
+    if( pthread_create(&thread,NULL,worker_thread,this) != 0 ) break;
+    threads_.push_back(thread);
+  }
+
+  if( threads_.empty() )
+  {
+    pthread_cond_destroy(&completed_);
+    pthread_cond_destroy(&work_);
+    pthread_mutex_destroy(&mutex_);
+    throw runtime_error("Failed to start the threads which evaluate queued requests");
+  }
+}
+
+// The threads evaluate every queued request before they exit
+XMLFuncQueue::Dispatcher::~Dispatcher()
+{
+  pthread_mutex_lock(&mutex_);
+  stop_ = true;
+  pthread_cond_broadcast(&work_);
+  pthread_mutex_unlock(&mutex_);
+
+  for(size_t i=0; i<threads_.size(); ++i) pthread_join(threads_[i],NULL);
+
+  for(vector<Batch *>::iterator b=free_.begin(); b!=free_.end(); ++b) delete *b;
+
+  pthread_cond_destroy(&completed_);
+  pthread_cond_destroy(&work_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void XMLFuncQueue::Dispatcher::submit(size_t index, const Args_t &args, const Target &target)
+{
+  const XMLFunc::ArgDefs &argDefs = func_.argDefs(index);
+  size_t nargs = size_t(argDefs.count());
+
+  pthread_mutex_lock(&mutex_);
+
+  map<size_t,Batch *>::iterator pending = pending_.find(index);
+  if( pending == pending_.end() )
+  {
+    Batch *batch = NULL;
+    if( free_.empty() ) { batch = new Batch; }
+    else                { batch = free_.back(); free_.pop_back(); }
+
+    batch->index    = index;
+    batch->deadline = target.submitted + maxDelay_;
+    batch->full     = false;
+    batch->ivals.resize(nargs);
+    batch->dvals.resize(nargs);
+
+    pending = pending_.insert( make_pair(index,batch) ).first;
+
+    pthread_cond_signal(&work_); // a new deadline
+  }
+
+  Batch &batch = *pending->second;
+  for(size_t i=0; i<nargs; ++i)
+  {
+    if( argDefs.type(int(i)) == Number_t::Integer ) batch.ivals[i].push_back( long(args[i])   );
+    else                                            batch.dvals[i].push_back( double(args[i]) );
+  }
+  batch.targets.push_back(target);
+
+  if( batch.targets.size() >= maxBatch_ )
+  {
+    batch.full = true;
+    send(pending);
+  }
+
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Moves a pending batch to the ready queue (the lock must be held)
+void XMLFuncQueue::Dispatcher::send(map<size_t,Batch *>::iterator pending)
+{
+  ready_.push_back(pending->second);
+  pending_.erase(pending);
+  pthread_cond_signal(&work_);
+}
+
+void XMLFuncQueue::Dispatcher::flush(void)
+{
+  pthread_mutex_lock(&mutex_);
+  while( pending_.empty() == false ) send(pending_.begin());
+  pthread_mutex_unlock(&mutex_);
+}
+
+void XMLFuncQueue::Dispatcher::wait(const Request &request)
+{
+  pthread_mutex_lock(&mutex_);
+  while( request.ready() == false ) pthread_cond_wait(&completed_,&mutex_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+void XMLFuncQueue::Dispatcher::complete(const Target &target, double value, unsigned status)
+{
+  if(target.request != NULL)
+  {
+    target.request->value_  = value;
+    target.request->status_ = status;
+    __atomic_store_n( &target.request->ready_, true, __ATOMIC_RELEASE );
+  }
+  else if(target.callback != NULL)
+  {
+    target.callback(target.context, value, status);
+  }
+}
+
+XMLFuncQueue::Stats XMLFuncQueue::Dispatcher::stats(void)
+{
+  pthread_mutex_lock(&mutex_);
+  Stats rval = stats_;
+  rval.seconds = 1.e-9 * double( now() - statsStart_ );
+  pthread_mutex_unlock(&mutex_);
+  return rval;
+}
+
+void XMLFuncQueue::Dispatcher::resetStats(void)
+{
+  pthread_mutex_lock(&mutex_);
+  stats_      = Stats();
+  statsStart_ = now();
+  pthread_mutex_unlock(&mutex_);
+}
+
+void *XMLFuncQueue::Dispatcher::worker_thread(void *arg)
+{
+  static_cast<Dispatcher *>(arg)->work();
+  return NULL;
+}
+
+// Evaluates ready batches, sending each pending batch when its deadline passes, 
+//   until the queue is stopped and every request has been evaluated.
+void XMLFuncQueue::Dispatcher::work(void)
+{
+  pthread_mutex_lock(&mutex_);
+  while(true)
+  {
+    if( ready_.empty() == false )
+    {
+      Batch *batch = ready_.front();
+      ready_.pop_front();
+
+      pthread_mutex_unlock(&mutex_);
+      evaluate(*batch);
+      pthread_mutex_lock(&mutex_);
+
+      for(size_t i=0; i<batch->ivals.size(); ++i) { batch->ivals[i].clear(); batch->dvals[i].clear(); }
+      batch->targets.clear();
+      free_.push_back(batch);
+
+      pthread_cond_broadcast(&completed_);
+      continue;
+    }
+
+    if( stop_ )
+    {
+      if( pending_.empty() ) break;
+      while( pending_.empty() == false ) send(pending_.begin());
+      continue;
+    }
+
+    unsigned long t = now();
+    unsigned long deadline = 0;
+    for(map<size_t,Batch *>::iterator b=pending_.begin(); b!=pending_.end(); )
+    {
+      map<size_t,Batch *>::iterator next = b; ++next;
+      if     ( b->second->deadline <= t )                    send(b);
+      else if( deadline == 0 || b->second->deadline < deadline ) deadline = b->second->deadline;
+      b = next;
+    }
+    if( ready_.empty() == false ) continue;
+
+    if( deadline == 0 ) 
+    {
+      pthread_cond_wait(&work_,&mutex_);
+    }
+    else
+    {
+      struct timespec ts;
+      ts.tv_sec  = time_t( deadline / 1000000000UL );
+      ts.tv_nsec = long(   deadline % 1000000000UL );
+      pthread_cond_timedwait(&work_,&mutex_,&ts);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Evaluates a batch (without the lock) and completes its requests
+void XMLFuncQueue::Dispatcher::evaluate(Batch &batch)
+{
+  size_t n = batch.targets.size();
+  const XMLFunc::ArgDefs &argDefs = func_.argDefs(batch.index);
+
+  BatchArgs_t args;
+  for(size_t i=0; i<batch.ivals.size(); ++i)
+  {
+    if( argDefs.type(int(i)) == Number_t::Integer ) args.add( &batch.ivals[i][0] );
+    else                                            args.add( &batch.dvals[i][0] );
+  }
+
+  batch.out.resize(n);
+  batch.status.resize(n);
+
+  unsigned long start = now();
+
+  unsigned status = func_.tryEval(batch.index, args, n, &batch.out[0], &batch.status[0]);
+  if( status >= XMLFunc::UnknownFunction ) 
+  {
+    // (a call status, nothing was evaluated)
+    for(size_t k=0; k<n; ++k) { batch.out[k] = 0.; batch.status[k] = (unsigned char)status; }
+  }
+
+  unsigned long end = now();
+
+  // latencies are measured before the callbacks are called (which may take any amount of time)
+  unsigned long latencies[Stats::LatencyBins] = {0};
+  for(size_t k=0; k<n; ++k)
+  {
+    unsigned long ns = end - batch.targets[k].submitted;
+
+    size_t bin = 0;
+    while( bin < Stats::LatencyBins-1 && ( ns >> (bin+1) ) != 0 ) ++bin;
+    ++latencies[bin];
+  }
+
+  for(size_t k=0; k<n; ++k) complete(batch.targets[k], batch.out[k], batch.status[k]);
+
+  pthread_mutex_lock(&mutex_);
+  stats_.requests    += n;
+  stats_.batches     += 1;
+  stats_.fullBatches += batch.full ? 1 : 0;
+  stats_.evalSeconds += 1.e-9 * double(end - start);
+  for(size_t b=0; b<Stats::LatencyBins; ++b) stats_.latencies[b] += latencies[b];
+  pthread_mutex_unlock(&mutex_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// XMLFunc::Op subclass methods
+////////////////////////////////////////////////////////////////////////////////
+
+// Deleting an operation deletes all of its operands.  Each operand is detached
+//   from its op before being deleted so that the tree is deleted without recursion.
+XMLFunc::Operation::~Operation()
+{
+  vector<Operation *> doomed;
+  doomed.swap(operands_);
+
+  while( doomed.empty() == false )
+  {
+    Operation *op = doomed.back();
+    doomed.pop_back();
+
+    doomed.insert(doomed.end(), op->operands_.begin(), op->operands_.end());
+    op->operands_.clear();
+
+    delete op;
+  }
+}
+
+// Copies each op in the tree (without its operands) and then links the copies
+//   as the original ops are linked.
+XMLFunc::Operation *XMLFunc::Operation::clone(void) const
+{
+  Operation *rval = copy();
+
+  vector< pair<const Operation *, Operation *> > pending(1, make_pair(this,rval));
+
+  while( pending.empty() == false )
+  {
+    const Operation *src = pending.back().first;
+    Operation       *dst = pending.back().second;
+    pending.pop_back();
+
+    for(size_t i=0; i<src->operands_.size(); ++i)
+    {
+      Operation *op = src->operands_[i]->copy();
+      dst->operands_.push_back(op);
+      pending.push_back( make_pair(src->operands_[i],op) );
+    }
+  }
+
+  return rval;
+}
+
+// Operations without float kernels compute in double precision.  Only the 
+//   double operands need widening; the value is rounded to float.
+void XMLFunc::Operation::evalBlockFloat(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+{
+  size_t n = batch.size();
+
+  for(size_t i=0; i<operands_.size(); ++i)
+  {
+    if( operands_[i]->type() == Number::Double )
+    {
+      Block_t &a = *operands[i];
+      for(size_t k=0; k<n; ++k) a.d[k] = double(a.f[k]);
+    }
+  }
+
+  evalBlock(batch,operands,out);
+
+  if( valueType_ == Number::Double )
+  {
+    for(size_t k=0; k<n; ++k) out.f[k] = float(out.d[k]);
+  }
+}
+
+// The status of a value is by default the status of its operands combined
+unsigned char XMLFunc::Operation::evalStatus(const Number_t *operands, const unsigned char *status) const
+{
+  unsigned char rval = Ok;
+  for(size_t i=0; i<operands_.size(); ++i) rval |= status[i];
+  return rval;
+}
+
+// Each row's operand status is read before its status is written, as out may 
+//   be one of the operands.
+void XMLFunc::Operation::evalBlockStatus(const Batch_t &batch, Block_t *const *operands, Block_t &out) const
+{
+  size_t n = batch.size();
+  size_t m = operands_.size();
+
+  for(size_t k=0; k<n; ++k)
+  {
+    unsigned char s = Ok;
+    for(size_t i=0; i<m; ++i) s |= operands[i]->status[k];
+    out.status[k] = s;
+  }
+}
+
+const string &XMLFunc::Operation::element(void) const
+{
+  static const string none;
+  return element_ == NULL ? none : *element_;
+}
+
+
+ConstOp::ConstOp(const XMLNode *xml, const Scope &scope, NumberType_t type)
+{
+  const string &value = xml->attributeValue("value");
+  if( value.empty() ) INVALID_XML("Const op must have a value attribute");
+
+  if( xml->hasChildren() ) INVALID_XML("Const op cannot have child ops");
+
+  string extra;
+  if(type == Number_t::Double)
+  {
+    double dval(0.);
+    if( ! read_double( value, dval, extra ) ) INVALID_XML("Invalid double value (" << value << ")");
+    value_ = Number_t(dval);
+  }
+  else
+  {
+    long ival(0);
+    if( ! read_integer( value, ival, extra ) ) INVALID_XML("Invalid integer value (" << value << ")");
+    value_ = Number_t(ival);
+  }
+  if( has_content(extra) ) INVALID_XML("Extraneous data (" << extra << ") following " << value);
+
+  valueType_ = value_.type();
+}
+
+
+size_t ArgOp::index(const XMLNode *xml, const ArgDefs_t &argDefs)
+{
+  size_t index(0);
+
+  const string &index_attr = xml->attributeValue("index");
+  const string &name_attr  = xml->attributeValue("name");
+
+  bool hasIndex = ( index_attr.empty() == false );
+  bool hasName  = ( name_attr.empty() == false );
+
+  if( hasIndex && hasName ) 
+  {
+    INVALID_XML("Arg op may only contain name or index attribute, not both");
+  }
+  else if(hasIndex)
+  {
+    long ival(0);
+    string extra;
+
+    if( read_integer(index_attr,ival,extra) == false )
+      INVALID_XML("index attribute is not an integer (" << index_attr << ")");
+
+    if(has_content(extra)) 
+      INVALID_XML("index attribute contains extraneous data (" << extra << ")");
+
+    index = (size_t)ival;
+
+    if( ival<0 || index >= size_t(argDefs.count()) )
+      INVALID_XML("Argument index " << index << " is out of range (0-" << argDefs.count()-1 << ")");
+  }
+  else if(hasName)
+  {
+    string name;
+    string extra;
+
+    if( read_token(name_attr,name,extra) == false )
+      INVALID_XML("Arg name attribute must contain a non-empty string");
+
+    if(has_content(extra)) 
+      INVALID_XML("name attribute contains extraneous data (" << extra << ")");
+
+    index = argDefs.index(name);
   }
   else
   {
-    op1_ = build_op(xml->child(0),argDefs);
-    op2_ = build_op(xml->child(1),argDefs);
+    INVALID_XML("Arg op must contain either name or index attribute");
+  }
+
+  return index;
+}
+
+// The operator constructors take ownership of the ops built from their child
+//   elements (see build_op) before validating them, so that they are deleted
+//   along with the partially constructed op if the XML is invalid.
+
+UnaryOp::UnaryOp(const XMLNode *xml, const Scope &scope, Type_t type, OpList_t &operands)
+  : type_(type)
+{
+  operands_.swap(operands);
+
+  const string &arg = xml->attributeValue("arg");
+
+  bool hasArg = arg.empty() == false;
+
+  size_t numArg  = xml->numChildren();
+  if(hasArg) ++numArg;
+
+  if(numArg == 0)
+    INVALID_XML(xml->name() << " op requires an arg attribute or child element");
+  if(numArg>1)
+    INVALID_XML(xml->name() << " op cannot specify more than one arg attribute or child element");
+
+  if(hasArg) 
+  {
+    operands_.push_back( build_op(arg,scope) );
+    scope.linker().locate(operands_.back(),xml,"arg");
+  }
+
+  bool keepsType = ( type_ == NEG || type_ == ABS );
+  valueType_ = ( keepsType ? operands_[0]->type() : Number_t::Double );
+}
+
+BinaryOp::BinaryOp(const XMLNode *xml, const Scope &scope, Type_t type, OpList_t &operands)
+  : type_(type), hasDivisor_(false), divisor_(1)
+{
+  static const char *attrs[2] = { "arg1", "arg2" };
+
+  operands_.swap(operands);
+
+  const string &arg1 = xml->attributeValue("arg1");
+  const string &arg2 = xml->attributeValue("arg2");
+
+  bool hasArg1 = arg1.empty() == false;
+  bool hasArg2 = arg2.empty() == false;
+
+  size_t numArg  = xml->numChildren();
+  if(hasArg1) ++numArg;
+  if(hasArg2) ++numArg;
+
+  if(numArg < 2)
+  {
+    INVALID_XML(xml->name() << " op requires two arg attributes or child elements");
+  }
+  else if(numArg>2)
+  {
+    INVALID_XML(xml->name() << " op cannot specify more than two arg attribute or child element");
+  }
+
+  insert_attribute_ops(operands_,xml,scope,attrs,2);
+
+  bool isInteger = operands_[0]->type() == Number_t::Integer && operands_[1]->type() == Number_t::Integer;
+
+  valueType_ = Number_t::Double;
+  switch(type_)
+  {
+    case SUB: case DIV: case MOD:
+      if(isInteger) valueType_ = Number_t::Integer;
+      break;
+
+    case POW: case ATAN2:
+      break;
+
+    case LT: case LE: case GT: case GE: case EQ: case NE:
+      valueType_ = Number_t::Integer;
+      break;
+  }
+
+  const ConstOp *d = dynamic_cast<const ConstOp *>(operands_[1]);
+  if( isDivision() && isInteger && d != NULL )
+  {
+    hasDivisor_ = true;
+    divisor_    = ConstDivisor( long(d->value()) );
+  }
+}
+
+ListOp::ListOp(const XMLNode *xml, const Scope &scope, Type_t type, OpList_t &operands) : type_(type)
+{
+  static const char *attrs[2] = { "arg1", "arg2" };
+
+  operands_.swap(operands);
+
+  const string &arg1 = xml->attributeValue("arg1");
+  const string &arg2 = xml->attributeValue("arg2");
+
+  bool hasArg1 = arg1.empty() == false;
+  bool hasArg2 = arg2.empty() == false;
+
+  size_t numArg  = xml->numChildren();
+  if(hasArg1) ++numArg;
+  if(hasArg2) ++numArg;
+
+  if(hasArg2 && numArg<2)
+    INVALID_XML(xml->name() << " op requires at least two arg attributes or child elements if arg2 is specified");
+
+  if(numArg<1)
+    INVALID_XML(xml->name() << " op requires at least one arg attribute or child element");
+
+  insert_attribute_ops(operands_,xml,scope,attrs,2);
+
+  valueType_ = Number_t::Integer;
+  for(OpList_t::const_iterator op = operands_.begin(); op!=operands_.end(); ++op)
+  {
+    if( (*op)->type() == Number_t::Double ) valueType_ = Number_t::Double;
+  }
+}
+
+TernaryOp::TernaryOp(const XMLNode *xml, const Scope &scope, Type_t type, OpList_t &operands) : type_(type)
+{
+  static const char *attrs[3] = { "arg1", "arg2", "arg3" };
+
+  operands_.swap(operands);
+
+  size_t numArg = xml->numChildren();
+  for(int i=0; i<3; ++i)
+  {
+    if( xml->attributeValue(attrs[i]).empty() == false ) ++numArg;
+  }
+
+  if(numArg != 3)
+    INVALID_XML(xml->name() << " op requires exactly three arg attributes or child elements");
+
+  insert_attribute_ops(operands_,xml,scope,attrs,3);
+
+  bool isInteger = operands_[1]->type() == Number_t::Integer && operands_[2]->type() == Number_t::Integer;
+  if( type_ == CLAMP ) isInteger = isInteger && operands_[0]->type() == Number_t::Integer;
+
+  valueType_ = ( isInteger ? Number_t::Integer : Number_t::Double );
+}
+
+LogOp::LogOp(const XMLNode *xml, const Scope &scope, OpList_t &operands) : UnaryOp(xml,scope,CHILD,operands)
+{
+  double base(10.);
+
+  string base_str = xml->attributeValue("base");
+  if( base_str.empty() == false )
+  {
+    string extra;
+    if( read_double(base_str, base, extra) == false ) INVALID_XML("Invalid base value (" << base_str << ") for log");
+    if( has_content(extra) )                          INVALID_XML("Extraneous data found for base value");
+    if(base <= 0.)                                    INVALID_XML("Base for log must be a positive value");
+  }
+
+  fac_ = 1. / log(base);
+}
+
+TableOp::TableOp(const XMLNode *xml, const Scope &scope, OpList_t &operands) 
+  : UnaryOp(xml,scope,CHILD,operands), interp_(LINEAR)
+{
+  const string &interp = xml->attributeValue("interp");
+  if     ( interp == "step"   ) interp_ = STEP;
+  else if( interp == "cubic"  ) interp_ = CUBIC;
+  else if( interp == "linear" || interp.empty() ) interp_ = LINEAR;
+  else INVALID_XML("table interp must be step, linear, or cubic (not " << interp << ")");
+
+  const char     *keys[2] = { "x", "y" };
+  vector<double>  values[2];
+  for(size_t i=0; i<2; ++i)
+  {
+    const string &attr = xml->attributeValue(keys[i]);
+    if( attr.empty() ) INVALID_XML("table requires x and y attributes");
+
+    size_t bad = read_doubles(attr,values[i]);
+    if( bad != string::npos )
+    {
+      size_t end = min( attr.find_first_of(" \t\n\r,",bad), attr.length() );
+      INVALID_XML("Invalid value (" << attr.substr(bad,end-bad) << ") in table " << keys[i] << " attribute");
+    }
+  }
+
+  const vector<double> &x = values[0];
+  const vector<double> &y = values[1];
+  size_t n = x.size();
+
+  if( n == 0 )         INVALID_XML("table requires at least one point");
+  if( y.size() != n )  INVALID_XML("table has " << n << " x values but " << y.size() << " y values");
+  if( n > UINT_MAX-1 ) INVALID_XML("table has too many points");
+
+  for(size_t i=0; i<n; ++i)
+  {
+    if( ! ( fabs(x[i]) <= numeric_limits<double>::max() ) ) INVALID_XML("table x values must be finite");
+    if( i > 0 && ! ( x[i] > x[i-1] ) ) 
+      INVALID_XML("table x values must be increasing (" << x[i] << " follows " << x[i-1] << ")");
+  }
+
+  xmin_ = x[0];
+  xmax_ = x[n-1];
+
+  // The second derivatives of the natural cubic spline (zero at both ends), 
+  //   solving the tridiagonal system by forward elimination and substitution
+
+  vector<double> m(n,0.);
+  if( interp_ == CUBIC && n > 2 )
+  {
+    vector<double> c(n,0.);
+    double slope0 = (y[1] - y[0]) / (x[1] - x[0]);
+    for(size_t i=1; i+1<n; ++i)
+    {
+      double h0     = x[i]   - x[i-1];
+      double h1     = x[i+1] - x[i];
+      double slope1 = (y[i+1] - y[i]) / h1;
+      double q      = 1. / ( 2. * (h0 + h1) - h0 * c[i-1] );
+      c[i] = h1 * q;
+      m[i] = ( 6. * (slope1 - slope0) - h0 * m[i-1] ) * q;
+      slope0 = slope1;
+    }
+    for(size_t i=n-2; i>0; --i) m[i] -= c[i] * m[i+1];
+  }
+
+  tree_.assign(n+1,0.);
+  segments_.assign(5*(n+1),0.);
+
+  fill(x,y,m,0,1);
+  setSegment(0,n,x,y,m);
+}
+
+size_t TableOp::fill(const vector<double> &x, const vector<double> &y, const vector<double> &m, size_t i, size_t k)
+{
+  if( k < tree_.size() )
+  {
+    i = fill(x,y,m,i,2*k);
+    tree_[k] = x[i];
+    setSegment(k,i,x,y,m);
+    i = fill(x,y,m,i+1,2*k+1);
+  }
+  return i;
+}
+
+void TableOp::setSegment(size_t k, size_t j, const vector<double> &x, const vector<double> &y, const vector<double> &m)
+{
+  size_t  n = x.size();
+  double *s = &segments_[5*k];
+
+  if( j == 0 || j == n )  // constant
+  {
+    s[0] = x[ j == 0 ? 0 : n-1 ];
+    s[1] = y[ j == 0 ? 0 : n-1 ];
+    return;
+  }
+
+  double h = x[j] - x[j-1];
+  s[0] = x[j-1];
+  s[1] = y[j-1];
+  switch(interp_)
+  {
+    case STEP:   break;
+    case LINEAR: s[2] = (y[j] - y[j-1]) / h; break;
+    case CUBIC:
+      s[2] = (y[j] - y[j-1]) / h - h * (2. * m[j-1] + m[j]) / 6.;
+      s[3] = m[j-1] / 2.;
+      s[4] = (m[j] - m[j-1]) / (6. * h);
+      break;
+  }
+}
+
+// The arrays are given by the arg (arg1 and arg2 for dot) attributes or by 
+//   <arg> child elements, each of which must reference an array argument.
+ArrayOp::ArrayOp(const XMLNode *xml, const Scope &scope, Type_t type, OpList_t &operands)
+  : type_(type), map_(NONE)
+{
+  static const char *attrs[2] = { "arg1", "arg2" };
+  static const char *attr[1]  = { "arg" };
+
+  operands_.swap(operands);
+
+  size_t numArg = ( type_ == DOT ? 2 : 1 );
+  insert_attribute_ops(operands_, xml, scope, ( type_ == DOT ? attrs : attr ), numArg);
+
+  if( operands_.size() != numArg )
+    INVALID_XML(xml->name() << " op requires " << ( numArg == 1 ? "one array" : "two arrays" ) << " (by attribute or child element)");
+
+  for(size_t i=0; i<numArg; ++i)
+  {
+    const ArgOp *a = dynamic_cast<const ArgOp *>(operands_[i]);
+    if( a == NULL || a->type() != Number_t::Array )
+      INVALID_XML(xml->name() << " op requires array arguments (declared as double[] in the arglist)");
+    index_.push_back( a->argIndex() );
+  }
+
+  for(OpList_t::iterator i=operands_.begin(); i!=operands_.end(); ++i) delete *i;
+  operands_.clear();
+
+  const string &map = xml->attributeValue("map");
+  if( type_ == NORM && map.empty() == false ) INVALID_XML("norm op cannot have a map attribute");
+
+  if     ( map.empty()      ) map_ = NONE;
+  else if( map == "abs"     ) map_ = ABS;
+  else if( map == "square"  ) map_ = SQUARE;
+  else if( map == "sqrt"    ) map_ = SQRT;
+  else if( map == "exp"     ) map_ = EXP;
+  else if( map == "ln"      ) map_ = LN;
+  else if( map == "sin"     ) map_ = SIN;
+  else if( map == "cos"     ) map_ = COS;
+  else if( map == "tan"     ) map_ = TAN;
+  else if( map == "asin"    ) map_ = ASIN;
+  else if( map == "acos"    ) map_ = ACOS;
+  else if( map == "atan"    ) map_ = ATAN;
+  else INVALID_XML("Unknown " << xml->name() << " map (" << map << ")");
+
+  valueType_ = Number_t::Double;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Support functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Determines if source is the name of a file or is already an XML string
+//   If the former, it loads the XML from the file
+//   If the latter, it simply returns the source string.
+// Yes, there is a huge assumption here... but if the file does not actually//   contain XML, it will be caught shortly.
+//   contain XML, it will be caught shortly.
+string load_xml(const string &src)
+{
+  // Assume src contains a filename and attempt to open it.
+  //   If it fails, then assume src is the xml string and return it.
+
+  ifstream s(src.c_str());
+  if(s.fail()) return src;
+
+  // read the contents into a string and return it.
+  
+  stringstream buffer;
+  buffer << s.rdbuf();
+
+  return buffer.str();
+}
+
+// Removes specified string (based on start/end) from XML (in place).  The
+//   removed text is replaced by spaces (keeping its line breaks) so that the 
+//   position of each remaining character, and its line and column, are unchanged.
+void strip_xml(string &rval, const string &start, const string &end)
+{
+  size_t pos = 0;
+  while(true)
+  {
+    size_t start_del = rval.find(start,pos);
+    if(start_del == string::npos) break;
+
+    size_t end_del = rval.find(end,start_del);
+    if(end_del==string::npos) INVALID_XML(start << " is missing closing " << end);
+
+    pos = end_del + end.size();
+    for(size_t i=start_del; i<pos; ++i)
+    {
+      const char *nl = static_cast<const char *>( memchr(&rval[i],'\n',pos-i) );
+      size_t stop = ( nl == NULL ? pos : size_t(nl - rval.data()) );
+      memset(&rval[i],' ',stop-i);
+      i = stop;
+    }
+  }
+}
+
+// Character classes of the tokenizer.  Each tests one character (has) or,
+//   with SSE2, gives the mask (0xff where in the class) of 16 or 32 of them.
+
+#ifdef XMLFUNC_SSE2
+static const bool cpu_has_avx2 = ( __builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0 );
+
+// lo <= c < lo+n in each byte
+inline __m128i in_range(__m128i v, char lo, char n)
+{
+  __m128i d = _mm_subs_epu8( _mm_sub_epi8(v,_mm_set1_epi8(lo)), _mm_set1_epi8(char(n-1)) );
+  return _mm_cmpeq_epi8(d,_mm_setzero_si128());
+}
+
+__attribute__((target("avx2"))) inline __m256i in_range(__m256i v, char lo, char n)
+{
+  __m256i d = _mm256_subs_epu8( _mm256_sub_epi8(v,_mm256_set1_epi8(lo)), _mm256_set1_epi8(char(n-1)) );
+  return _mm256_cmpeq_epi8(d,_mm256_setzero_si256());
+}
+
+#define XMLFUNC_CHAR_MASKS(expr) \
+  static __m128i mask(__m128i v) { \
+    using namespace sse2; return expr; } \
+  __attribute__((target("avx2"))) static __m256i mask(__m256i v) { \
+    using namespace avx2; return expr; }
+
+// The operations used by the masks (for 16 and 32 byte vectors)
+namespace sse2 {
+  inline __m128i eq (__m128i v, char c)     { return _mm_cmpeq_epi8(v,_mm_set1_epi8(c)); }
+  inline __m128i any(__m128i a, __m128i b)  { return _mm_or_si128(a,b); }
+}
+namespace avx2 {
+  __attribute__((target("avx2"))) inline __m256i eq (__m256i v, char c)    { return _mm256_cmpeq_epi8(v,_mm256_set1_epi8(c)); }
+  __attribute__((target("avx2"))) inline __m256i any(__m256i a, __m256i b) { return _mm256_or_si256(a,b); }
+}
+#else
+#define XMLFUNC_CHAR_MASKS(expr)
+#endif
+
+// whitespace (as isspace in the C locale)
+struct SpaceChars
+{
+  static bool has(char c) { return c == ' ' || (unsigned char)(c - '\t') < 5; }
+  XMLFUNC_CHAR_MASKS( any( eq(v,' '), in_range(v,'\t',5) ) )
+};
+
+// tag names and attribute keys
+struct NameChars
+{
+  static bool has(char c) { return (unsigned char)(c - 'a') < 26 || (unsigned char)(c - '0') < 10; }
+  XMLFUNC_CHAR_MASKS( any( in_range(v,'a',26), in_range(v,'0',10) ) )
+};
+
+// unquoted attribute values (the brackets for array types, e.g. double[])
+struct ValueChars
+{
+  static bool has(char c) { return NameChars::has(c) || c == '.' || c == '-' || c == '+' || c == '[' || c == ']'; }
+  XMLFUNC_CHAR_MASKS( any( NameChars::mask(v), any( any( eq(v,'.'), eq(v,'-') ), any( eq(v,'+'), any( eq(v,'['), eq(v,']') ) ) ) ) )
+};
+
+// the characters which end a tag or start a quoted value within it
+struct TagChars
+{
+  static bool has(char c) { return c == '>' || c == '"' || c == '\''; }
+  XMLFUNC_CHAR_MASKS( any( eq(v,'>'), any( eq(v,'"'), eq(v,'\'') ) ) )
+};
+
+#undef XMLFUNC_CHAR_MASKS
+
+#ifdef XMLFUNC_SSE2
+template<class C, bool in> __attribute__((target("avx2"))) 
+size_t scan_avx2(const char *s, size_t pos, size_t end)
+{
+  for( ; pos+32 <= end; pos += 32)
+  {
+    unsigned m = unsigned( _mm256_movemask_epi8( C::mask( _mm256_loadu_si256((const __m256i *)(s+pos)) ) ) );
+    if( in == false ) m = ~m;
+    if( m != 0 ) return pos + __builtin_ctz(m);
+  }
+  for( ; pos<end; ++pos)
+  {
+    if( C::has(s[pos]) == in ) return pos;
+  }
+  return end;
+}
+#endif
+
+// Returns the position of the first character of s[pos,end) which is (in=true)
+//   or is not (in=false) in the class C, or end if there is none
+template<class C, bool in> size_t scan(const char *s, size_t pos, size_t end)
+{
+  // Most runs (names, the whitespace between attributes) are short, so the 
+  //   first few characters are tested one at a time
+  for(size_t stop = min(end,pos+4); pos<stop; ++pos)
+  {
+    if( C::has(s[pos]) == in ) return pos;
+  }
+#ifdef XMLFUNC_SSE2
+  if( cpu_has_avx2 ) return scan_avx2<C,in>(s,pos,end);
+
+  for( ; pos+16 <= end; pos += 16)
+  {
+    unsigned m = unsigned( _mm_movemask_epi8( C::mask( _mm_loadu_si128((const __m128i *)(s+pos)) ) ) );
+    if( in == false ) m ^= 0xffff;
+    if( m != 0 ) return pos + __builtin_ctz(m);
+  }
+#endif
+  for( ; pos<end; ++pos)
+  {
+    if( C::has(s[pos]) == in ) return pos;
+  }
+  return end;
+}
+
+// Converts A-Z to a-z (leaving all other characters, as tolower does in the
+//   C locale)
+void lowercase(string &xml)
+{
+  if( xml.empty() ) return;
+
+  char  *s = &xml[0];
+  size_t n = xml.size();
+  size_t i = 0;
+#ifdef XMLFUNC_SSE2
+  for( ; i+16 <= n; i += 16)
+  {
+    __m128i v     = _mm_loadu_si128((const __m128i *)(s+i));
+    __m128i upper = in_range(v,'A',26);
+    _mm_storeu_si128( (__m128i *)(s+i), _mm_add_epi8( v, _mm_and_si128(upper,_mm_set1_epi8('a'-'A')) ) );
+  }
+#endif
+  for( ; i<n; ++i)
+  {
+    if( (unsigned char)(s[i] - 'A') < 26 ) s[i] += 'a' - 'A';
+  }
+}
+
+// Returns true if a value (or column) of valueType may be passed for an argument
+//   of argType: integers may be passed for doubles, but not doubles for integers,
+//   and only arrays for arrays.
+bool arg_matches(NumberType_t argType, NumberType_t valueType)
+{
+  if( argType == Number_t::Integer ) return valueType == Number_t::Integer;
+  if( argType == Number_t::Array )   return valueType == Number_t::Array;
+  return valueType != Number_t::Array;
+}
+
+// Array kernels.  Value i is added to lane i % ArrayLanes, each lane in order,
+//   so the lanes (and their total) are the same whichever instructions compute
+//   them.  Separate lanes let the adds of consecutive values overlap.
+
+#ifdef XMLFUNC_SSE2
+__attribute__((target("avx2"))) 
+size_t add_lanes_avx2(const double *a, const double *b, size_t n, double *lanes)
+{
+  __m256d s0 = _mm256_loadu_pd(lanes),   s1 = _mm256_loadu_pd(lanes+4);
+  __m256d s2 = _mm256_loadu_pd(lanes+8), s3 = _mm256_loadu_pd(lanes+12);
+
+  size_t i = 0;
+  for( ; i+ArrayLanes <= n; i += ArrayLanes)
+  {
+    __m256d a0 = _mm256_loadu_pd(a+i),   a1 = _mm256_loadu_pd(a+i+4);
+    __m256d a2 = _mm256_loadu_pd(a+i+8), a3 = _mm256_loadu_pd(a+i+12);
+    if( b != NULL )
+    {
+      a0 = _mm256_mul_pd( a0, _mm256_loadu_pd(b+i)   );
+      a1 = _mm256_mul_pd( a1, _mm256_loadu_pd(b+i+4) );
+      a2 = _mm256_mul_pd( a2, _mm256_loadu_pd(b+i+8) );
+      a3 = _mm256_mul_pd( a3, _mm256_loadu_pd(b+i+12) );
+    }
+    s0 = _mm256_add_pd(s0,a0);
+    s1 = _mm256_add_pd(s1,a1);
+    s2 = _mm256_add_pd(s2,a2);
+    s3 = _mm256_add_pd(s3,a3);
+  }
+
+  _mm256_storeu_pd(lanes,   s0);  _mm256_storeu_pd(lanes+4,  s1);
+  _mm256_storeu_pd(lanes+8, s2);  _mm256_storeu_pd(lanes+12, s3);
+  return i;
+}
+
+// 16 lanes, in 8 registers of 2
+size_t add_lanes_sse2(const double *a, const double *b, size_t n, double *lanes)
+{
+  __m128d s0 = _mm_loadu_pd(lanes),    s1 = _mm_loadu_pd(lanes+2);
+  __m128d s2 = _mm_loadu_pd(lanes+4),  s3 = _mm_loadu_pd(lanes+6);
+  __m128d s4 = _mm_loadu_pd(lanes+8),  s5 = _mm_loadu_pd(lanes+10);
+  __m128d s6 = _mm_loadu_pd(lanes+12), s7 = _mm_loadu_pd(lanes+14);
+
+  size_t i = 0;
+  for( ; i+ArrayLanes <= n; i += ArrayLanes)
+  {
+    __m128d a0 = _mm_loadu_pd(a+i),    a1 = _mm_loadu_pd(a+i+2);
+    __m128d a2 = _mm_loadu_pd(a+i+4),  a3 = _mm_loadu_pd(a+i+6);
+    __m128d a4 = _mm_loadu_pd(a+i+8),  a5 = _mm_loadu_pd(a+i+10);
+    __m128d a6 = _mm_loadu_pd(a+i+12), a7 = _mm_loadu_pd(a+i+14);
+    if( b != NULL )
+    {
+      a0 = _mm_mul_pd( a0, _mm_loadu_pd(b+i)    );
+      a1 = _mm_mul_pd( a1, _mm_loadu_pd(b+i+2)  );
+      a2 = _mm_mul_pd( a2, _mm_loadu_pd(b+i+4)  );
+      a3 = _mm_mul_pd( a3, _mm_loadu_pd(b+i+6)  );
+      a4 = _mm_mul_pd( a4, _mm_loadu_pd(b+i+8)  );
+      a5 = _mm_mul_pd( a5, _mm_loadu_pd(b+i+10) );
+      a6 = _mm_mul_pd( a6, _mm_loadu_pd(b+i+12) );
+      a7 = _mm_mul_pd( a7, _mm_loadu_pd(b+i+14) );
+    }
+    s0 = _mm_add_pd(s0,a0);  s1 = _mm_add_pd(s1,a1);
+    s2 = _mm_add_pd(s2,a2);  s3 = _mm_add_pd(s3,a3);
+    s4 = _mm_add_pd(s4,a4);  s5 = _mm_add_pd(s5,a5);
+    s6 = _mm_add_pd(s6,a6);  s7 = _mm_add_pd(s7,a7);
+  }
+
+  _mm_storeu_pd(lanes,    s0);  _mm_storeu_pd(lanes+2,  s1);
+  _mm_storeu_pd(lanes+4,  s2);  _mm_storeu_pd(lanes+6,  s3);
+  _mm_storeu_pd(lanes+8,  s4);  _mm_storeu_pd(lanes+10, s5);
+  _mm_storeu_pd(lanes+12, s6);  _mm_storeu_pd(lanes+14, s7);
+  return i;
+}
+#endif
+
+// Adds a[i]*b[i] (or a[i] if b is NULL) for each i < n to the lanes
+void add_lanes(const double *a, const double *b, size_t n, double *lanes)
+{
+  size_t i = 0;
+#ifdef XMLFUNC_SSE2
+  i = ( cpu_has_avx2 ? add_lanes_avx2(a,b,n,lanes) : add_lanes_sse2(a,b,n,lanes) );
+#endif
+  for( ; i+ArrayLanes <= n; i += ArrayLanes)
+  {
+    if( b == NULL ) for(size_t j=0; j<ArrayLanes; ++j) lanes[j] += a[i+j];
+    else            for(size_t j=0; j<ArrayLanes; ++j) lanes[j] += a[i+j] * b[i+j];
+  }
+  for(size_t j=0; i<n; ++i, ++j)
+  {
+    lanes[j] += ( b == NULL ? a[i] : a[i] * b[i] );
   }
 }
 
-ListOp::ListOp(const XMLNode *xml, const ArgDefs_t &argDefs,Type_t type) : type_(type)
+// The lanes are added pairwise
+double lane_total(const double *lanes)
 {
-  const string &arg1 = xml->attributeValue("arg1");
-  const string &arg2 = xml->attributeValue("arg2");
+  double s[ArrayLanes];
+  for(size_t j=0; j<ArrayLanes; ++j) s[j] = lanes[j];
+  for(size_t m=ArrayLanes/2; m>0; m/=2)
+  {
+    for(size_t j=0; j<m; ++j) s[j] += s[j+m];
+  }
+  return s[0];
+}
 
-  bool hasArg1 = arg1.empty() == false;
-  bool hasArg2 = arg2.empty() == false;
+// Locates the first non-whitespace character in the string beginning at
+//   the specified location.  Returns string::npos if all reamaining 
+//   characters are white space.
+size_t skip_whitespace(const string &s,size_t pos)
+{
+  size_t end = s.length();
+  if( pos >= end ) return string::npos;
 
-  size_t numArg  = xml->numChildren();
-  if(hasArg1) ++numArg;
-  if(hasArg2) ++numArg;
+  pos = scan<SpaceChars,false>(s.data(),pos,end);
+  return ( pos == end ? string::npos : pos );
+}
+
+// Locates the first character following the tag name or attribute key (a-z 
+//   and 0-9) beginning at the specified location, or string::npos if there is
+//   none
+size_t skip_name(const string &s,size_t pos)
+{
+  size_t end = s.length();
+  if( pos >= end ) return string::npos;
+
+  pos = scan<NameChars,false>(s.data(),pos,end);
+  return ( pos == end ? string::npos : pos );
+}
+
+// As skip_name, for an unquoted attribute value (which may also contain . - +)
+size_t skip_value(const string &s,size_t pos)
+{
+  size_t end = s.length();
+  if( pos >= end ) return string::npos;
+
+  pos = scan<ValueChars,false>(s.data(),pos,end);
+  return ( pos == end ? string::npos : pos );
+}
+
+// Returns the position following the element whose opening tag is at pos (or
+//   npos if there is no such position).  Only the nesting of the tags is 
+//   followed (skipping quoted attribute values); the element is checked 
+//   when it is parsed (see parse_roots).
+size_t skip_element(const string &xml, size_t pos)
+{
+  const size_t end = xml.length();
+
+  size_t depth = 0;
+  do
+  {
+    pos = xml.find('<',pos);
+    if( pos == string::npos ) return string::npos;
+
+    bool is_closing = ( xml.compare(pos,2,"</") == 0 );
+
+    size_t p = pos + 1;
+    while( (p = scan<TagChars,true>(xml.data(),p,end)) < end && xml[p] != '>' )
+    {
+      p = xml.find(xml[p],p+1);  // closing quote
+      if( p == string::npos ) return string::npos;
+      ++p;
+    }
+    if( p == end ) return string::npos;
+
+    if( is_closing )
+    {
+      if( depth == 0 ) return string::npos;
+      --depth;
+    }
+    else if( xml[p-1] != '/' )
+    {
+      ++depth;
+    }
+
+    pos = p + 1;
+  }
+  while( depth > 0 );
+
+  return pos;
+}
+
+// Parses each of the root level elements, keeping only depth levels of the
+//   elements within them (see XMLNode::parse)
+void parse_roots(const string &xml, size_t depth, XMLRoots &roots)
+{
+  size_t pos = 0;
+  while( skip_whitespace(xml,pos) != string::npos )
+  {
+    XMLNode *node = XMLNode::parse(xml,pos,depth);
+    if( node==NULL ) INVALID_XML("Failed to parse root level element");
+
+    roots.push_back(node);
+  }
+}
+
+// Parses the root level elements as above, using up to nthreads threads.  The
+//   XML is first split at the end of each root level element (by skip_element)
+//   so that they may be parsed independently.  If any element cannot be parsed
+//   (or the XML cannot be split), false is returned, with nothing kept, so that
+//   the error may be reported by parsing the elements in order.
+bool parse_roots(const string &xml, size_t depth, XMLRoots &roots, unsigned nthreads)
+{
+  vector<size_t> starts, ends;
+
+  size_t pos = 0;
+  while( (pos = skip_whitespace(xml,pos)) != string::npos )
+  {
+    if( xml[pos] != '<' ) return false;
+
+    starts.push_back(pos);
+    pos = skip_element(xml,pos);
+    if( pos == string::npos ) return false;
+    ends.push_back(pos);
+  }
+
+  XMLRoots parsed;
+  parsed.assign(starts.size(),NULL);
+
+  ParseTask task(xml,depth,starts,ends,parsed);
+  run_parallel(task,starts.size(),nthreads);
+
+  if( task.failed() ) return false;
+
+  roots.insert(roots.end(),parsed.begin(),parsed.end());
+  parsed.clear();
+  return true;
+}
+
+
+// returns whether or not the string has something other than whitespace
+bool has_content(const string &s)
+{
+  return skip_whitespace(s) != string::npos;
+}
+
+// extracts the first token and attempts to interpret it as a double
+//   if succesful, true is returned and tail is set to the substring following the first token
+//   otherwise, false is returned and tail is set to the empty string
+//
+// As with strtod, only the leading number in the token is read (e.g. "1.5x" 
+//   is read as 1.5), but the decimal point is always '.' whatever the locale.
+bool read_double(const string &s, double &val, string &tail)
+{
+  string token;
+  if( read_token(s,token,tail) == false ) return false;
+
+  const char *a = token.c_str();
+  if( parse_double( a, a + token.length(), val ) == NULL ) { tail = ""; return false; }
+
+  return true;
+}
+
+// extracts the first token and attempts to interpret it as a long integer
+//   if succesful, true is returned and tail is set to the substring following the first token
+//   otherwise, false is returned and tail is set to the empty string
+bool read_integer(const string &s, long &val, string &tail)
+{
+  string token;
+  if( read_token(s,token,tail) == false ) return false;
+
+  const char *a = token.c_str();
+  char *b(NULL);
+
+  val = strtol(a,&b,10);
+
+  if( a==b ) { tail = ""; return false; }
+  
+  return true;
+}
+
+// Reads all of the values in s (separated by whitespace and/or commas) into
+//   dvals.  Returns string::npos if they are all valid, otherwise the position 
+//   of the first invalid value.
+size_t read_doubles(const string &s, vector<double> &dvals)
+{
+  dvals.clear();
+
+  const char *p   = s.data();
+  const char *end = p + s.length();
+  while(true)
+  {
+    while( p < end && ( *p == ',' || SpaceChars::has(*p) ) ) ++p;
+    if( p == end ) break;
+
+    double      v;
+    const char *q = parse_double(p,end,v);
+    if( q == NULL || ( q != end && *q != ',' && SpaceChars::has(*q) == false ) ) return size_t(p - s.data());
+
+    dvals.push_back(v);
+    p = q;
+  }
+  return string::npos;
+}
+
+// Parses the number at the start of [s,end) without regard to the locale (the 
+//   decimal point is always '.').  Returns the position following it, or NULL 
+//   if s does not start with a number.
+//
+// A number whose digits (without the decimal point) are less than 2^53, with a
+//   decimal exponent of at most 22, is computed from the digits with a single 
+//   rounding, as both the digits and the power of 10 are exact doubles.  This 
+//   covers nearly all of the numbers written in XML.  Others (and inf, nan, and
+//   hexadecimal) are left to strtod (in the C locale).
+const char *parse_double(const char *s, const char *end, double &val)
+{
+  static const double powers[23] = 
+  {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11, 
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  const char *p = s;
+  bool negative = ( p < end && *p == '-' );
+  if( p < end && ( *p == '-' || *p == '+' ) ) ++p;
+
+  unsigned long long digits = 0;
+  int    exponent = 0;
+  size_t ndigits  = 0;
+  bool   exact    = true;   // all of the significant digits are in digits
+
+  for( ; p < end && (unsigned char)(*p - '0') < 10; ++p, ++ndigits )
+  {
+    if( digits < 100000000000000000ULL ) digits = 10 * digits + (unsigned)(*p - '0');
+    else                                 { ++exponent; exact = exact && *p == '0'; }
+  }
+  if( p < end && *p == '.' )
+  {
+    for( ++p; p < end && (unsigned char)(*p - '0') < 10; ++p, ++ndigits )
+    {
+      if( digits < 100000000000000000ULL ) { digits = 10 * digits + (unsigned)(*p - '0'); --exponent; }
+      else                                 { exact = exact && *p == '0'; }
+    }
+  }
+
+  // not a decimal number: leave it to strtod (e.g. inf)
+  if( ndigits == 0 || ( p < end && *p == 'x' ) ) exact = false;
+
+  if( exact && p < end && *p == 'e' )
+  {
+    const char *q = p + 1;
+    bool negexp = ( q < end && *q == '-' );
+    if( q < end && ( *q == '-' || *q == '+' ) ) ++q;
+
+    if( q < end && (unsigned char)(*q - '0') < 10 )
+    {
+      int e = 0;
+      for( ; q < end && (unsigned char)(*q - '0') < 10; ++q )
+      {
+        if( e < 100000 ) e = 10 * e + (*q - '0');
+      }
+      exponent += ( negexp ? -e : e );
+      p = q;
+    }
+  }
+
+  if( exact && digits < (1ULL << 53) && exponent >= -22 && exponent <= 22 )
+  {
+    double v = double(digits);
+    if( exponent < 0 ) v /= powers[-exponent];
+    else               v *= powers[exponent];
+    val = ( negative ? -v : v );
+    return p;
+  }
+
+  // The slow path is given a copy (up to the next separator) as strtod needs
+  //   a terminated string
+
+  const char *stop = s;
+  while( stop < end && *stop != ',' && SpaceChars::has(*stop) == false ) ++stop;
+
+  string token(s,stop);
+  char  *tail = NULL;
+#ifdef __GLIBC__
+  static locale_t c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+  val = strtod_l(token.c_str(), &tail, c_locale);
+#else
+  val = strtod(token.c_str(), &tail);
+#endif
+  if( tail == token.c_str() ) return NULL;
+
+  return s + ( tail - token.c_str() );
+}
+
+// Parses the (decimal) integer at the start of [s,end).  Returns the position
+//   following it, or NULL if s does not start with an integer or it is out of 
+//   the range of a long.
+const char *parse_integer(const char *s, const char *end, long &val)
+{
+  const char *p = s;
+  bool negative = ( p < end && *p == '-' );
+  if( p < end && ( *p == '-' || *p == '+' ) ) ++p;
+
+  const unsigned long limit = ( negative ? 0UL - (unsigned long)LONG_MIN : (unsigned long)LONG_MAX );
+
+  const char   *first = p;
+  unsigned long v     = 0;
+  for( ; p < end && (unsigned char)(*p - '0') < 10; ++p )
+  {
+    unsigned d = (unsigned)(*p - '0');
+    if( v > ( limit - d ) / 10 ) return NULL;
+    v = 10 * v + d;
+  }
+  if( p == first ) return NULL;
+
+  val = ( negative ? long(0UL - v) : long(v) );
+  return p;
+}
+
+// extracts the first token from the input string
+//   returns true if one is found and sets tail to the following substring
+//   returns false if no token is found
+bool read_token(const string &s, string &token, string &tail)
+{
+  token = "";
+  tail  = "";
+
+  size_t n = s.length();
+
+  size_t a(0);
+  while( a<n && isspace(s[a]) ) ++a;
+
+  if(a==n) return false;
+
+  size_t b(a);
+  while( b<n && isspace(s[b])==false ) ++b;
+
+  token = s.substr(a,b-a);
+  tail  = s.substr(b);
+
+  return true;
+}
+
+
+// Shared state of the threads running a ParallelTask
+struct ParallelRun
+{
+  ParallelTask    *task;
+  size_t           nparts;
+  size_t           next;
+  bool             failed;
+  string           error;
+  pthread_mutex_t  mutex;
+};
+
+void *run_parallel_thread(void *arg)
+{
+  ParallelRun *run = (ParallelRun *)arg;
+
+  while(true)
+  {
+    size_t part = __sync_fetch_and_add(&run->next,size_t(1));
+    if(part >= run->nparts) break;
+
+    try
+    {
+      run->task->run(part);
+    }
+    catch( exception &e )
+    {
+      pthread_mutex_lock(&run->mutex);
+      if(run->failed == false) run->error = e.what();
+      run->failed = true;
+      pthread_mutex_unlock(&run->mutex);
+
+      __sync_fetch_and_add(&run->next,run->nparts);  // skip the remaining parts
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Runs task.run(i) for each part i in [0,nparts) using up to nthreads threads
+//   (the calling thread is one of these).  Parts are handed out in order as
+//   threads become available.  If any part throws an exception, the remaining
+//   parts are skipped and a runtime_error is thrown once all threads finish.
+void run_parallel(ParallelTask &task, size_t nparts, unsigned nthreads)
+{
+  ParallelRun run;
+  run.task   = &task;
+  run.nparts = nparts;
+  run.next   = 0;
+  run.failed = false;
+  pthread_mutex_init(&run.mutex,NULL);
+
+  if( nthreads > nparts ) nthreads = unsigned(nparts);
+
+  vector<pthread_t> threads;
+  for(unsigned i=1; i<nthreads; ++i)
+  {
+    pthread_t thread;
+    if( pthread_create(&thread,NULL,run_parallel_thread,&run) != 0 ) break;
+    threads.push_back(thread);
+  }
+
+  run_parallel_thread(&run);
+
+  for(size_t i=0; i<threads.size(); ++i) pthread_join(threads[i],NULL);
+
+  pthread_mutex_destroy(&run.mutex);
+
+  if(run.failed) throw runtime_error(run.error);
+}
+
+// Integer arithmetic wraps around (two's complement) in every eval path rather
+//   than overflowing, which is undefined for signed values.  The unsigned
+//   operations vectorize just as the signed ones do.
+inline long wrap_add(long a, long b) { return long( (unsigned long)a + (unsigned long)b ); }
+inline long wrap_sub(long a, long b) { return long( (unsigned long)a - (unsigned long)b ); }
+inline long wrap_mul(long a, long b) { return long( (unsigned long)a * (unsigned long)b ); }
+inline long wrap_neg(long a)         { return long( 0UL - (unsigned long)a ); }
+
+// Converts the values in a block populated by the specified op to double
+//   values (in place) if the op computes integer values.
+void as_double(const XMLFunc::Operation *op, Block_t &block, size_t n)
+{
+  if( op->type() == Number_t::Integer )
+  {
+    for(size_t k=0; k<n; ++k) block.d[k] = double(block.i[k]);
+  }
+}
+
+// Converts the values in a block populated by the specified op to double or 
+//   float values (in place) if the op computes integer values.
+template<class Real_t>
+void as_real(const XMLFunc::Operation *op, Block_t &block, size_t n)
+{
+  if( op->type() == Number_t::Integer )
+  {
+    Real_t *r = Lanes<Real_t>::of(block);
+    for(size_t k=0; k<n; ++k) r[k] = Real_t(block.i[k]);
+  }
+}
+
+// Converts the function values in a block (populated by the specified root op)
+//   to double (d) or float (f) values, whatever their type and precision.
+void as_double(const XMLFunc::Operation *op, const Batch_t &batch, Block_t &block)
+{
+  size_t n = batch.size();
+
+  if     ( op->type() == Number_t::Integer ) { for(size_t k=0; k<n; ++k) block.d[k] = double(block.i[k]); }
+  else if( batch.single() )                  { for(size_t k=0; k<n; ++k) block.d[k] = double(block.f[k]); }
+}
+
+void as_float(const XMLFunc::Operation *op, const Batch_t &batch, Block_t &block)
+{
+  size_t n = batch.size();
+
+  if     ( op->type() == Number_t::Integer ) { for(size_t k=0; k<n; ++k) block.f[k] = float(block.i[k]); }
+  else if( batch.single() == false )         { for(size_t k=0; k<n; ++k) block.f[k] = float(block.d[k]); }
+}
+
+// Lists the nodes of a profile (given the parent of each node, see Program::nodes)
+//   root first, with each node followed by its operands (in order)
+void preorder_nodes(const vector<size_t> &parents, vector<size_t> &order)
+{
+  size_t n = parents.size();
+
+  order.clear();
+  order.reserve(n);
+
+  // Operands precede their op, so each op's operands are listed in order by
+  //   walking the nodes in reverse and linking each to its op's first operand
+
+  vector<size_t> first(n,string::npos);
+  vector<size_t> next(n,string::npos);
+  vector<size_t> pending;
+
+  for(size_t i=n; i>0; --i)
+  {
+    size_t p = parents[i-1];
+    if(p == string::npos) 
+    {
+      pending.push_back(i-1);
+    }
+    else
+    {
+      next[i-1] = first[p];
+      first[p]  = i-1;
+    }
+  }
+
+  while( pending.empty() == false )
+  {
+    size_t node = pending.back();
+    pending.pop_back();
+
+    order.push_back(node);
+
+    // push the operands so that the first is popped first
+
+    size_t nchild = 0;
+    for(size_t c=first[node]; c!=string::npos; c=next[c]) { pending.push_back(c); ++nchild; }
+    reverse(pending.end()-nchild, pending.end());
+  }
+}
+
+// Returns the shared copy of an element name (see Operation::element).  The
+//   names are never freed, so an op may refer to its element name for as long 
+//   as it exists (and the set of distinct names is small).
+// FNV-1a, a byte at a time
+size_t hash_mix(size_t h, unsigned long v)
+{
+  for(size_t i=0; i<sizeof(v); ++i, v >>= 8)
+  {
+    h ^= (v & 0xff);
+    h *= 1099511628211UL;
+  }
+  return h;
+}
+
+size_t hash_doubles(size_t h, const double *v, size_t n)
+{
+  for(size_t i=0; i<n; ++i)
+  {
+    unsigned long bits;
+    memcpy(&bits, v+i, sizeof(bits));
+    h = hash_mix(h,bits);
+  }
+  return h;
+}
+
+// Compares the values bit for bit
+bool same_doubles(const double *a, const double *b, size_t n)
+{
+  return memcmp(a, b, n * sizeof(double)) == 0;
+}
 
-  if(hasArg2 && numArg<2)
-    INVALID_XML(xml->name() << " op requires at least two arg attributes or child elements if arg2 is specified");
+const string *intern_element(const string &element)
+{
+  static set<string>     elements;
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
-  if(numArg<1)
-    INVALID_XML(xml->name() << " op requires at least one arg attribute or child element");
+  pthread_mutex_lock(&mutex);
+  const string *rval = &*elements.insert(element).first;
+  pthread_mutex_unlock(&mutex);
 
-  size_t j(0);
-  for(size_t i=0; i<numArg; ++i)
-  {
-    OpPtr_t op = NULL;
-    if( i==0 && hasArg1 )      op = build_op( arg1, argDefs );
-    else if( i==1 && hasArg2 ) op = build_op( arg2, argDefs );
-    else                       op = build_op( xml->child(j++), argDefs );
-    ops_.push_back(op);
-  }
+  return rval;
 }
 
-LogOp::LogOp(const XMLNode *xml, const ArgDefs_t &argDefs) : UnaryOp(xml,argDefs,CHILD)
+// Returns the upper edge (in seconds) of the latency bin below which fraction q
+//   of the counts lie.  Bin b counts latencies from 2^b to 2^(b+1) nanoseconds.
+double latency_quantile(const unsigned long *bins, size_t nbins, double q)
 {
-  double base(10.);
+  unsigned long total(0);
+  for(size_t b=0; b<nbins; ++b) total += bins[b];
 
-  string base_str = xml->attributeValue("base");
-  if( base_str.empty() == false )
+  if(total == 0) return 0.;
+
+  double        target = q * double(total);
+  unsigned long count(0);
+
+  size_t b = 0;
+  for( ; b<nbins-1; ++b)
   {
-    string extra;
-    if( read_double(base_str, base, extra) == false ) INVALID_XML("Invalid base value (" << base_str << ") for log");
-    if( has_content(extra) )                          INVALID_XML("Extraneous data found for base value");
-    if(base <= 0.)                                    INVALID_XML("Base for log must be a positive value");
+    count += bins[b];
+    if( count > 0 && double(count) >= target ) break;
   }
 
-  fac_ = 1. / log(base);
+  return 1.e-9 * double( 2UL << b );
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Support functions
-////////////////////////////////////////////////////////////////////////////////
+// One element of the op tree being built by build_op
+struct BuildFrame
+{
+  BuildFrame(const XMLNode *x, const Scope *s) : xml(x), scope(s), next(0), callee(NULL), body(NULL) {}
+
+  const XMLNode *xml;
+  const Scope   *scope;
+  size_t         next;      // next child element to build
+  OpList_t       operands;  // ops built from the child elements
+  Scope         *callee;    // (<call> only) scope of the called function's body
+  OpPtr_t        body;      // (<call> only) op built from (or copied for) the called function's body
+};
 
-// Determines if source is the name of a file or is already an XML string
-//   If the former, it loads the XML from the file
-//   If the latter, it simply returns the source string.
-// Yes, there is a huge assumption here... but if the file does not actually//   contain XML, it will be caught shortly.
-//   contain XML, it will be caught shortly.
-string load_xml(const string &src)
+// Constructs an XMLFunc::operation pointer from an XMLNode
+//   The elements are visited depth first using an explicit stack, so that the
+//   depth of the XML is not limited by the depth of the call stack.  Each op is
+//   constructed once the ops for all of its child elements have been built.  A
+//   <call> element is replaced by the called function's body, which is built
+//   (on the same stack) in the scope of the call.
+OpPtr_t build_op(const XMLNode *xml, const Scope &scope)
 {
-  // Assume src contains a filename and attempt to open it.
-  //   If it fails, then assume src is the xml string and return it.
+  deque<BuildFrame> stack;  // a deque so that pushing frames does not move the others
+  stack.push_back( BuildFrame(xml,&scope) );
 
-  ifstream s(src.c_str());
-  if(s.fail()) return src;
+  OpPtr_t rval=NULL;
 
-  // read the contents into a string and return it.
-  
-  stringstream buffer;
-  buffer << s.rdbuf();
+  try
+  {
+    while( stack.empty() == false )
+    {
+      BuildFrame &frame = stack.back();
 
-  return buffer.str();
-}
+      const XMLNode *node = frame.xml;
+      const Scope   &s    = *frame.scope;
 
-// Removes specified string (based on start/end) from XML
-string strip_xml(const string &xml, const string &start, const string &end)
-{
-  // If the string is empty, there is no cleanup to be done.
-  if(xml.empty()) return xml;
+      OpPtr_t op=NULL;
+
+      if( frame.next == 0 )
+      {
+        if( op == NULL ) op = ConstOp::build( node, s );
+        if( op == NULL ) op =   ArgOp::build( node, s );
+      }
 
-  string rval = xml;
+      if( op == NULL && frame.next < node->numChildren() )
+      {
+        stack.push_back( BuildFrame(node->child(frame.next++),&s) );
+        continue;
+      }
 
-  // remove all occurances of start.[stuff].end
+      if( op == NULL && node->name() == "call" )
+      {
+        if( frame.callee == NULL && frame.body == NULL )
+        {
+          const XMLNode *body = s.linker().enter( node, frame.operands, frame.callee, frame.body );
+          if( body != NULL )
+          {
+            stack.push_back( BuildFrame(body,frame.callee) );
+            continue;
+          }
+        }
+        else
+        {
+          s.linker().inlined( frame.operands, frame.body );
+          s.linker().leave();
+        }
 
-  while(true)
-  {
-    size_t start_del = rval.find(start);
-    if(start_del == string::npos) break;
+        op = frame.body;
+        frame.body = NULL;
 
-    size_t end_del = rval.find(end,start_del);
-    if(end_del==string::npos) INVALID_XML(start << " is missing closing " << end);
+        for(OpList_t::iterator i=frame.operands.begin(); i!=frame.operands.end(); ++i) delete *i;
+        frame.operands.clear();
+
+        delete frame.callee;
+        frame.callee = NULL;
+      }
+
+      if( op == NULL ) op =   UnaryOp::build( node, s, frame.operands );
+      if( op == NULL ) op =  BinaryOp::build( node, s, frame.operands );
+      if( op == NULL ) op =    ListOp::build( node, s, frame.operands );
+      if( op == NULL ) op = TernaryOp::build( node, s, frame.operands );
+      if( op == NULL ) op =     LogOp::build( node, s, frame.operands );
+      if( op == NULL ) op =   TableOp::build( node, s, frame.operands );
+      if( op == NULL ) op =   ArrayOp::build( node, s, frame.operands );
+
+      if( op == NULL) 
+        INVALID_XML("Unrecognized operator name (" << node->name() << ")");
 
-    rval.erase(start_del, end_del + end.size() - start_del);
+      // array arguments are only read by the array ops (or passed on by <call>)
+      bool arrayOperand = false;
+      for(size_t i=0; i<op->numOperands(); ++i) arrayOperand = arrayOperand || op->operand(i)->type() == Number_t::Array;
+      if( dynamic_cast<const CallOp *>(op) != NULL ) arrayOperand = false;
+
+      bool arrayValue = ( op->type() == Number_t::Array && stack.size() == 1 );
+
+      if( arrayOperand || arrayValue ) delete op;
+      if( arrayOperand ) INVALID_XML(node->name() << " op cannot take an array argument (only dot, sum, and norm can)");
+      if( arrayValue   ) INVALID_XML("function value cannot be an array argument");
+
+      s.linker().locate(op,node);
+      s.linker().grow(1);
+
+      stack.pop_back();
+
+      if     ( stack.empty() )                rval = op;
+      else if( stack.back().callee != NULL )  stack.back().body = op;
+      else                                    stack.back().operands.push_back(op);
+    }
+  }
+  catch(...)
+  {
+    for(deque<BuildFrame>::iterator f=stack.begin(); f!=stack.end(); ++f)
+    {
+      for(OpList_t::iterator i=f->operands.begin(); i!=f->operands.end(); ++i) delete *i;
+      delete f->body;
+      delete f->callee;
+    }
+    throw;
   }
 
   return rval;
 }
 
-// Locates the first non-whitespace character in the string beginning at
-//   the specified location.  Returns string::npos if all reamaining 
-//   characters are white space.
-size_t skip_whitespace(const string &s,size_t pos)
+// Inserts the ops specified by attribute values (e.g. arg1="x") among the ops
+//   built from the child elements.  Position i is taken by the op specified by
+//   attrs[i] if the element has that attribute, or otherwise by the next op 
+//   built from the child elements.
+void insert_attribute_ops(OpList_t &operands, const XMLNode *xml, const Scope &scope, const char **attrs, size_t nattrs)
 {
-  size_t end = s.length();
-  for(size_t i=pos; i<end; ++i)
+  for(size_t i=0; i<nattrs; ++i)
   {
-    if( isspace(s[i]) == false ) return i;
+    const string &value = xml->attributeValue(attrs[i]);
+    if( value.empty() == false ) 
+    {
+      operands.insert( operands.begin() + i, build_op(value,scope) );
+      scope.linker().locate(operands[i],xml,attrs[i]);
+    }
   }
-  return string::npos;
 }
 
-
-// returns whether or not the string has something other than whitespace
-bool has_content(const string &s)
+// Constructs an XMLFunc::operation pointer from an attribute value
+OpPtr_t build_op(const string &xml, const Scope &scope)
 {
-  for(size_t i=0; i<s.length(); ++i)
+  string token;
+  string extra;
+
+  if( read_token(xml,token,extra) == false ) INVALID_XML("empty argument value");
+  if( has_content(extra) )                   INVALID_XML("extraneous data in arg value ('" << extra << "')");
+
+  // the value is an integer only if the whole token is one (so "0.5" is a double)
+  const char *a = token.c_str();
+  const char *b = a + token.length();
+
+  long ival;
+  if( parse_integer( a, b, ival ) == b ) return new ConstOp(ival);
+
+  double dval;
+  if( read_double( token, dval, extra ) )
   {
-    if( isspace( s[i] ) == false ) return true;
+    if(has_content(extra)) 
+      INVALID_XML("Extraneous data found after double value (" << extra << ")");
+
+    return new ConstOp(dval);
   }
-  return false;
+
+  pair<size_t,bool> rc = scope.argDefs().find(token);
+  if( rc.second == false ) INVALID_XML("Unrecognized argument name (" << token << ")");
+
+  return scope.arg(rc.first);
 }
 
-// extracts the first token and attempts to interpret it as a double
-//   if succesful, true is returned and tail is set to the substring following the first token
-//   otherwise, false is returned and tail is set to the empty string
-bool read_double(const string &s, double &val, string &tail)
+size_t count_ops(const XMLFunc::Operation *root)
 {
-  string token;
-  if( read_token(s,token,tail) == false ) return false;
+  size_t rval(0);
 
-  const char *a = token.c_str();
-  char *b(NULL);
+  vector<const XMLFunc::Operation *> pending(1,root);
+  while( pending.empty() == false )
+  {
+    const XMLFunc::Operation *op = pending.back();
+    pending.pop_back();
 
-  val = strtod(a,&b);
+    ++rval;
+    for(size_t i=0; i<op->numOperands(); ++i) pending.push_back(op->operand(i));
+  }
 
-  if( a==b ) { tail = ""; return false; }
-  
-  return true;
+  return rval;
 }
 
-// extracts the first token and attempts to interpret it as a long integer
-//   if succesful, true is returned and tail is set to the substring following the first token
-//   otherwise, false is returned and tail is set to the empty string
-bool read_integer(const string &s, long &val, string &tail)
+// Combines h with the parameters and location of the root of the tree and of 
+//   its operands, so that trees for which same_tree() is true have the same 
+//   hash.  The rest of the tree is not visited, so the cost does not depend
+//   on the size of the tree.
+size_t tree_hash(size_t h, const XMLFunc::Operation *root)
 {
-  string token;
-  if( read_token(s,token,tail) == false ) return false;
+  for(size_t i=0; i<=root->numOperands(); ++i)
+  {
+    const XMLFunc::Operation *op = ( i == 0 ? root : root->operand(i-1) );
 
-  const char *a = token.c_str();
-  char *b(NULL);
+    h = hash_mix(h,op->hash());
+    h = hash_mix(h,op->type());
+    h = hash_mix(h,op->line());
+    h = hash_mix(h,op->column());
+    h = hash_mix(h,op->numOperands());
+  }
 
-  val = strtol(a,&b,10);
+  return h;
+}
+
+// True if the trees compute the same values and were built from the same 
+//   elements (so that either may be used in place of the other, see Profile)
+bool same_tree(const XMLFunc::Operation *a, const XMLFunc::Operation *b)
+{
+  vector< pair<const XMLFunc::Operation *, const XMLFunc::Operation *> > pending(1, make_pair(a,b));
+  while( pending.empty() == false )
+  {
+    const XMLFunc::Operation *x = pending.back().first;
+    const XMLFunc::Operation *y = pending.back().second;
+    pending.pop_back();
+
+    if( typeid(*x) != typeid(*y) || x->type() != y->type() )                 return false;
+    if( x->numOperands() != y->numOperands() || x->equivalent(*y) == false ) return false;
+    if( &x->element() != &y->element() || x->line() != y->line() || x->column() != y->column() ) return false;
+
+    for(size_t i=0; i<x->numOperands(); ++i) pending.push_back( make_pair(x->operand(i),y->operand(i)) );
+  }
 
-  if( a==b ) { tail = ""; return false; }
-  
   return true;
 }
 
-// extracts the first token from the input string
-//   returns true if one is found and sets tail to the following substring
-//   returns false if no token is found
-bool read_token(const string &s, string &token, string &tail)
+// The polynomial computed by an op (if it computes one) in terms of a single
+//   argument.  Constants are polynomials (of degree 0) in no argument.
+struct Polynomial
 {
-  token = "";
-  tail  = "";
+  static const size_t MaxDegree = 32;
 
-  size_t n = s.length();
+  Polynomial(void) : valid(false), x(NULL), integral(false) {}
 
-  size_t a(0);
-  while( a<n && isspace(s[a]) ) ++a;
+  // A constant (integer constants are integral)
+  Polynomial(const Number_t &c) : valid(true), x(NULL), integral(c.isInteger()), coefficients(1,double(c)) 
+  {
+    if(integral) integers.assign(1,long(c));
+  }
 
-  if(a==n) return false;
+  // The argument itself
+  Polynomial(const ArgOp *a) : valid(true), x(a), integral(true), coefficients(2,0.), integers(2,0L)
+  {
+    coefficients[1] = 1.;
+    integers[1]     = 1;
+  }
 
-  size_t b(a);
-  while( b<n && isspace(s[b])==false ) ++b;
+  size_t degree(void) const { return coefficients.size() - 1; }
 
-  token = s.substr(a,b-a);
-  tail  = s.substr(b);
+  // A constant, or a constant times a power of the argument
+  bool monomial(void) const
+  {
+    size_t terms = 0;
+    for(size_t j=0; j<coefficients.size(); ++j) if( coefficients[j] != 0. ) ++terms;
+    return valid && terms <= 1;
+  }
 
-  return true;
-}
+  bool sameArg(const Polynomial &p) const
+  {
+    return x == NULL || p.x == NULL || x->argIndex() == p.x->argIndex();
+  }
 
+  void add(const Polynomial &p, double sign)
+  {
+    if( valid == false || p.valid == false || sameArg(p) == false ) { valid = false; return; }
 
-// Constructs an XMLFunc::operation pointer from an XMLNode
-OpPtr_t build_op(const XMLNode *xml, const ArgDefs_t &argDefs)
-{
-  OpPtr_t rval=NULL;
+    if(x == NULL) x = p.x;
 
-  if( rval == NULL ) rval =  ConstOp::build( xml, argDefs );
-  if( rval == NULL ) rval =    ArgOp::build( xml, argDefs );
-  if( rval == NULL ) rval =  UnaryOp::build( xml, argDefs );
-  if( rval == NULL ) rval = BinaryOp::build( xml, argDefs );
-  if( rval == NULL ) rval =   ListOp::build( xml, argDefs );
-  if( rval == NULL ) rval =    LogOp::build( xml, argDefs );
+    size_t n = max(coefficients.size(), p.coefficients.size());
+    coefficients.resize(n,0.);
+    for(size_t j=0; j<p.coefficients.size(); ++j) coefficients[j] += sign * p.coefficients[j];
 
-  if( rval == NULL) 
-    INVALID_XML("Unrecognized operator name (" << xml->name() << ")");
+    integral = integral && p.integral;
+    if(integral)
+    {
+      integers.resize(n,0L);
+      for(size_t j=0; j<p.integers.size(); ++j) integers[j] += long(sign) * p.integers[j];
+    }
+    else
+    {
+      integers.clear();
+    }
+  }
 
-  return rval;
-}
+  // Products are only expanded where one factor is a monomial: expanding the
+  //   product of two polynomials with several terms each (e.g. (x-1)^10) gives
+  //   coefficients whose terms cancel badly near the roots of the factors
+  void multiply(const Polynomial &p)
+  {
+    if( valid == false || p.valid == false || sameArg(p) == false ) { valid = false; return; }
+    if( monomial() == false && p.monomial() == false )              { valid = false; return; }
+    if( degree() + p.degree() > MaxDegree )                         { valid = false; return; }
 
+    if(x == NULL) x = p.x;
 
-// Constructs an XMLFunc::operation pointer from an attribute value
-OpPtr_t build_op(const string &xml, const ArgDefs_t &argDefs)
+    size_t n = coefficients.size() + p.coefficients.size() - 1;
+
+    vector<double> c(n,0.);
+    for(size_t i=0; i<coefficients.size(); ++i)
+    {
+      for(size_t j=0; j<p.coefficients.size(); ++j) c[i+j] += coefficients[i] * p.coefficients[j];
+    }
+    coefficients.swap(c);
+
+    integral = integral && p.integral;
+    if(integral)
+    {
+      vector<long> ic(n,0L);
+      for(size_t i=0; i<integers.size(); ++i)
+      {
+        for(size_t j=0; j<p.integers.size(); ++j) ic[i+j] += integers[i] * p.integers[j];
+      }
+      integers.swap(ic);
+    }
+    else
+    {
+      integers.clear();
+    }
+  }
+
+  void scale(double f)
+  {
+    for(size_t j=0; j<coefficients.size(); ++j) coefficients[j] *= f;
+    integral = false;
+    integers.clear();
+  }
+
+  bool           valid;
+  const ArgOp   *x;             // the argument (NULL if constant)
+  bool           integral;      // the op's value is an integer for an integer argument value
+  vector<double> coefficients;  // coefficients[j] multiplies x^j
+  vector<long>   integers;      // (integral only) the same coefficients
+};
+
+const size_t Polynomial::MaxDegree;
+
+// The polynomial computed by op, given those computed by its operands
+Polynomial polynomial(const XMLFunc::Operation *op, const vector<Polynomial> &operands)
 {
-  string token;
-  string extra;
+  if( const ConstOp *c = dynamic_cast<const ConstOp *>(op) ) return Polynomial(c->value());
 
-  if( read_token(xml,token,extra) == false ) INVALID_XML("empty argument value");
-  if( has_content(extra) )                   INVALID_XML("extraneous data in arg value ('" << extra << "')");
+  Polynomial rval;
 
-  long ival;
-  if( read_integer( token, ival, extra ) )
+  // integer ops with non-constant values use integer arithmetic (and division)
+
+  if( op->type() == Number_t::Integer ) return rval;
+
+  if( const ArgOp *a = dynamic_cast<const ArgOp *>(op) )
   {
-    if(has_content(extra)) 
-      INVALID_XML("Extraneous data found after integer value (" << extra << ")");
+    rval = Polynomial(a);
+  }
+  else if( const ListOp *l = dynamic_cast<const ListOp *>(op) )
+  {
+    if( l->opType() == ListOp::ADD || l->opType() == ListOp::MULT )
+    {
+      rval = operands[0];
+      for(size_t i=1; i<operands.size(); ++i)
+      {
+        if( l->opType() == ListOp::ADD ) rval.add(operands[i],1.);
+        else                             rval.multiply(operands[i]);
+      }
+    }
+  }
+  else if( const BinaryOp *b = dynamic_cast<const BinaryOp *>(op) )
+  {
+    const Polynomial &p = operands[0];
+    const Polynomial &q = operands[1];
+
+    bool isConst = ( q.valid && q.x == NULL );
+
+    switch(b->opType())
+    {
+      case BinaryOp::SUB:
+        rval = p;
+        rval.add(q,-1.);
+        break;
 
-    return new ConstOp(ival);
+      case BinaryOp::POW:
+        if( isConst && p.valid && p.x != NULL && p.monomial() )
+        {
+          double e = q.coefficients[0];
+          if( e >= 0. && e <= double(Polynomial::MaxDegree) && e == floor(e) )
+          {
+            rval = Polynomial( Number_t(1L) );
+            for(long i=0; i<long(e) && rval.valid; ++i) rval.multiply(p);
+            rval.scale(1.);  // pow() always has a double value
+          }
+        }
+        break;
+
+      case BinaryOp::DIV:
+        if( isConst && q.coefficients[0] != 0. && ( p.integral == false || q.integral == false ) )
+        {
+          rval = p;
+          rval.scale( 1. / q.coefficients[0] );
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+  else if( const UnaryOp *u = dynamic_cast<const UnaryOp *>(op) )
+  {
+    if( u->opType() == UnaryOp::NEG )
+    {
+      rval = Polynomial( Number_t(0L) );
+      rval.add(operands[0],-1.);
+    }
   }
 
-  double dval;
-  if( read_double( token, dval, extra ) )
+  return rval;
+}
+
+// One op of the tree being visited by fold_polynomials
+struct PolyFrame
+{
+  PolyFrame(OpPtr_t o) : op(o), next(0) {}
+  OpPtr_t            op;
+  size_t             next;      // next operand to visit
+  vector<Polynomial> operands;  // polynomials computed by the visited operands
+};
+
+// Replaces each largest subtree which computes a polynomial (of degree 2 or
+//   more) in one argument with a PolyOp.  The ops are visited depth first using
+//   an explicit stack (as in build_op).  Returns the new root (which may be a
+//   PolyOp replacing the original root, which is then deleted).
+OpPtr_t fold_polynomials(OpPtr_t root)
+{
+  deque<PolyFrame> stack(1,PolyFrame(root));
+  Polynomial   result;
+
+  while( stack.empty() == false )
   {
-    if(has_content(extra)) 
-      INVALID_XML("Extraneous data found after double value (" << extra << ")");
+    PolyFrame &frame = stack.back();
+    OpPtr_t    op    = frame.op;
 
-    return new ConstOp(dval);
+    if( frame.next < op->numOperands() )
+    {
+      stack.push_back( PolyFrame( op->operand(frame.next++) ) );
+      continue;
+    }
+
+    Polynomial p = polynomial(op,frame.operands);
+
+    if( p.valid == false )
+    {
+      for(size_t i=0; i<op->numOperands(); ++i)
+      {
+        const Polynomial &q = frame.operands[i];
+        if( q.valid && q.x != NULL && q.degree() >= 2 ) 
+        {
+          OpPtr_t poly = new PolyOp( q.x->clone(), q.coefficients, q.integers );
+          poly->locate( &op->operand(i)->element(), op->operand(i)->line(), op->operand(i)->column() );
+          delete op->replaceOperand(i,poly);
+        }
+      }
+    }
+
+    stack.pop_back();
+
+    if( stack.empty() ) result = p;
+    else                stack.back().operands.push_back(p);
   }
 
-  pair<size_t,bool> rc = argDefs.find(token);
-  if( rc.second == false ) INVALID_XML("Unrecognized argument name (" << token << ")");
+  if( result.valid && result.x != NULL && result.degree() >= 2 )
+  {
+    OpPtr_t poly = new PolyOp( result.x->clone(), result.coefficients, result.integers );
+    poly->locate( &root->element(), root->line(), root->column() );
+    delete root;
+    root = poly;
+  }
 
-  return new ArgOp(rc.first);
+  return root;
 }
-
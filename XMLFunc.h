@@ -22,6 +22,8 @@ class XMLFunc
     typedef std::map<std::string,size_t>  Xref_t;
     typedef std::pair<std::string,size_t> XrefEntry_t;
 
+    class ArgDefs;
+
     /*!
      * \class XMLFunc::Number
      * \brief integer or double value
@@ -29,74 +31,88 @@ class XMLFunc
      * Objects of this class can be used to pass/store arguments that may be
      * either double or integer values.  Each object "knows" which type it
      * contains based on its constructor.
+     *
+     * A Number may also reference a caller owned array of doubles, which is
+     * passed for an array argument (type="double[]" in the arglist).  Arrays
+     * are only arguments: every operation has an integer or double value.
      */
 
     class Number
     {
       public:
-        typedef enum {Integer, Double} Type_t;
+        typedef enum {Integer, Double, Array} Type_t;
 
       public:
         /// \brief default constructor (0.0)
-        Number(void)             : type_(Double),  ival_(0), dval_(0.0) {}
+        Number(void)             : type_(Double),  ival_(0), dval_(0.0), avals_(NULL) {}
         /// \brief integer constructor
-        Number(long v)           : type_(Integer), ival_(v), dval_(double(v)) {}
+        Number(long v)           : type_(Integer), ival_(v), dval_(double(v)), avals_(NULL) {}
         /// \brief integer constructor
-        Number(int v)            : type_(Integer), ival_(v), dval_(double(v)) {}
+        Number(int v)            : type_(Integer), ival_(v), dval_(double(v)), avals_(NULL) {}
         /// \brief integer constructor
-        Number(short v)          : type_(Integer), ival_(v), dval_(double(v)) {}
+        Number(short v)          : type_(Integer), ival_(v), dval_(double(v)), avals_(NULL) {}
         /// \brief integer constructor
-        Number(unsigned long v)  : type_(Integer), ival_(v), dval_(double(v)) {}
+        Number(unsigned long v)  : type_(Integer), ival_(v), dval_(double(v)), avals_(NULL) {}
         /// \brief integer constructor
-        Number(unsigned int v)   : type_(Integer), ival_(v), dval_(double(v)) {}
+        Number(unsigned int v)   : type_(Integer), ival_(v), dval_(double(v)), avals_(NULL) {}
         /// \brief integer constructor
-        Number(unsigned short v) : type_(Integer), ival_(v), dval_(double(v)) {}
+        Number(unsigned short v) : type_(Integer), ival_(v), dval_(double(v)), avals_(NULL) {}
         /// \brief double constructor
-        Number(double v)         : type_(Double),  ival_(int(v)), dval_(v) {}
+        Number(double v)         : type_(Double),  ival_(int(v)), dval_(v), avals_(NULL) {}
         /// \brief double constructor
-        Number(float v)          : type_(Double),  ival_(int(v)), dval_(v) {}
+        Number(float v)          : type_(Double),  ival_(int(v)), dval_(v), avals_(NULL) {}
+        /// \brief array constructor (the n values at v, which must outlive the Number)
+        Number(const double *v, size_t n) : type_(Array), ival_(long(n)), dval_(0.0), avals_(v) {}
         /// \brief copy constructor
-        Number(const Number &x)  : type_(x.type_), ival_(x.ival_), dval_(x.dval_) {}
+        Number(const Number &x)  : type_(x.type_), ival_(x.ival_), dval_(x.dval_), avals_(x.avals_) {}
       
         /// \brief integer cast operator
         operator long(void)   const { return ival_;    }
         /// \brief double cast operator
         operator double(void) const { return dval_; }
 
-        /// \brief Integer or Double
+        /// \brief Integer, Double, or Array
         Type_t type(void) const { return type_; }
 
         /// \brief Returns true if type is Integer
         bool isInteger(void) const { return type_ == Integer; }
         bool isDouble(void)  const { return type_ == Double;  }
+        bool isArray(void)   const { return type_ == Array;   }
 
-        /// \brief Changes value to negative of current value
+        /// \brief array values (NULL unless type is Array)
+        const double *array(void)  const { return avals_; }
+        /// \brief number of array values (0 unless type is Array)
+        size_t        length(void) const { return type_ == Array ? size_t(ival_) : 0; }
+
+        /// \brief Changes value to negative of current value (integers wrap around)
         const Number &negate(void) 
         { 
-          ival_ = -ival_; 
+          ival_ = long( 0UL - (unsigned long)ival_ ); 
           dval_ = -dval_; 
           return *this; 
         }
 
-        /// \brief Changes value to absolute value of current value
+        /// \brief Changes value to absolute value of current value (integers wrap around)
         const Number &abs(void) 
         { 
-          ival_    = std::abs(ival_); 
+          if( ival_ < 0 ) ival_ = long( 0UL - (unsigned long)ival_ ); 
           dval_ = std::fabs(dval_); 
           return *this; 
         }
 
         void write(std::ostream &s) const
         {
-          if(type_ == Integer) { s << ival_; }
-          else                 { s << dval_; }
+          if     (type_ == Integer) { s << ival_; }
+          else if(type_ == Array)   { s << "double[" << ival_ << "]"; }
+          else                      { s << dval_; }
         }
 
       private:
         /// \cond PRIVATE
-        Type_t type_;
-        long   ival_;
-        double dval_;
+        Type_t        type_;
+        long          ival_;   // (the length of an array)
+        double        dval_;
+        const double *avals_;
         /// \endcond
     };
 
@@ -112,30 +128,494 @@ class XMLFunc
     {
       public:
         void add(const Number &v) { push_back(v); }
+        void add(const double *v, size_t n) { push_back(Number(v,n)); }
+    };
+
+    /*!
+     * \class XMLFunc::Stride
+     * \brief distance in bytes from the value of one row to that of the next (see Column)
+     */
+
+    struct Stride
+    {
+      explicit Stride(size_t b) : bytes(b) {}
+      size_t bytes;
+    };
+
+    /*!
+     * \class XMLFunc::Column
+     * \brief column of integer or double argument values used in batch evaluation
+     *
+     * A column does not own its values.  It simply references a caller owned array
+     * with (at least) one value for each row being evaluated.  Double arguments may 
+     * also be passed as float columns, which halves the memory read (see SinglePrecision).
+     *
+     * An array column holds an array of the same length for each row, one after
+     * another: the array of row r is the length values from avals() + r * length().
+     *
+     * A column constructed with a Stride reads the value of row r from stride bytes 
+     * times r past the first value, rather than from the next element of the array.
+     * The fields of an array of records are then read in place, e.g.
+     * Column(&quotes[0].bid, Stride(sizeof(Quote))).  The values must be aligned for
+     * their type.
+     */
+
+    class Column
+    {
+      public:
+        /// \brief integer column constructor
+        Column(const long *v)   : type_(Number::Integer), ivals_(v),    dvals_(NULL), fvals_(NULL), avals_(NULL), length_(0), stride_(sizeof(long))   {}
+        /// \brief double column constructor
+        Column(const double *v) : type_(Number::Double),  ivals_(NULL), dvals_(v),    fvals_(NULL), avals_(NULL), length_(0), stride_(sizeof(double)) {}
+        /// \brief float column constructor (a Double column)
+        Column(const float *v)  : type_(Number::Double),  ivals_(NULL), dvals_(NULL), fvals_(v),    avals_(NULL), length_(0), stride_(sizeof(float))  {}
+        /// \brief array column constructor (length values per row)
+        Column(const double *v, size_t length)
+          : type_(Number::Array), ivals_(NULL), dvals_(NULL), fvals_(NULL), avals_(v), length_(length), stride_(length * sizeof(double)) {}
+
+        /// \brief strided integer column constructor
+        Column(const long *v, Stride s)   : type_(Number::Integer), ivals_(v),    dvals_(NULL), fvals_(NULL), avals_(NULL), length_(0), stride_(s.bytes) {}
+        /// \brief strided double column constructor
+        Column(const double *v, Stride s) : type_(Number::Double),  ivals_(NULL), dvals_(v),    fvals_(NULL), avals_(NULL), length_(0), stride_(s.bytes) {}
+        /// \brief strided float column constructor (a Double column)
+        Column(const float *v, Stride s)  : type_(Number::Double),  ivals_(NULL), dvals_(NULL), fvals_(v),    avals_(NULL), length_(0), stride_(s.bytes) {}
+        /// \brief strided array column constructor (the length values of each row are consecutive)
+        Column(const double *v, size_t length, Stride s)
+          : type_(Number::Array), ivals_(NULL), dvals_(NULL), fvals_(NULL), avals_(v), length_(length), stride_(s.bytes) {}
+
+        /// \brief Integer, Double, or Array
+        Number::Type_t type(void) const { return type_; }
+
+        /// \brief integer values (NULL if a double column)
+        const long   *ivals(void) const { return ivals_; }
+        /// \brief double values (NULL if an integer or float column)
+        const double *dvals(void) const { return dvals_; }
+        /// \brief float values (NULL unless a float column)
+        const float  *fvals(void) const { return fvals_; }
+        /// \brief array values of every row (NULL unless an array column)
+        const double *avals(void) const { return avals_; }
+        /// \brief number of array values in each row (0 unless an array column)
+        size_t        length(void) const { return length_; }
+
+        /// \brief bytes from the value (or array) of one row to that of the next
+        size_t        stride(void) const { return stride_; }
+        /// \brief true unless the values of consecutive rows are further apart than their size
+        bool          contiguous(void) const
+        {
+          return stride_ == ( ivals_ ? sizeof(long) : dvals_ ? sizeof(double) : fvals_ ? sizeof(float) : length_ * sizeof(double) );
+        }
+
+        /// \brief the value (or array) of row r
+        long          ival (size_t r) const { return *at(ivals_,r); }
+        double        dval (size_t r) const { return *at(dvals_,r); }
+        float         fval (size_t r) const { return *at(fvals_,r); }
+        const double *array(size_t r) const { return  at(avals_,r); }
+
+      private:
+        /// \cond PRIVATE
+        template<class T>
+        const T *at(const T *v, size_t r) const 
+        { 
+          return reinterpret_cast<const T *>( reinterpret_cast<const char *>(v) + r * stride_ ); 
+        }
+
+        Number::Type_t  type_;
+        const long     *ivals_;
+        const double   *dvals_;
+        const float    *fvals_;
+        const double   *avals_;
+        size_t          length_;
+        size_t          stride_;   // (bytes)
+        /// \endcond
+    };
+
+    /*! 
+     * \class XMLFunc::BatchArgs
+     * \brief list of XML::Column objects, passed to batch eval calls
+     *
+     * This is the batch equivalent of XMLFunc::Args.  Each column provides the
+     * values of one argument for every row being evaluated.
+     */
+
+    class BatchArgs : public std::vector<Column>
+    {
+      public:
+        void add(const long   *v) { push_back(Column(v)); }
+        void add(const double *v) { push_back(Column(v)); }
+        void add(const float  *v) { push_back(Column(v)); }
+        void add(const double *v, size_t length) { push_back(Column(v,length)); }
+        void add(const long   *v, Stride s) { push_back(Column(v,s)); }
+        void add(const double *v, Stride s) { push_back(Column(v,s)); }
+        void add(const float  *v, Stride s) { push_back(Column(v,s)); }
+        void add(const double *v, size_t length, Stride s) { push_back(Column(v,length,s)); }
+    };
+
+    /*!
+     * \class XMLFunc::Axis
+     * \brief the values taken by one double argument over a sweep (see sweep())
+     *
+     * The argument is identified by its (0 based) index or by its name in the
+     * function's arglist.
+     */
+
+    class Axis
+    {
+      public:
+        /// \brief count values evenly spaced from first to last (inclusive)
+        Axis(size_t arg, double first, double last, size_t count);
+        /// \brief count values evenly spaced from first to last (inclusive) of the named argument
+        Axis(const std::string &arg, double first, double last, size_t count);
+        /// \brief the count values at v (which are copied)
+        Axis(size_t arg, const double *v, size_t count);
+        /// \brief the count values at v (which are copied) of the named argument
+        Axis(const std::string &arg, const double *v, size_t count);
+
+        /// \brief index of the argument (0 if it is identified by name)
+        size_t             index(void) const { return index_; }
+        /// \brief name of the argument (empty if it is identified by index)
+        const std::string &name(void)  const { return name_; }
+
+        /// \brief number of values
+        size_t size(void) const { return values_.size(); }
+
+        /// \brief the values, in the order they are evaluated
+        const std::vector<double> &values(void) const { return values_; }
+
+      private:
+        /// \cond PRIVATE
+        friend class XMLFunc;
+
+        void linspace(double first, double last, size_t count);
+
+        size_t              index_;
+        std::string         name_;    // (empty if identified by index)
+        std::vector<double> values_;
+        /// \endcond
+    };
+
+    /*!
+     * \class XMLFunc::Summary
+     * \brief streaming summary statistics (count, sum, mean, min, max, variance)
+     *
+     * Values may be added one at a time or a block at a time.  Two summaries may be
+     * merged to produce the summary of the combined set of values.
+     */
+
+    class Summary
+    {
+      public:
+        Summary(void);
+
+        /// \brief adds a single value
+        void add(double v) { add(&v,1); }
+        /// \brief adds a block of n values
+        void add(const double *v, size_t n);
+        /// \brief combines the values in another summary with this one
+        void merge(const Summary &x);
+
+        size_t count(void)    const { return count_; }
+        double sum(void)      const { return sum_;   }
+        double mean(void)     const { return mean_;  }
+        double min(void)      const { return min_;   }
+        double max(void)      const { return max_;   }
+        /// \brief population variance (0 if there are no values)
+        double variance(void) const { return count_ > 0 ? m2_ / double(count_) : 0.; }
+
+      private:
+        /// \cond PRIVATE
+        size_t count_;
+        double sum_;
+        double mean_;
+        double m2_;    // sum of squared differences from the mean
+        double min_;
+        double max_;
+        /// \endcond
+    };
+
+    /*!
+     * \class XMLFunc::Histogram
+     * \brief streaming histogram with equal width bins
+     *
+     * Values below the low edge or at/above the high edge of the histogram are counted 
+     * as underflow or overflow.  NaN values are counted separately.
+     */
+
+    class Histogram
+    {
+      public:
+        Histogram(double lo, double hi, size_t nbins);
+
+        /// \brief adds a single value
+        void add(double v) { add(&v,1); }
+        /// \brief adds a block of n values
+        void add(const double *v, size_t n);
+        /// \brief combines the counts in another histogram (with the same bins) with this one
+        void merge(const Histogram &x);
+
+        double lo(void)    const { return lo_; }
+        double hi(void)    const { return hi_; }
+        size_t nbins(void) const { return counts_.size() - 2; }
+
+        /// \brief number of values in the specified bin
+        size_t count(size_t bin) const { return counts_.at(bin+1); }
+
+        size_t underflow(void) const { return counts_.front(); }
+        size_t overflow(void)  const { return counts_.back();  }
+        size_t nan(void)       const { return nan_;            }
+
+      private:
+        /// \cond PRIVATE
+        double              lo_;
+        double              hi_;
+        double              scale_;
+        std::vector<size_t> counts_; // [0]=underflow, [nbins+1]=overflow
+        size_t              nan_;
+        /// \endcond
+    };
+
+    /*!
+     * \class XMLFunc::FunctionMetrics
+     * \brief call counts and latency histogram for one function (see metrics())
+     *
+     * Metrics are only collected if XMLFunc.cc is compiled with XMLFUNC_METRICS defined.
+     * Otherwise, the instrumentation is compiled out of the eval methods entirely and
+     * all of the counts are zero.
+     *
+     * Each batch eval or reduce call counts as a single call (of however many rows).
+     * To keep the cost of the clock off the single row eval path, only one in 16 single
+     * row calls is timed (batch eval and reduce calls are always timed).  The latency
+     * bins count the timed calls, binned by powers of two: bin b counts the calls which
+     * took from 2^b to 2^(b+1) nanoseconds (bin 0 includes calls under 1 ns).
+     */
+
+    struct FunctionMetrics
+    {
+      static const size_t LatencyBins = 40;
+
+      FunctionMetrics(void);
+
+      /// \brief approximate latency (seconds) below which fraction q of the calls completed
+      double latency(double q) const;
+
+      std::string   name;
+      unsigned long calls;                  ///< eval and reduce calls
+      unsigned long rows;                   ///< rows evaluated (1 per single row call)
+      unsigned long errors;                 ///< calls which threw an exception
+      double        seconds;                ///< total time spent in the calls (estimated from the timed calls)
+      unsigned long latencies[LatencyBins]; ///< number of timed calls in each latency bin
+    };
+
+    /*!
+     * \class XMLFunc::MemoryUsage
+     * \brief approximate heap memory (in bytes) used by the functions (see memoryUsage())
+     */
+
+    struct MemoryUsage
+    {
+      MemoryUsage(void) : functions(0), names(0), argDefs(0), operations(0), programs(0), source(0), numArgDefs(0) {}
+
+      /// \brief total bytes
+      size_t total(void) const { return functions + names + argDefs + operations + programs + source; }
+
+      size_t functions;   ///< the table of functions
+      size_t names;       ///< the function names and the hashed index used to look them up
+      size_t argDefs;     ///< argument definitions (shared by functions with identical arglists)
+      size_t operations;  ///< the operations of each function
+      size_t programs;    ///< the operations flattened for evaluation
+      size_t source;      ///< the XML kept to build functions on first use (see Lazy)
+      size_t numArgDefs;  ///< number of distinct argument definitions
+    };
+
+    /*!
+     * \class XMLFunc::SharedOperations
+     * \brief operations shared by the functions of every XMLFunc built with Shared (see sharedOperations())
+     */
+
+    struct SharedOperations
+    {
+      SharedOperations(void) : functions(0), nodes(0), bytes(0), table(0), unshared(0) {}
+
+      /// \brief bytes saved by sharing (negative if the table costs more than sharing saves)
+      long saved(void) const { return long(unshared) - long(bytes + table); }
+
+      size_t functions;   ///< functions using the shared operations
+      size_t nodes;       ///< distinct operations
+      size_t bytes;       ///< heap memory of the distinct operations
+      size_t table;       ///< the table used to find them
+      size_t unshared;    ///< heap memory the operations of the functions would use if none were shared
+    };
+
+    /// \cond PRIVATE
+    class Program;        // a function body flattened for non-recursive evaluation
+    class Metrics;        // per-function counters (see metrics())
+    class FunctionIndex;  // hashed function names (see functionIndex())
+    class Compiler;       // builds functions on first use (see Lazy)
+    class OperationPool;  // operations shared by every XMLFunc (see Shared)
+    class Sweep;          // a function rewritten for evaluation over axes (see sweep())
+    /// \endcond
+
+    /*!
+     * \class XMLFunc::Profile
+     * \brief evaluation counts and times of each node of one function (see profile())
+     *
+     * The nodes are the operations of the function, each identified by the XML element
+     * from which it was built.  The inclusive time of a node includes the time spent
+     * evaluating its operands; the exclusive time does not.
+     *
+     * Timing a call reads the clock once per node evaluated, which is comparable to the
+     * cost of evaluating the node.  To limit the overhead, only one in every period calls
+     * may be timed; the other calls are evaluated normally and only counted.  Counts and
+     * times are then estimated from the timed calls.
+     *
+     * A profile is bound to the first function it is used with and may not be used 
+     * with any other function (or after the XMLFunc is destroyed).  It is not thread safe.
+     */
+
+    class Profile
+    {
+      public:
+        /// \brief one of every period calls is timed
+        Profile(unsigned long period=1);
+
+        struct Node
+        {
+          std::string element;    ///< element from which the operation was built
+          unsigned    line;       ///< location of the element in the XML
+          unsigned    column;
+          size_t      parent;     ///< index of the parent node (npos for the root)
+          size_t      depth;      ///< 0 for the root
+          double      evals;      ///< (estimated) number of evaluations
+          double      inclusive;  ///< (estimated) seconds, including operands
+          double      exclusive;  ///< (estimated) seconds, excluding operands
+        };
+
+        /// \brief name of the profiled function
+        const std::string &function(void) const { return function_; }
+
+        unsigned long calls(void)      const { return calls_; }
+        unsigned long timedCalls(void) const { return timed_; }
+
+        /// \brief the nodes in evaluation order (each operand before the operation using it)
+        void nodes(std::vector<Node> &nodes) const;
+
+        /// \brief writes a table of the nodes (root first, indented by depth)
+        void report(std::ostream &s) const;
+
+        /*!
+         * \brief writes the exclusive time (ns) of each node as folded stacks
+         *
+         * Each line is the path from the function to the node (separated by ';'),
+         * followed by the node's exclusive time in nanoseconds.  This is the input 
+         * format of flame graph tools (e.g. flamegraph.pl).
+         */
+        void folded(std::ostream &s) const;
+
+        /// \brief clears the counts and times (the profile remains bound to its function)
+        void clear(void);
+
+      private:
+        /// \cond PRIVATE
+        friend class XMLFunc;
+
+        const Program              *program_;
+        std::string                 function_;
+        unsigned long               period_;
+        unsigned long               calls_;
+        unsigned long               timed_;
+        std::vector<size_t>         steps_;    // program step of each node
+        std::vector<size_t>         parents_;  // parent of each node
+        std::vector<unsigned long>  evals_;    // by program step
+        std::vector<unsigned long>  ns_;       // by program step (inclusive)
+        std::vector<unsigned long>  marks_;    // by program step (scratch)
+        /// \endcond
     };
 
 
   public:
 
+    /*!
+     * \brief Optimizations applied to the functions as they are built (may be or'ed together)
+     *
+     * - Polynomials: subtrees which are polynomials (of degree 2 or more) in a single double
+     *   argument, built from add, sub, mult, neg, pow (by a constant whole number), and div
+     *   (by a double constant), are replaced by their coefficients and evaluated by Horner's
+     *   rule using fused multiply-adds.  Products and powers are only expanded where a factor
+     *   is a single term (a power of a sum, e.g. (x-1)^10, is left as written).  The values may
+     *   differ from those of the original subtree, by more than a few ulps where the terms of
+     *   the polynomial cancel, and for infinite arguments, so this is not applied by default.
+     * - SinglePrecision: the double values of every function are computed in single 
+     *   precision (float) in batch evaluation, twice as many per vector instruction.  A
+     *   function's precision attribute (single or double) overrides this.  The values
+     *   typically differ from those computed in double precision in the 7th significant
+     *   digit, so this is not applied by default.  Single row evaluation is always in
+     *   double precision.
+     * - Lazy: each function is parsed and built the first time it is evaluated (or by warm())
+     *   rather than by the constructor, which only reads the root level elements, the function
+     *   names, and their arglists.  Construction time then depends little on the number and
+     *   size of the functions, but errors in a function's body are not reported until it is
+     *   built.  The XML is kept until the XMLFunc is deleted.
+     * - Shared: the operations of each function are interned in a table shared by every XMLFunc
+     *   in the process, so that identical subtrees (within a function, across functions, and
+     *   across XMLFunc objects built from the same or similar XML) are kept once.  The shared
+     *   operations count their references and are deleted when no function uses them; XMLFunc
+     *   objects may be built and deleted concurrently.  This saves memory where many copies of
+     *   similar functions are loaded (e.g. versions of a ReloadableXMLFunc), at the cost of a
+     *   table lookup for each operation built.  A shared operation (see Operation::element) keeps
+     *   the element and location of the first one built, but each function keeps the locations
+     *   of its own operations where these differ, so that a Profile reports the function's own
+     *   elements.  See sharedOperations().
+     *
+     * DefaultOptimizations (the constructors' default) is NoOptimization: each of the others
+     * either changes the values computed or when errors are reported, so is chosen explicitly.
+     */
+    typedef enum 
+    { 
+      NoOptimization   = 0, 
+      Polynomials      = 0x1, 
+      SinglePrecision  = 0x2, 
+      Lazy             = 0x4, 
+      Shared           = 0x8, 
+      DefaultOptimizations = NoOptimization
+    } Optimization_t;
+
+    /*!
+     * \brief Status returned by the non-throwing eval methods (see tryEval())
+     *
+     * The row status bits describe the value computed for a row.  The call status values
+     * indicate that nothing was evaluated.  Integer division (or modulus) by zero has the
+     * value 0 in every eval method; only tryEval() reports it.
+     */
+    typedef enum 
+    {
+      Ok               = 0x00,
+      DivideByZero     = 0x01,  ///< (row) an integer division or modulus by zero was evaluated
+      NotANumber       = 0x02,  ///< (row) the value is NaN
+      Infinite         = 0x04,  ///< (row) the value is infinite
+      UnknownFunction  = 0x10,  ///< (call) there is no function with the index or name
+      MissingArguments = 0x20,  ///< (call) fewer arguments (or columns) than the function's arglist
+      ArgumentType     = 0x40,  ///< (call) a double value (or column) was passed for an integer argument, or an array for a number (or vice versa)
+      RequestTooLarge  = 0x80   ///< (call) one row of a batch does not fit in the data area of an XMLFuncServer (XMLFuncClient only)
+    } Status_t;
+
+    /// \brief names of the status bits set in status (e.g. "DivideByZero|Infinite"), or "Ok"
+    static std::string statusText(unsigned status);
+
     /*!
      * \brief Constructor
      *
      * \param xml - may be either the path to a file containing XML or a string containing the XML
+     * \param optimizations - Optimization_t values (or'ed together)
+     * \param nthreads - maximum number of threads used to parse and build the functions (the
+     *   functions are numbered, and errors reported, just as they are with one thread)
      *
      * \warning If a file path is provided, but that file cannot be read, a std::runtime_error
      *   exception will be thrown.
      *
      * \warning If the XML cannot be parsed, a std::runtime_error exception will be thrown.
      */
-    XMLFunc(const std::string &xml);
+    XMLFunc(const std::string &xml, unsigned optimizations=DefaultOptimizations, unsigned nthreads=1);
 
-    virtual ~XMLFunc() 
-    { 
-      for(std::vector<Function>::iterator i=funcs_.begin(); i!=funcs_.end(); ++i)
-      {
-        delete i->root;
-      }
-    }
+    virtual ~XMLFunc();
 
     /*!
      * \brief Invocation method when only one function is defined
@@ -167,8 +647,335 @@ class XMLFunc
      */
     Number eval(const std::string &name, const Args &args) const;
 
+    /*!
+     * \brief Batch invocation method when only one function is defined
+     *
+     * \param args - list of argument columns, one per argument in the function's arglist
+     * \param n    - number of rows to evaluate
+     * \param out  - receives the n function values
+     *
+     * In batch evaluation, the type of each value is determined by the types declared
+     * in the function's arglist rather than by the type of the values passed in.  Integer
+     * columns may be passed for double arguments (they are converted), but double columns
+     * may not be passed for integer arguments.  Array arguments take array columns.
+     *
+     * \warning A std::runtime_error will be thrown if there are too few columns or if a
+     *   column's type does not match its argument (a double column for an integer argument,
+     *   or an array column for a number argument or vice versa).
+     */
+    void eval(const BatchArgs &args, size_t n, double *out) const;
+
+    /*!
+     * \brief Batch invocation method specifying function by function (0 based) index
+     *
+     * \see eval(const BatchArgs &, size_t, double *) const
+     */
+    void eval(size_t index, const BatchArgs &args, size_t n, double *out) const;
+
+    /*!
+     * \brief Batch invocation method specifying function by name
+     *
+     * \see eval(const BatchArgs &, size_t, double *) const
+     */
+    void eval(const std::string &name, const BatchArgs &args, size_t n, double *out) const;
+
+    /*!
+     * \brief Batch invocation method writing the value of row r stride bytes times r past out
+     *
+     * With strided argument columns (see Column), this evaluates an array of records in
+     * place, writing the values to a field of each (e.g. &quotes[0].price, Stride(sizeof(Quote))).
+     *
+     * \see eval(const BatchArgs &, size_t, double *) const
+     */
+    void eval(size_t index, const BatchArgs &args, size_t n, double *out, Stride stride) const;
+    /// \brief Batch invocation method writing strided values specifying function by name
+    void eval(const std::string &name, const BatchArgs &args, size_t n, double *out, Stride stride) const;
+
+    /*!
+     * \brief Returns the argument columns of the function with the specified index, in 
+     *   the order of its arglist, given the column of each argument by name
+     *
+     * For example, the arguments of a function may be bound to the fields of an array
+     * of records (see Stride) once, rather than copying the fields of each record.
+     *
+     * \warning A std::runtime_error will be thrown if an argument of the function has no
+     *   column, or if a column is named for an argument the function does not have
+     */
+    BatchArgs bind(size_t index, const std::map<std::string,Column> &columns) const;
+
+    /*!
+     * \brief Evaluates the function specified by index over the values of one argument
+     *
+     * The values are those the batch eval() would compute with a column of the axis values
+     * for the swept argument and columns repeating the other arguments' values.  However, 
+     * each operation (and its operands) which does not depend on the swept argument is 
+     * evaluated only once, and its value is used for every row.
+     *
+     * \param args - value of each argument in the function's arglist (that of the swept
+     *   argument is ignored)
+     * \param x    - values of the swept argument
+     * \param out  - array of x.size() values to write
+     *
+     * \warning A std::runtime_error will be thrown if args do not match the arglist or if
+     *   the swept argument does not exist or is not a double argument.
+     */
+    void sweep(size_t index, const Args &args, const Axis &x, double *out) const;
+    /// \brief Evaluates the function specified by name over the values of one argument
+    void sweep(const std::string &name, const Args &args, const Axis &x, double *out) const;
+
+    /*!
+     * \brief Evaluates the function specified by index over the grid of values of two arguments
+     *
+     * The value for the i'th y value and the j'th x value is written to out[i * x.size() + j].
+     * Operations which depend on neither argument are evaluated once, and those which depend 
+     * on y but not x are evaluated once for each y value (in batch, over the y values).  Rows
+     * of the grid are then evaluated in batch, over the x values.
+     *
+     * \see sweep(size_t, const Args &, const Axis &, double *) const
+     */
+    void sweep(size_t index, const Args &args, const Axis &y, const Axis &x, double *out) const;
+    /// \brief Evaluates the function specified by name over the grid of values of two arguments
+    void sweep(const std::string &name, const Args &args, const Axis &y, const Axis &x, double *out) const;
+
+    /*!
+     * \brief Batch invocation methods writing float values
+     *
+     * Evaluates the function as the double batch eval() does, rounding the values to 
+     * float.  Together with float argument columns, this halves the memory traffic of 
+     * single precision functions (see SinglePrecision).
+     */
+    void eval(const BatchArgs &args, size_t n, float *out) const;
+    /// \brief Batch invocation method writing float values specifying function by index
+    void eval(size_t index, const BatchArgs &args, size_t n, float *out) const;
+    /// \brief Batch invocation method writing float values specifying function by name
+    void eval(const std::string &name, const BatchArgs &args, size_t n, float *out) const;
+
+    /*!
+     * \brief Computes summary statistics of the function values over a batch of rows
+     *
+     * The function values are never stored.  Each block of values is reduced as soon as
+     * it is computed.  The rows are reduced in fixed size chunks whose partial results 
+     * are merged in row order, so the result does not depend on the number of threads used.
+     *
+     * \param args     - list of argument columns, one per argument in the function's arglist
+     * \param n        - number of rows to evaluate
+     * \param summary  - summary to which the n function values are added
+     * \param nthreads - number of threads to use (including the calling thread)
+     *
+     * \see eval(const BatchArgs &, size_t, double *) const
+     */
+    void reduce(const BatchArgs &args, size_t n, Summary &summary, unsigned nthreads=1) const;
+
+    /*!
+     * \brief Computes summary statistics specifying function by function (0 based) index
+     *
+     * \see reduce(const BatchArgs &, size_t, Summary &, unsigned) const
+     */
+    void reduce(size_t index, const BatchArgs &args, size_t n, Summary &summary, unsigned nthreads=1) const;
+
+    /*!
+     * \brief Computes summary statistics specifying function by name
+     *
+     * \see reduce(const BatchArgs &, size_t, Summary &, unsigned) const
+     */
+    void reduce(const std::string &name, const BatchArgs &args, size_t n, Summary &summary, unsigned nthreads=1) const;
+
+    /*!
+     * \brief Computes a histogram of the function values over a batch of rows
+     *
+     * \see reduce(const BatchArgs &, size_t, Summary &, unsigned) const
+     */
+    void reduce(const BatchArgs &args, size_t n, Histogram &hist, unsigned nthreads=1) const;
+
+    /*!
+     * \brief Computes a histogram specifying function by function (0 based) index
+     *
+     * \see reduce(const BatchArgs &, size_t, Summary &, unsigned) const
+     */
+    void reduce(size_t index, const BatchArgs &args, size_t n, Histogram &hist, unsigned nthreads=1) const;
+
+    /*!
+     * \brief Computes a histogram specifying function by name
+     *
+     * \see reduce(const BatchArgs &, size_t, Summary &, unsigned) const
+     */
+    void reduce(const std::string &name, const BatchArgs &args, size_t n, Histogram &hist, unsigned nthreads=1) const;
+
+    /*!
+     * \brief Evaluates the function specified by index, recording the time spent in each node
+     *
+     * \see eval(size_t, const Args &) const
+     * \see XMLFunc::Profile
+     */
+    Number profile(size_t index, const Args &args, Profile &profile) const;
+
+    /*!
+     * \brief Evaluates the function specified by name, recording the time spent in each node
+     *
+     * \see eval(const std::string &, const Args &) const
+     * \see XMLFunc::Profile
+     */
+    Number profile(const std::string &name, const Args &args, Profile &profile) const;
+
+    /*!
+     * \brief Non-throwing invocation method specifying function by index
+     *
+     * Evaluates the function as eval() does, but returns a status rather than throwing an
+     * exception: a call status (nothing is evaluated) or the row status of value.
+     *
+     * \see Status_t
+     */
+    unsigned tryEval(size_t index, const Args &args, Number &value) const;
+
+    /// \brief Non-throwing invocation method specifying function by name
+    unsigned tryEval(const std::string &name, const Args &args, Number &value) const;
+
+    /*!
+     * \brief Non-throwing batch invocation method specifying function by index
+     *
+     * Evaluates the function as the batch eval() does, but returns a status rather than 
+     * throwing an exception.  The status of each row is written to status (n values).  The 
+     * returned status is a call status (nothing is evaluated) or the row statuses combined.
+     *
+     * In batch evaluation, both candidate values of an \<if> are computed, but a row's status
+     * only includes that of the value chosen.  Recording the status is branch free, so rows
+     * with errors do not slow down the others.
+     *
+     * \see Status_t
+     */
+    unsigned tryEval(size_t index, const BatchArgs &args, size_t n, double *out, unsigned char *status) const;
+
+    /// \brief Non-throwing batch invocation method specifying function by name
+    unsigned tryEval(const std::string &name, const BatchArgs &args, size_t n, double *out, unsigned char *status) const;
+
+    /// \brief Number of functions defined in the XML
+    size_t numFunctions(void) const { return funcs_.size(); }
+
+    /// \brief True if the function's batch values are computed in single precision (see SinglePrecision)
+    bool singlePrecision(size_t index) const { return _function(index).single; }
+
+    /// \brief True if the function has been built (always, unless constructed with Lazy)
+    bool built(size_t index) const;
+
+    /*!
+     * \brief Builds the specified functions now, rather than on first use (see Lazy)
+     *
+     * This may be called from any thread, including while other threads evaluate functions.
+     *
+     * \warning A std::runtime_error will be thrown if a function does not exist or cannot be built
+     */
+    void warm(const std::vector<std::string> &names) const;
+
+    /// \brief Builds the functions with the specified indices (see Lazy)
+    void warm(const std::vector<size_t> &indices) const;
+
+    /// \brief Builds all of the functions (see Lazy)
+    void warm(void) const;
+
+    /*!
+     * \brief Returns the (0 based) index of the named function
+     *
+     * \warning A std::runtime_error will be thrown if there is no function with this name
+     */
+    size_t functionIndex(const std::string &name) const;
+
+    /*!
+     * \brief Returns the name of the function with the specified index (empty if it is not named)
+     *
+     * \warning A std::out_of_range exception will be thrown if the index is out of range
+     */
+    const std::string &functionName(size_t index) const;
+
+    /*!
+     * \brief Returns the argument definitions for the function with the specified index
+     *
+     * This allows applications to match their data to the function's arglist by name and type.
+     *
+     * \warning A std::runtime_error will be thrown if the index is out of range
+     */
+    const ArgDefs &argDefs(size_t index) const;
+
+    /// \brief Returns true if XMLFunc.cc was compiled with XMLFUNC_METRICS defined
+    static bool metricsEnabled(void);
+
+    /*!
+     * \brief Returns a snapshot of the metrics for each function (in function index order)
+     *
+     * The counters are updated without locks, so a snapshot taken while other threads
+     * are evaluating functions may include some of their calls and not others.
+     *
+     * \see XMLFunc::FunctionMetrics
+     */
+    void metrics(std::vector<FunctionMetrics> &snapshot) const;
+
+    /// \brief Resets the metrics for all functions to zero
+    void resetMetrics(void);
+
+    /*!
+     * \brief Returns the approximate heap memory used by the functions
+     *
+     * Functions with identical arglists (including all of those which use the same root 
+     * level \<arglist>) share one set of argument definitions.
+     */
+    MemoryUsage memoryUsage(void) const;
+
+    /*!
+     * \brief Returns the number and memory of the operations shared by every XMLFunc built
+     *   with Shared, and the memory saved by sharing them
+     *
+     * The memoryUsage() of each XMLFunc includes all of the operations it uses, whether or
+     * not they are shared.
+     */
+    static SharedOperations sharedOperations(void);
+
   public: // making these public allows Operation subclasses to exist outside XMLFunc scope
 
+    /// \brief maximum number of rows evaluated by an Operation in a single batch step
+    static const size_t BlockSize = 256;
+
+    /*!
+     * \class XMLFunc::Block
+     * \brief values computed by an Operation for one block of rows in batch evaluation
+     *
+     * Only one of the value arrays is meaningful, as determined by the type() of the
+     * Operation which populated it and by the precision of the evaluation (see Batch).
+     */
+    struct Block
+    {
+      long          i[BlockSize];
+      double        d[BlockSize];
+      float         f[BlockSize];       ///< double values computed in single precision
+      unsigned char status[BlockSize];  ///< row status of each value (tryEval() only, see evalBlockStatus())
+    };
+
+    /*!
+     * \class XMLFunc::Batch
+     * \brief the block of rows (within a set of BatchArgs) currently being evaluated
+     */
+    class Batch
+    {
+      public:
+        Batch(const BatchArgs &args, size_t offset, size_t n, bool single=false) 
+          : args_(args), offset_(offset), n_(n), single_(single) {}
+
+        /// \brief columns containing the argument values
+        const BatchArgs &args(void) const { return args_; }
+        /// \brief index of first row in the block
+        size_t offset(void) const { return offset_; }
+        /// \brief number of rows in the block (never more than BlockSize)
+        size_t size(void) const { return n_; }
+        /// \brief true if double values are computed in single precision (see evalBlockFloat())
+        bool single(void) const { return single_; }
+
+      private:
+        /// \cond PRIVATE
+        const BatchArgs &args_;
+        size_t           offset_;
+        size_t           n_;
+        bool             single_;
+        /// \endcond
+    };
+
     /*!
      * \class XMLFunc::Operation
      * \brief value node that performs a unary, binary, or list operation/function
@@ -176,26 +983,182 @@ class XMLFunc
      * This is an abstract base class for all operator nodes.  There are a number of
      * built-in subclasses that perform most of the standard mathematical operations.
      * If additional subclasses are needed, code will need to be added in XMLFunc.cpp
+     *
+     * An operation owns its operands, but never evaluates them itself.  Functions are
+     * evaluated by walking the tree of operations with an explicit stack (see Program)
+     * and passing each operation the values of its operands.  This allows expressions
+     * of arbitrary depth to be built, evaluated, copied, and deleted without recursion.
      */
     class Operation
     {
       /*!
-       * The constructor is protected so that only subclasses can be instantiated
+       * The constructor is protected so that only subclasses can be instantiated.
+       * The copy constructor copies everything but the operands (see clone()).
        */
       protected:
-        Operation(void) {}
+        Operation(void) : valueType_(Number::Double), refs_(0), element_(NULL), line_(0), column_(0) {}
+        Operation(const Operation &x) 
+          : valueType_(x.valueType_), refs_(0), element_(x.element_), line_(x.line_), column_(x.column_) {}
 
+      /*!
+       * Deletes the operation and all of its operands.
+       */
       public:
-        virtual ~Operation() {}
+        virtual ~Operation();
+
+      /*!
+       * Number of operands and access to each of them (in the order they are passed
+       * to eval() and evalBlock())
+       */
+      public:
+        size_t           numOperands(void)   const { return operands_.size(); }
+        const Operation *operand(size_t i)   const { return operands_.at(i);  }
+        Operation       *operand(size_t i)         { return operands_.at(i);  }
+
+      /*!
+       * Returns the approximate heap memory (in bytes) used by the operation, not 
+       * including that of its operands.  Subclasses override this to include their
+       * own members.
+       */
+      public:
+        virtual size_t memoryUsage(void) const { return sizeof(*this) + operandsMemory(); }
+
+      protected:
+        size_t operandsMemory(void) const { return operands_.capacity() * sizeof(Operation *); }
+
+      /*!
+       * Replaces operand i with op (taking ownership of it) and returns the operand
+       * it replaced (which the caller must delete).  This is used by optimizations 
+       * which rewrite the operations once they are built.
+       */
+      public:
+        Operation *replaceOperand(size_t i, Operation *op)
+        {
+          Operation *rval = operands_.at(i);
+          operands_[i] = op;
+          return rval;
+        }
 
       /*!
        * Evaluates and returns the value of the element node as defined by the
        * input XML file (or subset thereof)
        *
        * \param args is the list of argument values passed to the function being evaluated.
+       * \param operands contains the values of each of the operation's operands.
+       */
+      public:
+        virtual XMLFunc::Number eval(const Args &args, const Number *operands) const = 0;
+
+      /*!
+       * Returns a deep copy of the operation (and all of its operands).  This is used
+       * when the body of one function is inlined into another via a \<call> element.
+       */
+      public:
+        Operation *clone(void) const;
+
+      /*!
+       * Returns a copy of the operation without its operands (used by clone()).
+       */
+      protected:
+        virtual Operation *copy(void) const = 0;
+
+      /*!
+       * Compare the parameters of operations (see Shared).  hash() returns a hash of
+       * the operation's parameters (not its operands), and equivalent() returns true
+       * if op, of the same class and with the same operands, computes the same values.
+       * By default no two operations are equivalent, so subclasses which do not 
+       * override these are never shared.
+       */
+      public:
+        virtual size_t hash(void) const { return 0; }
+        virtual bool   equivalent(const Operation &) const { return false; }
+
+      /*!
+       * Returns the type of the values computed by evalBlock().  This is determined 
+       * when the operation is constructed from the types declared in the arglist.
+       */
+      public:
+        Number::Type_t type(void) const { return valueType_; }
+
+      /*!
+       * Evaluates the element node for each row in the specified batch.  The values
+       * are written to the integer or double array in out (as indicated by type()).
+       *
+       * Operations evaluated in batch do not branch on the values being computed.  Where
+       * a choice must be made between values (e.g. \<if>), all candidate values are
+       * computed for the block and blended.
+       *
+       * Operand blocks are populated as indicated by the type() of each operand and
+       * may be modified (e.g. converted to double).  The out block may be the same
+       * block as one of the operands.
+       *
+       * \param batch identifies the argument values for the rows being evaluated.
+       * \param operands contains the values of each operand for each row in the batch
+       * \param out receives the values for each row in the batch
        */
       public:
-        virtual XMLFunc::Number eval(const Args &args) const = 0;
+        virtual void evalBlock(const Batch &batch, Block *const *operands, Block &out) const = 0;
+
+      /*!
+       * Same as evalBlock(), but double values (of the operands and out) are in single 
+       * precision, in the f arrays of the blocks.  This is called instead of evalBlock()
+       * for functions evaluated in single precision (see SinglePrecision).  By default, 
+       * the operands are widened to double, evalBlock() is called, and its values are
+       * rounded to float.  Subclasses override this to compute in float lanes.
+       */
+      public:
+        virtual void evalBlockFloat(const Batch &batch, Block *const *operands, Block &out) const;
+
+      /*!
+       * Returns the row status (see Status_t) of the value computed by eval() from the 
+       * specified operand values, given the status of each operand.  This is only called
+       * by tryEval(), before eval() is called with the same operands.  By default, it is 
+       * the status of the operands combined.  Operations which choose between their
+       * operand values (e.g. \<select>) return the status of the operand chosen, and those
+       * which raise an error (e.g. integer division by zero) add it.  NaN and infinite 
+       * values are detected in the function's value, so need not be reported.
+       */
+      public:
+        virtual unsigned char evalStatus(const Number *operands, const unsigned char *status) const;
+
+      /*!
+       * Sets the row status of each value in out, as evalStatus() does, from the operand
+       * blocks and their status.  This is only called by tryEval(), before evalBlock() is
+       * called with the same blocks.
+       */
+      public:
+        virtual void evalBlockStatus(const Batch &batch, Block *const *operands, Block &out) const;
+
+      /*!
+       * Identifies the XML element from which the operation was built (see Profile).  
+       * Operations specified by attribute values (e.g. arg1="x") are identified as 
+       * element.attribute (e.g. mult.arg1) at the location of the element.  Lines and 
+       * columns are 1 based (0 if the operation was not built from XML).
+       */
+      public:
+        const std::string &element(void) const;
+        unsigned           line(void)    const { return line_;   }
+        unsigned           column(void)  const { return column_; }
+
+        /// \brief sets the element and location (element must outlive the operation)
+        void locate(const std::string *element, unsigned line, unsigned column)
+        {
+          element_ = element;
+          line_    = line;
+          column_  = column;
+        }
+
+      /// \cond PRIVATE
+      protected:
+        friend class XMLFunc::OperationPool;
+
+        std::vector<Operation *> operands_;
+        Number::Type_t           valueType_;
+        unsigned                 refs_;      // references to a shared operation (see OperationPool)
+        const std::string       *element_;
+        unsigned                 line_;
+        unsigned                 column_;
+      /// \endcond
     };
 
     ////////////////////////////////////////////////////////////
@@ -221,10 +1184,14 @@ class XMLFunc
 
         size_t index(const std::string &name) const;
 
+        std::string name(int i) const;
+
         std::pair<size_t,bool> find(const std::string &name) const;
 
         void clear(void) { types_.clear(); xref_.clear(); }
 
+        size_t memoryUsage(void) const;
+
       private:
 
         std::vector<Number::Type_t> types_;
@@ -235,23 +1202,334 @@ class XMLFunc
 
     struct Function
     {
-      ArgDefs    argDefs;
-      Operation *root;
-      Function(void) : root(NULL) {}
-      Function(const ArgDefs &a, Operation *o) : argDefs(a), root(o) {}
-      Function(Operation *o, const ArgDefs &a) : argDefs(a), root(o) {}
+      const ArgDefs     *argDefs;   // (interned, see argDefs_)
+      mutable Operation *root;      // (NULL until built, see Lazy)
+      mutable Program   *program;
+      bool               single;    // batch values computed in single precision
+      mutable bool       shared;    // root is in the OperationPool (see Shared)
+      Function(void) : argDefs(NULL), root(NULL), program(NULL), single(false), shared(false) {}
+      Function(Operation *o, const ArgDefs *a) : argDefs(a), root(o), program(NULL), single(false), shared(false) {}
     };
 
     Number _eval(const Function &, const Args &args) const;
+    void   _eval(const Function &, const BatchArgs &args, size_t n, double *out, size_t stride=sizeof(double)) const;
+    void   _eval(const Function &, const BatchArgs &args, size_t n, float *out) const;
+
+    void   _sweep(const Function &, const Args &args, const Axis *y, const Axis &x, double *out) const;
+
+    void   _check(const Function &, const Args &args) const;
+    void   _check(const Function &, const BatchArgs &args) const;
+
+    unsigned _validate(const Function &, const Args &args) const;
+    unsigned _validate(const Function &, const BatchArgs &args) const;
+
+    unsigned _tryEval(const Function *, const Args &args, Number &value) const;
+    unsigned _tryEval(const Function *, const BatchArgs &args, size_t n, double *out, unsigned char *status) const;
+
+    Number _profile(const Function &, const Args &args, Profile &profile) const;
+
+    const Function &_function(void) const;
+    const Function &_function(size_t index) const;
+    const Function &_function(const std::string &name) const;
+
+    const Function *_find(size_t index) const;
+    const Function *_find(const std::string &name) const;
+
+    template<class Result_t>
+    void   _reduce(const Function &, const BatchArgs &args, size_t n, Result_t &result, unsigned nthreads) const;
+
+    void   _compile(const Function &) const;
+
+    void   _clear(void);
 
   private:
 
-    std::vector<Function> funcs_;
-    Xref_t                funcXref_;
+    std::vector<Function>  funcs_;
+    std::vector<ArgDefs *> argDefs_;    // each distinct arglist, shared by the functions
+    FunctionIndex         *funcIndex_;
+    Compiler              *compiler_;   // (NULL unless constructed with Lazy)
+    Metrics               *metrics_;
 
     /// \endcond
 };
 
+/*!
+ * \class ReloadableXMLFunc
+ * \brief XMLFunc which may be replaced by a new version while other threads evaluate it
+ *
+ * A new version of the functions is built (from new XML, or by reading the file again) 
+ * while the current version remains in use, and is then published by a single atomic swap.
+ * Calls already evaluating the old version finish on it, and it is deleted once they have
+ * all released it.  Readers never take a lock: pinning the current version and releasing
+ * it are each a single atomic add.
+ *
+ * If a new version cannot be built, the current version is unchanged.
+ */
+
+class ReloadableXMLFunc
+{
+  public:
+
+    typedef XMLFunc::Number    Number;
+    typedef XMLFunc::Args      Args;
+    typedef XMLFunc::BatchArgs BatchArgs;
+
+    /// \brief maximum number of versions which may exist at once (the current version and those still pinned)
+    static const size_t MaxVersions = 16;
+
+    /*!
+     * \class ReloadableXMLFunc::Handle
+     * \brief pins the current version for as long as the handle exists
+     *
+     * Use a handle to make several calls on the same version (e.g. to look up a
+     * function's index and then evaluate it).  Handles must be destroyed before 
+     * the ReloadableXMLFunc.
+     */
+
+    class Handle
+    {
+      public:
+        explicit Handle(const ReloadableXMLFunc &holder);
+        ~Handle();
+
+        const XMLFunc &operator*(void)  const { return *func_; }
+        const XMLFunc *operator->(void) const { return func_; }
+
+        /// \brief version number of the pinned functions (1 for those first constructed)
+        unsigned long version(void) const { return version_; }
+
+      private:
+        Handle(const Handle &);
+        Handle &operator=(const Handle &);
+
+        const ReloadableXMLFunc *holder_;
+        size_t                   slot_;
+        const XMLFunc           *func_;
+        unsigned long            version_;
+    };
+
+    /*!
+     * \brief Constructor
+     *
+     * \param xml - may be either the path to a file containing XML or a string containing the XML
+     * \param optimizations - XMLFunc::Optimization_t values (or'ed together), used for every version
+     * \param nthreads - maximum number of threads used to parse and build each version
+     *
+     * \see XMLFunc::XMLFunc()
+     */
+    ReloadableXMLFunc(const std::string &xml, unsigned optimizations=XMLFunc::DefaultOptimizations, unsigned nthreads=1);
+
+    ~ReloadableXMLFunc();
+
+    /// \brief Evaluates the function specified by index using the current version
+    Number eval(size_t index, const Args &args) const;
+    /// \brief Evaluates the function specified by name using the current version
+    Number eval(const std::string &name, const Args &args) const;
+    /// \brief Batch evaluates the function specified by index using the current version
+    void   eval(size_t index, const BatchArgs &args, size_t n, double *out) const;
+    /// \brief Batch evaluates the function specified by name using the current version
+    void   eval(const std::string &name, const BatchArgs &args, size_t n, double *out) const;
+
+    /*!
+     * \brief Builds a new version from xml (a file path or XML string) and makes it current
+     *
+     * \returns the new version number
+     *
+     * \warning If the new version cannot be built, a std::runtime_error exception will be thrown
+     *   and the current version is unchanged.  An exception is also thrown if MaxVersions are
+     *   still pinned.
+     */
+    unsigned long reload(const std::string &xml);
+
+    /*!
+     * \brief Builds a new version from the file from which the functions were constructed
+     *
+     * \warning A std::runtime_error will be thrown if they were not constructed from a file
+     */
+    unsigned long reload(void);
+
+    /*!
+     * \brief Starts a thread which reloads the file whenever it changes
+     *
+     * The thread checks the file's modification time every interval seconds and also 
+     * deletes old versions which are no longer pinned.  If a changed file cannot be built,
+     * the error is available from lastError() and the current version is unchanged 
+     * until the file changes again.
+     *
+     * \warning A std::runtime_error will be thrown if the functions were not constructed from a file
+     */
+    void watch(double interval=1.0);
+
+    /// \brief Stops the thread started by watch()
+    void unwatch(void);
+
+    /// \brief Version number of the current functions
+    unsigned long version(void) const;
+
+    /// \brief Error message from the most recent failed reload by the watch() thread (empty if none)
+    std::string lastError(void) const;
+
+    /// \brief Deletes old versions which are no longer pinned, returning the number of versions which remain
+    size_t reclaim(void);
+
+  private:
+
+    ReloadableXMLFunc(const ReloadableXMLFunc &);
+    ReloadableXMLFunc &operator=(const ReloadableXMLFunc &);
+
+    unsigned long _publish(XMLFunc *func);
+
+    struct Slot
+    {
+      XMLFunc       *func;      // (NULL if the slot is free)
+      unsigned long  version;
+      long long      pending;   // pins of a retired version not yet released (see _publish)
+      bool           retired;
+    };
+
+    class Reloader;  // file source, writer lock and watch thread
+
+    mutable unsigned long long current_;  // slot of the current version (high bits) and the number of times it was pinned
+    mutable Slot               slots_[MaxVersions];
+    Reloader                  *reloader_;
+};
+
+/*!
+ * \class XMLFuncQueue
+ * \brief evaluates single row requests, submitted by many threads, in batches
+ *
+ * Requests for each function are gathered into a batch until it holds maxBatch rows
+ * or its oldest request has waited maxDelay seconds.  The batch is then evaluated by one
+ * of the queue's threads with batch evaluation (see XMLFunc::tryEval()), and each request
+ * is completed with its value and row status.  Larger batches evaluate more rows per 
+ * second but each request waits longer: stats() reports both so that maxBatch and 
+ * maxDelay can be tuned.
+ *
+ * As in batch evaluation, the values are doubles and the arguments are converted to the
+ * types declared in the function's arglist.
+ */
+
+class XMLFuncQueue
+{
+  public:
+
+    /// \brief function called (by a queue thread) with the value and status of a request
+    typedef void (*Callback_t)(void *context, double value, unsigned status);
+
+    /*!
+     * \class XMLFuncQueue::Request
+     * \brief value of a request, available once the request has been evaluated
+     *
+     * A request may not be destroyed or submitted again until it is ready.
+     */
+
+    class Request
+    {
+      public:
+        Request(void) : queue_(NULL), ready_(false), value_(0.), status_(XMLFunc::Ok) {}
+
+        /// \brief True once the request has been evaluated
+        bool ready(void) const { return __atomic_load_n(&ready_,__ATOMIC_ACQUIRE); }
+
+        /// \brief Waits until the request has been evaluated and returns its value
+        double wait(void);
+
+        double   value(void)  const { return value_;  }
+        /// \brief XMLFunc::Status_t bits (see XMLFunc::tryEval())
+        unsigned status(void) const { return status_; }
+
+      private:
+        friend class XMLFuncQueue;
+
+        XMLFuncQueue *queue_;
+        bool          ready_;
+        double        value_;
+        unsigned      status_;
+    };
+
+    /*!
+     * \class XMLFuncQueue::Stats
+     * \brief batch sizes, evaluation time and request latencies (see stats())
+     *
+     * The latency of a request is the time from its submission until it is completed.
+     * The latency bins count requests binned by powers of two: bin b counts the requests
+     * which took from 2^b to 2^(b+1) nanoseconds.
+     */
+
+    struct Stats
+    {
+      static const size_t LatencyBins = 40;
+
+      Stats(void);
+
+      /// \brief approximate latency (seconds) below which fraction q of the requests completed
+      double latency(double q) const;
+
+      /// \brief average number of requests per batch
+      double batchSize(void) const { return batches > 0 ? double(requests) / double(batches) : 0.; }
+
+      /// \brief requests evaluated per second
+      double throughput(void) const { return seconds > 0. ? double(requests) / seconds : 0.; }
+
+      unsigned long requests;               ///< requests evaluated in batches
+      unsigned long batches;                ///< batches evaluated
+      unsigned long fullBatches;            ///< batches sent when full (the others waited maxDelay)
+      double        evalSeconds;            ///< time spent evaluating batches
+      double        seconds;                ///< time since the queue was constructed (or the stats reset)
+      unsigned long latencies[LatencyBins]; ///< number of requests in each latency bin
+    };
+
+    /*!
+     * \brief Constructor
+     *
+     * \param func     - functions to evaluate (must outlive the queue)
+     * \param maxBatch - a batch is evaluated as soon as it holds this many requests
+     * \param maxDelay - or once its oldest request has waited this many seconds
+     * \param nthreads - number of threads evaluating batches
+     */
+    XMLFuncQueue(const XMLFunc &func, size_t maxBatch=XMLFunc::BlockSize, double maxDelay=100.e-6, unsigned nthreads=1);
+
+    /// \brief Evaluates the requests still queued, then stops the queue's threads
+    ~XMLFuncQueue();
+
+    /*!
+     * \brief Queues the evaluation of the function specified by index
+     *
+     * A request which cannot be evaluated (see XMLFunc::Status_t) is completed at once
+     * with its call status.  A request for a function with array arguments is evaluated
+     * at once (the arrays of different requests may differ in length, so are not batched).
+     */
+    void submit(size_t index, const XMLFunc::Args &args, Request &request);
+    /// \brief Queues the evaluation of the function specified by name
+    void submit(const std::string &name, const XMLFunc::Args &args, Request &request);
+
+    /// \brief Queues the evaluation of the function specified by index, calling callback once it is evaluated
+    void submit(size_t index, const XMLFunc::Args &args, Callback_t callback, void *context);
+    /// \brief Queues the evaluation of the function specified by name, calling callback once it is evaluated
+    void submit(const std::string &name, const XMLFunc::Args &args, Callback_t callback, void *context);
+
+    /// \brief Sends all of the queued requests to be evaluated without waiting for their batches to fill
+    void flush(void);
+
+    /// \brief Returns a snapshot of the statistics
+    Stats stats(void) const;
+
+    /// \brief Resets the statistics to zero
+    void resetStats(void);
+
+  private:
+
+    XMLFuncQueue(const XMLFuncQueue &);
+    XMLFuncQueue &operator=(const XMLFuncQueue &);
+
+    void _submit(size_t index, const XMLFunc::Args &args, Request *request, Callback_t callback, void *context);
+
+    class Dispatcher;  // pending batches, the lock and the threads which evaluate the batches
+
+    const XMLFunc &func_;
+    Dispatcher    *dispatcher_;
+};
+
 static std::ostream &operator<<(std::ostream &s,const XMLFunc::Number &x) { x.write(s); return s; }
 
 #endif // _XMLFUNC_h_
@@ -0,0 +1,726 @@
+#include "XMLFuncServer.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+using namespace std;
+
+typedef XMLFunc::Number    Number_t;
+typedef XMLFunc::Args      Args_t;
+typedef XMLFunc::BatchArgs BatchArgs_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared memory layout
+////////////////////////////////////////////////////////////////////////////////
+
+// The segment is laid out as:
+//   Header
+//   FunctionEntry[numFunctions], followed by the function names and argument types
+//   Slot[numSlots], each followed by its data area
+// All offsets are from the start of the segment.  Values waited on with futexes
+//   are 32 bits.
+
+static const char     Magic[8]    = "XMLFUNC";
+static const uint32_t Version     = 1;
+static const uint32_t RingEntries = 8;    // (a power of two)
+static const size_t   CacheLine   = 64;
+static const unsigned SpinLimit   = 100;  // polls before sleeping on a futex
+static const long     WaitNs      = 100000000L;  // longest futex wait before checking the other side is alive
+
+enum { EvalRequest = 1, BatchRequest = 2 };
+
+struct Header
+{
+  char     magic[8];       // (written last, once the rest of the segment is ready)
+  uint32_t version;
+  int32_t  serverPid;
+  uint32_t running;        // cleared when the server stops
+  uint32_t nthreads;
+  uint64_t numSlots;
+  uint64_t slotsOffset;
+  uint64_t slotBytes;      // (including the data area)
+  uint64_t dataBytes;
+  uint64_t numFunctions;
+  uint64_t functionsOffset;
+  uint32_t doorbells[XMLFuncServer::MaxThreads];  // counts the requests sent to each thread
+  uint32_t sleeping [XMLFuncServer::MaxThreads];  // set while the thread waits on its doorbell
+};
+
+struct FunctionEntry
+{
+  uint64_t nameOffset;
+  uint64_t nameLength;
+  uint64_t typesOffset;    // one byte (Number::Type_t) per argument
+  uint64_t numArgs;
+};
+
+struct RingEntry
+{
+  uint32_t kind;           // (requests) EvalRequest or BatchRequest
+  uint32_t status;         // (responses) XMLFunc::Status_t
+  uint32_t seq;            // matches each response to its request
+  uint32_t type;           // (eval responses) Number::Type_t of the value
+  uint64_t index;          // function
+  uint64_t count;          // arguments (eval) or rows (batch) in the data area
+  int64_t  ival;           // (eval responses) value
+  double   dval;
+};
+
+// An eval request's arguments in the data area
+struct WireNumber
+{
+  uint32_t type;
+  uint32_t pad;
+  int64_t  ival;
+  double   dval;
+};
+
+// Single producer, single consumer queue.  Only the producer writes tail and
+//   only the consumer writes head (each on its own cache line).  Both count the
+//   entries ever pushed or popped (modulo 2^32).
+struct Ring
+{
+  uint32_t  tail;
+  char      pad1[CacheLine - sizeof(uint32_t)];
+  uint32_t  head;
+  char      pad2[CacheLine - sizeof(uint32_t)];
+  RingEntry entries[RingEntries];
+
+  bool push(const RingEntry &e)
+  {
+    uint32_t t = tail;
+    if( t - __atomic_load_n(&head,__ATOMIC_ACQUIRE) >= RingEntries ) return false;
+    entries[t % RingEntries] = e;
+    __atomic_store_n(&tail, t+1, __ATOMIC_SEQ_CST);  // (ordered before the check for a sleeping consumer)
+    return true;
+  }
+
+  bool pop(RingEntry &e)
+  {
+    uint32_t h = head;
+    if( h == __atomic_load_n(&tail,__ATOMIC_ACQUIRE) ) return false;
+    e = entries[h % RingEntries];
+    __atomic_store_n(&head, h+1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  bool empty(void) const
+  {
+    return __atomic_load_n(&head,__ATOMIC_ACQUIRE) == __atomic_load_n(&tail,__ATOMIC_ACQUIRE);
+  }
+};
+
+// One client's rings.  The data area follows.
+struct Slot
+{
+  int32_t  owner;          // pid of the attached client (0 if free)
+  uint32_t waiting;        // set while the client waits on responses.tail
+  char     pad[CacheLine - 2*sizeof(uint32_t)];
+  Ring     requests;
+  Ring     responses;
+};
+
+static size_t round_up(size_t n) { return (n + CacheLine - 1) / CacheLine * CacheLine; }
+
+static Header &header(char *segment)                 { return *reinterpret_cast<Header *>(segment); }
+static Slot   &slot(char *segment, size_t s)         { Header &h = header(segment); return *reinterpret_cast<Slot *>(segment + h.slotsOffset + s * h.slotBytes); }
+static char   *data_area(Slot &slot)                 { return reinterpret_cast<char *>(&slot) + round_up(sizeof(Slot)); }
+
+static void futex_wait(uint32_t *addr, uint32_t value)
+{
+  struct timespec ts;
+  ts.tv_sec  = 0;
+  ts.tv_nsec = WaitNs;
+  syscall(SYS_futex, addr, FUTEX_WAIT, value, &ts, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static bool process_exists(pid_t pid)
+{
+  return kill(pid,0) == 0 || errno != ESRCH;
+}
+
+// Shared memory object names begin with a single /
+static string segment_name(const string &name)
+{
+  return ( name.empty() || name[0] != '/' ) ? "/" + name : name;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// XMLFuncServer methods
+////////////////////////////////////////////////////////////////////////////////
+
+const unsigned XMLFuncServer::MaxThreads;
+
+// Serves the requests of every nthreads'th slot, sleeping on its doorbell when
+//   there are none.
+class XMLFuncServer::Worker
+{
+  public:
+    Worker(const XMLFunc &func, char *segment, unsigned id)
+      : func_(func), segment_(segment), id_(id), requests_(0)
+    {
+      if( pthread_create(&thread_,NULL,run_thread,this) != 0 ) throw runtime_error("Failed to start an XMLFuncServer thread");
+    }
+
+    // The server must have been stopped (see ~XMLFuncServer)
+    ~Worker() { pthread_join(thread_,NULL); }
+
+    unsigned long requests(void) const { return __atomic_load_n(&requests_,__ATOMIC_RELAXED); }
+
+  private:
+    static void *run_thread(void *arg) { static_cast<Worker *>(arg)->run(); return NULL; }
+
+    void run(void);
+    bool serve(Slot &slot);
+
+    const XMLFunc &func_;
+    char          *segment_;
+    unsigned       id_;
+    unsigned long  requests_;
+    pthread_t      thread_;
+};
+
+XMLFuncServer::XMLFuncServer(const XMLFunc &func, const string &name, size_t maxClients, unsigned nthreads, size_t dataBytes)
+  : func_(func), name_(segment_name(name)), bytes_(0), segment_(NULL)
+{
+  if( nthreads == 0 )         nthreads = 1;
+  if( nthreads > MaxThreads ) nthreads = MaxThreads;
+  if( maxClients == 0 )       maxClients = 1;
+
+  // layout
+
+  size_t nfuncs = func.numFunctions();
+  size_t tableBytes = nfuncs * sizeof(FunctionEntry);
+  for(size_t i=0; i<nfuncs; ++i)
+  {
+    tableBytes += func.functionName(i).size() + size_t(func.argDefs(i).count());
+  }
+
+  size_t functionsOffset = round_up(sizeof(Header));
+  size_t slotsOffset     = round_up(functionsOffset + tableBytes);
+  size_t slotBytes       = round_up(sizeof(Slot)) + round_up(dataBytes);
+
+  bytes_ = slotsOffset + maxClients * slotBytes;
+
+  // create the segment, replacing one left by a server which has exited
+
+  int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if( fd < 0 && errno == EEXIST )
+  {
+    int old = shm_open(name_.c_str(), O_RDONLY, 0);
+    if( old >= 0 )
+    {
+      struct stat st;
+      bool stale = true;
+      if( fstat(old,&st) == 0 && size_t(st.st_size) >= sizeof(Header) )
+      {
+        void *p = mmap(NULL, sizeof(Header), PROT_READ, MAP_SHARED, old, 0);
+        if( p != MAP_FAILED )
+        {
+          const Header &h = *static_cast<const Header *>(p);
+          stale = ( __atomic_load_n(&h.running,__ATOMIC_ACQUIRE) == 0 || process_exists(h.serverPid) == false );
+          munmap(p, sizeof(Header));
+        }
+      }
+      close(old);
+      if( stale ) shm_unlink(name_.c_str());
+    }
+    fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  }
+  if( fd < 0 )
+  {
+    stringstream err;
+    err << "Cannot create shared memory segment " << name_ << ": " << strerror(errno);
+    throw runtime_error(err.str());
+  }
+
+  void *p = MAP_FAILED;
+  if( ftruncate(fd, off_t(bytes_)) == 0 ) p = mmap(NULL, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int mapErrno = errno;
+  close(fd);
+
+  if( p == MAP_FAILED )
+  {
+    shm_unlink(name_.c_str());
+    stringstream err;
+    err << "Cannot map shared memory segment " << name_ << ": " << strerror(mapErrno);
+    throw runtime_error(err.str());
+  }
+  segment_ = static_cast<char *>(p);
+
+  // header and function table (the segment is zero filled)
+
+  Header &h = header(segment_);
+  h.version         = Version;
+  h.serverPid       = int32_t(getpid());
+  h.running         = 1;
+  h.nthreads        = nthreads;
+  h.numSlots        = maxClients;
+  h.slotsOffset     = slotsOffset;
+  h.slotBytes       = slotBytes;
+  h.dataBytes       = round_up(dataBytes);
+  h.numFunctions    = nfuncs;
+  h.functionsOffset = functionsOffset;
+
+  FunctionEntry *entries = reinterpret_cast<FunctionEntry *>(segment_ + functionsOffset);
+  size_t pos = functionsOffset + nfuncs * sizeof(FunctionEntry);
+  for(size_t i=0; i<nfuncs; ++i)
+  {
+    const string           &fname   = func.functionName(i);
+    const XMLFunc::ArgDefs &argDefs = func.argDefs(i);
+
+    entries[i].nameOffset  = pos;
+    entries[i].nameLength  = fname.size();
+    memcpy(segment_ + pos, fname.data(), fname.size());
+    pos += fname.size();
+
+    entries[i].typesOffset = pos;
+    entries[i].numArgs     = size_t(argDefs.count());
+    for(int a=0; a<argDefs.count(); ++a) segment_[pos++] = char(argDefs.type(a));
+  }
+
+  try
+  {
+    for(unsigned t=0; t<nthreads; ++t) workers_.push_back( new Worker(func, segment_, t) );
+  }
+  catch(...)
+  {
+    __atomic_store_n(&h.running, 0U, __ATOMIC_SEQ_CST);
+    for(size_t t=0; t<workers_.size(); ++t) { futex_wake(&h.doorbells[t]); delete workers_[t]; }
+    munmap(segment_, bytes_);
+    shm_unlink(name_.c_str());
+    throw;
+  }
+
+  __atomic_store_n(reinterpret_cast<uint64_t *>(h.magic), *reinterpret_cast<const uint64_t *>(Magic), __ATOMIC_RELEASE);
+}
+
+// Clients still attached will find the server has stopped when they next
+//   make a request.
+XMLFuncServer::~XMLFuncServer()
+{
+  Header &h = header(segment_);
+  __atomic_store_n(&h.running, 0U, __ATOMIC_SEQ_CST);
+
+  for(size_t t=0; t<workers_.size(); ++t)
+  {
+    __atomic_add_fetch(&h.doorbells[t], 1U, __ATOMIC_SEQ_CST);
+    futex_wake(&h.doorbells[t]);
+  }
+  for(size_t t=0; t<workers_.size(); ++t) delete workers_[t];
+
+  // wake any client waiting for a response
+  for(size_t s=0; s<h.numSlots; ++s) futex_wake( &slot(segment_,s).responses.tail );
+
+  munmap(segment_, bytes_);
+  shm_unlink(name_.c_str());
+}
+
+unsigned long XMLFuncServer::requests(void) const
+{
+  unsigned long rval = 0;
+  for(size_t t=0; t<workers_.size(); ++t) rval += workers_[t]->requests();
+  return rval;
+}
+
+size_t XMLFuncServer::numClients(void) const
+{
+  Header &h = header(segment_);
+
+  size_t rval = 0;
+  for(size_t s=0; s<h.numSlots; ++s) rval += __atomic_load_n( &slot(segment_,s).owner, __ATOMIC_ACQUIRE ) != 0;
+  return rval;
+}
+
+void XMLFuncServer::Worker::run(void)
+{
+  Header &h = header(segment_);
+
+  unsigned spins = 0;
+  while( __atomic_load_n(&h.running,__ATOMIC_ACQUIRE) )
+  {
+    uint32_t bell = __atomic_load_n(&h.doorbells[id_],__ATOMIC_SEQ_CST);
+
+    bool served = false;
+    for(size_t s=id_; s<h.numSlots; s+=h.nthreads) served |= serve( slot(segment_,s) );
+
+    if( served )              { spins = 0; continue; }
+    if( ++spins < SpinLimit ) { sched_yield(); continue; }
+
+    // A client rings the doorbell after sending its request, then checks
+    //   whether the thread is sleeping.  As both sides write then read (in
+    //   sequentially consistent order), at least one sees the other's write.
+    __atomic_store_n(&h.sleeping[id_], 1U, __ATOMIC_SEQ_CST);
+    if( __atomic_load_n(&h.doorbells[id_],__ATOMIC_SEQ_CST) == bell ) futex_wait(&h.doorbells[id_], bell);
+    __atomic_store_n(&h.sleeping[id_], 0U, __ATOMIC_SEQ_CST);
+
+    spins = 0;
+  }
+}
+
+// Serves one request from the slot (if there is one).  The sizes in a request
+//   are checked, so a misbehaving client cannot make the server read or write
+//   outside its data area.
+bool XMLFuncServer::Worker::serve(Slot &slot)
+{
+  RingEntry req;
+  if( slot.requests.pop(req) == false ) return false;
+
+  const Header &h = header(segment_);
+  char *data = data_area(slot);
+
+  RingEntry rsp = req;
+  rsp.status = XMLFunc::Ok;
+
+  if( req.index >= func_.numFunctions() )
+  {
+    rsp.status = XMLFunc::UnknownFunction;
+  }
+  else if( req.kind == EvalRequest )
+  {
+    if( req.count * sizeof(WireNumber) > h.dataBytes ) req.count = h.dataBytes / sizeof(WireNumber);
+
+    const WireNumber *wire = reinterpret_cast<const WireNumber *>(data);
+
+    Args_t args;
+    for(size_t i=0; i<req.count; ++i)
+    {
+      if( wire[i].type == Number_t::Integer ) args.add( long(wire[i].ival) );
+      else                                    args.add( wire[i].dval );
+    }
+
+    Number_t value;
+    rsp.status = func_.tryEval(size_t(req.index), args, value);
+    rsp.type   = value.type();
+    rsp.ival   = long(value);
+    rsp.dval   = double(value);
+  }
+  else if( req.kind == BatchRequest )
+  {
+    // the argument columns (each of the argument's type), then the values, then the row statuses
+    const XMLFunc::ArgDefs &argDefs = func_.argDefs(size_t(req.index));
+    size_t nargs   = size_t(argDefs.count());
+    size_t rowSize = 8 * (nargs + 1) + 1;
+
+    if( req.count * rowSize > h.dataBytes ) req.count = h.dataBytes / rowSize;
+    size_t n = size_t(req.count);
+
+    BatchArgs_t args;
+    for(size_t i=0; i<nargs; ++i)
+    {
+      char *col = data + 8 * i * n;
+      if( argDefs.type(int(i)) == Number_t::Integer ) args.add( reinterpret_cast<const long *>(col) );
+      else                                            args.add( reinterpret_cast<const double *>(col) );
+    }
+    double        *out    = reinterpret_cast<double *>( data + 8 * nargs * n );
+    unsigned char *status = reinterpret_cast<unsigned char *>( data + 8 * (nargs+1) * n );
+
+    rsp.status = func_.tryEval(size_t(req.index), args, n, out, status);
+    rsp.count  = n;
+  }
+
+  __atomic_fetch_add(&requests_, 1UL, __ATOMIC_RELAXED);  // (counted before the client can see the response)
+  while( slot.responses.push(rsp) == false ) sched_yield();  // (a client only has one request outstanding)
+
+  if( __atomic_load_n(&slot.waiting,__ATOMIC_SEQ_CST) ) futex_wake(&slot.responses.tail);
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// XMLFuncClient methods
+////////////////////////////////////////////////////////////////////////////////
+
+XMLFuncClient::XMLFuncClient(const string &name)
+  : name_(segment_name(name)), bytes_(0), segment_(NULL), slot_(0), seq_(0)
+{
+  int fd = shm_open(name_.c_str(), O_RDWR, 0);
+  if( fd < 0 )
+  {
+    stringstream err;
+    err << "No XMLFuncServer is using shared memory segment " << name_;
+    throw runtime_error(err.str());
+  }
+
+  struct stat st;
+  void *p = MAP_FAILED;
+  if( fstat(fd,&st) == 0 && size_t(st.st_size) >= sizeof(Header) )
+  {
+    bytes_ = size_t(st.st_size);
+    p = mmap(NULL, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  if( p == MAP_FAILED )
+  {
+    stringstream err;
+    err << "Cannot map shared memory segment " << name_;
+    throw runtime_error(err.str());
+  }
+  segment_ = static_cast<char *>(p);
+
+  Header &h = header(segment_);
+  uint64_t magic = __atomic_load_n(reinterpret_cast<uint64_t *>(h.magic), __ATOMIC_ACQUIRE);
+  if( magic != *reinterpret_cast<const uint64_t *>(Magic) || h.version != Version
+      || __atomic_load_n(&h.running,__ATOMIC_ACQUIRE) == 0 || process_exists(h.serverPid) == false )
+  {
+    munmap(segment_, bytes_);
+    stringstream err;
+    err << "The XMLFuncServer using shared memory segment " << name_ << " is not running";
+    throw runtime_error(err.str());
+  }
+
+  // function names and argument types
+
+  const FunctionEntry *entries = reinterpret_cast<const FunctionEntry *>(segment_ + h.functionsOffset);
+  argTypes_.resize(size_t(h.numFunctions));
+  for(size_t i=0; i<argTypes_.size(); ++i)
+  {
+    string fname(segment_ + entries[i].nameOffset, size_t(entries[i].nameLength));
+    if( fname.empty() == false ) index_.insert( make_pair(fname,i) );
+
+    for(size_t a=0; a<entries[i].numArgs; ++a)
+    {
+      argTypes_[i].push_back( Number_t::Type_t( segment_[entries[i].typesOffset + a] ) );
+    }
+  }
+
+  // claim a free slot, or the slot of a client which has exited once the
+  //   server has finished with its requests
+
+  int32_t pid = int32_t(getpid());
+  for(slot_=0; slot_<h.numSlots; ++slot_)
+  {
+    Slot &s = slot(segment_,slot_);
+
+    int32_t owner = __atomic_load_n(&s.owner,__ATOMIC_ACQUIRE);
+    if( owner != 0 && ( process_exists(owner) || s.requests.empty() == false ) ) continue;
+
+    if( __atomic_compare_exchange_n(&s.owner, &owner, pid, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+    {
+      RingEntry stale;
+      while( s.responses.pop(stale) ) {}
+      break;
+    }
+  }
+
+  if( slot_ == h.numSlots )
+  {
+    munmap(segment_, bytes_);
+    stringstream err;
+    err << "All " << h.numSlots << " client slots of XMLFuncServer " << name_ << " are in use";
+    throw runtime_error(err.str());
+  }
+}
+
+XMLFuncClient::~XMLFuncClient()
+{
+  __atomic_store_n( &slot(segment_,slot_).owner, 0, __ATOMIC_RELEASE );
+  munmap(segment_, bytes_);
+}
+
+size_t XMLFuncClient::functionIndex(const string &name) const
+{
+  map<string,size_t>::const_iterator i = index_.find(name);
+  if( i == index_.end() )
+  {
+    stringstream err;
+    err << "No function named " << name << " is served by " << name_;
+    throw runtime_error(err.str());
+  }
+  return i->second;
+}
+
+Number_t XMLFuncClient::eval(size_t index, const Args_t &args)
+{
+  Number_t value;
+  unsigned status = tryEval(index, args, value);
+  if( status >= XMLFunc::UnknownFunction )
+  {
+    stringstream err;
+    err << "eval of function " << index << " served by " << name_ << " failed: " << XMLFunc::statusText(status);
+    throw runtime_error(err.str());
+  }
+  return value;
+}
+
+Number_t XMLFuncClient::eval(const string &name, const Args_t &args)
+{
+  return eval(functionIndex(name), args);
+}
+
+void XMLFuncClient::eval(size_t index, const BatchArgs_t &args, size_t n, double *out)
+{
+  unsigned status = tryEval(index, args, n, out, NULL);
+  if( status >= XMLFunc::UnknownFunction )
+  {
+    stringstream err;
+    err << "batch eval of function " << index << " served by " << name_ << " failed: " << XMLFunc::statusText(status);
+    throw runtime_error(err.str());
+  }
+}
+
+void XMLFuncClient::eval(const string &name, const BatchArgs_t &args, size_t n, double *out)
+{
+  eval(functionIndex(name), args, n, out);
+}
+
+unsigned XMLFuncClient::tryEval(size_t index, const Args_t &args, Number_t &value)
+{
+  if( index >= argTypes_.size() ) return XMLFunc::UnknownFunction;
+
+  const Header &h = header(segment_);
+
+  size_t nargs = args.size();
+  if( nargs * sizeof(WireNumber) > h.dataBytes ) nargs = h.dataBytes / sizeof(WireNumber);
+
+  for(size_t i=0; i<nargs; ++i)
+  {
+    if( args[i].isArray() ) return XMLFunc::ArgumentType;
+  }
+
+  WireNumber *wire = reinterpret_cast<WireNumber *>( data_area( slot(segment_,slot_) ) );
+  for(size_t i=0; i<nargs; ++i)
+  {
+    wire[i].type = args[i].type();
+    wire[i].ival = long(args[i]);
+    wire[i].dval = double(args[i]);
+  }
+
+  unsigned status = XMLFunc::Ok;
+  _call(EvalRequest, index, nargs, status, &value);
+  return status;
+}
+
+// The rows are sent in chunks which fit in the data area, each column converted
+//   to the type of its argument (as XMLFunc's batch evaluation does).  status may
+//   be NULL (see eval).  Nothing is sent if a single row does not fit.
+unsigned XMLFuncClient::tryEval(size_t index, const BatchArgs_t &args, size_t n, double *out, unsigned char *status)
+{
+  if( index >= argTypes_.size() ) return XMLFunc::UnknownFunction;
+
+  const vector<Number_t::Type_t> &types = argTypes_[index];
+  size_t nargs = types.size();
+
+  if( args.size() < nargs ) return XMLFunc::MissingArguments;
+  for(size_t i=0; i<nargs; ++i)
+  {
+    if( types[i] == Number_t::Integer && args[i].type() == Number_t::Double ) return XMLFunc::ArgumentType;
+    if( types[i] == Number_t::Array   || args[i].type() == Number_t::Array  ) return XMLFunc::ArgumentType;
+  }
+
+  const Header &h = header(segment_);
+  size_t chunk = h.dataBytes / ( 8 * (nargs + 1) + 1 );
+  if( chunk == 0 ) return XMLFunc::RequestTooLarge;
+
+  char *data = data_area( slot(segment_,slot_) );
+
+  unsigned rval = XMLFunc::Ok;
+  for(size_t start=0; start<n; start+=chunk)
+  {
+    size_t rows = std::min(chunk, n - start);
+
+    for(size_t i=0; i<nargs; ++i)
+    {
+      const XMLFunc::Column &c = args[i];
+      if( types[i] == Number_t::Integer )
+      {
+        long *col = reinterpret_cast<long *>(data + 8 * i * rows);
+        if( c.contiguous() ) memcpy(col, c.ivals() + start, rows * sizeof(long));
+        else                 for(size_t r=0; r<rows; ++r) col[r] = c.ival(start+r);
+      }
+      else
+      {
+        double *col = reinterpret_cast<double *>(data + 8 * i * rows);
+        if     ( c.dvals() != NULL && c.contiguous() ) memcpy(col, c.dvals() + start, rows * sizeof(double));
+        else if( c.dvals() != NULL ) for(size_t r=0; r<rows; ++r) col[r] = c.dval(start+r);
+        else if( c.fvals() != NULL ) for(size_t r=0; r<rows; ++r) col[r] = double( c.fval(start+r) );
+        else                         for(size_t r=0; r<rows; ++r) col[r] = double( c.ival(start+r) );
+      }
+    }
+
+    unsigned callStatus = XMLFunc::Ok;
+    _call(BatchRequest, index, rows, callStatus, NULL);
+    if( callStatus >= XMLFunc::UnknownFunction ) return callStatus;
+    rval |= callStatus;
+
+    memcpy(out + start, data + 8 * nargs * rows, rows * sizeof(double));
+    if( status != NULL ) memcpy(status + start, data + 8 * (nargs+1) * rows, rows);
+  }
+
+  return rval;
+}
+
+void XMLFuncClient::_call(unsigned kind, size_t index, size_t count, unsigned &status, Number_t *value)
+{
+  Header &h = header(segment_);
+  Slot   &s = slot(segment_,slot_);
+
+  RingEntry req;
+  memset(&req, 0, sizeof(req));
+  req.kind  = kind;
+  req.seq   = ++seq_;
+  req.index = index;
+  req.count = count;
+
+  while( s.requests.push(req) == false ) sched_yield();
+
+  // ring the doorbell of the slot's thread (see XMLFuncServer::Worker::run)
+  size_t t = slot_ % h.nthreads;
+  __atomic_add_fetch(&h.doorbells[t], 1U, __ATOMIC_SEQ_CST);
+  if( __atomic_load_n(&h.sleeping[t],__ATOMIC_SEQ_CST) ) futex_wake(&h.doorbells[t]);
+
+  RingEntry rsp;
+  unsigned spins = 0;
+  while(true)
+  {
+    if( s.responses.pop(rsp) )
+    {
+      if( rsp.seq == req.seq ) break;
+      continue;  // (left by a client which exited)
+    }
+
+    if( ++spins < SpinLimit ) { sched_yield(); continue; }
+
+    uint32_t tail = __atomic_load_n(&s.responses.tail,__ATOMIC_SEQ_CST);
+    __atomic_store_n(&s.waiting, 1U, __ATOMIC_SEQ_CST);
+    if( s.responses.empty() ) futex_wait(&s.responses.tail, tail);
+    __atomic_store_n(&s.waiting, 0U, __ATOMIC_SEQ_CST);
+
+    if( s.responses.empty() &&
+        ( __atomic_load_n(&h.running,__ATOMIC_ACQUIRE) == 0 || process_exists(h.serverPid) == false ) )
+    {
+      stringstream err;
+      err << "The XMLFuncServer using shared memory segment " << name_ << " has stopped";
+      throw runtime_error(err.str());
+    }
+    spins = 0;
+  }
+
+  status = rsp.status;
+  if( value != NULL )
+  {
+    if( rsp.type == Number_t::Integer ) *value = Number_t( long(rsp.ival) );
+    else                                *value = Number_t( rsp.dval );
+  }
+}
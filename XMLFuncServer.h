@@ -0,0 +1,156 @@
+#ifndef _XMLFUNCSERVER_H_
+#define _XMLFUNCSERVER_H_
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "XMLFunc.h"
+
+/*!
+ * \class XMLFuncServer
+ * \brief serves the functions of one XMLFunc to client processes on the same host
+ *
+ * The functions are built once, in the server process, rather than in every process
+ * which evaluates them.  Clients (see XMLFuncClient) attach to a named POSIX shared
+ * memory segment created by the server.  Each client claims a slot of the segment
+ * which holds a request ring, a response ring and a data area for the arguments and
+ * values.  The rings are single producer, single consumer queues indexed by atomic
+ * counters, so neither side ever takes a lock.  An idle server thread (or a client
+ * waiting for its response) sleeps on a futex and is woken by the other side.
+ *
+ * The segment also holds the name and argument types of each function, so clients
+ * look up functions and check their arguments without asking the server.
+ *
+ * Array arguments are not sent: functions with array arguments are listed, but
+ * evaluating them returns XMLFunc::ArgumentType.
+ */
+
+class XMLFuncServer
+{
+  public:
+
+    /// \brief maximum number of threads serving the clients
+    static const unsigned MaxThreads = 64;
+
+    /*!
+     * \brief Constructor
+     *
+     * \param func       - functions to serve (must outlive the server)
+     * \param name       - name of the shared memory segment (e.g. "/xmlfunc-pricing")
+     * \param maxClients - number of client slots (clients which may be attached at once)
+     * \param nthreads   - number of threads serving requests (each serves every nthreads'th slot)
+     * \param dataBytes  - size of each slot's data area, which limits the rows per batch request
+     *   (larger batches are sent in several requests).  A batch eval of a function whose 
+     *   arguments and value for one row (8 bytes each, plus a status byte) do not fit 
+     *   returns XMLFunc::RequestTooLarge.
+     *
+     * \warning A std::runtime_error will be thrown if the segment cannot be created (including
+     *   if another server is already using the name).
+     */
+    XMLFuncServer(const XMLFunc &func, const std::string &name, size_t maxClients=16,
+                  unsigned nthreads=1, size_t dataBytes=256*1024);
+
+    /// \brief Stops serving and removes the shared memory segment
+    ~XMLFuncServer();
+
+    const std::string &name(void) const { return name_; }
+
+    /// \brief Size of the shared memory segment in bytes (pages of the data areas are only allocated when used)
+    size_t segmentBytes(void) const { return bytes_; }
+
+    /// \brief Number of requests served
+    unsigned long requests(void) const;
+
+    /// \brief Number of clients attached
+    size_t numClients(void) const;
+
+  private:
+
+    XMLFuncServer(const XMLFuncServer &);
+    XMLFuncServer &operator=(const XMLFuncServer &);
+
+    class Worker;  // thread serving some of the slots
+
+    const XMLFunc          &func_;
+    std::string             name_;
+    size_t                  bytes_;
+    char                   *segment_;
+    std::vector<Worker *>   workers_;
+};
+
+/*!
+ * \class XMLFuncClient
+ * \brief evaluates functions served by an XMLFuncServer in another process
+ *
+ * The eval and tryEval methods behave as those of XMLFunc do, except that the
+ * exceptions thrown by eval only give the XMLFunc::Status_t of the failed call.
+ * A client is not thread safe: each thread should attach its own client.
+ */
+
+class XMLFuncClient
+{
+  public:
+
+    typedef XMLFunc::Number    Number;
+    typedef XMLFunc::Args      Args;
+    typedef XMLFunc::BatchArgs BatchArgs;
+
+    /*!
+     * \brief Attaches to the server using the named shared memory segment
+     *
+     * \warning A std::runtime_error will be thrown if there is no such server or if
+     *   all of its client slots are in use.
+     */
+    XMLFuncClient(const std::string &name);
+
+    /// \brief Releases the client's slot
+    ~XMLFuncClient();
+
+    /// \brief Number of functions served
+    size_t numFunctions(void) const { return argTypes_.size(); }
+
+    /*!
+     * \brief Returns the (0 based) index of the named function
+     *
+     * \warning A std::runtime_error will be thrown if there is no function with this name
+     */
+    size_t functionIndex(const std::string &name) const;
+
+    /// \brief Argument types of the function with the specified index
+    const std::vector<Number::Type_t> &argTypes(size_t index) const { return argTypes_.at(index); }
+
+    /// \brief Evaluates the function specified by index (see XMLFunc::eval())
+    Number eval(size_t index, const Args &args);
+    /// \brief Evaluates the function specified by name (see XMLFunc::eval())
+    Number eval(const std::string &name, const Args &args);
+
+    /// \brief Batch evaluates the function specified by index (see XMLFunc::eval())
+    void   eval(size_t index, const BatchArgs &args, size_t n, double *out);
+    /// \brief Batch evaluates the function specified by name (see XMLFunc::eval())
+    void   eval(const std::string &name, const BatchArgs &args, size_t n, double *out);
+
+    /// \brief Non-throwing evaluation of the function specified by index (see XMLFunc::tryEval())
+    unsigned tryEval(size_t index, const Args &args, Number &value);
+
+    /// \brief Non-throwing batch evaluation of the function specified by index (see XMLFunc::tryEval()); status may be NULL
+    unsigned tryEval(size_t index, const BatchArgs &args, size_t n, double *out, unsigned char *status);
+
+  private:
+
+    XMLFuncClient(const XMLFuncClient &);
+    XMLFuncClient &operator=(const XMLFuncClient &);
+
+    // Sends the request in the data area and waits for its response
+    void _call(unsigned kind, size_t index, size_t count, unsigned &status, Number *value);
+
+    std::string                                name_;
+    size_t                                     bytes_;
+    char                                      *segment_;
+    size_t                                     slot_;
+    unsigned                                   seq_;     // of the most recent request
+    std::map<std::string,size_t>               index_;
+    std::vector< std::vector<Number::Type_t> > argTypes_;
+};
+
+#endif // _XMLFUNCSERVER_H_
@@ -0,0 +1,1191 @@
+// bench
+//
+// Reproducible benchmarks of the XMLFunc parse/construct, single row eval, and
+//   batch eval paths.  The inputs are quad.xml, unit_tests.xml, and a set of
+//   generated stress documents (deep, wide, many-function, polynomial, and table).
+//   Nothing is read from the network and the generated documents depend only
+//   on their parameters.
+//
+// Each result is written as a single line of JSON (to stdout or the file named
+//   with -o) so that results can be collected and compared across releases:
+//
+//   {"bench":"eval_by_name","input":"quad.xml","func":"root1","param":0,
+//    "iterations":..,"samples":5,"ns_per_op_min":..,"ns_per_op_median":..,"ops_per_sec":..}
+//
+// With -S a depth scaling series is added: deep documents of 10^3 to 10^6 (with
+//   2x10^5 and 5x10^5 between 10^5 and 10^6) nested operators are constructed,
+//   evaluated and batch evaluated, and the time is reported per node ("param"
+//   is the depth) so that linear scaling shows up as a flat ns_per_op.  With
+//   -g kind:n the generated document is written to stdout instead (e.g.
+//   -g deep:1000000).
+//
+// Build:  g++ -O2 -pthread -o bench bench.cc XMLFuncServer.cc XMLFunc.cc
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "XMLFunc.h"
+#include "XMLFuncServer.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// Timing support
+////////////////////////////////////////////////////////////////////////////////
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return double(ts.tv_sec) + 1.e-9 * double(ts.tv_nsec);
+}
+
+// Something that can be timed.  run(n) must perform the operation n times.
+class Benchmark
+{
+  public:
+    virtual ~Benchmark() {}
+    virtual void run(size_t n) = 0;
+};
+
+// Defeats dead code elimination of benchmarked results
+volatile double sink;
+
+struct Options
+{
+  Options(void) : out(&cout), minTime(0.05), samples(5), quick(false), stress(false) {}
+
+  ostream  *out;
+  double    minTime;   // minimum time of each sample (seconds)
+  int       samples;
+  bool      quick;     // use smaller stress documents and batches
+  bool      stress;    // add the depth scaling series
+};
+
+// Calibrates the number of iterations so each sample takes at least
+//   minTime, then times the samples (ns, sorted, per operation).  opsPerIter 
+//   is the number of operations (e.g. rows) performed in each iteration.
+//   Returns the number of iterations per sample.
+size_t sample( const Options &opts, Benchmark &b, double opsPerIter, vector<double> &ns )
+{
+  size_t iters = 1;
+  while(true)
+  {
+    double t0 = now();
+    b.run(iters);
+    double dt = now() - t0;
+    if( dt >= opts.minTime || iters >= (size_t(1)<<40) ) break;
+    iters = ( dt <= 0. ? iters * 10 : size_t( double(iters) * 1.2 * opts.minTime / dt ) + 1 );
+  }
+
+  ns.clear();
+  for(int s=0; s<opts.samples; ++s)
+  {
+    double t0 = now();
+    b.run(iters);
+    double dt = now() - t0;
+    ns.push_back( 1.e9 * dt / ( double(iters) * opsPerIter ) );
+  }
+  sort(ns.begin(),ns.end());
+
+  return iters;
+}
+
+// Reports the min and median time per operation over the samples (see sample)
+void measure( const Options &opts, Benchmark &b,
+              const string &bench, const string &input, const string &func,
+              long param, double opsPerIter = 1. )
+{
+  vector<double> ns;
+  size_t iters = sample(opts, b, opsPerIter, ns);
+
+  double nsMin    = ns.front();
+  double nsMedian = ns[ns.size()/2];
+
+  char line[512];
+  snprintf(line, sizeof(line),
+    "{\"bench\":\"%s\",\"input\":\"%s\",\"func\":\"%s\",\"param\":%ld,"
+    "\"iterations\":%lu,\"samples\":%d,\"ns_per_op_min\":%.3f,\"ns_per_op_median\":%.3f,\"ops_per_sec\":%.1f}",
+    bench.c_str(), input.c_str(), func.c_str(), param,
+    (unsigned long)iters, opts.samples, nsMin, nsMedian, 1.e9 / nsMedian );
+
+  *opts.out << line << endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stress document generators
+////////////////////////////////////////////////////////////////////////////////
+
+// A chain of depth nested operators, alternating (x + ...) and (y * ...)
+string deep_xml(size_t depth)
+{
+  string xml = "<arglist><arg name=x/><arg name=y/></arglist>\n<func name=deep>";
+  for(size_t i=0; i<depth; ++i) xml += ( i%2 ? "<mult arg1=y>" : "<add arg1=x>" );
+  xml += "<arg name=x/>";
+  for(size_t i=depth; i>0; --i) xml += ( (i-1)%2 ? "</mult>" : "</add>" );
+  xml += "</func>\n";
+  return xml;
+}
+
+// A single sum of width products
+string wide_xml(size_t width)
+{
+  string xml = "<arglist><arg name=x/><arg name=y/></arglist>\n<func name=wide><add>";
+  for(size_t i=0; i<width; ++i)
+  {
+    char term[64];
+    snprintf(term,sizeof(term),"<mult arg1=%s arg2=%lu/>", (i%2 ? "y" : "x"), (unsigned long)(i+1));
+    xml += term;
+  }
+  xml += "</add></func>\n";
+  return xml;
+}
+
+// count small functions, f0 ... f<count-1>, sharing a root level arglist
+string many_xml(size_t count)
+{
+  string xml = "<arglist><arg name=x/><arg name=y/></arglist>\n";
+  for(size_t i=0; i<count; ++i)
+  {
+    char func[256];
+    snprintf(func,sizeof(func),
+      "<func name=f%lu><add><mult arg1=x arg2=%lu/><pow arg1=y arg2=2/><sin arg=x/></add></func>\n",
+      (unsigned long)i, (unsigned long)(i+1));
+    xml += func;
+  }
+  return xml;
+}
+
+// Coefficient j of the poly document, (-1)^j / (j+1) (rounded to a double)
+double poly_coefficient(size_t j)
+{
+  return ( j%2 ? -1. : 1. ) / double(j+1);
+}
+
+// A polynomial of degree n written out term by term, c0 + c1 * x^1 + ... + cn * x^n
+string poly_xml(size_t degree)
+{
+  string xml = "<arglist><arg name=x/></arglist>\n<func name=poly><add>";
+  for(size_t j=0; j<=degree; ++j)
+  {
+    char term[128];
+    if(j == 0) snprintf(term,sizeof(term),"<double value=%.17g/>", poly_coefficient(j));
+    else       snprintf(term,sizeof(term),"<mult><double value=%.17g/><pow arg1=x arg2=%lu/></mult>", poly_coefficient(j), (unsigned long)j);
+    xml += term;
+  }
+  xml += "</add></func>\n";
+  return xml;
+}
+
+// A table of n points of sin(2 pi x) for x in [0,1), interpolated by cubics
+string table_xml(size_t n)
+{
+  string xs, ys;
+  for(size_t i=0; i<n; ++i)
+  {
+    char value[64];
+    double x = double(i) / double(n);
+    snprintf(value,sizeof(value),"%.15g ",x);
+    xs += value;
+    snprintf(value,sizeof(value),"%.15g ",sin(6.283185307179586 * x));
+    ys += value;
+  }
+  return "<arglist><arg name=x/></arglist>\n<func name=table><table interp=cubic arg=x\n  x='" + xs + "'\n  y='" + ys + "'/></func>\n";
+}
+
+// The dot product of two n element arrays, both as a <dot> of array arguments
+//   (func dot) and written out as an add of n mults of scalar arguments w0 ...
+//   w<n-1> and x0 ... x<n-1> (func terms, with its own arglist)
+string dot_xml(size_t n)
+{
+  string xml = "<func name=dot><arglist><arg name=w type=double[]/><arg name=x type=double[]/></arglist>"
+               "<dot arg1=w arg2=x/></func>\n<func name=terms><arglist>";
+  for(size_t i=0; i<n; ++i)
+  {
+    char arg[64];
+    snprintf(arg,sizeof(arg),"<arg name=w%lu/>",(unsigned long)i);
+    xml += arg;
+  }
+  for(size_t i=0; i<n; ++i)
+  {
+    char arg[64];
+    snprintf(arg,sizeof(arg),"<arg name=x%lu/>",(unsigned long)i);
+    xml += arg;
+  }
+  xml += "</arglist><add>";
+  for(size_t i=0; i<n; ++i)
+  {
+    char term[64];
+    snprintf(term,sizeof(term),"<mult arg1=w%lu arg2=x%lu/>",(unsigned long)i,(unsigned long)i);
+    xml += term;
+  }
+  xml += "</add></func>\n";
+  return xml;
+}
+
+// Generates the stress document described by kind:n (e.g. deep:1000)
+string generate_xml(const string &spec)
+{
+  size_t colon = spec.find(':');
+  if(colon == string::npos) throw runtime_error("Generator must be kind:n (" + spec + ")");
+
+  string kind = spec.substr(0,colon);
+  long   n    = atol(spec.c_str() + colon + 1);
+  if(n < 1) throw runtime_error("Generator size must be positive (" + spec + ")");
+
+  if(kind == "deep") return deep_xml(size_t(n));
+  if(kind == "wide") return wide_xml(size_t(n));
+  if(kind == "many") return many_xml(size_t(n));
+  if(kind == "poly") return poly_xml(size_t(n));
+  if(kind == "table") return table_xml(size_t(n));
+
+  throw runtime_error("Unknown generator (" + kind + "), must be deep, wide, many, poly, or table");
+}
+
+string read_file(const string &path)
+{
+  ifstream s(path.c_str());
+  if(s.fail()) throw runtime_error("Cannot read " + path);
+  stringstream buffer;
+  buffer << s.rdbuf();
+  return buffer.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+////////////////////////////////////////////////////////////////////////////////
+
+// Reports the largest error in the values (y) of the poly document's function
+//   relative to its exact value (computed in long double) at each x, in ulps
+//   of the exact value.
+void poly_accuracy( const Options &opts, const string &func, size_t degree,
+                    const vector<double> &x, const vector<double> &y )
+{
+  double maxUlps = 0.;
+  for(size_t i=0; i<x.size(); ++i)
+  {
+    long double exact = poly_coefficient(degree);
+    for(size_t j=degree; j>0; --j) exact = exact * x[i] + poly_coefficient(j-1);
+
+    double ulp  = ldexp(1., ilogb(double(exact)) - 52);
+    double ulps = double( fabsl( (long double)y[i] - exact ) ) / ulp;
+    if( ulps > maxUlps ) maxUlps = ulps;
+  }
+
+  char line[512];
+  snprintf(line, sizeof(line),
+    "{\"bench\":\"accuracy\",\"input\":\"poly\",\"func\":\"%s\",\"param\":%lu,\"rows\":%lu,\"max_ulps\":%.3f}",
+    func.c_str(), (unsigned long)degree, (unsigned long)x.size(), maxUlps);
+
+  *opts.out << line << endl;
+}
+
+// Writes the memory used by the functions of a document
+void memory_usage( const Options &opts, const string &input, size_t param, const XMLFunc &f )
+{
+  XMLFunc::MemoryUsage mem = f.memoryUsage();
+
+  char line[512];
+  snprintf(line, sizeof(line),
+    "{\"bench\":\"memory\",\"input\":\"%s\",\"param\":%lu,\"functions\":%lu,\"arg_defs\":%lu,"
+    "\"bytes\":%lu,\"names_bytes\":%lu,\"bytes_per_func\":%.1f}",
+    input.c_str(), (unsigned long)param, (unsigned long)f.numFunctions(), (unsigned long)mem.numArgDefs,
+    (unsigned long)mem.total(), (unsigned long)mem.names, double(mem.total()) / double(f.numFunctions()));
+
+  *opts.out << line << endl;
+}
+
+// Writes the memory used by a document's functions in each process which builds
+//   them, and the shared memory used to serve them instead (see XMLFuncServer)
+void server_memory( const Options &opts, const string &input, size_t param, const XMLFunc &f, 
+                    const XMLFuncServer &server, size_t maxClients )
+{
+  char line[512];
+  snprintf(line, sizeof(line),
+    "{\"bench\":\"server_memory\",\"input\":\"%s\",\"param\":%lu,\"functions\":%lu,"
+    "\"bytes_per_process\":%lu,\"segment_bytes\":%lu,\"segment_bytes_per_client\":%.1f}",
+    input.c_str(), (unsigned long)param, (unsigned long)f.numFunctions(), (unsigned long)f.memoryUsage().total(),
+    (unsigned long)server.segmentBytes(), double(server.segmentBytes()) / double(maxClients));
+
+  *opts.out << line << endl;
+}
+
+// Writes the memory used by the operations of copies of a document built with
+//   their identical subtrees shared (see XMLFunc::Shared), and the memory saved
+void shared_memory( const Options &opts, const string &input, size_t param, const string &xml, size_t copies )
+{
+  vector<XMLFunc *> funcs;
+  for(size_t i=0; i<copies; ++i) funcs.push_back( new XMLFunc(xml, XMLFunc::Shared) );
+
+  XMLFunc::SharedOperations shared = XMLFunc::sharedOperations();
+
+  for(size_t i=0; i<copies; ++i) delete funcs[i];
+
+  char line[512];
+  snprintf(line, sizeof(line),
+    "{\"bench\":\"shared_memory\",\"input\":\"%s\",\"param\":%lu,\"copies\":%lu,\"nodes\":%lu,"
+    "\"bytes\":%lu,\"table_bytes\":%lu,\"unshared_bytes\":%lu,\"saved_bytes\":%ld}",
+    input.c_str(), (unsigned long)param, (unsigned long)copies, (unsigned long)shared.nodes,
+    (unsigned long)shared.bytes, (unsigned long)shared.table, (unsigned long)shared.unshared, shared.saved());
+
+  *opts.out << line << endl;
+}
+
+// A thread of closed loop clients of a queue: each of its window requests is 
+//   submitted again as soon as it has been evaluated, until the deadline
+struct QueueSubmitter
+{
+  XMLFuncQueue        *queue;
+  size_t               index;
+  const XMLFunc::Args *args;
+  size_t               window;
+  double               deadline;
+};
+
+void *queue_submitter(void *arg)
+{
+  QueueSubmitter &qs = *static_cast<QueueSubmitter *>(arg);
+
+  vector<XMLFuncQueue::Request> requests(qs.window);
+  for(size_t i=0; i<qs.window; ++i) qs.queue->submit(qs.index, *qs.args, requests[i]);
+
+  for(size_t i=0; now() < qs.deadline; i = (i+1) % qs.window)
+  {
+    sink = requests[i].wait();
+    qs.queue->submit(qs.index, *qs.args, requests[i]);
+  }
+
+  for(size_t i=0; i<qs.window; ++i) sink = requests[i].wait();
+  return NULL;
+}
+
+// Writes the throughput and latency of single row requests evaluated in batches
+//   of up to maxBatch rows, offered by a number of closed loop clients (spread
+//   over nthreads threads), each of which waits for its value before submitting
+//   its next request.  The latency is then that of batching at the offered load,
+//   rather than of a backlog of requests.
+void queue_tuning( const Options &opts, const XMLFunc &f, const string &input, const string &func,
+                   const XMLFunc::Args &args, size_t maxBatch, double maxDelay, size_t clients, unsigned nthreads )
+{
+  double duration = opts.minTime * double(opts.samples);
+
+  XMLFuncQueue::Stats stats;
+  double start = now();
+  {
+    XMLFuncQueue queue(f, maxBatch, maxDelay);
+
+    vector<QueueSubmitter> submitters(nthreads);
+    vector<pthread_t>      threads(nthreads);
+    for(unsigned t=0; t<nthreads; ++t)
+    {
+      submitters[t].queue    = &queue;
+      submitters[t].index    = f.functionIndex(func);
+      submitters[t].args     = &args;
+      submitters[t].window   = clients / nthreads;
+      submitters[t].deadline = start + duration;
+      pthread_create(&threads[t], NULL, queue_submitter, &submitters[t]);
+    }
+    for(unsigned t=0; t<nthreads; ++t) pthread_join(threads[t], NULL);
+
+    stats = queue.stats();
+  }
+  double seconds = now() - start;
+
+  char line[512];
+  snprintf(line, sizeof(line),
+    "{\"bench\":\"queue\",\"input\":\"%s\",\"func\":\"%s\",\"param\":%lu,\"max_delay_us\":%.0f,\"clients\":%lu,"
+    "\"requests\":%lu,\"batch_size\":%.1f,\"ops_per_sec\":%.1f,\"latency_p50_us\":%.1f,\"latency_p99_us\":%.1f}",
+    input.c_str(), func.c_str(), (unsigned long)maxBatch, 1.e6 * maxDelay, (unsigned long)clients, stats.requests, 
+    stats.batchSize(), double(stats.requests) / seconds, 1.e6 * stats.latency(0.5), 1.e6 * stats.latency(0.99));
+
+  *opts.out << line << endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+class ConstructBench : public Benchmark
+{
+  public:
+    ConstructBench(const string &xml, unsigned optimizations, unsigned nthreads=1) 
+      : xml_(xml), optimizations_(optimizations), nthreads_(nthreads) {}
+    void run(size_t n)
+    {
+      for(size_t i=0; i<n; ++i)
+      {
+        XMLFunc f(xml_,optimizations_,nthreads_);
+        sink = double(f.numFunctions());
+      }
+    }
+  private:
+    const string &xml_;
+    unsigned      optimizations_;
+    unsigned      nthreads_;
+};
+
+// Writes the tokenizer throughput for a document: a Lazy construction, which 
+//   tokenizes all of the XML but only builds the arglists, timed per byte
+void parse_throughput( const Options &opts, const string &input, long param, const string &xml )
+{
+  ConstructBench b(xml, XMLFunc::Lazy);
+
+  vector<double> ns;
+  size_t iters = sample(opts, b, double(xml.size()), ns);
+
+  char line[512];
+  snprintf(line, sizeof(line),
+    "{\"bench\":\"parse\",\"input\":\"%s\",\"param\":%ld,\"bytes\":%lu,"
+    "\"iterations\":%lu,\"samples\":%d,\"gb_per_sec_max\":%.3f,\"gb_per_sec_median\":%.3f}",
+    input.c_str(), param, (unsigned long)xml.size(), (unsigned long)iters, opts.samples,
+    1. / ns.front(), 1. / ns[ns.size()/2] );
+
+  *opts.out << line << endl;
+}
+
+class EvalByNameBench : public Benchmark
+{
+  public:
+    EvalByNameBench(const XMLFunc &f, const string &name, const XMLFunc::Args &args)
+      : f_(f), name_(name), args_(args) {}
+    void run(size_t n)
+    {
+      double s(0.);
+      for(size_t i=0; i<n; ++i) s += double( f_.eval(name_,args_) );
+      sink = s;
+    }
+  private:
+    const XMLFunc       &f_;
+    string               name_;
+    const XMLFunc::Args &args_;
+};
+
+class EvalByIndexBench : public Benchmark
+{
+  public:
+    EvalByIndexBench(const XMLFunc &f, size_t index, const XMLFunc::Args &args)
+      : f_(f), index_(index), args_(args) {}
+    void run(size_t n)
+    {
+      double s(0.);
+      for(size_t i=0; i<n; ++i) s += double( f_.eval(index_,args_) );
+      sink = s;
+    }
+  private:
+    const XMLFunc       &f_;
+    size_t               index_;
+    const XMLFunc::Args &args_;
+};
+
+class EvalReloadableBench : public Benchmark
+{
+  public:
+    EvalReloadableBench(const ReloadableXMLFunc &f, size_t index, const XMLFunc::Args &args)
+      : f_(f), index_(index), args_(args) {}
+    void run(size_t n)
+    {
+      double s(0.);
+      for(size_t i=0; i<n; ++i) s += double( f_.eval(index_,args_) );
+      sink = s;
+    }
+  private:
+    const ReloadableXMLFunc &f_;
+    size_t                   index_;
+    const XMLFunc::Args     &args_;
+};
+
+class BatchBench : public Benchmark
+{
+  public:
+    BatchBench(const XMLFunc &f, size_t index, const XMLFunc::BatchArgs &args, size_t rows)
+      : f_(f), index_(index), args_(args), out_(rows) {}
+    void run(size_t n)
+    {
+      for(size_t i=0; i<n; ++i) f_.eval(index_, args_, out_.size(), &out_[0]);
+      sink = out_[0];
+    }
+  private:
+    const XMLFunc            &f_;
+    size_t                    index_;
+    const XMLFunc::BatchArgs &args_;
+    vector<double>            out_;
+};
+
+// Batch evaluation of an array of records, either reading the arguments (and
+//   writing the values) in place with strided columns, or copying the fields 
+//   to columns and the values back (as without strided columns)
+struct Quote
+{
+  double a;
+  double b;
+  long   c;
+  double value;
+};
+
+class RecordsBench : public Benchmark
+{
+  public:
+    RecordsBench(const XMLFunc &f, size_t index, vector<Quote> &quotes, bool inPlace)
+      : f_(f), index_(index), quotes_(quotes), inPlace_(inPlace), a_(quotes.size()), b_(quotes.size()), 
+        c_(quotes.size()), out_(quotes.size())
+    {
+      XMLFunc::Stride stride(sizeof(Quote));
+
+      map<string,XMLFunc::Column> fields;
+      fields.insert( make_pair( string("a"), XMLFunc::Column(&quotes[0].a, stride) ) );
+      fields.insert( make_pair( string("b"), XMLFunc::Column(&quotes[0].b, stride) ) );
+      fields.insert( make_pair( string("c"), XMLFunc::Column(&quotes[0].c, stride) ) );
+      fieldArgs_ = f.bind(index, fields);
+
+      columnArgs_.add(&a_[0]);
+      columnArgs_.add(&b_[0]);
+      columnArgs_.add(&c_[0]);
+    }
+    void run(size_t n)
+    {
+      size_t rows = quotes_.size();
+      for(size_t i=0; i<n; ++i)
+      {
+        if( inPlace_ )
+        {
+          f_.eval(index_, fieldArgs_, rows, &quotes_[0].value, XMLFunc::Stride(sizeof(Quote)));
+          continue;
+        }
+        for(size_t r=0; r<rows; ++r) { a_[r] = quotes_[r].a; b_[r] = quotes_[r].b; c_[r] = quotes_[r].c; }
+        f_.eval(index_, columnArgs_, rows, &out_[0]);
+        for(size_t r=0; r<rows; ++r) quotes_[r].value = out_[r];
+      }
+      sink = quotes_[0].value;
+    }
+  private:
+    const XMLFunc      &f_;
+    size_t              index_;
+    vector<Quote>      &quotes_;
+    bool                inPlace_;
+    vector<double>      a_, b_;
+    vector<long>        c_;
+    vector<double>      out_;
+    XMLFunc::BatchArgs  fieldArgs_;
+    XMLFunc::BatchArgs  columnArgs_;
+};
+
+// Evaluation over the values of one argument, with the others fixed, either as a 
+//   sweep (which evaluates the ops not depending on the argument once) or as a
+//   batch eval with columns repeating the fixed values
+class SweepBench : public Benchmark
+{
+  public:
+    SweepBench(const XMLFunc &f, size_t index, const XMLFunc::Args &args, const XMLFunc::Axis &x, bool sweep)
+      : f_(f), index_(index), args_(args), x_(x), sweep_(sweep), cols_(args.size()), out_(x.size())
+    {
+      for(size_t i=0; i<args.size(); ++i)
+      {
+        cols_[i].assign(x.size(), double(args[i]));
+        columns_.add(&cols_[i][0]);
+      }
+      cols_[x_.index()] = x.values();
+    }
+    void run(size_t n)
+    {
+      for(size_t i=0; i<n; ++i)
+      {
+        if(sweep_) f_.sweep(index_, args_, x_, &out_[0]);
+        else       f_.eval(index_, columns_, out_.size(), &out_[0]);
+      }
+      sink = out_[0];
+    }
+  private:
+    const XMLFunc            &f_;
+    size_t                    index_;
+    const XMLFunc::Args      &args_;
+    const XMLFunc::Axis      &x_;
+    bool                      sweep_;
+    vector< vector<double> >  cols_;
+    XMLFunc::BatchArgs        columns_;
+    vector<double>            out_;
+};
+
+class ServedEvalBench : public Benchmark
+{
+  public:
+    ServedEvalBench(XMLFuncClient &client, size_t index, const XMLFunc::Args &args)
+      : client_(client), index_(index), args_(args) {}
+    void run(size_t n)
+    {
+      double s(0.);
+      for(size_t i=0; i<n; ++i) s += double( client_.eval(index_,args_) );
+      sink = s;
+    }
+  private:
+    XMLFuncClient       &client_;
+    size_t               index_;
+    const XMLFunc::Args &args_;
+};
+
+class ServedBatchBench : public Benchmark
+{
+  public:
+    ServedBatchBench(XMLFuncClient &client, size_t index, const XMLFunc::BatchArgs &args, size_t rows)
+      : client_(client), index_(index), args_(args), out_(rows) {}
+    void run(size_t n)
+    {
+      for(size_t i=0; i<n; ++i) client_.eval(index_, args_, out_.size(), &out_[0]);
+      sink = out_[0];
+    }
+  private:
+    XMLFuncClient            &client_;
+    size_t                    index_;
+    const XMLFunc::BatchArgs &args_;
+    vector<double>            out_;
+};
+
+class BatchFloatBench : public Benchmark
+{
+  public:
+    BatchFloatBench(const XMLFunc &f, size_t index, const XMLFunc::BatchArgs &args, size_t rows)
+      : f_(f), index_(index), args_(args), out_(rows) {}
+    void run(size_t n)
+    {
+      for(size_t i=0; i<n; ++i) f_.eval(index_, args_, out_.size(), &out_[0]);
+      sink = out_[0];
+    }
+  private:
+    const XMLFunc            &f_;
+    size_t                    index_;
+    const XMLFunc::BatchArgs &args_;
+    vector<float>             out_;
+};
+
+class ReduceBench : public Benchmark
+{
+  public:
+    ReduceBench(const XMLFunc &f, size_t index, const XMLFunc::BatchArgs &args, size_t rows, unsigned nthreads)
+      : f_(f), index_(index), args_(args), rows_(rows), nthreads_(nthreads) {}
+    void run(size_t n)
+    {
+      for(size_t i=0; i<n; ++i)
+      {
+        XMLFunc::Summary s;
+        f_.reduce(index_, args_, rows_, s, nthreads_);
+        sink = s.mean();
+      }
+    }
+  private:
+    const XMLFunc            &f_;
+    size_t                    index_;
+    const XMLFunc::BatchArgs &args_;
+    size_t                    rows_;
+    unsigned                  nthreads_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////////
+
+void usage(const char *argv0)
+{
+  cerr << endl
+    << "Usage: " << argv0 << " [-q] [-S] [-o file] [-t seconds] [-s samples]" << endl
+    << "       " << argv0 << " -g kind:n" << endl
+    << endl
+    << "  -q          quick run (smaller stress documents and batches)" << endl
+    << "  -S          add the depth scaling series (deep documents up to 10^6)" << endl
+    << "  -g kind:n   write a generated stress document (deep, wide, many, poly, or table) to stdout" << endl
+    << "  -o file     write results to file (default is stdout)" << endl
+    << "  -t seconds  minimum time per sample (default 0.05)" << endl
+    << "  -s samples  number of samples per benchmark (default 5)" << endl
+    << endl
+    << "  Must be run from the directory containing quad.xml and unit_tests.xml" << endl
+    << endl;
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  Options opts;
+  ofstream outFile;
+
+  int opt;
+  while( (opt = getopt(argc,argv,"qSg:o:t:s:h")) != -1 )
+  {
+    switch(opt)
+    {
+      case 'q': opts.quick  = true; break;
+      case 'S': opts.stress = true; break;
+      case 'g':
+        try
+        {
+          cout << generate_xml(optarg);
+        }
+        catch( exception &e )
+        {
+          cerr << "bench: " << e.what() << endl;
+          return 1;
+        }
+        return 0;
+      case 'o':
+        outFile.open(optarg);
+        if(outFile.fail()) { cerr << "Cannot create " << optarg << endl; return 1; }
+        opts.out = &outFile;
+        break;
+      case 't': opts.minTime = atof(optarg);     break;
+      case 's': opts.samples = atoi(optarg);     break;
+      default:  usage(argv[0]);
+    }
+  }
+  if(opts.samples < 1) usage(argv[0]);
+
+  try
+  {
+    // Inputs
+
+    string quadXml = read_file("quad.xml");
+    string utXml   = read_file("unit_tests.xml");
+
+    vector<size_t> depths;
+    vector<size_t> widths;
+    vector<size_t> counts;
+    depths.push_back(10);  depths.push_back(100);
+    widths.push_back(10);  widths.push_back(100);  widths.push_back(1000);
+    counts.push_back(10);  counts.push_back(100);  counts.push_back(1000);
+    if(opts.quick == false)
+    {
+      depths.push_back(1000);
+      widths.push_back(10000);
+      counts.push_back(10000);
+    }
+
+    size_t rows = ( opts.quick ? 10000 : 1000000 );
+
+    // Parse and construct
+
+    {
+      ConstructBench b(quadXml, XMLFunc::NoOptimization);
+      measure(opts, b, "construct", "quad.xml", "", long(quadXml.size()));
+    }
+    {
+      ConstructBench b(utXml, XMLFunc::NoOptimization);
+      measure(opts, b, "construct", "unit_tests.xml", "", long(utXml.size()));
+    }
+    for(size_t i=0; i<depths.size(); ++i)
+    {
+      string xml = deep_xml(depths[i]);
+      ConstructBench b(xml, XMLFunc::NoOptimization);
+      measure(opts, b, "construct", "deep", "", long(depths[i]));
+    }
+    for(size_t i=0; i<widths.size(); ++i)
+    {
+      string xml = wide_xml(widths[i]);
+      ConstructBench b(xml, XMLFunc::NoOptimization);
+      measure(opts, b, "construct", "wide", "", long(widths[i]));
+    }
+    for(size_t i=0; i<counts.size(); ++i)
+    {
+      string xml = many_xml(counts[i]);
+      ConstructBench b(xml, XMLFunc::NoOptimization);
+      ConstructBench lb(xml, XMLFunc::Lazy);
+      ConstructBench pb(xml, XMLFunc::NoOptimization, 4);
+      ConstructBench sb(xml, XMLFunc::Shared);
+      measure(opts, b,  "construct",          "many", "", long(counts[i]));
+      measure(opts, lb, "construct_lazy",     "many", "", long(counts[i]));
+      measure(opts, pb, "construct_4threads", "many", "", long(counts[i]));
+      measure(opts, sb, "construct_shared",   "many", "", long(counts[i]));
+      shared_memory(opts, "many", counts[i], xml, 1);
+      shared_memory(opts, "many", counts[i], xml, 4);
+    }
+
+    // Tokenizer throughput
+
+    parse_throughput(opts, "unit_tests.xml", 0, utXml);
+    for(size_t i=0; i<widths.size(); ++i) parse_throughput(opts, "wide", long(widths[i]), wide_xml(widths[i]));
+    for(size_t i=0; i<counts.size(); ++i) parse_throughput(opts, "many", long(counts[i]), many_xml(counts[i]));
+
+    // Single row eval
+
+    XMLFunc quad(quadXml);
+    XMLFunc ut(utXml);
+
+    XMLFunc::Args quadArgs;
+    quadArgs.add(1.);
+    quadArgs.add(-3.5);
+    quadArgs.add(2);
+    quadArgs.add(1234);
+
+    XMLFunc::Args xArgs;
+    xArgs.add(0.5);
+
+    XMLFunc::Args xyArgs;
+    xyArgs.add(0.5);
+    xyArgs.add(0.5);
+
+    const char *quadFuncs[] = { "root1", "root2" };
+    for(size_t i=0; i<2; ++i)
+    {
+      EvalByNameBench  b1(quad, quadFuncs[i], quadArgs);
+      EvalByIndexBench b2(quad, quad.functionIndex(quadFuncs[i]), quadArgs);
+      measure(opts, b1, "eval_by_name",  "quad.xml", quadFuncs[i], 0);
+      measure(opts, b2, "eval_by_index", "quad.xml", quadFuncs[i], 0);
+    }
+
+    ReloadableXMLFunc reloadable("quad.xml");
+    {
+      EvalReloadableBench b(reloadable, quad.functionIndex("root1"), quadArgs);
+      measure(opts, b, "eval_reloadable", "quad.xml", "root1", 0);
+    }
+
+    const char *utFuncs[] = { "neg", "sin", "sqrt", "log10" };
+    for(size_t i=0; i<4; ++i)
+    {
+      EvalByNameBench  b1(ut, utFuncs[i], xArgs);
+      EvalByIndexBench b2(ut, ut.functionIndex(utFuncs[i]), xArgs);
+      measure(opts, b1, "eval_by_name",  "unit_tests.xml", utFuncs[i], 0);
+      measure(opts, b2, "eval_by_index", "unit_tests.xml", utFuncs[i], 0);
+    }
+
+    for(size_t i=0; i<depths.size(); ++i)
+    {
+      XMLFunc f( deep_xml(depths[i]) );
+      EvalByIndexBench b(f, 0, xyArgs);
+      measure(opts, b, "eval_by_index", "deep", "deep", long(depths[i]));
+    }
+    for(size_t i=0; i<widths.size(); ++i)
+    {
+      XMLFunc f( wide_xml(widths[i]) );
+      EvalByIndexBench b(f, 0, xyArgs);
+      measure(opts, b, "eval_by_index", "wide", "wide", long(widths[i]));
+    }
+    for(size_t i=0; i<counts.size(); ++i)
+    {
+      XMLFunc f( many_xml(counts[i]) );
+
+      char name[32];
+      snprintf(name,sizeof(name),"f%lu",(unsigned long)(counts[i]/2));
+
+      EvalByNameBench  b1(f, name, xyArgs);
+      EvalByIndexBench b2(f, counts[i]/2, xyArgs);
+      measure(opts, b1, "eval_by_name",  "many", name, long(counts[i]));
+      measure(opts, b2, "eval_by_index", "many", name, long(counts[i]));
+      memory_usage(opts, "many", counts[i], f);
+    }
+
+    // Batch eval (ops are rows)
+
+    vector<double> a(rows), b(rows), x(rows), y(rows);
+    vector<long>   c(rows);
+    unsigned long  seed = 12345;
+    for(size_t i=0; i<rows; ++i)
+    {
+      seed = seed * 6364136223846793005UL + 1442695040888963407UL;  // LCG, fixed seed
+      double u = double(seed >> 11) / double(1UL << 53);
+      a[i] = 1. + u;
+      b[i] = -9. + 4. * u;
+      c[i] = long(i % 4);
+      x[i] = u;
+      y[i] = 1. - u;
+    }
+
+    XMLFunc::BatchArgs quadCols;
+    quadCols.add(&a[0]);
+    quadCols.add(&b[0]);
+    quadCols.add(&c[0]);
+    quadCols.add(&c[0]);
+
+    XMLFunc::BatchArgs xCols;
+    xCols.add(&x[0]);
+
+    XMLFunc::BatchArgs xyCols;
+    xyCols.add(&x[0]);
+    xyCols.add(&y[0]);
+
+    for(size_t i=0; i<2; ++i)
+    {
+      BatchBench bb(quad, quad.functionIndex(quadFuncs[i]), quadCols, rows);
+      measure(opts, bb, "batch", "quad.xml", quadFuncs[i], long(rows), double(rows));
+    }
+    for(size_t i=0; i<4; ++i)
+    {
+      BatchBench bb(ut, ut.functionIndex(utFuncs[i]), xCols, rows);
+      measure(opts, bb, "batch", "unit_tests.xml", utFuncs[i], long(rows), double(rows));
+    }
+
+    // Arrays of records, in place and repacked into columns (ops are rows)
+
+    {
+      vector<Quote> quotes(rows);
+      for(size_t i=0; i<rows; ++i) { quotes[i].a = a[i]; quotes[i].b = b[i]; quotes[i].c = c[i]; quotes[i].value = 0.; }
+
+      RecordsBench ib(quad, quad.functionIndex("root1"), quotes, true);
+      RecordsBench rb(quad, quad.functionIndex("root1"), quotes, false);
+      measure(opts, ib, "batch_records", "quad.xml", "in_place", long(rows), double(rows));
+      measure(opts, rb, "batch_records", "quad.xml", "repacked", long(rows), double(rows));
+    }
+
+    // root1 over b, with a and c fixed, swept and as a batch (ops are values of b)
+
+    {
+      XMLFunc::Args fixed;
+      fixed.add(1.5);
+      fixed.add(0.);
+      fixed.add(2.);
+
+      XMLFunc::Axis bs(1, -9., -5., rows);
+
+      SweepBench sb(quad, quad.functionIndex("root1"), fixed, bs, true);
+      SweepBench eb(quad, quad.functionIndex("root1"), fixed, bs, false);
+      measure(opts, sb, "sweep", "quad.xml", "root1", long(rows), double(rows));
+      measure(opts, eb, "sweep", "quad.xml", "root1_batch", long(rows), double(rows));
+    }
+    for(size_t i=0; i<depths.size(); ++i)
+    {
+      XMLFunc f( deep_xml(depths[i]) );
+      BatchBench bb(f, 0, xyCols, rows);
+      measure(opts, bb, "batch", "deep", "deep", long(depths[i]), double(rows));
+    }
+    for(size_t i=0; i<widths.size(); ++i)
+    {
+      XMLFunc f( wide_xml(widths[i]) );
+      BatchBench bb(f, 0, xyCols, rows);
+      measure(opts, bb, "batch", "wide", "wide", long(widths[i]), double(rows));
+    }
+
+    // Single precision batch eval, with float columns and values (ops are rows)
+
+    vector<float> fa(a.begin(),a.end()), fb(b.begin(),b.end()), fx(x.begin(),x.end());
+
+    XMLFunc::BatchArgs quadFloatCols;
+    quadFloatCols.add(&fa[0]);
+    quadFloatCols.add(&fb[0]);
+    quadFloatCols.add(&c[0]);
+    quadFloatCols.add(&c[0]);
+
+    XMLFunc::BatchArgs xFloatCols;
+    xFloatCols.add(&fx[0]);
+
+    {
+      XMLFunc quadSingle("quad.xml", XMLFunc::SinglePrecision);
+      XMLFunc utSingle("unit_tests.xml", XMLFunc::SinglePrecision);
+
+      for(size_t i=0; i<2; ++i)
+      {
+        BatchFloatBench bb(quadSingle, quadSingle.functionIndex(quadFuncs[i]), quadFloatCols, rows);
+        measure(opts, bb, "batch_single", "quad.xml", quadFuncs[i], long(rows), double(rows));
+      }
+      for(size_t i=0; i<4; ++i)
+      {
+        BatchFloatBench bb(utSingle, utSingle.functionIndex(utFuncs[i]), xFloatCols, rows);
+        measure(opts, bb, "batch_single", "unit_tests.xml", utFuncs[i], long(rows), double(rows));
+      }
+    }
+
+    // Evaluation by a shared memory server (from a client in this process, but
+    //   through the rings and the server's thread, as from another process)
+
+    {
+      stringstream segment;
+      segment << "/xmlfunc-bench-" << getpid();
+      XMLFuncServer server(quad, segment.str());
+      XMLFuncClient client(segment.str());
+
+      ServedEvalBench  b(client, client.functionIndex("root1"), quadArgs);
+      ServedBatchBench bb(client, client.functionIndex("root1"), quadCols, rows);
+      measure(opts, b,  "eval_served",  "quad.xml", "root1", 0);
+      measure(opts, bb, "batch_served", "quad.xml", "root1", long(rows), double(rows));
+
+      server_memory(opts, "quad.xml", 0, quad, server, 16);
+    }
+    for(size_t i=0; i<counts.size(); ++i)
+    {
+      stringstream segment;
+      segment << "/xmlfunc-bench-" << getpid();
+      XMLFunc f( many_xml(counts[i]) );
+      XMLFuncServer server(f, segment.str());
+      server_memory(opts, "many", counts[i], f, server, 16);
+    }
+
+    // Single row requests from 4, 64, and 256 closed loop clients (on 4 threads),
+    //   queued and evaluated in batches of up to 1, 16 and 256 rows
+
+    size_t maxBatches[] = { 1, 16, 256 };
+    size_t clients[]    = { 4, 64, 256 };
+    for(size_t i=0; i<3; ++i)
+    {
+      for(size_t c=0; c<3; ++c)
+      {
+        queue_tuning(opts, quad, "quad.xml", "root1", quadArgs, maxBatches[i], 100.e-6, clients[c], 4);
+      }
+    }
+
+    // Fused batch reduction (ops are rows)
+
+    unsigned nthreads[] = { 1, 4 };
+    for(size_t i=0; i<2; ++i)
+    {
+      ReduceBench rb(quad, quad.functionIndex("root1"), quadCols, rows, nthreads[i]);
+      measure(opts, rb, "reduce", "quad.xml", "root1", long(nthreads[i]), double(rows));
+    }
+
+    // Integer division by a constant (multiply and shift) and by a column of
+    //   the same divisor (hardware divide)
+
+    vector<long> in(rows), id(rows, 7L);
+    for(size_t i=0; i<rows; ++i) in[i] = long(i) * 2654435761L - long(rows);
+
+    XMLFunc::BatchArgs intCols;
+    intCols.add(&in[0]);
+    intCols.add(&id[0]);
+
+    {
+      XMLFunc idiv("<arglist><arg name=n type=integer/><arg name=d type=integer/></arglist>"
+                   "<func name=\"div_const\"><div arg1=n arg2=7/></func>"
+                   "<func name=\"div_var\"><div arg1=n arg2=d/></func>"
+                   "<func name=\"mod_const\"><mod arg1=n arg2=7/></func>"
+                   "<func name=\"mod_var\"><mod arg1=n arg2=d/></func>");
+
+      const char *idivFuncs[] = { "div_const", "div_var", "mod_const", "mod_var" };
+      for(size_t i=0; i<4; ++i)
+      {
+        BatchBench bb(idiv, idiv.functionIndex(idivFuncs[i]), intCols, rows);
+        measure(opts, bb, "batch", "integer", idivFuncs[i], long(rows), double(rows));
+      }
+    }
+
+    // Polynomials evaluated by Horner's rule and as written (term by term), with
+    //   the accuracy of each over x in [-1,1)
+
+    vector<double> px(rows);
+    for(size_t i=0; i<rows; ++i) px[i] = 2. * x[i] - 1.;
+
+    XMLFunc::BatchArgs pxCols;
+    pxCols.add(&px[0]);
+
+    size_t degrees[] = { 4, 8, 16 };
+    for(size_t i=0; i<3; ++i)
+    {
+      string xml = poly_xml(degrees[i]);
+
+      XMLFunc horner(xml, XMLFunc::Polynomials);
+      XMLFunc naive(xml, XMLFunc::NoOptimization);
+
+      EvalByIndexBench hb(horner, 0, xArgs);
+      EvalByIndexBench nb(naive,  0, xArgs);
+      measure(opts, hb, "eval_by_index", "poly", "horner", long(degrees[i]));
+      measure(opts, nb, "eval_by_index", "poly", "naive",  long(degrees[i]));
+
+      BatchBench hbb(horner, 0, pxCols, rows);
+      BatchBench nbb(naive,  0, pxCols, rows);
+      measure(opts, hbb, "batch", "poly", "horner", long(degrees[i]), double(rows));
+      measure(opts, nbb, "batch", "poly", "naive",  long(degrees[i]), double(rows));
+
+      vector<double> py(rows);
+      horner.eval(0, pxCols, rows, &py[0]);
+      poly_accuracy(opts, "horner", degrees[i], px, py);
+      naive.eval(0, pxCols, rows, &py[0]);
+      poly_accuracy(opts, "naive", degrees[i], px, py);
+    }
+
+    // Tables of up to a million points, loaded and interpolated at x in [0,1)
+
+    size_t points[] = { 1000, 100000, 1000000 };
+    for(size_t i=0; i<( opts.quick ? 2 : 3 ); ++i)
+    {
+      string xml = table_xml(points[i]);
+
+      ConstructBench cb(xml, XMLFunc::NoOptimization);
+      measure(opts, cb, "construct", "table", "", long(points[i]));
+
+      XMLFunc table(xml);
+      EvalByIndexBench eb(table, 0, xArgs);
+      measure(opts, eb, "eval_by_index", "table", "cubic", long(points[i]));
+
+      BatchBench bb(table, 0, xCols, rows);
+      measure(opts, bb, "batch", "table", "cubic", long(points[i]), double(rows));
+    }
+
+    // Dot products of arrays of up to 10000 values, by the <dot> kernel and as
+    //   a tree of n mults of scalar arguments
+
+    size_t lengths[] = { 100, 1000, 10000 };
+    for(size_t i=0; i<3; ++i)
+    {
+      size_t len = lengths[i];
+      XMLFunc dot( dot_xml(len) );
+
+      vector<double> w(len), v(len);
+      for(size_t j=0; j<len; ++j) { w[j] = 1. / double(j+1); v[j] = x[j % rows]; }
+
+      XMLFunc::Args arrayArgs;
+      arrayArgs.add(&w[0],len);
+      arrayArgs.add(&v[0],len);
+
+      XMLFunc::Args scalarArgs;
+      for(size_t j=0; j<len; ++j) scalarArgs.add(w[j]);
+      for(size_t j=0; j<len; ++j) scalarArgs.add(v[j]);
+
+      EvalByIndexBench ab(dot, dot.functionIndex("dot"),   arrayArgs);
+      EvalByIndexBench sb(dot, dot.functionIndex("terms"), scalarArgs);
+      measure(opts, ab, "eval_by_index", "dot", "array",   long(len));
+      measure(opts, sb, "eval_by_index", "dot", "scalars", long(len));
+
+      // (rows of the same arrays)
+      size_t dotRows = max(size_t(1), 100000 / len);
+      vector<double> ws(dotRows * len), vs(dotRows * len);
+      for(size_t r=0; r<dotRows; ++r)
+      {
+        copy(w.begin(), w.end(), ws.begin() + r * len);
+        copy(v.begin(), v.end(), vs.begin() + r * len);
+      }
+
+      XMLFunc::BatchArgs arrayCols;
+      arrayCols.add(&ws[0],len);
+      arrayCols.add(&vs[0],len);
+
+      BatchBench bb(dot, dot.functionIndex("dot"), arrayCols, dotRows);
+      measure(opts, bb, "batch", "dot", "array", long(len), double(dotRows));
+    }
+
+    // Depth scaling (ops are nodes; a flat ns_per_op is linear scaling)
+
+    if(opts.stress)
+    {
+      Options once(opts);
+      once.samples = 1;
+
+      size_t stressRows = 1000;
+      size_t depths[] = { 1000, 10000, 100000, 200000, 500000, 1000000 };
+      for(size_t i=0; i<sizeof(depths)/sizeof(depths[0]); ++i)
+      {
+        size_t depth = depths[i];
+        string xml = deep_xml(depth);
+        double nodes = double(2*depth + 1);
+
+        ConstructBench cb(xml, XMLFunc::NoOptimization);
+        measure(once, cb, "stress_construct", "deep", "", long(depth), nodes);
+
+        XMLFunc f(xml);
+        EvalByIndexBench eb(f, 0, xyArgs);
+        measure(once, eb, "stress_eval", "deep", "deep", long(depth), nodes);
+
+        BatchBench bb(f, 0, xyCols, stressRows);
+        measure(once, bb, "stress_batch", "deep", "deep", long(depth), nodes * double(stressRows));
+      }
+    }
+  }
+  catch( exception &e )
+  {
+    cerr << "bench: " << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
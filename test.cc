@@ -2,11 +2,151 @@
 #include <fstream>
 #include <sstream>
 #include <stdlib.h>
+#include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include <vector>
+#include <limits>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "XMLFunc.h"
+#include "XMLFuncServer.h"
 
 using namespace std;
 
+// Reference integer division: division by 0 is 0, and LONG_MIN / -1 wraps around
+static long ref_quotient(long n, long d)  { return d == 0 ? 0 : d == -1 ? long(0UL - (unsigned long)n) : n / d; }
+static long ref_remainder(long n, long d) { return ( d == 0 || d == -1 ) ? 0 : n % d; }
+
+// Evaluates every function of a library built with XMLFunc::Lazy, in a different
+//   order in each thread, counting values other than f(i) = 2+i
+struct LazyEvals
+{
+  const XMLFunc *lib;
+  size_t         start;
+  size_t         misses;
+};
+
+static void *lazy_evals(void *arg)
+{
+  LazyEvals &le = *static_cast<LazyEvals *>(arg);
+
+  size_t n = le.lib->numFunctions();
+  for(size_t k=0; k<n; ++k)
+  {
+    size_t i = ( le.start + 7 * k ) % n;
+
+    XMLFunc::Args args;
+    args.add(2L);
+    if( long(le.lib->eval(i,args)) != long(2+i) ) ++le.misses;
+  }
+  return NULL;
+}
+
+// Evaluates two functions on one pinned version of a reloadable library until 
+//   done, counting pairs which differ from each other or from the version number
+struct ReloadEvals
+{
+  const ReloadableXMLFunc *lib;
+  const bool              *done;
+  size_t                   misses;
+};
+
+static void *reload_evals(void *arg)
+{
+  ReloadEvals &re = *static_cast<ReloadEvals *>(arg);
+
+  XMLFunc::Args args;
+  args.add(0L);
+  while( __atomic_load_n(re.done,__ATOMIC_ACQUIRE) == false )
+  {
+    ReloadableXMLFunc::Handle h(*re.lib);
+    long a = long( h->eval("a",args) );
+    long b = long( h->eval("b",args) );
+    if( a != b || a != long(h.version()) ) ++re.misses;
+  }
+  return NULL;
+}
+
+// Builds, evaluates and deletes one version of a library 50 times with its
+//   operations shared (see XMLFunc::Shared), counting wrong values
+struct SharedBuilds
+{
+  long   version;
+  size_t misses;
+};
+
+static string version_xml(long version);
+
+static void *shared_builds(void *arg)
+{
+  SharedBuilds &sb = *static_cast<SharedBuilds *>(arg);
+
+  XMLFunc::Args args;
+  args.add(0L);
+  for(size_t i=0; i<50; ++i)
+  {
+    XMLFunc lib(version_xml(sb.version), XMLFunc::Shared);
+    if( long(lib.eval("a",args)) != sb.version || long(lib.eval("b",args)) != sb.version ) ++sb.misses;
+  }
+  return NULL;
+}
+
+// Submits 100 requests for f(x) = x+1 to a queue, adding the values to sum
+struct QueueSubmits
+{
+  XMLFuncQueue *queue;
+  long          start;
+};
+
+static void add_value(void *sum, double value, unsigned status)
+{
+  if( status == XMLFunc::Ok ) __sync_fetch_and_add( static_cast<long *>(sum), long(value) );
+}
+
+static long queueSum = 0;
+
+static void *queue_submits(void *arg)
+{
+  QueueSubmits &qs = *static_cast<QueueSubmits *>(arg);
+
+  for(long i=0; i<100; ++i)
+  {
+    XMLFunc::Args args;
+    args.add(qs.start + i);
+    qs.queue->submit("f", args, add_value, &queueSum);
+  }
+  return NULL;
+}
+
+// The arguments of quad.xml's root1 and its value, in an application's own
+//   (mixed) record layout
+struct Quote
+{
+  double a;
+  float  b;
+  long   c;
+  double root1;
+};
+
+// Library whose functions a and b both return version
+static string version_xml(long version)
+{
+  stringstream xml;
+  xml << "<arglist><arg name=x type=int/></arglist>"
+    << "<func name=a><add arg1=x arg2=" << version << "/></func>"
+    << "<func name=b><sub arg1=" << version << " arg2=x/></func>";
+  return xml.str();
+}
+
+static void write_file(const char *path, const string &contents)
+{
+  ofstream s(path);
+  s << contents;
+}
+
 int main(int argc,char **argv)
 {
   try
@@ -106,7 +246,1034 @@ int main(int argc,char **argv)
     y = ut.eval("log2",args);
     cout << "log2(36) = " << y << (y.isInteger() ? " (int)" : "") << endl;
 
-    
+    cout << endl;
+
+    args.clear();
+    args.add(3.);
+    args.add(4.);
+
+    y = ut.eval("hypot",args);
+    cout << "hypot(3,4) = " << y << (y.isInteger() ? " (int)" : "") << endl;
+
+    args.clear();
+    args.add(7.5);
+    args.add(2);
+
+    y = ut.eval("mod",args);
+    cout << "mod(7.5,2) = " << y << (y.isInteger() ? " (int)" : "") << endl;
+
+    try
+    {
+      XMLFunc recursive("<arglist><arg name=x/></arglist>"
+                        "<func name=f><call func=g><arg name=x/></call></func>"
+                        "<func name=g><call func=f><arg name=x/></call></func>");
+      cout << "recursive call was NOT rejected" << endl;
+    }
+    catch( runtime_error &e )
+    {
+      cout << "recursive call rejected" << endl;
+    }
+
+    try
+    {
+      XMLFunc mistyped("<func name=half><arglist><arg name=n type=integer/></arglist><div arg1=n arg2=2/></func>"
+                       "<func name=f><arglist><arg name=x/></arglist><call func=half><arg name=x/></call></func>");
+      cout << "double passed for integer argument was NOT rejected" << endl;
+    }
+    catch( runtime_error &e )
+    {
+      cout << "double passed for integer argument rejected" << endl;
+    }
+
+    // Each function calls the one before it twice, so that inlining the calls
+    //   doubles the size of the body at each level
+
+    stringstream doubling;
+    doubling << "<arglist><arg name=x/></arglist><func name=f0><mult arg1=x arg2=1.5/></func>";
+    for(int k=1; k<=30; ++k)
+    {
+      doubling << "<func name=f" << k << "><add><call func=f" << k-1 << "><arg name=x/></call>"
+               << "<call func=f" << k-1 << "><arg name=x/></call></add></func>";
+      if( k == 12 )
+      {
+        XMLFunc shallow(doubling.str());
+        args.clear();
+        args.add(1.);
+        cout << "f12(1) with calls inlined = " << shallow.eval("f12",args);
+      }
+    }
+    cout << endl;
+
+    // Inlined, f30 would have billions of operations, so the calls of the larger
+    //   functions are evaluated instead (in batch, one argument becomes a column)
+
+    {
+      XMLFunc deep(doubling.str());
+      args.clear();
+      args.add(1.);
+      y = deep.eval("f20",args);
+
+      double xs[2] = { 1., 2. };
+      double ys[2];
+      XMLFunc::BatchArgs xbatch;
+      xbatch.add(xs);
+      deep.eval("f20",xbatch,2,ys);
+
+      cout << "f20(1) with calls evaluated = " << y << (double(y) == ys[0] ? "" : " (BATCH MISMATCH)")
+           << ", f20(2) = " << ys[1] << endl;
+    }
+
+    // Calls evaluated with an array and more than three other arguments
+
+    stringstream wide;
+    wide << "<arglist><arg name=x/><arg name=n type=int/><arg name=y/><arg name=z/><arg name=w type=double[]/></arglist>"
+         << "<func name=g0><add><mult arg1=x arg2=n/><sub arg1=y arg2=z/><sum arg=w/></add></func>";
+    for(int k=1; k<=18; ++k)
+    {
+      wide << "<func name=g" << k << "><add>";
+      for(int c=0; c<2; ++c)
+      {
+        wide << "<call func=g" << k-1 << "><arg name=x/><arg name=n/><arg name=y/><arg name=z/><arg name=w/></call>";
+      }
+      wide << "</add></func>";
+    }
+    {
+      XMLFunc calls(wide.str());
+
+      double w[4] = { 1., 2., 3., 4. };
+      args.clear();
+      args.add(1.5);
+      args.add(2);
+      args.add(1.);
+      args.add(0.5);
+      args.add(w,2);
+      y = calls.eval("g18",args);
+
+      double gx[2] = { 1.5, 1.5 }, gy[2] = { 1., 0. }, gz[2] = { 0.5, 0.5 }, gv[2];
+      long   gn[2] = { 2, 3 };
+      XMLFunc::BatchArgs gbatch;
+      gbatch.add(gx);
+      gbatch.add(gn);
+      gbatch.add(gy);
+      gbatch.add(gz);
+      gbatch.add(w,2);
+      calls.eval("g18",gbatch,2,gv);
+
+      cout << "g18(1.5,2,1,0.5,[1 2]) = " << y << (double(y) == gv[0] ? "" : " (BATCH MISMATCH)")
+           << ", g18(1.5,3,0,0.5,[3 4]) = " << gv[1] << endl;
+    }
+
+    cout << endl;
+
+    // Conditional functions are evaluated both one row at a time and in batch.
+    //   The batch values must match the individual values.
+
+    const char *condFuncs[] = { "lt", "ge", "eq", "min", "max", "clamp", "tiered", "select" };
+    double xs[] = { -2., 0.5, 1., 3. };
+    double ys[] = {  1., 1.,  1., 1. };
+
+    XMLFunc::BatchArgs batch;
+    batch.add(xs);
+    batch.add(ys);
+
+    for(size_t f=0; f<sizeof(condFuncs)/sizeof(condFuncs[0]); ++f)
+    {
+      double batch_y[4];
+      ut.eval(condFuncs[f],batch,4,batch_y);
+
+      cout << condFuncs[f] << "(x,1) =";
+      for(size_t i=0; i<4; ++i)
+      {
+        args.clear();
+        args.add(xs[i]);
+        args.add(ys[i]);
+        y = ut.eval(condFuncs[f],args);
+        cout << " " << y << (double(y) == batch_y[i] ? "" : " (BATCH MISMATCH)");
+      }
+      cout << endl;
+    }
+
+    // A NaN operand must give the same value one row at a time and in batch
+
+    const char *nanFuncs[] = { "min", "max", "clamp" };
+    double nanXs[] = { numeric_limits<double>::quiet_NaN() };
+    double nanYs[] = { 1. };
+
+    XMLFunc::BatchArgs nanBatch;
+    nanBatch.add(nanXs);
+    nanBatch.add(nanYs);
+
+    cout << "(NaN,1):";
+    for(size_t f=0; f<sizeof(nanFuncs)/sizeof(nanFuncs[0]); ++f)
+    {
+      double batch_y;
+      ut.eval(nanFuncs[f],nanBatch,1,&batch_y);
+
+      args.clear();
+      args.add(nanXs[0]);
+      args.add(nanYs[0]);
+      double v = ut.eval(nanFuncs[f],args);
+      cout << " " << nanFuncs[f] << "=" << v
+        << ( v == batch_y || ( v != v && batch_y != batch_y ) ? "" : " (BATCH MISMATCH)" );
+    }
+    cout << endl;
+
+    // Polynomials are evaluated by Horner's rule, which must match the 
+    //   unoptimized functions (exactly, for these values)
+
+    XMLFunc utPoly(utxml.str(), XMLFunc::Polynomials);
+
+    double poly_y[4], plain_y[4];
+    utPoly.eval("poly",batch,4,poly_y);
+    ut.eval("poly",batch,4,plain_y);
+
+    cout << "poly(x) =";
+    for(size_t i=0; i<4; ++i)
+    {
+      args.clear();
+      args.add(xs[i]);
+      y = utPoly.eval("poly",args);
+      XMLFunc::Number plain = ut.eval("poly",args);
+      cout << " " << y << ( double(y) == double(plain) ? "" : " (MISMATCH)" )
+        << ( poly_y[i] == plain_y[i] ? "" : " (BATCH MISMATCH)" );
+    }
+    cout << endl;
+
+    // Powers and products of sums are not expanded into coefficients, which would 
+    //   cancel near the root (giving ~1e-14 rather than ~1e-30 at x=0.999)
+
+    const char *cancelXml = 
+      "<arglist><arg name=x/></arglist>"
+      "<func name=pow><pow><sub><arg name=x/><double value=1/></sub><int value=10/></pow></func>"
+      "<func name=mult><mult><sub><arg name=x/><double value=1/></sub>"
+      "<mult><sub><arg name=x/><double value=1/></sub><sub><arg name=x/><double value=1/></sub></mult></mult></func>";
+    XMLFunc cancelPoly(cancelXml, XMLFunc::Polynomials);
+    XMLFunc cancelPlain(cancelXml);
+
+    cout << "(x-1)^n near x=1 with polynomials =";
+    const double nearOne[2] = { 1.001, 0.999 };
+    for(size_t f=0; f<2; ++f)
+    {
+      const char *name = f == 0 ? "pow" : "mult";
+      for(size_t i=0; i<2; ++i)
+      {
+        args.clear();
+        args.add(nearOne[i]);
+        double folded = cancelPoly.eval(name,args);
+        double plain  = cancelPlain.eval(name,args);
+        cout << " " << name << "(" << nearOne[i] << ")=" << folded
+          << ( fabs(folded - plain) <= 1e-12 * fabs(plain) ? "" : " (MISMATCH)" );
+      }
+    }
+    cout << endl;
+
+    // Tables are interpolated one row at a time and in batch (which must match)
+
+    XMLFunc tables("<arglist><arg name=x/></arglist>"
+                   "<func name=linear><table x='0 1 2 4' y='0, 10, 20, 0' arg=x/></func>"
+                   "<func name=cubic><table x='0 1 2 4' y='0 10 20 0' interp=cubic arg=x/></func>"
+                   "<func name=step><table x='0 1 2 4' y='0 10 20 0' interp=step><arg name=x/></table></func>"
+                   "<func name=half><mult arg1=x arg2=0.5/></func>");
+
+    XMLFunc::BatchArgs xbatch;
+    xbatch.add(xs);
+
+    const char *tableFuncs[] = { "linear", "cubic", "step", "half" };
+    for(size_t f=0; f<sizeof(tableFuncs)/sizeof(tableFuncs[0]); ++f)
+    {
+      double batch_y[4];
+      tables.eval(tableFuncs[f],xbatch,4,batch_y);
+
+      cout << tableFuncs[f] << "(x) =";
+      for(size_t i=0; i<4; ++i)
+      {
+        args.clear();
+        args.add(xs[i]);
+        y = tables.eval(tableFuncs[f],args);
+        cout << " " << y << (double(y) == batch_y[i] ? "" : " (BATCH MISMATCH)");
+      }
+      cout << endl;
+    }
+
+    try
+    {
+      XMLFunc unsorted("<arglist><arg name=x/></arglist><func><table x='0 2 1' y='0 1 2' arg=x/></func>");
+      cout << "unsorted table was NOT rejected" << endl;
+    }
+    catch( runtime_error &e )
+    {
+      cout << "unsorted table rejected" << endl;
+    }
+
+    // Array arguments: 37 values per row (which leaves a partial set of lanes),
+    //   the same weights in each row
+
+    const size_t alen = 37;
+    double wcol[3*alen], xcol[3*alen];
+    for(size_t r=0; r<3; ++r)
+    {
+      for(size_t i=0; i<alen; ++i) { wcol[r*alen+i] = 1. / double(i+1); xcol[r*alen+i] = 0.1 * double(i+1) + double(r); }
+    }
+
+    XMLFunc arrays("<arglist><arg name=w type=double[]/><arg name=x type=double[]/><arg name=k type=int/></arglist>"
+                   "<func name=dot><dot arg1=w arg2=x/></func>"
+                   "<func name=sum><sum arg=x/></func>"
+                   "<func name=norm><norm><arg name=x/></norm></func>"
+                   "<func name=expdot><dot arg1=w arg2=x map=exp/></func>"
+                   "<func name=scaled><mult arg1=k><sum arg=w map=square/></mult></func>"
+                   "<func name=viacall><call func=dot><arg name=x/><arg name=w/><int value=1/></call></func>");
+
+    XMLFunc::BatchArgs abatch;
+    abatch.add(wcol,alen);
+    abatch.add(xcol,alen);
+    long ks[3] = { 1, 2, 3 };
+    abatch.add(ks);
+
+    const char *arrayFuncs[] = { "dot", "sum", "norm", "expdot", "scaled", "viacall" };
+    for(size_t f=0; f<sizeof(arrayFuncs)/sizeof(arrayFuncs[0]); ++f)
+    {
+      double batch_y[3];
+      arrays.eval(arrayFuncs[f],abatch,3,batch_y);
+
+      cout << arrayFuncs[f] << "(w,x) =";
+      for(size_t r=0; r<3; ++r)
+      {
+        args.clear();
+        args.add(wcol+r*alen,alen);
+        args.add(xcol+r*alen,alen);
+        args.add(ks[r]);
+        y = arrays.eval(arrayFuncs[f],args);
+        cout << " " << y << (double(y) == batch_y[r] ? "" : " (BATCH MISMATCH)");
+      }
+      cout << endl;
+    }
+
+    args.clear();
+    args.add(wcol,alen);
+    args.add(xcol,alen-1);
+    args.add(1);
+    cout << "dot of unequal arrays = " << arrays.eval("dot",args) << endl;
+
+    args[1] = XMLFunc::Number(1.5);
+    XMLFunc::Number value;
+    cout << "number passed for array: " << XMLFunc::statusText( arrays.tryEval("sum",args,value) ) << endl;
+
+    const char *badArrays[] = { "<add arg1=w arg2=1/>", "<sum arg=k/>", "<arg name=w/>" };
+    for(size_t i=0; i<sizeof(badArrays)/sizeof(badArrays[0]); ++i)
+    {
+      try
+      {
+        XMLFunc bad(string("<arglist><arg name=w type=double[]/><arg name=k type=int/></arglist><func>") + badArrays[i] + "</func>");
+        cout << badArrays[i] << " was NOT rejected" << endl;
+      }
+      catch( runtime_error &e )
+      {
+        cout << badArrays[i] << " rejected" << endl;
+      }
+    }
+
+    // Batch arguments may be read in place from the fields of an array of records, 
+    //   and the values written to another field
+
+    Quote quotes[5];
+    for(size_t r=0; r<5; ++r)
+    {
+      quotes[r].a     = 1. + 0.5 * double(r);
+      quotes[r].b     = float(-4. - double(r));
+      quotes[r].c     = long(r);
+      quotes[r].root1 = 0.;
+    }
+
+    XMLFunc::Stride quoteStride(sizeof(Quote));
+
+    map<string,XMLFunc::Column> fields;
+    fields.insert( make_pair( string("a"), XMLFunc::Column(&quotes[0].a, quoteStride) ) );
+    fields.insert( make_pair( string("b"), XMLFunc::Column(&quotes[0].b, quoteStride) ) );
+    fields.insert( make_pair( string("c"), XMLFunc::Column(&quotes[0].c, quoteStride) ) );
+
+    size_t root1 = quad.functionIndex("root1");
+    quad.eval(root1, quad.bind(root1,fields), 5, &quotes[0].root1, quoteStride);
+
+    cout << "root1 of records =";
+    for(size_t r=0; r<5; ++r)
+    {
+      args.clear();
+      args.add(quotes[r].a);
+      args.add(double(quotes[r].b));
+      args.add(double(quotes[r].c));
+      y = quad.eval(root1,args);
+      cout << " " << quotes[r].root1 << ( double(y) == quotes[r].root1 ? "" : " (MISMATCH)" );
+    }
+
+    fields.erase("c");
+    try                        { quad.bind(root1,fields); cout << ", missing field NOT rejected" << endl; }
+    catch( runtime_error &e )  { cout << ", missing field rejected" << endl; }
+
+    // A sweep computes the values eval does over the values of one argument (or a
+    //   grid of two), evaluating the ops which do not depend on them only once
+
+    XMLFunc::Axis aAxis("a", 1., 2., 3);
+    XMLFunc::Axis bAxis("b", -9., -5., 4);
+    double swept[12];
+
+    args.clear();
+    args.add(1.5);
+    args.add(0.);
+    args.add(2.);
+    quad.sweep(root1, args, bAxis, swept);
+
+    cout << "root1 swept over b =";
+    for(size_t j=0; j<4; ++j)
+    {
+      args[1] = XMLFunc::Number(bAxis.values()[j]);
+      y = quad.eval(root1,args);
+      cout << " " << swept[j] << ( double(y) == swept[j] ? "" : " (MISMATCH)" );
+    }
+
+    quad.sweep("root1", args, aAxis, bAxis, swept);
+
+    size_t gridMismatches = 0;
+    for(size_t i=0; i<3; ++i)
+    {
+      for(size_t j=0; j<4; ++j)
+      {
+        args[0] = XMLFunc::Number(aAxis.values()[i]);
+        args[1] = XMLFunc::Number(bAxis.values()[j]);
+        if( double(quad.eval(root1,args)) != swept[i*4+j] ) ++gridMismatches;
+      }
+    }
+    cout << ", over a and b " << ( gridMismatches == 0 ? "matches eval" : "MISMATCH" );
+
+    try                        { quad.sweep(root1, args, XMLFunc::Axis("q",0.,1.,2), swept); cout << ", unknown argument NOT rejected" << endl; }
+    catch( runtime_error &e )  { cout << ", unknown argument rejected" << endl; }
+
+    // Single precision batch values (from float columns) must be within a few
+    //   float rounding errors of the double precision values
+
+    XMLFunc utSingle(utxml.str(), XMLFunc::SinglePrecision);
+
+    const char *singleFuncs[] = { "sin", "sqrt", "log2", "hypot", "tiered", "clamp", "select", "poly" };
+    float fxs[4], fys[4];
+    for(size_t i=0; i<4; ++i) { fxs[i] = float(xs[i]); fys[i] = float(ys[i]); }
+
+    XMLFunc::BatchArgs fbatch;
+    fbatch.add(fxs);
+    fbatch.add(fys);
+
+    cout << "single precision:";
+    for(size_t f=0; f<sizeof(singleFuncs)/sizeof(singleFuncs[0]); ++f)
+    {
+      double double_y[4];
+      float  single_y[4];
+      ut.eval(singleFuncs[f],batch,4,double_y);
+      utSingle.eval(singleFuncs[f],fbatch,4,single_y);
+
+      bool close = true;
+      for(size_t i=0; i<4; ++i)
+      {
+        double d = double_y[i], e = fabs( double(single_y[i]) - d );
+        close = close && ( e <= 4. * FLT_EPSILON * fabs(d) || ( d != d && single_y[i] != single_y[i] ) );
+      }
+      cout << " " << singleFuncs[f] << ( close ? "" : " (DEVIATES)" );
+    }
+    cout << endl;
+
+    cout << endl;
+
+    // tryEval reports errors rather than throwing exceptions.  The single row
+    //   status must match the batch status.
+
+    const char *tryFuncs[] = { "idiv", "safediv" };
+    long as[] = { 7, -7, numeric_limits<long>::min(), 7 };
+    long bs[] = { 2,  0, -1,                          0 };
+
+    XMLFunc::BatchArgs ibatch;
+    ibatch.add(as);
+    ibatch.add(bs);
+
+    for(size_t f=0; f<sizeof(tryFuncs)/sizeof(tryFuncs[0]); ++f)
+    {
+      double        batch_y[4];
+      unsigned char batch_s[4];
+      unsigned any = ut.tryEval(tryFuncs[f],ibatch,4,batch_y,batch_s);
+
+      cout << tryFuncs[f] << "(a,b) =";
+      for(size_t i=0; i<4; ++i)
+      {
+        args.clear();
+        args.add(as[i]);
+        args.add(bs[i]);
+        unsigned s = ut.tryEval(tryFuncs[f],args,y);
+        cout << " " << y << " (" << XMLFunc::statusText(s) << ")"
+          << ( double(y) == batch_y[i] && s == batch_s[i] ? "" : " (BATCH MISMATCH)" );
+      }
+      cout << "  [" << XMLFunc::statusText(any) << "]" << endl;
+    }
+
+    cout << "(NaN,1) status =";
+    for(size_t f=0; f<sizeof(nanFuncs)/sizeof(nanFuncs[0]); ++f)
+    {
+      double        batch_y;
+      unsigned char batch_s;
+      ut.tryEval(nanFuncs[f],nanBatch,1,&batch_y,&batch_s);
+
+      args.clear();
+      args.add(nanXs[0]);
+      args.add(nanYs[0]);
+      unsigned s = ut.tryEval(nanFuncs[f],args,y);
+      cout << " " << nanFuncs[f] << "=" << XMLFunc::statusText(s) << ( s == batch_s ? "" : " (BATCH MISMATCH)" );
+    }
+    cout << endl;
+
+    double lxs[] = { -2., 0., 1., 4. };
+    XMLFunc::BatchArgs lbatch;
+    lbatch.add(lxs);
+
+    double        ln_y[4];
+    unsigned char ln_s[4];
+    ut.tryEval("ln",lbatch,4,ln_y,ln_s);
+
+    cout << "ln(-2,0,1,4) status =";
+    for(size_t i=0; i<4; ++i) cout << " " << XMLFunc::statusText(ln_s[i]);
+    cout << endl;
+
+    args.clear();
+    cout << "ln() status " << XMLFunc::statusText( ut.tryEval("ln",args,y) )
+      << ", nosuch() status " << XMLFunc::statusText( ut.tryEval("nosuch",args,y) ) << endl;
+
+    cout << endl;
+
+    // Integer division and modulus by constants (a multiply and shift in batch
+    //   evaluation) must be bit exact.  Each function compares its value with the
+    //   reference value passed as its second argument.
+
+    const long lmin = numeric_limits<long>::min();
+    const long lmax = numeric_limits<long>::max();
+    long divisors[] = { 1, -1, 2, -2, 3, 7, -7, 10, 64, -641, 1000000007, lmax, lmin, 0 };
+    size_t ndivisors = sizeof(divisors)/sizeof(divisors[0]);
+
+    stringstream divXml;
+    divXml << "<arglist><arg name=n type=integer/><arg name=ref type=integer/></arglist>";
+    for(size_t j=0; j<ndivisors; ++j)
+    {
+      divXml << "<func><eq arg2=ref><div arg1=n arg2=" << divisors[j] << "/></eq></func>"
+             << "<func><eq arg2=ref><mod arg1=n arg2=" << divisors[j] << "/></eq></func>";
+    }
+    XMLFunc divs(divXml.str());
+
+    vector<long> ns;
+    long edges[] = { 0, 1, -1, 6, -6, 7, -7, 1000000006, lmin, lmax, lmin+1, lmax-1 };
+    ns.assign(edges, edges + sizeof(edges)/sizeof(edges[0]));
+    unsigned long seed = 12345;
+    while( ns.size() < 1000 )
+    {
+      seed = seed * 6364136223846793005UL + 1442695040888963407UL;  // LCG, fixed seed
+      ns.push_back( long(seed) >> (seed % 64) );
+    }
+
+    size_t mismatches = 0;
+    vector<long>   refs(ns.size());
+    vector<double> matched(ns.size());
+    for(size_t j=0; j<2*ndivisors; ++j)
+    {
+      long d = divisors[j/2];
+      for(size_t i=0; i<ns.size(); ++i) refs[i] = ( j%2 ? ref_remainder(ns[i],d) : ref_quotient(ns[i],d) );
+
+      XMLFunc::BatchArgs dbatch;
+      dbatch.add(&ns[0]);
+      dbatch.add(&refs[0]);
+      divs.eval(j,dbatch,ns.size(),&matched[0]);
+
+      for(size_t i=0; i<ns.size(); ++i)
+      {
+        args.clear();
+        args.add(ns[i]);
+        args.add(refs[i]);
+        if( matched[i] != 1. || long(divs.eval(j,args)) != 1 ) ++mismatches;
+      }
+    }
+    cout << "integer div and mod by " << ndivisors << " constants: " 
+      << ( mismatches == 0 ? "bit exact" : "MISMATCHES" ) << endl;
+
+    cout << endl;
+
+    // Reductions must not depend on the number of threads used
+
+    vector<double> rxs(300000);
+    vector<double> rys(rxs.size(), 1.);
+    for(size_t i=0; i<rxs.size(); ++i) rxs[i] = -2. + 4. * double(i) / double(rxs.size());
+
+    XMLFunc::BatchArgs rbatch;
+    rbatch.add(&rxs[0]);
+    rbatch.add(&rys[0]);
+
+    XMLFunc::Summary s1, s4;
+    ut.reduce("tiered",rbatch,rxs.size(),s1,1);
+    ut.reduce("tiered",rbatch,rxs.size(),s4,4);
+
+    XMLFunc::Histogram h4(-0.5,0.5,4);
+    ut.reduce("tiered",rbatch,rxs.size(),h4,4);
+
+    cout << "tiered(-2..2,1): count=" << s1.count() << " mean=" << s1.mean() 
+      << " min=" << s1.min() << " max=" << s1.max() << " variance=" << s1.variance() << endl;
+    cout << "  reduction is " 
+      << ( s1.sum() == s4.sum() && s1.mean() == s4.mean() && s1.variance() == s4.variance() ? "" : "NOT " )
+      << "independent of thread count" << endl;
+    cout << "  histogram:";
+    for(size_t b=0; b<h4.nbins(); ++b) cout << " " << h4.count(b);
+    cout << " (under=" << h4.underflow() << " over=" << h4.overflow() << ")" << endl;
+    cout << endl;
+
+    // Very deep documents must parse, evaluate, and be deleted without recursion
+
+    size_t depth = 1000000;
+    string deepXml = "<arglist><arg name=x/><arg name=y/></arglist><func name=deep>";
+    for(size_t i=0; i<depth; ++i) deepXml += ( i%2 ? "<mult arg1=y>" : "<add arg1=x>" );
+    deepXml += "<arg name=x/>";
+    for(size_t i=depth; i>0; --i) deepXml += ( (i-1)%2 ? "</mult>" : "</add>" );
+    deepXml += "</func>";
+
+    XMLFunc deep(deepXml);
+
+    double dx[2] = { 0.5, 0.25 };
+    double dy[2] = { 0.5, 0.75 };
+    double deep_y[2];
+
+    XMLFunc::BatchArgs dbatch;
+    dbatch.add(dx);
+    dbatch.add(dy);
+    deep.eval(0,dbatch,2,deep_y);
+
+    for(size_t r=0; r<2; ++r)
+    {
+      double ref = dx[r];
+      for(size_t i=depth; i>0; --i) ref = ( (i-1)%2 ? dy[r] * ref : dx[r] + ref );
+
+      args.clear();
+      args.add(dx[r]);
+      args.add(dy[r]);
+      y = deep.eval(0,args);
+
+      cout << "deep(" << dx[r] << "," << dy[r] << ") depth " << depth << " = " << y
+        << ( double(y) == ref ? "" : " (MISMATCH)" )
+        << ( deep_y[r] == ref ? "" : " (BATCH MISMATCH)" ) << endl;
+    }
+
+    // Large libraries: functions are looked up by hashed name, and functions with
+    //   identical arglists share them
+
+    size_t nlib = 20000;
+    stringstream libXml;
+    libXml << "<arglist><arg name=x/></arglist>";
+    for(size_t i=0; i<nlib; ++i)
+    {
+      libXml << "<func name=f" << i << ">";
+      if( i%2 ) libXml << "<arglist><arg name=n type=integer/></arglist><mult arg1=n arg2=" << i << "/>";
+      else      libXml << "<add arg1=x arg2=" << i << "/>";
+      libXml << "</func>";
+    }
+    XMLFunc lib(libXml.str());
+
+    size_t misses = 0;
+    for(size_t i=0; i<nlib; ++i)
+    {
+      stringstream name;
+      name << "f" << i;
+
+      args.clear();
+      args.add(2L);
+      if( lib.functionIndex(name.str()) != i || long(lib.eval(name.str(),args)) != long( i%2 ? 2*i : 2+i ) ) ++misses;
+    }
+
+    bool rejected = false;
+    try { XMLFunc dup("<arglist><arg/></arglist><func name=a><arg/></func><func name=a><arg/></func>"); }
+    catch( runtime_error & ) { rejected = true; }
+
+    cout << endl << "library of " << nlib << " functions: " << lib.memoryUsage().numArgDefs << " distinct arglists, "
+      << ( misses == 0 ? "all found by name" : "LOOKUP MISMATCHES" ) 
+      << ( rejected ? ", duplicate names rejected" : ", DUPLICATE NAMES ACCEPTED" ) << endl;
+
+    // Libraries may be parsed and built by several threads, with the same results 
+    //   (and errors) as one
+
+    XMLFunc parallel(libXml.str(), XMLFunc::NoOptimization, 4);
+
+    size_t pmisses = 0;
+    for(size_t i=0; i<nlib; ++i)
+    {
+      stringstream name;
+      name << "f" << i;
+
+      args.clear();
+      args.add(2L);
+      if( parallel.functionIndex(name.str()) != i || long(parallel.eval(i,args)) != long( i%2 ? 2*i : 2+i ) ) ++pmisses;
+    }
+
+    const char *badLibs[] = {
+      "<arglist><arg name=x/></arglist><func name=a><arg name=y/></func><func name=b><add arg1=x/></func>",
+      "<arglist><arg name=x/></arglist><func name=a><arg name=x/></func><func name=b><add arg1=x></func>",
+      "<arglist><arg name=x/></arglist><func name=a><arg name=x/></func><func name=a><arg name=x/></func>" };
+
+    size_t sameErrors = 0;
+    for(size_t i=0; i<3; ++i)
+    {
+      string serialError, parallelError;
+      try { XMLFunc f(badLibs[i]);                              } catch( runtime_error &e ) { serialError   = e.what(); }
+      try { XMLFunc f(badLibs[i], XMLFunc::NoOptimization, 4); } catch( runtime_error &e ) { parallelError = e.what(); }
+      if( serialError.empty() == false && serialError == parallelError ) ++sameErrors;
+    }
+
+    cout << "library built by 4 threads: " << ( pmisses == 0 ? "same values" : "MISMATCHES" ) 
+      << ", " << sameErrors << " of 3 errors the same" << endl;
+
+    // Lazy libraries build each function on first use, or when warmed
+
+    XMLFunc lazy(libXml.str(), XMLFunc::Lazy);
+
+    args.clear();
+    args.add(2L);
+    y = lazy.eval("f10",args);
+
+    vector<string> warmNames(1,"f11");
+    lazy.warm(warmNames);
+
+    size_t nbuilt = 0;
+    for(size_t i=0; i<lazy.numFunctions(); ++i) nbuilt += lazy.built(i);
+
+    cout << "lazy library: f10(2) = " << y << ", " << nbuilt << " of " << lazy.numFunctions() << " functions built";
+
+    XMLFunc lazyBad("<arglist><arg name=x/></arglist><func name=ok><arg name=x/></func><func name=bad><nosuch/></func>",
+                    XMLFunc::Lazy);
+    XMLFunc::Number bad_y;
+    cout << ", bad() " << XMLFunc::statusText( lazyBad.tryEval("bad",args,bad_y) ) << endl;
+
+    string addsXml = "<arglist><arg name=x/></arglist>";
+    for(size_t i=0; i<2000; ++i)
+    {
+      stringstream func;
+      func << "<func><add arg1=x arg2=" << i << "/></func>";
+      addsXml += func.str();
+    }
+    XMLFunc threaded(addsXml, XMLFunc::Lazy);
+
+    LazyEvals evals[4];
+    pthread_t threads[4];
+    for(size_t t=0; t<4; ++t)
+    {
+      evals[t].lib    = &threaded;
+      evals[t].start  = 500 * t;
+      evals[t].misses = 0;
+      pthread_create(&threads[t], NULL, lazy_evals, &evals[t]);
+    }
+    size_t threadMisses = 0;
+    for(size_t t=0; t<4; ++t)
+    {
+      pthread_join(threads[t], NULL);
+      threadMisses += evals[t].misses;
+    }
+    cout << "lazy library evaluated by 4 threads: " << ( threadMisses == 0 ? "ok" : "MISMATCHES" ) << endl;
+
+    // Reloadable libraries may be replaced while other threads evaluate them
+
+    ReloadableXMLFunc live(version_xml(1));
+    {
+      args.clear();
+      args.add(0L);
+
+      ReloadableXMLFunc::Handle pinned(live);
+      live.reload(version_xml(2));
+
+      cout << "reloadable library: a() = " << live.eval("a",args) << ", pinned version " << pinned.version()
+        << " a() = " << pinned->eval("a",args) << ", " << live.reclaim() << " versions";
+    }
+    cout << ", then " << live.reclaim();
+
+    try { live.reload("<func name=a><nosuch/></func>"); } catch( runtime_error & ) { cout << ", bad reload kept version " << live.version(); }
+    cout << endl;
+
+    bool done = false;
+    ReloadEvals reloadEvals[2];
+    for(size_t t=0; t<2; ++t)
+    {
+      reloadEvals[t].lib    = &live;
+      reloadEvals[t].done   = &done;
+      reloadEvals[t].misses = 0;
+      pthread_create(&threads[t], NULL, reload_evals, &reloadEvals[t]);
+    }
+    for(long v=3; v<=50; ++v) live.reload(version_xml(v));
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    threadMisses = 0;
+    for(size_t t=0; t<2; ++t)
+    {
+      pthread_join(threads[t], NULL);
+      threadMisses += reloadEvals[t].misses;
+    }
+    cout << "reloadable library evaluated by 2 threads during 48 reloads: " << ( threadMisses == 0 ? "ok" : "MISMATCHES" )
+      << ", version " << live.version() << ", " << live.reclaim() << " versions" << endl;
+
+    // Identical subtrees are kept once by every XMLFunc built with Shared, and are
+    //   deleted with the last XMLFunc using them
+
+    {
+      XMLFunc first(libXml.str(), XMLFunc::Shared);
+      XMLFunc::SharedOperations one = XMLFunc::sharedOperations();
+
+      XMLFunc second(libXml.str(), XMLFunc::Shared, 4);
+      XMLFunc::SharedOperations two = XMLFunc::sharedOperations();
+
+      XMLFunc::Args sargs;
+      sargs.add(2L);
+
+      size_t smisses = 0;
+      for(size_t i=0; i<nlib; i+=97)
+      {
+        if( long(second.eval(i,sargs)) != long(lib.eval(i,sargs)) ) ++smisses;
+      }
+
+      SharedBuilds builds[4];
+      for(size_t t=0; t<4; ++t)
+      {
+        builds[t].version = long(1 + t%2);
+        builds[t].misses  = 0;
+        pthread_create(&threads[t], NULL, shared_builds, &builds[t]);
+      }
+      for(size_t t=0; t<4; ++t)
+      {
+        pthread_join(threads[t], NULL);
+        smisses += builds[t].misses;
+      }
+
+      cout << "shared library: " << one.nodes << " operations for " << one.functions << " functions, " 
+        << two.nodes << " for " << two.functions << ( two.saved() > one.saved() ? " (second copy saved)" : " (NOTHING SAVED)" )
+        << ", built and deleted by 4 threads: " << ( smisses == 0 ? "ok" : "MISMATCHES" ) 
+        << ", " << XMLFunc::sharedOperations().nodes << " operations after";
+    }
+    cout << ", " << XMLFunc::sharedOperations().nodes << " once deleted" << endl;
+
+    // Queued requests are evaluated in batches (when full, after maxDelay, or when flushed)
+
+    XMLFunc queued("<arglist><arg name=x type=int/></arglist><func name=f><add arg1=x arg2=1/></func>");
+    {
+      XMLFuncQueue queue(queued, 8, 60.);
+
+      XMLFunc::Args qargs;
+      vector<XMLFuncQueue::Request> requests(11);
+      for(size_t i=0; i<requests.size(); ++i)
+      {
+        qargs.clear();
+        qargs.add(long(i));
+        queue.submit(0, qargs, requests[i]);
+      }
+      cout << "queued requests: f(0) = " << requests[0].wait() << " (batch full)";
+      queue.flush();
+      cout << ", f(10) = " << requests[10].wait() << " (flushed)";
+
+      XMLFuncQueue::Request unknown, wrongType;
+      queue.submit("nosuch", qargs, unknown);
+      qargs.clear();
+      qargs.add(0.5);
+      queue.submit("f", qargs, wrongType);
+      cout << ", " << XMLFunc::statusText(unknown.status()) << ", " << XMLFunc::statusText(wrongType.status());
+
+      XMLFuncQueue::Stats stats = queue.stats();
+      cout << ", " << stats.requests << " requests in " << stats.batches << " batches (" << stats.fullBatches << " full)" << endl;
+    }
+    {
+      XMLFuncQueue queue(queued, 32, 1.e-3, 2);
+
+      QueueSubmits submits[4];
+      for(size_t t=0; t<4; ++t)
+      {
+        submits[t].queue = &queue;
+        submits[t].start = long(100 * t);
+        pthread_create(&threads[t], NULL, queue_submits, &submits[t]);
+      }
+      for(size_t t=0; t<4; ++t) pthread_join(threads[t], NULL);
+    }
+    cout << "queued requests from 4 threads: sum " << queueSum << " (expected " << 400*401/2 << ")" << endl;
+
+    const char *watchedPath = "reload_test.xml";
+    write_file(watchedPath, version_xml(1));
+    {
+      ReloadableXMLFunc watched(watchedPath);
+      watched.watch(0.01);
+
+      write_file(watchedPath, version_xml(7));
+      for(size_t i=0; i<500 && watched.version() == 1; ++i) usleep(10000);
+      cout << "watched file: version " << watched.version() << " a() = " << watched.eval("a",args);
+
+      write_file(watchedPath, "<func name=a><nosuch/></func>");
+      for(size_t i=0; i<500 && watched.lastError().empty(); ++i) usleep(10000);
+      cout << ", bad file " << ( watched.lastError().empty() ? "not reported" : "reported" )
+        << ", still version " << watched.version() << " a() = " << watched.eval("a",args) << endl;
+    }
+    remove(watchedPath);
+
+    // Functions served through shared memory to another process
+
+    {
+      stringstream segment;
+      segment << "/xmlfunc-test-" << getpid();
+      XMLFuncServer server(quad, segment.str(), 4, 1, 4096);
+
+      int fds[2];
+      if( pipe(fds) != 0 ) throw runtime_error("pipe failed");
+
+      pid_t child = fork();
+      if( child == 0 )
+      {
+        stringstream result;
+        try
+        {
+          XMLFuncClient client(segment.str());
+
+          XMLFunc::Args cargs;
+          cargs.add(1.);
+          cargs.add(-3.5);
+          cargs.add(2L);
+          cargs.add(1234L);
+          result << "root1 = " << client.eval("root1",cargs);
+
+          // (more rows than fit in the data area, so sent in several requests)
+          size_t nrows = 1000;
+          vector<double> ca(nrows), cb(nrows), served(nrows), local(nrows);
+          vector<long>   cc(nrows), cd(nrows, 0L);
+          for(size_t i=0; i<nrows; ++i) { ca[i] = 1. + 0.01 * double(i); cb[i] = -40. + 0.1 * double(i); cc[i] = long(i % 7); }
+
+          XMLFunc::BatchArgs ccols;
+          ccols.add(&ca[0]);
+          ccols.add(&cb[0]);
+          ccols.add(&cc[0]);
+          ccols.add(&cd[0]);
+          client.eval("root1", ccols, nrows, &served[0]);
+          quad.eval("root1", ccols, nrows, &local[0]);
+
+          size_t same = 0;
+          for(size_t i=0; i<nrows; ++i) same += ( served[i] == local[i] || ( served[i] != served[i] && local[i] != local[i] ) );
+          result << ", " << same << " of " << nrows << " batch values as in-process";
+
+          cargs.resize(2);
+          XMLFunc::Number value;
+          result << ", " << XMLFunc::statusText( client.tryEval(client.functionIndex("root1"), cargs, value) );
+        }
+        catch( exception &e )
+        {
+          result << e.what();
+        }
+        string r = result.str();
+        ssize_t written = write(fds[1], r.data(), r.size());
+        _exit( written == ssize_t(r.size()) ? 0 : 1 );
+      }
+
+      close(fds[1]);
+      string result;
+      char buffer[256];
+      ssize_t nread;
+      while( (nread = read(fds[0], buffer, sizeof(buffer))) > 0 ) result.append(buffer, size_t(nread));
+      close(fds[0]);
+      waitpid(child, NULL, 0);
+
+      cout << "served to another process: " << result << ", " << server.requests() << " requests" << endl;
+    }
+
+    // A batch of which a single row does not fit in the data area (8 arguments
+    //   and the value take 73 bytes of the 64) is refused rather than sent
+
+    {
+      XMLFunc eight("<arglist><arg name=a/><arg name=b/><arg name=c/><arg name=d/>"
+                    "<arg name=e/><arg name=f/><arg name=g/><arg name=h/></arglist>"
+                    "<func name=ends><add arg1=a arg2=h/></func>");
+
+      stringstream segment;
+      segment << "/xmlfunc-test-small-" << getpid();
+      XMLFuncServer server(eight, segment.str(), 1, 1, 64);
+      XMLFuncClient client(segment.str());
+
+      double cols[8][2] = { { 1., 2. } };
+      XMLFunc::BatchArgs ecols;
+      for(size_t i=0; i<8; ++i) ecols.add(cols[i]);
+
+      double out[2];
+      cout << "batch too large for the data area: " << XMLFunc::statusText( client.tryEval(0, ecols, 2, out, NULL) );
+      try
+      {
+        client.eval("ends", ecols, 2, out);
+        cout << ", eval NOT rejected";
+      }
+      catch( runtime_error &e )
+      {
+        cout << ", eval rejected";
+      }
+      cout << ", " << server.requests() << " requests" << endl;
+    }
+
+    // Profiles count the evaluations of each node (the times vary from run to run)
+
+    XMLFunc::Profile profile;
+    for(size_t i=0; i<4; ++i)
+    {
+      args.clear();
+      args.add(xs[i]);
+      args.add(ys[i]);
+      ut.profile("tiered",args,profile);
+    }
+
+    vector<XMLFunc::Profile::Node> nodes;
+    profile.nodes(nodes);
+
+    cout << endl << "profile of " << profile.function() << " (" << profile.calls() << " calls):" << endl;
+    for(size_t i=0; i<nodes.size(); ++i)
+    {
+      cout << "  " << string(2*nodes[i].depth,' ') << nodes[i].element 
+        << " (line " << nodes[i].line << ", col " << nodes[i].column << ") evals=" << nodes[i].evals << endl;
+    }
+
+    // A function whose ops are shared with another (see Shared) is profiled at
+    //   its own elements
+
+    const char *twinXml = "<arglist><arg name=x/></arglist>\n"
+                          "<func name=a><mult arg1=x><add arg1=x arg2=1/></mult></func>\n"
+                          "<func name=b><mult arg1=x><add arg1=x arg2=1/></mult></func>";
+    XMLFunc twins(twinXml, XMLFunc::Shared);
+    XMLFunc twinsPlain(twinXml);
+
+    XMLFunc::Profile sharedProfile, plainProfile;
+    args.clear();
+    args.add(2.);
+    twins.profile("b",args,sharedProfile);
+    twinsPlain.profile("b",args,plainProfile);
+
+    vector<XMLFunc::Profile::Node> sharedNodes, plainNodes;
+    sharedProfile.nodes(sharedNodes);
+    plainProfile.nodes(plainNodes);
+
+    bool sameLocations = ( sharedNodes.size() == plainNodes.size() );
+    for(size_t i=0; i<sharedNodes.size() && sameLocations; ++i)
+    {
+      sameLocations = sharedNodes[i].element == plainNodes[i].element
+        && sharedNodes[i].line == plainNodes[i].line && sharedNodes[i].column == plainNodes[i].column;
+    }
+    cout << "profile of shared b: " << sharedNodes.back().element << " (line " << sharedNodes.back().line << ")"
+      << ( sameLocations ? "" : " (LOCATION MISMATCH)" ) << endl;
+
+    // Metrics are only collected if XMLFunc.cc is compiled with -DXMLFUNC_METRICS
+
+    if( XMLFunc::metricsEnabled() )
+    {
+      args.clear();
+      try { quad.eval("root2",args); } catch( runtime_error & ) {}
+
+      vector<XMLFunc::FunctionMetrics> metrics;
+      quad.metrics(metrics);
+
+      cout << endl;
+      for(size_t i=0; i<metrics.size(); ++i)
+      {
+        cout << "metrics " << metrics[i].name << ": calls=" << metrics[i].calls
+          << " rows=" << metrics[i].rows << " errors=" << metrics[i].errors << endl;
+      }
+    }
+
 
   }
   catch( runtime_error &e )
@@ -0,0 +1,1061 @@
+// xmlfunc-eval
+//
+// Streams rows of argument values from a CSV (or raw binary) file through one
+//   or more functions defined in an XMLFunc document and writes the function
+//   values for each row.
+//
+// The work is split into three pipelined stages, each running in its own thread:
+//   - reader:    reads and parses the input into batches of argument columns
+//   - evaluator: evaluates each function over each batch (see XMLFunc::eval)
+//   - writer:    formats and writes the function values
+// The stages are connected by bounded queues so that I/O overlaps computation
+//   without the reader running arbitrarily far ahead of the writer.
+//
+// With -D, the functions are evaluated in single precision and each value is
+//   compared with the double precision value (from the single row eval, which
+//   is always in double precision).  The largest deviations are reported.
+//
+// With -M, the input and output are columnar files (see ColumnsHeader) which
+//   are memory mapped rather than read and written.  Each batch is evaluated
+//   directly from the input mapping into the output mapping; the kernel is
+//   asked to read ahead of the batches and the pages of finished batches are
+//   released, so the resident memory does not grow with the size of the files.
+//
+// Build:  g++ -O2 -pthread -o xmlfunc-eval xmlfunc-eval.cc XMLFunc.cc
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "XMLFunc.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// Support classes
+////////////////////////////////////////////////////////////////////////////////
+
+// A batch of rows passed from stage to stage.  The input values are stored
+//   by column (as doubles or integers, depending on the argument types they
+//   are mapped to) and the function values are stored by function.
+struct RowBatch
+{
+  size_t                  nrows;
+  vector< vector<double> > dcols;
+  vector< vector<long> >   icols;
+  vector< vector<double> > values;
+};
+
+// Fixed capacity FIFO queue shared by two pipeline stages.  A NULL batch
+//   marks the end of the stream.
+class BatchQueue
+{
+  public:
+    BatchQueue(size_t capacity) : capacity_(capacity)
+    {
+      pthread_mutex_init(&mutex_,NULL);
+      pthread_cond_init(&notEmpty_,NULL);
+      pthread_cond_init(&notFull_,NULL);
+    }
+
+    ~BatchQueue()
+    {
+      pthread_mutex_destroy(&mutex_);
+      pthread_cond_destroy(&notEmpty_);
+      pthread_cond_destroy(&notFull_);
+    }
+
+    void push(RowBatch *batch)
+    {
+      pthread_mutex_lock(&mutex_);
+      while(queue_.size() >= capacity_) pthread_cond_wait(&notFull_,&mutex_);
+      queue_.push_back(batch);
+      pthread_cond_signal(&notEmpty_);
+      pthread_mutex_unlock(&mutex_);
+    }
+
+    RowBatch *pop(void)
+    {
+      pthread_mutex_lock(&mutex_);
+      while(queue_.empty()) pthread_cond_wait(&notEmpty_,&mutex_);
+      RowBatch *rval = queue_.front();
+      queue_.pop_front();
+      pthread_cond_signal(&notFull_);
+      pthread_mutex_unlock(&mutex_);
+      return rval;
+    }
+
+  private:
+    size_t             capacity_;
+    deque<RowBatch *>  queue_;
+    pthread_mutex_t    mutex_;
+    pthread_cond_t     notEmpty_;
+    pthread_cond_t     notFull_;
+};
+
+// Largest deviations of the single precision values of a function from its
+//   double precision values, and the (0 based) rows where they occurred
+struct Deviation
+{
+  Deviation(void) : maxAbs(0.), maxRel(0.), absRow(0), relRow(0), nonFinite(0) {}
+
+  double maxAbs;
+  double maxRel;
+  size_t absRow;
+  size_t relRow;
+  size_t nonFinite;   // rows where only one of the values is finite
+
+  void add(size_t row, double single, double ref)
+  {
+    if( single == ref || ( single != single && ref != ref ) ) return;
+
+    double abs = fabs(single - ref);
+    if( abs != abs || abs > DBL_MAX ) { ++nonFinite; return; }
+
+    double rel = ( ref != 0. ? abs / fabs(ref) : abs );
+
+    if( abs > maxAbs ) { maxAbs = abs; absRow = row; }
+    if( rel > maxRel ) { maxRel = rel; relRow = row; }
+  }
+};
+
+// Columnar files (-M) start with a ColumnsHeader, followed by a ColumnEntry
+//   for each column.  The values of each column are stored contiguously (one
+//   for each row) at the column's offset, which is a multiple of their size.
+static const char ColumnsMagic[8] = { 'X','F','C','O','L','S','0','1' };
+
+struct ColumnsHeader
+{
+  char     magic[8];
+  uint64_t rows;
+  uint64_t numColumns;
+};
+
+struct ColumnEntry
+{
+  char     name[48];       // (NUL padded)
+  char     type;           // 'd' (double), 'f' (float) or 'i' (64 bit integer)
+  char     pad[7];
+  uint64_t offset;         // of the values, from the start of the file
+};
+
+// A file mapped into memory (unmapped and closed on destruction)
+struct MappedFile
+{
+  MappedFile(void) : fd(-1), data(NULL), bytes(0) {}
+  ~MappedFile()
+  {
+    if(data != NULL) munmap(data,bytes);
+    if(fd >= 0)      close(fd);
+  }
+
+  int     fd;
+  char   *data;
+  size_t  bytes;
+};
+
+// Command line options and everything derived from them
+struct Pipeline
+{
+  Pipeline(void)
+    : xmlfunc(NULL), in(stdin), out(stdout), delim(','), header(false), binary(false), mapped(false),
+      numInputCols(0), batchSize(4096), queueDepth(4), buildThreads(1), polynomials(false), single(false), deviation(false),
+      numDSlots(0), numISlots(0), toEval(NULL), toWrite(NULL), failed(false), rows(0), bytes(0), evaluated(0)
+  {
+    pthread_mutex_init(&failMutex,NULL);
+  }
+
+  ~Pipeline() { pthread_mutex_destroy(&failMutex); }
+
+  XMLFunc        *xmlfunc;
+  FILE           *in;
+  FILE           *out;
+  char            delim;
+  bool            header;
+  bool            binary;
+  bool            mapped;        // input and output are memory mapped columnar files (-M)
+  string          inPath;
+  string          outPath;
+  size_t          numInputCols;
+  size_t          batchSize;
+  size_t          queueDepth;
+  unsigned        buildThreads;  // threads used to parse and build the functions (-j)
+  bool            polynomials;   // fold polynomials (-P)
+  bool            single;        // evaluate in single precision (-s or -D)
+  bool            deviation;     // compare with double precision (-D)
+
+  vector<size_t>  funcs;         // indices of functions to evaluate
+  map<string,string> mapping;    // argument name -> column name/index (from -m)
+
+  // Each input column that is used is stored in a double or integer column of
+  //   each batch.  colSlot[i] is the slot for input column i (or -1 if unused).
+  vector<int>            colSlot;
+  vector<bool>           colIsInt;
+  size_t                 numDSlots;
+  size_t                 numISlots;
+
+  vector< vector<int> >  argCols;    // function -> argument -> input column
+
+  BatchQueue     *toEval;
+  BatchQueue     *toWrite;
+
+  // The first error (from any stage) is kept in error, which is only read once
+  //   failed is seen to be true (see fail() and hasFailed())
+  pthread_mutex_t failMutex;
+  bool            failed;
+  string          error;
+  size_t          rows;
+  size_t          bytes;         // of the columns read and written (-M)
+
+  vector<Deviation> deviations;  // by function (-D)
+  size_t            evaluated;   // rows compared so far (-D)
+
+  void fail(const string &msg)
+  {
+    pthread_mutex_lock(&failMutex);
+    if( hasFailed() == false ) 
+    {
+      error = msg;
+      __atomic_store_n( &failed, true, __ATOMIC_RELEASE );
+    }
+    pthread_mutex_unlock(&failMutex);
+  }
+
+  bool hasFailed(void) const { return __atomic_load_n( &failed, __ATOMIC_ACQUIRE ); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Support functions
+////////////////////////////////////////////////////////////////////////////////
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return double(ts.tv_sec) + 1.e-9 * double(ts.tv_nsec);
+}
+
+void usage(const char *argv0)
+{
+  cerr << endl
+    << "Usage: " << argv0 << " [options] xml-file func [func ...]" << endl
+    << endl
+    << "  Evaluates each of the named (or 0 based indexed) functions for each row of input" << endl
+    << endl
+    << "  -i file     read input from file (default is stdin)" << endl
+    << "  -o file     write output to file (default is stdout)" << endl
+    << "  -d c        CSV field delimiter (default is ',')" << endl
+    << "  -H          first input row is a header naming the columns" << endl
+    << "  -b n        input is binary: n native doubles per row; output is binary doubles" << endl
+    << "  -m arg=col  maps the named argument to the named (with -H) or 0 based indexed column" << endl
+    << "                (default: matching column name with -H, else argument index)" << endl
+    << "  -r n        rows per batch (default 4096)" << endl
+    << "  -q n        maximum batches queued between stages (default 4)" << endl
+    << "  -j n        threads used to parse and build the functions (default 1)" << endl
+    << "  -P          evaluate polynomials by Horner's rule (see XMLFunc::Polynomials)" << endl
+    << "  -s          evaluate in single precision (see XMLFunc::SinglePrecision)" << endl
+    << "  -D          evaluate in single precision and report the maximum deviation of each" << endl
+    << "                function from its double precision values on stderr" << endl
+    << "  -M          input and output (-i and -o are required) are memory mapped columnar files:" << endl
+    << "                each argument is read from the column with its name, and the output has" << endl
+    << "                a double column for each function; -q n batches are read ahead" << endl
+    << endl
+    << "  The rate (rows per second) is reported on stderr when the input is exhausted" << endl
+    << endl;
+  exit(1);
+}
+
+// splits a line of CSV into fields (surrounding whitespace is removed)
+void split(const char *line, char delim, vector<string> &fields)
+{
+  fields.clear();
+  const char *a = line;
+  while(true)
+  {
+    const char *b = a;
+    while(*b && *b != delim && *b != '\n' && *b != '\r') ++b;
+
+    const char *s = a;
+    const char *e = b;
+    while(s<e && isspace(*s))    ++s;
+    while(e>s && isspace(e[-1])) --e;
+    fields.push_back(string(s,e-s));
+
+    if(*b != delim) break;
+    a = b + 1;
+  }
+}
+
+// Determines which input column provides each argument of each function
+void map_columns(Pipeline &p, const vector<string> &colNames)
+{
+  size_t numCols = ( p.binary ? p.numInputCols : colNames.size() );
+
+  p.colSlot.assign(numCols,-1);
+  p.colIsInt.assign(numCols,false);
+  p.argCols.clear();
+
+  for(size_t f=0; f<p.funcs.size(); ++f)
+  {
+    const XMLFunc::ArgDefs &argDefs = p.xmlfunc->argDefs(p.funcs[f]);
+
+    vector<int> cols;
+    for(int a=0; a<argDefs.count(); ++a)
+    {
+      string name = argDefs.name(a);
+      string col;
+
+      if( argDefs.type(a) == XMLFunc::Number::Array )
+      {
+        stringstream err;
+        err << "Argument " << a << (name.empty() ? "" : " (" + name + ")")
+          << " is an array, which cannot be read from an input column";
+        throw runtime_error(err.str());
+      }
+
+      map<string,string>::const_iterator mi = p.mapping.find(name);
+      if( name.empty() == false && mi != p.mapping.end() ) col = mi->second;
+      else if( p.header && name.empty() == false )        col = name;
+
+      int index = a;
+      if( col.empty() == false )
+      {
+        index = -1;
+        if(p.header)
+        {
+          for(size_t c=0; c<colNames.size(); ++c) if(colNames[c] == col) index = int(c);
+        }
+        if( index < 0 )
+        {
+          char *end(NULL);
+          long v = strtol(col.c_str(),&end,10);
+          if( *end == '\0' && end != col.c_str() ) index = int(v);
+        }
+        if( index < 0 ) throw runtime_error("No input column named '" + col + "' for argument " + name);
+      }
+
+      if( size_t(index) >= numCols )
+      {
+        stringstream err;
+        err << "Argument " << a << (name.empty() ? "" : " (" + name + ")")
+          << " maps to column " << index << ", but the input only has " << numCols << " columns";
+        throw runtime_error(err.str());
+      }
+
+      cols.push_back(index);
+      if( argDefs.type(a) == XMLFunc::Number::Integer ) p.colIsInt[index] = true;
+      p.colSlot[index] = 0;
+    }
+    p.argCols.push_back(cols);
+  }
+
+  // A column shared by integer and double arguments is read as an integer
+  //   (integer columns may be passed for double arguments, but not vice versa)
+
+  p.numDSlots = 0;
+  p.numISlots = 0;
+  for(size_t c=0; c<numCols; ++c)
+  {
+    if(p.colSlot[c] < 0) continue;
+    p.colSlot[c] = int( p.colIsInt[c] ? p.numISlots++ : p.numDSlots++ );
+  }
+}
+
+RowBatch *new_batch(const Pipeline &p)
+{
+  RowBatch *batch = new RowBatch;
+  batch->nrows = 0;
+  batch->dcols.assign(p.numDSlots, vector<double>(p.batchSize));
+  batch->icols.assign(p.numISlots, vector<long>(p.batchSize));
+  return batch;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Pipeline stages
+////////////////////////////////////////////////////////////////////////////////
+
+void read_csv(Pipeline &p)
+{
+  char   *line(NULL);
+  size_t  lineSize(0);
+  size_t  lineNum(0);
+
+  vector<string> fields;
+  vector<string> colNames;
+
+  if(p.header)
+  {
+    if( getline(&line,&lineSize,p.in) < 0 ) throw runtime_error("Input is empty (missing header)");
+    ++lineNum;
+    split(line,p.delim,colNames);
+
+    // names in the XML are case insensitive
+    for(size_t c=0; c<colNames.size(); ++c) 
+    {
+      for(size_t i=0; i<colNames[c].size(); ++i) colNames[c][i] = char(tolower(colNames[c][i]));
+    }
+  }
+  else
+  {
+    // peek at the first (non-blank) line to determine the number of columns
+    while(true)
+    {
+      if( getline(&line,&lineSize,p.in) < 0 ) { free(line); return; }
+      ++lineNum;
+
+      const char *s = line;
+      while(*s && isspace(*s)) ++s;
+      if(*s != '\0') break;
+    }
+    --lineNum;  // (counted again as it is read below)
+    split(line,p.delim,fields);
+    colNames.resize(fields.size());
+  }
+
+  map_columns(p,colNames);
+  size_t numCols = colNames.size();
+
+  RowBatch *batch = new_batch(p);
+
+  bool havePeekedLine = ( p.header == false );
+  while( p.hasFailed() == false && (havePeekedLine || getline(&line,&lineSize,p.in) >= 0) )
+  {
+    havePeekedLine = false;
+    ++lineNum;
+
+    // skip blank lines
+    const char *s = line;
+    while(*s && isspace(*s)) ++s;
+    if(*s == '\0') continue;
+
+    size_t row = batch->nrows;
+    size_t col = 0;
+    const char *a = line;
+    while(true)
+    {
+      if(col >= numCols)
+      {
+        stringstream err;
+        err << "Line " << lineNum << " has more than " << numCols << " columns";
+        throw runtime_error(err.str());
+      }
+
+      const char *b = a;
+      while(*b && *b != p.delim && *b != '\n' && *b != '\r') ++b;
+
+      int slot = p.colSlot[col];
+      if(slot >= 0)
+      {
+        char *end(NULL);
+        if(p.colIsInt[col]) batch->icols[slot][row] = strtol(a,&end,10);
+        else                batch->dcols[slot][row] = strtod(a,&end);
+
+        while(end < b && isspace(*end)) ++end;
+        if( end == a || end != b )
+        {
+          stringstream err;
+          err << "Line " << lineNum << " column " << col << ": invalid "
+            << (p.colIsInt[col] ? "integer" : "number") << " (" << string(a,b-a) << ")";
+          throw runtime_error(err.str());
+        }
+      }
+
+      ++col;
+      if(*b != p.delim) break;
+      a = b + 1;
+    }
+
+    if(col != numCols)
+    {
+      stringstream err;
+      err << "Line " << lineNum << " has " << col << " columns, expected " << numCols;
+      throw runtime_error(err.str());
+    }
+
+    if( ++batch->nrows == p.batchSize )
+    {
+      p.toEval->push(batch);
+      batch = new_batch(p);
+    }
+  }
+
+  free(line);
+
+  if(batch->nrows > 0) p.toEval->push(batch);
+  else                 delete batch;
+}
+
+void read_binary(Pipeline &p)
+{
+  map_columns(p,vector<string>());
+
+  vector<double> rows(p.batchSize * p.numInputCols);
+
+  while(p.hasFailed() == false)
+  {
+    size_t n = fread(&rows[0], sizeof(double) * p.numInputCols, p.batchSize, p.in);
+    if(n == 0) break;
+
+    RowBatch *batch = new_batch(p);
+    batch->nrows = n;
+
+    for(size_t c=0; c<p.numInputCols; ++c)
+    {
+      int slot = p.colSlot[c];
+      if(slot < 0) continue;
+
+      const double *v = &rows[c];
+      if(p.colIsInt[c]) { long   *r = &batch->icols[slot][0]; for(size_t i=0; i<n; ++i) r[i] = long(v[i*p.numInputCols]); }
+      else              { double *r = &batch->dcols[slot][0]; for(size_t i=0; i<n; ++i) r[i] = v[i*p.numInputCols];       }
+    }
+
+    p.toEval->push(batch);
+
+    if(n < p.batchSize) break;
+  }
+}
+
+void *reader(void *arg)
+{
+  Pipeline &p = *(Pipeline *)arg;
+  try
+  {
+    if(p.binary) read_binary(p);
+    else         read_csv(p);
+  }
+  catch( exception &e )
+  {
+    p.fail(e.what());
+  }
+  p.toEval->push(NULL);
+  return NULL;
+}
+
+// Compares the values of function f (in the batch) with the double precision
+//   values computed one row at a time
+void compare(Pipeline &p, size_t f, const RowBatch &batch)
+{
+  const vector<int> &cols = p.argCols[f];
+
+  XMLFunc::Args args;
+  for(size_t i=0; i<batch.nrows; ++i)
+  {
+    args.clear();
+    for(size_t a=0; a<cols.size(); ++a)
+    {
+      int slot = p.colSlot[cols[a]];
+      if(p.colIsInt[cols[a]]) args.add( batch.icols[slot][i] );
+      else                    args.add( batch.dcols[slot][i] );
+    }
+
+    double ref = p.xmlfunc->eval( p.funcs[f], args );
+    p.deviations[f].add( p.evaluated + i, batch.values[f][i], ref );
+  }
+}
+
+void *evaluator(void *arg)
+{
+  Pipeline &p = *(Pipeline *)arg;
+
+  RowBatch *batch(NULL);
+  while( (batch = p.toEval->pop()) != NULL )
+  {
+    try
+    {
+      if(p.hasFailed() == false)
+      {
+        batch->values.resize(p.funcs.size());
+        for(size_t f=0; f<p.funcs.size(); ++f)
+        {
+          XMLFunc::BatchArgs args;
+          const vector<int> &cols = p.argCols[f];
+          for(size_t a=0; a<cols.size(); ++a)
+          {
+            int slot = p.colSlot[cols[a]];
+            if(p.colIsInt[cols[a]]) args.add( &batch->icols[slot][0] );
+            else                    args.add( &batch->dcols[slot][0] );
+          }
+
+          batch->values[f].resize(batch->nrows);
+          p.xmlfunc->eval( p.funcs[f], args, batch->nrows, &batch->values[f][0] );
+
+          if(p.deviation) compare(p, f, *batch);
+        }
+        p.evaluated += batch->nrows;
+      }
+    }
+    catch( exception &e )
+    {
+      p.fail(e.what());
+    }
+    p.toWrite->push(batch);
+  }
+  p.toWrite->push(NULL);
+  return NULL;
+}
+
+void writer(Pipeline &p)
+{
+  size_t nfuncs = p.funcs.size();
+
+  vector<double> rows;
+  string         text;
+  char           buf[32];
+
+  RowBatch *batch(NULL);
+  while( (batch = p.toWrite->pop()) != NULL )
+  {
+    if(p.hasFailed() == false)
+    {
+      size_t n = batch->nrows;
+      if(p.binary)
+      {
+        rows.resize(n * nfuncs);
+        for(size_t f=0; f<nfuncs; ++f)
+        {
+          const double *v = &batch->values[f][0];
+          for(size_t i=0; i<n; ++i) rows[i*nfuncs + f] = v[i];
+        }
+        if( fwrite(&rows[0], sizeof(double) * nfuncs, n, p.out) != n ) p.fail("Failed to write output");
+      }
+      else
+      {
+        text.clear();
+        for(size_t i=0; i<n; ++i)
+        {
+          for(size_t f=0; f<nfuncs; ++f)
+          {
+            if(f>0) text += p.delim;
+            snprintf(buf,sizeof(buf),"%.17g",batch->values[f][i]);
+            text += buf;
+          }
+          text += '\n';
+        }
+        if( fwrite(text.data(), 1, text.size(), p.out) != text.size() ) p.fail("Failed to write output");
+      }
+      p.rows += n;
+    }
+    delete batch;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Memory mapped columnar files (-M)
+////////////////////////////////////////////////////////////////////////////////
+
+// Rows evaluated between releases of the finished pages of the mappings
+static const size_t ReleaseRows = 64 * 1024;
+
+size_t value_bytes(char type)
+{
+  switch(type)
+  {
+    case 'd': return sizeof(double);
+    case 'f': return sizeof(float);
+    case 'i': return sizeof(int64_t);
+  }
+  return 0;
+}
+
+// Advises the kernel about the pages holding bytes [begin,end) of a mapping
+//   (begin is rounded down to a page boundary; end is rounded up if roundUp)
+void advise(const MappedFile &file, size_t begin, size_t end, bool roundUp, int advice)
+{
+  static const size_t page = size_t(sysconf(_SC_PAGESIZE));
+
+  begin -= begin % page;
+  if(roundUp) end += (page - end % page) % page;
+  else        end -= end % page;
+  if(end > file.bytes) end = file.bytes;
+
+  if(end > begin) madvise(file.data + begin, end - begin, advice);
+}
+
+// Maps the columnar input file and checks its header.  Returns its columns and
+//   sets rows and the (lower case) column names.
+const ColumnEntry *map_input(const string &path, MappedFile &file, size_t &rows, vector<string> &colNames)
+{
+  file.fd = open(path.c_str(),O_RDONLY);
+  if(file.fd < 0) throw runtime_error("Cannot open " + path);
+
+  struct stat st;
+  if( fstat(file.fd,&st) != 0 ) throw runtime_error("Cannot stat " + path);
+  file.bytes = size_t(st.st_size);
+  if( file.bytes < sizeof(ColumnsHeader) ) throw runtime_error(path + " is not a columnar file (too short)");
+
+  void *data = mmap(NULL, file.bytes, PROT_READ, MAP_SHARED, file.fd, 0);
+  if(data == MAP_FAILED) throw runtime_error("Cannot map " + path);
+  file.data = (char *)data;
+
+  const ColumnsHeader &header = *(const ColumnsHeader *)file.data;
+  if( memcmp(header.magic,ColumnsMagic,sizeof(ColumnsMagic)) != 0 ) 
+    throw runtime_error(path + " is not a columnar file (bad magic)");
+  if( header.numColumns > (file.bytes - sizeof(ColumnsHeader)) / sizeof(ColumnEntry) )
+    throw runtime_error(path + " is truncated (in its column entries)");
+
+  rows = size_t(header.rows);
+
+  const ColumnEntry *cols = (const ColumnEntry *)(file.data + sizeof(ColumnsHeader));
+  for(size_t c=0; c<header.numColumns; ++c)
+  {
+    // names in the XML are case insensitive
+    string name(cols[c].name, strnlen(cols[c].name,sizeof(cols[c].name)));
+    for(size_t i=0; i<name.size(); ++i) name[i] = char(tolower(name[i]));
+    colNames.push_back(name);
+
+    size_t size   = value_bytes(cols[c].type);
+    size_t offset = size_t(cols[c].offset);
+    if(size == 0) throw runtime_error("Column '" + name + "' has an unknown type");
+    if( offset % size != 0 || offset > file.bytes || rows > (file.bytes - offset) / size )
+      throw runtime_error("Column '" + name + "' is misaligned or extends past the end of " + path);
+  }
+
+  return cols;
+}
+
+// Creates and maps the columnar output file, with a double column for each
+//   function (each starting on a page boundary).  Returns the columns' values.
+vector<double *> create_output(const Pipeline &p, const string &path, MappedFile &file, size_t rows)
+{
+  const size_t page = size_t(sysconf(_SC_PAGESIZE));
+  const size_t numCols = p.funcs.size();
+
+  vector<size_t> offsets;
+  size_t bytes = sizeof(ColumnsHeader) + numCols * sizeof(ColumnEntry);
+  for(size_t f=0; f<numCols; ++f)
+  {
+    bytes += (page - bytes % page) % page;
+    offsets.push_back(bytes);
+    bytes += rows * sizeof(double);
+  }
+
+  file.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if(file.fd < 0) throw runtime_error("Cannot create " + path);
+  if( ftruncate(file.fd,off_t(bytes)) != 0 ) throw runtime_error("Cannot resize " + path);
+  file.bytes = bytes;
+
+  void *data = mmap(NULL, file.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file.fd, 0);
+  if(data == MAP_FAILED) throw runtime_error("Cannot map " + path);
+  file.data = (char *)data;
+
+  ColumnsHeader &header = *(ColumnsHeader *)file.data;
+  memcpy(header.magic,ColumnsMagic,sizeof(ColumnsMagic));
+  header.rows       = rows;
+  header.numColumns = numCols;
+
+  vector<double *> values;
+  ColumnEntry *cols = (ColumnEntry *)(file.data + sizeof(ColumnsHeader));
+  for(size_t f=0; f<numCols; ++f)
+  {
+    const string &name = p.xmlfunc->functionName(p.funcs[f]);
+    if( name.size() > sizeof(cols[f].name) )
+      throw runtime_error("Function name '" + name + "' is too long for a column name");
+
+    memcpy(cols[f].name, name.data(), name.size());
+    cols[f].type   = 'd';
+    cols[f].offset = offsets[f];
+
+    values.push_back( (double *)(file.data + offsets[f]) );
+  }
+  return values;
+}
+
+// Evaluates the functions over the rows of the columnar input, in batches of
+//   p.batchSize rows, reading ahead p.queueDepth batches.  The pages of the
+//   finished batches are released every ReleaseRows rows (those of the output
+//   are written back by the kernel), which bounds the resident memory.
+void eval_mapped(Pipeline &p)
+{
+  MappedFile     in;
+  MappedFile     out;
+  size_t         rows(0);
+  vector<string> colNames;
+
+  const ColumnEntry *cols = map_input(p.inPath, in, rows, colNames);
+  map_columns(p, colNames);
+
+  vector<size_t> used;   // input columns read by an argument
+  for(size_t c=0; c<colNames.size(); ++c)
+  {
+    if(p.colSlot[c] < 0) continue;
+    if( p.colIsInt[c] && cols[c].type != 'i' )
+      throw runtime_error("Column '" + colNames[c] + "' is read by an integer argument, but is not an integer column");
+    used.push_back(c);
+  }
+
+  vector<double *> values = create_output(p, p.outPath, out, rows);
+
+  madvise(in.data, in.bytes, MADV_SEQUENTIAL);
+
+  size_t ahead = p.queueDepth * p.batchSize;
+  for(size_t i=0; i<used.size(); ++i)
+  {
+    const ColumnEntry &col = cols[used[i]];
+    size_t size = value_bytes(col.type);
+    advise(in, col.offset, col.offset + min(ahead,rows) * size, true, MADV_WILLNEED);
+  }
+
+  size_t released = 0;
+  for(size_t start=0; start<rows; start+=p.batchSize)
+  {
+    size_t n   = min(p.batchSize, rows - start);
+    size_t end = start + n;
+
+    // read ahead the batch which will be evaluated after the queued ones
+    if( start + ahead < rows )
+    {
+      size_t last = min(start + ahead + p.batchSize, rows);
+      for(size_t i=0; i<used.size(); ++i)
+      {
+        const ColumnEntry &col = cols[used[i]];
+        size_t size = value_bytes(col.type);
+        advise(in, col.offset + (start + ahead) * size, col.offset + last * size, true, MADV_WILLNEED);
+      }
+    }
+
+    for(size_t f=0; f<p.funcs.size(); ++f)
+    {
+      XMLFunc::BatchArgs args;
+      const vector<int> &argCols = p.argCols[f];
+      for(size_t a=0; a<argCols.size(); ++a)
+      {
+        const ColumnEntry &col = cols[argCols[a]];
+        const char *v = in.data + col.offset + start * value_bytes(col.type);
+        switch(col.type)
+        {
+          case 'd': args.add( (const double *)v ); break;
+          case 'f': args.add( (const float  *)v ); break;
+          case 'i': args.add( (const long   *)v ); break;
+        }
+      }
+      p.xmlfunc->eval( p.funcs[f], args, n, values[f] + start );
+    }
+    p.rows  += n;
+    p.bytes += n * sizeof(double) * values.size();
+    for(size_t i=0; i<used.size(); ++i) p.bytes += n * value_bytes(cols[used[i]].type);
+
+    if( end - released >= ReleaseRows || end == rows )
+    {
+      for(size_t i=0; i<used.size(); ++i)
+      {
+        const ColumnEntry &col = cols[used[i]];
+        size_t size = value_bytes(col.type);
+        advise(in, col.offset + released * size, col.offset + end * size, end == rows, MADV_DONTNEED);
+      }
+      for(size_t f=0; f<values.size(); ++f)
+      {
+        size_t offset = (char *)values[f] - out.data;
+        advise(out, offset + released * sizeof(double), offset + end * sizeof(double), end == rows, MADV_DONTNEED);
+      }
+      released = end;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+  Pipeline p;
+
+  int opt;
+  while( (opt = getopt(argc,argv,"i:o:d:Hb:m:r:q:j:PsDMh")) != -1 )
+  {
+    switch(opt)
+    {
+      case 'i':
+        p.inPath = optarg;
+        break;
+      case 'o':
+        p.outPath = optarg;
+        break;
+      case 'd':
+        p.delim = ( strcmp(optarg,"\\t") == 0 ? '\t' : optarg[0] );
+        break;
+      case 'H':
+        p.header = true;
+        break;
+      case 'b':
+        p.binary = true;
+        p.numInputCols = size_t(atol(optarg));
+        if(p.numInputCols == 0) usage(argv[0]);
+        break;
+      case 'm':
+        {
+          string m(optarg);
+          size_t eq = m.find('=');
+          if(eq == string::npos) usage(argv[0]);
+          for(size_t i=0; i<m.size(); ++i) m[i] = char(tolower(m[i]));
+          p.mapping[m.substr(0,eq)] = m.substr(eq+1);
+        }
+        break;
+      case 'r':
+        p.batchSize = size_t(atol(optarg));
+        if(p.batchSize == 0) usage(argv[0]);
+        break;
+      case 'q':
+        p.queueDepth = size_t(atol(optarg));
+        if(p.queueDepth == 0) usage(argv[0]);
+        break;
+      case 'j':
+        p.buildThreads = unsigned(atol(optarg));
+        if(p.buildThreads == 0) usage(argv[0]);
+        break;
+      case 'P':
+        p.polynomials = true;
+        break;
+      case 's':
+        p.single = true;
+        break;
+      case 'D':
+        p.single    = true;
+        p.deviation = true;
+        break;
+      case 'M':
+        p.mapped = true;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if(argc - optind < 2) usage(argv[0]);
+
+  if(p.binary && p.header)
+  {
+    cerr << "The -H and -b options cannot be combined" << endl;
+    return 1;
+  }
+
+  if(p.mapped)
+  {
+    if( p.binary || p.deviation )
+    {
+      cerr << "The -M option cannot be combined with -b or -D" << endl;
+      return 1;
+    }
+    if( p.inPath.empty() || p.outPath.empty() )
+    {
+      cerr << "The -M option requires -i and -o" << endl;
+      return 1;
+    }
+    p.header = true;   // (arguments are read from the columns with their names)
+  }
+  else
+  {
+    if( p.inPath.empty() == false && (p.in = fopen(p.inPath.c_str(),"rb")) == NULL )
+    {
+      cerr << "Cannot open " << p.inPath << endl;
+      return 1;
+    }
+    if( p.outPath.empty() == false && (p.out = fopen(p.outPath.c_str(),"wb")) == NULL )
+    {
+      cerr << "Cannot create " << p.outPath << endl;
+      return 1;
+    }
+  }
+
+  try
+  {
+    unsigned optimizations = ( p.polynomials ? XMLFunc::Polynomials : 0 ) | ( p.single ? XMLFunc::SinglePrecision : 0 );
+
+    XMLFunc xmlfunc(argv[optind], optimizations, p.buildThreads);
+    p.xmlfunc = &xmlfunc;
+
+    for(int i=optind+1; i<argc; ++i)
+    {
+      string name(argv[i]);
+      for(size_t j=0; j<name.size(); ++j) name[j] = char(tolower(name[j]));
+
+      char *end(NULL);
+      long index = strtol(name.c_str(),&end,10);
+      if( *end == '\0' && index >= 0 && size_t(index) < xmlfunc.numFunctions() ) p.funcs.push_back(size_t(index));
+      else                                                                     p.funcs.push_back(xmlfunc.functionIndex(name));
+    }
+
+    p.deviations.assign(p.funcs.size(), Deviation());
+
+    if(p.mapped)
+    {
+      double start = now();
+      eval_mapped(p);
+      double elapsed = now() - start;
+
+      struct rusage usage;
+      getrusage(RUSAGE_SELF,&usage);
+
+      cerr << p.rows << " rows in " << elapsed << " sec ("
+        << ( elapsed > 0. ? double(p.rows)/elapsed : 0. ) << " rows/sec, "
+        << ( elapsed > 0. ? 1.e-6 * double(p.bytes)/elapsed : 0. ) << " MB/sec), max resident "
+        << usage.ru_maxrss / 1024 << " MB" << endl;
+      return 0;
+    }
+
+    BatchQueue toEval(p.queueDepth);
+    BatchQueue toWrite(p.queueDepth);
+    p.toEval  = &toEval;
+    p.toWrite = &toWrite;
+
+    double start = now();
+
+    pthread_t readThread;
+    pthread_t evalThread;
+    pthread_create(&readThread,NULL,reader,&p);
+    pthread_create(&evalThread,NULL,evaluator,&p);
+
+    writer(p);
+
+    pthread_join(readThread,NULL);
+    pthread_join(evalThread,NULL);
+
+    double elapsed = now() - start;
+
+    fflush(p.out);
+
+    if(p.hasFailed()) throw runtime_error(p.error);
+
+    cerr << p.rows << " rows in " << elapsed << " sec ("
+      << ( elapsed > 0. ? double(p.rows)/elapsed : 0. ) << " rows/sec)" << endl;
+
+    for(size_t f=0; p.deviation && f<p.funcs.size(); ++f)
+    {
+      const Deviation &d = p.deviations[f];
+      cerr << argv[optind+1+f] << ": max abs deviation " << d.maxAbs << " (row " << d.absRow << ")"
+        << ", max rel deviation " << d.maxRel << " (row " << d.relRow << ", " 
+        << d.maxRel / FLT_EPSILON << " float eps)";
+      if(d.nonFinite > 0) cerr << ", " << d.nonFinite << " rows with only one value finite";
+      cerr << endl;
+    }
+  }
+  catch( exception &e )
+  {
+    cerr << "xmlfunc-eval: " << e.what() << endl;
+    return 1;
+  }
+
+  if(p.in  != stdin)  fclose(p.in);
+  if(p.out != stdout) fclose(p.out);
+
+  return 0;
+}
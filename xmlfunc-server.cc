@@ -0,0 +1,133 @@
+// xmlfunc-server
+//
+// Serves the functions of an XMLFunc document to the processes on this host
+//   through shared memory (see XMLFuncServer and XMLFuncClient), so that the
+//   document is parsed and its functions built once rather than in each
+//   process.  The server runs until it is interrupted (SIGINT or SIGTERM).
+//
+// With -e, evaluates one function with the arguments given on the command
+//   line, as a client of a running server.
+//
+// Build:  g++ -O2 -pthread -o xmlfunc-server xmlfunc-server.cc XMLFuncServer.cc XMLFunc.cc
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "XMLFunc.h"
+#include "XMLFuncServer.h"
+
+using namespace std;
+
+void usage(const char *argv0)
+{
+  cerr << endl
+    << "Usage: " << argv0 << " [options] name xml-file" << endl
+    << "       " << argv0 << " -e name func [arg ...]" << endl
+    << endl
+    << "  Serves the functions in xml-file through the shared memory segment name" << endl
+    << "  (e.g. /xmlfunc-pricing) until interrupted" << endl
+    << endl
+    << "  -c n        maximum number of attached clients (default 16)" << endl
+    << "  -t n        threads serving requests (default 1)" << endl
+    << "  -d bytes    data area of each client, which limits the rows per request (default 262144)" << endl
+    << "  -P          evaluate polynomials by Horner's rule (see XMLFunc::Polynomials)" << endl
+    << "  -L          build each function on first use (see XMLFunc::Lazy)" << endl
+    << "  -e          evaluate the named (or 0 based indexed) function as a client of a running" << endl
+    << "                server (integer arguments are those without a decimal point or exponent)" << endl
+    << endl;
+  exit(1);
+}
+
+// Evaluates one function as a client of a running server
+int evaluate(const string &name, const string &func, int nargs, char **argv)
+{
+  XMLFuncClient client(name);
+
+  XMLFunc::Args args;
+  for(int i=0; i<nargs; ++i)
+  {
+    if( strpbrk(argv[i],".eEnN") == NULL ) args.add( atol(argv[i]) );
+    else                                   args.add( atof(argv[i]) );
+  }
+
+  size_t index = 0;
+  if( func.find_first_not_of("0123456789") == string::npos ) index = size_t(atol(func.c_str()));
+  else                                                       index = client.functionIndex(func);
+
+  XMLFunc::Number value;
+  unsigned status = client.tryEval(index, args, value);
+  if( status != XMLFunc::Ok ) cerr << "xmlfunc-server: " << XMLFunc::statusText(status) << endl;
+  if( status >= XMLFunc::UnknownFunction ) return 1;
+
+  cout << value << endl;
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  size_t   maxClients    = 16;
+  unsigned nthreads      = 1;
+  size_t   dataBytes     = 256 * 1024;
+  unsigned optimizations = XMLFunc::NoOptimization;
+  bool     client        = false;
+
+  int opt;
+  while( (opt = getopt(argc,argv,"+c:t:d:PLeh")) != -1 )
+  {
+    switch(opt)
+    {
+      case 'c': maxClients = size_t(atol(optarg));   break;
+      case 't': nthreads   = unsigned(atol(optarg)); break;
+      case 'd': dataBytes  = size_t(atol(optarg));   break;
+      case 'P': optimizations |= XMLFunc::Polynomials; break;
+      case 'L': optimizations |= XMLFunc::Lazy;      break;
+      case 'e': client = true;                       break;
+      default:  usage(argv[0]);
+    }
+  }
+
+  try
+  {
+    if( client )
+    {
+      if( argc - optind < 2 ) usage(argv[0]);
+      return evaluate(argv[optind], argv[optind+1], argc - optind - 2, argv + optind + 2);
+    }
+
+    if( argc - optind != 2 || maxClients == 0 || nthreads == 0 ) usage(argv[0]);
+
+    // The signals are blocked before the server starts its threads (which
+    //   inherit the mask), and are then waited for here.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    XMLFunc func(argv[optind+1], optimizations);
+    XMLFuncServer server(func, argv[optind], maxClients, nthreads, dataBytes);
+
+    XMLFunc::MemoryUsage mem = func.memoryUsage();
+    cerr << "xmlfunc-server: serving " << func.numFunctions() << " functions (" << mem.total() << " bytes) on "
+      << server.name() << " (" << server.segmentBytes() << " bytes of shared memory)" << endl;
+
+    int sig = 0;
+    sigwait(&signals, &sig);
+
+    cerr << "xmlfunc-server: " << server.requests() << " requests served" << endl;
+  }
+  catch( exception &e )
+  {
+    cerr << "xmlfunc-server: " << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}